@@ -0,0 +1,474 @@
+/**
+ * \file bench.cpp
+ * \brief Times the data processing routines
+ *
+ * Each routine is run over synthetic attractors and over a recorded
+ * sweep, and timed in nanoseconds per sample. The times are compared 
+ * with a baseline file so slowdowns show up before a release. The routines with versions for several instruction sets are
+ * timed with each one the processor supports, and the speedup over the
+ * generic version is shown. Of the FFT only the input conversion has 
+ * such versions, so it is timed on its own as fftinput. A capture to disk from the simulated unit
+ * shows how far ahead of the unit's sample rate capturing can keep.
+ *
+ * bench [-b baseline] [-f sweep.csv] [-c capture] [-t tolerance] [-w]
+ * bench -n
+ *
+ * The sweep defaults to bench/fixture.csv, a tap recorded from the 
+ * simulated unit. The baseline and the capture file default to the 
+ * build directory. -w writes the times to the baseline instead of 
+ * comparing. A missing baseline is written for the next run. Returns 1
+ * if any routine is more than tolerance (default 0.2) slower than the 
+ * baseline, 3 if there was no baseline to compare with.
+ *
+ * -n checks instead that the nearest neighbours the analysis finds 
+ * match a brute force search over the synthetic attractors, and returns
+ * 1 if any is wrong. It times nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis_check.h"
+#include "data_processing.h"
+#include "frames.h"
+#include "kernels.h"
+#include "libchaos.h"
+#include "peaks.h"
+#include "stft.h"
+#include "synth.h"
+#include "threads.h"
+
+#define BENCH_SAMPLES 65536
+#define BENCH_MAX_RESULTS 128
+#define BENCH_RUNS 5
+// keep running a routine for at least this long in each run
+#define BENCH_MIN_TIME 50000000LL
+#define BENCH_DEFAULT_BASELINE "build/bench_baseline.txt"
+#define BENCH_DEFAULT_FIXTURE "bench/fixture.csv"
+#define BENCH_DEFAULT_CAPTURE "build/bench_capture.tmp"
+#define BENCH_CAPTURE_SAMPLES (16*1024*1024)
+// spectrogram rows of 1024 samples, one every 256
+#define BENCH_STFT_SIZE 1024
+#define BENCH_STFT_HOP 256
+// references checked against a brute force neighbour search per attractor
+#define BENCH_NEIGHBOUR_QUERIES 2000
+
+typedef void (*BENCH_FUNCTION)(int* samples, int num_samples);
+
+typedef struct {
+    char name[64];
+    double ns_per_sample;
+} BENCH_RESULT;
+
+BENCH_RESULT BENCH_RESULTS[BENCH_MAX_RESULTS];
+int BENCH_NUM_RESULTS = 0;
+
+// results are written somewhere so the work is not optimised away
+volatile int BENCH_SINK = 0;
+int BENCH_OUT[BENCH_SAMPLES*3];
+float BENCH_FFT[NUM_FFT_PLOT_POINTS*2];
+short BENCH_DECODED[3][BENCH_SAMPLES];
+FILE* BENCH_CSV = 0;
+ST_SPECTROGRAM BENCH_SPECTROGRAM;
+
+static void BENCH_decode(int* samples, int num_samples) {
+    /**
+     * Split packed samples into channels, as the pipeline does
+     */
+    KN->decode(samples, BENCH_DECODED[0], BENCH_DECODED[1], BENCH_DECODED[2], num_samples);
+    BENCH_SINK += BENCH_DECODED[0][num_samples - 1];
+}
+
+static void BENCH_fftInput(int* samples, int num_samples) {
+    /**
+     * Make the complex FFT input in plot sized pieces
+     */
+    for(int i = 0; i + NUM_FFT_PLOT_POINTS <= num_samples; i += NUM_FFT_PLOT_POINTS) {
+        KN->fftInput(samples + i, BENCH_FFT, NUM_FFT_PLOT_POINTS);
+    }
+    BENCH_SINK += (int)BENCH_FFT[2];
+}
+
+static void BENCH_fft(int* samples, int num_samples) {
+    /**
+     * FFT the samples in plot sized pieces
+     */
+    for(int i = 0; i + NUM_FFT_PLOT_POINTS <= num_samples; i += NUM_FFT_PLOT_POINTS) {
+        DP_FFT(samples + i, BENCH_FFT, NUM_FFT_PLOT_POINTS);
+    }
+    BENCH_SINK += (int)BENCH_FFT[1];
+}
+
+static void BENCH_peaks(int* samples, int num_samples) {
+    /**
+     * Find peaks with the delta used for the bifurcation diagram
+     */
+    BENCH_SINK += peaks_findPeaks(BENCH_OUT, BENCH_SAMPLES, samples, num_samples, 2);
+}
+
+static void BENCH_returnMap(int* samples, int num_samples) {
+    /**
+     * Build return map points
+     */
+    BENCH_SINK += DP_getReturnMapPoints(BENCH_OUT, BENCH_SAMPLES, samples, num_samples);
+}
+
+static void BENCH_trigger(int* samples, int num_samples) {
+    /**
+     * Search for the default phase trigger in plot sized pieces
+     */
+    TR_TRIGGER trigger = {TR_PHASE, 1, 0, TR_RISING, 0, {0, 0, -1}, 3, 1};
+    TR_RESULT result;
+    for(int i = 0; i + 2040 <= num_samples; i += 2040) {
+        BENCH_SINK += DP_findTriggerIndex(&trigger, samples + i, 2040, 300, &result);
+    }
+}
+
+static void BENCH_csv(int* samples, int num_samples) {
+    /**
+     * Format samples as CSV rows
+     */
+    rewind(BENCH_CSV);
+    DP_appendToCSV(BENCH_CSV, samples, num_samples, 2000);
+}
+
+static void BENCH_stft(int* samples, int num_samples) {
+    /**
+     * Add the samples to a spectrogram as one continuous stream
+     */
+    KN->decode(samples, BENCH_DECODED[0], BENCH_DECODED[1], BENCH_DECODED[2], num_samples);
+    BENCH_SINK += ST_add(&BENCH_SPECTROGRAM, BENCH_DECODED[0], num_samples, 2000, 1);
+}
+
+static void BENCH_run(const char* name, BENCH_FUNCTION function, int* samples,
+                      int num_samples) {
+    /**
+     * Time a routine and keep the best of several runs
+     */
+    double best = -1;
+    for(int run = 0; run < BENCH_RUNS; run++) {
+        long long count = 0;
+        long long start = TH_nanoseconds();
+        long long elapsed;
+        do {
+            function(samples, num_samples);
+            count++;
+            elapsed = TH_nanoseconds() - start;
+        } while(elapsed < BENCH_MIN_TIME);
+        double ns_per_sample = (double)elapsed/(double)(count*num_samples);
+        if(best < 0 || ns_per_sample < best) {
+            best = ns_per_sample;
+        }
+    }
+    if(BENCH_NUM_RESULTS < BENCH_MAX_RESULTS) {
+        BENCH_RESULT* result = &BENCH_RESULTS[BENCH_NUM_RESULTS++];
+        snprintf(result->name, sizeof(result->name), "%s", name);
+        result->ns_per_sample = best;
+    }
+}
+
+static void BENCH_data(const char* data_name, int* samples, int num_samples) {
+    /**
+     * Time every routine on one set of samples
+     *
+     * Routines with kernels are named routine/data/isa.
+     */
+    static const struct {
+        const char* name;
+        BENCH_FUNCTION function;
+        int has_kernels;
+    } routines[] = {
+        {"decode", BENCH_decode, 1},
+        {"fftinput", BENCH_fftInput, 1},
+        {"fft", BENCH_fft, 0},
+        {"peaks", BENCH_peaks, 1},
+        {"returnmap", BENCH_returnMap, 0},
+        {"trigger", BENCH_trigger, 0},
+        {"csv", BENCH_csv, 0},
+        {"stft", BENCH_stft, 0}
+    };
+    char name[64];
+    for(unsigned int i = 0; i < sizeof(routines)/sizeof(routines[0]); i++) {
+        if(!routines[i].has_kernels) {
+            KN_select(KN_BEST);
+            snprintf(name, sizeof(name), "%s/%s", routines[i].name, data_name);
+            BENCH_run(name, routines[i].function, samples, num_samples);
+            continue;
+        }
+        for(int isa = 0; isa < KN_NUM_ISAS; isa++) {
+            if(KN_select(isa) < 0) {
+                continue;
+            }
+            snprintf(name, sizeof(name), "%s/%s/%s", routines[i].name, data_name, 
+                     KN_getName(isa));
+            BENCH_run(name, routines[i].function, samples, num_samples);
+        }
+    }
+    KN_select(KN_BEST);
+}
+
+static double BENCH_speedup(BENCH_RESULT* result) {
+    /**
+     * The speedup of a kernel over the generic one, -1 if there is none
+     */
+    char name[64];
+    const char* isa = strrchr(result->name, '/');
+    const char* generic = KN_getName(KN_GENERIC);
+    int length = isa ? (int)(isa - result->name) : 0;
+    if(!isa || strchr(result->name, '/') == isa || !strcmp(isa + 1, generic)) {
+        return -1;
+    }
+    snprintf(name, sizeof(name), "%.*s/%s", length, result->name, generic);
+    for(int i = 0; i < BENCH_NUM_RESULTS; i++) {
+        if(!strcmp(BENCH_RESULTS[i].name, name)) {
+            return BENCH_RESULTS[i].ns_per_sample/result->ns_per_sample;
+        }
+    }
+    return -1;
+}
+
+static void BENCH_capture(const char* filename) {
+    /**
+     * Time a capture to disk from a simulated unit running flat out
+     */
+    libchaos_context* ctx = libchaos_create();
+    if(!ctx || libchaos_ctx_startSimulation(ctx, 0, 0, 1)) {
+        libchaos_destroy(ctx);
+        return;
+    }
+    long long start = TH_nanoseconds();
+    if(libchaos_ctx_startCapture(ctx, filename, 2000, BENCH_CAPTURE_SAMPLES)) {
+        fprintf(stderr, "could not capture to %s\n", filename);
+        libchaos_destroy(ctx);
+        return;
+    }
+    while(libchaos_ctx_isCapturing(ctx)) {
+        TH_sleep(1);
+    }
+    long long elapsed = TH_nanoseconds() - start;
+    int result = libchaos_ctx_stopCapture(ctx);
+    libchaos_destroy(ctx);
+    remove(filename);
+    if(!result && BENCH_NUM_RESULTS < BENCH_MAX_RESULTS) {
+        BENCH_RESULT* capture = &BENCH_RESULTS[BENCH_NUM_RESULTS++];
+        snprintf(capture->name, sizeof(capture->name), "capture/sim");
+        capture->ns_per_sample = (double)elapsed/BENCH_CAPTURE_SAMPLES;
+    }
+}
+
+static double BENCH_baseline(FILE* file, const char* name) {
+    /**
+     * Look up a time in the baseline, -1 if it is not there
+     */
+    char line[256];
+    char line_name[64];
+    double ns_per_sample;
+    rewind(file);
+    while(fgets(line, sizeof(line), file)) {
+        if(line[0] == '#') {
+            continue;
+        }
+        if(sscanf(line, "%63s %lf", line_name, &ns_per_sample) == 2 &&
+           !strcmp(line_name, name)) {
+            return ns_per_sample;
+        }
+    }
+    return -1;
+}
+
+static void BENCH_attractor(int* samples, int mdac_value) {
+    /**
+     * Fill BENCH_SAMPLES samples of a synthetic attractor
+     */
+    SY_ATTRACTOR attractor;
+    SY_init(&attractor, mdac_value, 1);
+    // let the transient die away first
+    SY_generate(&attractor, samples, BENCH_SAMPLES);
+    SY_generate(&attractor, samples, BENCH_SAMPLES);
+}
+
+static int BENCH_checkNeighbours(const int* mdac_values, int num_values) {
+    /**
+     * Check the analysis's neighbour search against brute force
+     *
+     * Returns the number of wrong neighbours, or -1 if it could not check
+     */
+    static int samples[BENCH_SAMPLES];
+    // the cell sizes used for Rosenstein and for Kantz, over all the
+    // samples and over a short stretch where neighbours are sparse
+    static const float cells[] = {16.0f, 8.0f};
+    static const int lengths[] = {BENCH_SAMPLES, BENCH_SAMPLES/16};
+    int wrong_neighbours = 0;
+    for(int i = 0; i < num_values; i++) {
+        BENCH_attractor(samples, mdac_values[i]);
+        for(unsigned int c = 0; c < sizeof(cells)/sizeof(cells[0]); c++) {
+            for(unsigned int l = 0; l < sizeof(lengths)/sizeof(lengths[0]); l++) {
+                int wrong = AN_checkNeighbours(samples, lengths[l], cells[c],
+                                               BENCH_NEIGHBOUR_QUERIES);
+                if(wrong < 0) {
+                    return -1;
+                }
+                wrong_neighbours += wrong;
+            }
+        }
+    }
+    return wrong_neighbours;
+}
+
+int main(int argc, char** argv) {
+    /**
+     * Time every routine and compare with the baseline
+     */
+    const char* baseline_name = BENCH_DEFAULT_BASELINE;
+    const char* fixture_name = BENCH_DEFAULT_FIXTURE;
+    const char* capture_name = BENCH_DEFAULT_CAPTURE;
+    int fixture_given = 0;
+    double tolerance = 0.2;
+    int write = 0;
+    int check = 0;
+    int regressions = 0;
+    int compared = 0;
+    static int samples[BENCH_SAMPLES];
+    // periodic, just chaotic and well into chaos
+    static const int mdac_values[] = {1000, 2000, 3000};
+    const int num_values = sizeof(mdac_values)/sizeof(mdac_values[0]);
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-b") && i + 1 < argc) {
+            baseline_name = argv[++i];
+        } else if(!strcmp(argv[i], "-f") && i + 1 < argc) {
+            fixture_name = argv[++i];
+            fixture_given = 1;
+        } else if(!strcmp(argv[i], "-c") && i + 1 < argc) {
+            capture_name = argv[++i];
+        } else if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if(!strcmp(argv[i], "-w")) {
+            write = 1;
+        } else if(!strcmp(argv[i], "-n")) {
+            check = 1;
+        } else {
+            fprintf(stderr, "usage: %s [-b baseline] [-f sweep.csv] [-c capture] "
+                    "[-t tolerance] [-w]\n       %s -n\n", argv[0], argv[0]);
+            return 2;
+        }
+    }
+
+    if(check) {
+        int wrong_neighbours = BENCH_checkNeighbours(mdac_values, num_values);
+        if(wrong_neighbours < 0) {
+            fprintf(stderr, "could not check the nearest neighbours\n");
+            return 2;
+        }
+        if(wrong_neighbours) {
+            printf("%d nearest neighbours differ from a brute force search\n", 
+                   wrong_neighbours);
+            return 1;
+        }
+        printf("nearest neighbours match a brute force search\n");
+        return 0;
+    }
+
+    BENCH_CSV = tmpfile();
+    if(!BENCH_CSV) {
+        fprintf(stderr, "could not open a temporary file\n");
+        return 2;
+    }
+    if(ST_init(&BENCH_SPECTROGRAM, BENCH_STFT_SIZE, BENCH_STFT_HOP, ST_HANN, 256)) {
+        fprintf(stderr, "could not make a spectrogram\n");
+        return 2;
+    }
+
+    for(int i = 0; i < num_values; i++) {
+        char name[32];
+        BENCH_attractor(samples, mdac_values[i]);
+        snprintf(name, sizeof(name), "synth%d", mdac_values[i]);
+        BENCH_data(name, samples, BENCH_SAMPLES);
+    }
+
+    DP_SWEEP sweep;
+    int mdac_value;
+    int num_samples = -1;
+    if(!DP_openSweep(&sweep, (char*)fixture_name)) {
+        num_samples = DP_readSweepTap(&sweep, samples, BENCH_SAMPLES, &mdac_value);
+        DP_closeSweep(&sweep);
+    }
+    if(num_samples < 0 && !fixture_given) {
+        // run from outside the source tree
+        printf("no fixture at %s, only synthetic data timed\n", fixture_name);
+    } else if(num_samples < NUM_FFT_PLOT_POINTS) {
+        fprintf(stderr, "%s has no tap with %d samples\n", fixture_name,
+                NUM_FFT_PLOT_POINTS);
+        return 2;
+    } else {
+        BENCH_data("fixture", samples, num_samples);
+    }
+    fclose(BENCH_CSV);
+    ST_free(&BENCH_SPECTROGRAM);
+    BENCH_capture(capture_name);
+
+    FILE* baseline = write ? 0 : fopen(baseline_name, "r");
+    printf("%-28s %12s %10s %8s %12s %8s\n", "routine", "ns/sample", "GB/s", "speedup", 
+           "baseline", "ratio");
+    for(int i = 0; i < BENCH_NUM_RESULTS; i++) {
+        BENCH_RESULT* result = &BENCH_RESULTS[i];
+        double speedup = BENCH_speedup(result);
+        // samples are 4 bytes
+        printf("%-28s %12.3f %10.3f", result->name, result->ns_per_sample,
+               4.0/result->ns_per_sample);
+        if(speedup > 0) {
+            printf(" %7.2fx", speedup);
+        } else {
+            printf(" %8s", "");
+        }
+        double previous = baseline ? BENCH_baseline(baseline, result->name) : -1;
+        if(previous > 0) {
+            double ratio = result->ns_per_sample/previous;
+            printf(" %12.3f %8.2f", previous, ratio);
+            compared++;
+            if(ratio > 1.0 + tolerance) {
+                printf("  SLOWER");
+                regressions++;
+            }
+        }
+        printf("\n");
+    }
+
+    for(int i = 0; i < BENCH_NUM_RESULTS; i++) {
+        if(!strcmp(BENCH_RESULTS[i].name, "capture/sim")) {
+            printf("capture keeps up with %.0f times the unit's sample rate\n",
+                   1e9/(LIBCHAOS_SAMPLE_FREQUENCY)/BENCH_RESULTS[i].ns_per_sample);
+        }
+    }
+
+    if(baseline) {
+        fclose(baseline);
+    } else {
+        baseline = fopen(baseline_name, "w");
+        if(!baseline) {
+            fprintf(stderr, "could not write %s\n", baseline_name);
+            return 2;
+        }
+        fprintf(baseline, "# routine/data ns_per_sample\n");
+        for(int i = 0; i < BENCH_NUM_RESULTS; i++) {
+            fprintf(baseline, "%s %.4f\n", BENCH_RESULTS[i].name,
+                    BENCH_RESULTS[i].ns_per_sample);
+        }
+        fclose(baseline);
+        if(write) {
+            printf("baseline written to %s\n", baseline_name);
+            return 0;
+        }
+        printf("no baseline in %s, nothing compared, these times are the baseline "
+               "from now on\n", baseline_name);
+        return 3;
+    }
+
+    if(!compared) {
+        printf("no routine is in the baseline %s, nothing compared\n", baseline_name);
+        return 3;
+    }
+    printf("%d routines compared with %s, %d slower\n", compared, baseline_name, regressions);
+    return regressions ? 1 : 0;
+}
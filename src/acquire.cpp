@@ -0,0 +1,206 @@
+/**
+ * \file acquire.cpp
+ * \brief Triggered acquisition like an oscilloscope's
+ *
+ * Instead of taking a fresh capture for every frame and searching it for
+ * the trigger, the sample is left running and its samples flow into a
+ * ring. The trigger is searched for as packets arrive and the frame is
+ * cut out of the ring, with its pre-trigger samples, as soon as enough
+ * samples after the trigger are in. A frame then costs about one period
+ * of the signal more than its own length, and the pre-trigger samples
+ * are usually in the ring already from the frame before.
+ */
+
+#include "acquire.h"
+#include "bufpool.h"
+#include "log.h"
+
+int AQ_init(AQ_ACQUISITION* acquisition, int pre_trigger) {
+    /**
+     * Get triggered acquisition ready, the sample starts with the first frame
+     *
+     * \param pre_trigger Samples of each frame before the trigger point
+     */
+    memset(acquisition, 0, sizeof(AQ_ACQUISITION));
+    acquisition->ring = (int*)BP_alloc(2*AQ_RING_SIZE*sizeof(int));
+    if(!acquisition->ring) {
+        return -1;
+    }
+    acquisition->enabled = 1;
+    acquisition->pre_trigger = pre_trigger;
+    acquisition->trigger = -1;
+    return 0;
+}
+
+void AQ_stop(AQ_ACQUISITION* acquisition, UC_DEVICE* dev) {
+    /**
+     * End the sample if nothing else has taken over the device since
+     */
+    if(acquisition->streaming && acquisition->session == dev->sessions) {
+        UC_endSample(dev);
+    }
+    acquisition->streaming = 0;
+}
+
+void AQ_free(AQ_ACQUISITION* acquisition, UC_DEVICE* dev) {
+    /**
+     * End the sample and free the ring
+     */
+    AQ_stop(acquisition, dev);
+    BP_free(acquisition->ring);
+    memset(acquisition, 0, sizeof(AQ_ACQUISITION));
+    acquisition->trigger = -1;
+}
+
+static int AQ_start(AQ_ACQUISITION* acquisition, UC_DEVICE* dev, int mdac_value) {
+    /**
+     * Start a new sample with an empty ring
+     */
+    if(acquisition->streaming && acquisition->session == dev->sessions) {
+        UC_endSample(dev);
+    }
+    acquisition->streaming = 0;
+    if(UC_startSample(dev, mdac_value)) {
+        return -1;
+    }
+    acquisition->streaming = 1;
+    acquisition->session = dev->sessions;
+    acquisition->mdac = mdac_value;
+    acquisition->written = 0;
+    acquisition->valid_from = 0;
+    acquisition->search_from = 0;
+    acquisition->trigger = -1;
+    return 0;
+}
+
+static void AQ_copy(AQ_ACQUISITION* acquisition, long long first, int* dst, int length) {
+    /**
+     * Copy length samples from position first out of the ring
+     */
+    memcpy(dst, acquisition->ring + (first & AQ_RING_MASK), length*sizeof(int));
+}
+
+static int AQ_read(AQ_ACQUISITION* acquisition, UC_DEVICE* dev) {
+    /**
+     * Add the next packet to the ring
+     *
+     * A missing packet breaks the history so that no frame spans it.
+     */
+    int* in = (int*)dev->in_buf;
+    int packet_id = UC_getData(dev, in);
+    if(packet_id < 0) {
+        LOG(LOG_ERROR, "error getting data\n");
+        acquisition->streaming = 0;
+        return -1;
+    }
+    if(packet_id != dev->last_packet_id + 1) {
+        LOG(LOG_WARNING, "MISSING %d PACKETS (%d)\n", (packet_id - dev->last_packet_id) - 1,
+            packet_id);
+        acquisition->valid_from = acquisition->written;
+        acquisition->trigger = -1;
+        acquisition->gaps++;
+    }
+    dev->last_packet_id = packet_id;
+    for(int i = 0; i < AQ_PACKET_SAMPLES; i++) {
+        int slot = (int)((acquisition->written + i) & AQ_RING_MASK);
+        acquisition->ring[slot] = in[i + 1];
+        acquisition->ring[slot + AQ_RING_SIZE] = in[i + 1];
+    }
+    acquisition->written += AQ_PACKET_SAMPLES;
+    return 0;
+}
+
+static void AQ_search(AQ_ACQUISITION* acquisition, TR_TRIGGER* trigger, int length) {
+    /**
+     * Look for the trigger in the samples not searched yet
+     *
+     * A trigger only counts once the pre-trigger samples before it are
+     * held, and the rest of the frame must still fit in the ring.
+     */
+    long long start = acquisition->search_from;
+    int pre = acquisition->pre_trigger < length ? acquisition->pre_trigger : length - 1;
+    long long first = acquisition->valid_from + pre;
+    long long oldest = acquisition->written - (AQ_RING_SIZE - length);
+    if(start < first) start = first;
+    if(start < oldest) start = oldest;
+    if(start < acquisition->valid_from + 1) start = acquisition->valid_from + 1;
+    long long end = acquisition->written;
+    if(start >= end) {
+        return;
+    }
+    // one sample before start is passed so crossings at start are seen
+    int* base = acquisition->ring + ((start - 1) & AQ_RING_MASK);
+    TR_RESULT result;
+    int index = TR_find(trigger, base, 1, (int)(end - start + 1), &result);
+    if(index >= 0) {
+        acquisition->trigger = start - 1 + index;
+        acquisition->pending = result;
+    } else {
+        acquisition->search_from = end - AQ_LOOKBACK > start ? end - AQ_LOOKBACK : start;
+    }
+}
+
+int AQ_readFrame(AQ_ACQUISITION* acquisition, UC_DEVICE* dev, TR_TRIGGER* trigger,
+                 int mdac_value, int* dst, int length, TR_RESULT* result) {
+    /**
+     * Read samples until a triggered frame is complete
+     *
+     * The sample is started again when the MDAC value changes or
+     * something else used the device. The next frame is searched for
+     * after the end of this one. When the trigger does not fire within
+     * the longer of AQ_MIN_TIMEOUT samples and four frames the latest
+     * samples are returned untriggered, and a phase trigger with
+     * auto_seed set picks a new target from them.
+     *
+     * \param mdac_value MDAC value to sample at, -1 to keep the current one
+     * \param length Frame length, at most AQ_RING_SIZE/2. The trigger
+     * point is at pre_trigger, or the last sample of shorter frames.
+     * \param result Set to the trigger point, its index in dst is 
+     * result->index, -1 if the trigger did not fire
+     * \return 1 if the trigger fired, 0 if it did not, -1 on error
+     */
+    result->index = -1;
+    result->distance = 0;
+    result->quality = 0;
+    if(length < 1 || length > AQ_RING_SIZE/2) {
+        return -1;
+    }
+    if(!acquisition->streaming || acquisition->session != dev->sessions ||
+       (mdac_value >= 0 && mdac_value != acquisition->mdac)) {
+        if(AQ_start(acquisition, dev, mdac_value)) {
+            return -1;
+        }
+    }
+
+    int pre = acquisition->pre_trigger < length ? acquisition->pre_trigger : length - 1;
+    long long timeout = 4LL*length > AQ_MIN_TIMEOUT ? 4LL*length : AQ_MIN_TIMEOUT;
+    long long give_up = acquisition->written + timeout;
+    for(;;) {
+        if(acquisition->trigger < 0) {
+            AQ_search(acquisition, trigger, length);
+        }
+        long long position = acquisition->trigger;
+        if(position >= 0 && acquisition->written >= position + length - pre) {
+            AQ_copy(acquisition, position - pre, dst, length);
+            *result = acquisition->pending;
+            result->index = pre;
+            acquisition->search_from = position + length - pre;
+            acquisition->trigger = -1;
+            acquisition->frames++;
+            return 1;
+        }
+        if(position < 0 && acquisition->written >= give_up &&
+           acquisition->written - acquisition->valid_from >= length) {
+            AQ_copy(acquisition, acquisition->written - length, dst, length);
+            if(trigger->mode == TR_PHASE && trigger->auto_seed) {
+                TR_seedPhase(trigger, dst, 0, length);
+            }
+            acquisition->search_from = acquisition->written;
+            acquisition->timeouts++;
+            return 0;
+        }
+        if(AQ_read(acquisition, dev)) {
+            return -1;
+        }
+    }
+}
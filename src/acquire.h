@@ -0,0 +1,58 @@
+/**
+ * \file acquire.h
+ * \brief Header file for acquire.cpp
+ */
+
+#ifndef ACQUIRE_H
+#define ACQUIRE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "usb_comm.h"
+#include "trigger.h"
+
+// samples of history, a power of 2 at least twice the longest frame
+#define AQ_RING_SIZE (1 << 15)
+#define AQ_RING_MASK (AQ_RING_SIZE - 1)
+// samples searched again for each packet, so a hysteresis trigger armed
+// just before a packet still fires in it
+#define AQ_LOOKBACK 1024
+// samples read without the trigger firing before an untriggered frame
+#define AQ_MIN_TIMEOUT 8192
+#define AQ_PACKET_SAMPLES 255
+
+/**
+ * Triggered acquisition from a sample kept running between frames
+ *
+ * Every sample is stored at i & AQ_RING_MASK and again AQ_RING_SIZE
+ * later, so any AQ_RING_SIZE samples are contiguous in ring. Positions
+ * count samples since the sample was started. Samples before valid_from
+ * are not joined to later ones across a missing packet. trigger is the
+ * position of a trigger still waiting for its post-trigger samples, -1
+ * for none. session is the device's sessions when the sample was
+ * started.
+ */
+typedef struct {
+    int enabled;
+    int pre_trigger;
+    int streaming;
+    int session;
+    int mdac;
+    int* ring;
+    long long written;
+    long long valid_from;
+    long long search_from;
+    long long trigger;
+    TR_RESULT pending;
+    long long frames;
+    long long timeouts;
+    long long gaps;
+} AQ_ACQUISITION;
+
+int AQ_init(AQ_ACQUISITION* acquisition, int pre_trigger);
+void AQ_free(AQ_ACQUISITION* acquisition, UC_DEVICE* dev);
+void AQ_stop(AQ_ACQUISITION* acquisition, UC_DEVICE* dev);
+int AQ_readFrame(AQ_ACQUISITION* acquisition, UC_DEVICE* dev, TR_TRIGGER* trigger,
+                 int mdac_value, int* dst, int length, TR_RESULT* result);
+
+#endif
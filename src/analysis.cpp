@@ -0,0 +1,539 @@
+/**
+ * \file analysis.cpp
+ * \brief Routines for characterizing a captured attractor
+ *
+ * The largest Lyapunov exponent is found by following pairs of nearby
+ * points (Rosenstein et al. 1993, or Kantz 1994 which averages over a 
+ * neighbourhood) and the correlation dimension by counting close pairs 
+ * (Grassberger and Procaccia 1983). x1, x2 and x3 are all measured so 
+ * the samples are used as phase space points directly without a delay 
+ * embedding. Neighbours are found with a uniform grid over the points.
+ */
+
+#include "analysis.h"
+#include "analysis_check.h"
+#include "data_processing.h"
+#include "threads.h"
+#include "bufpool.h"
+
+/**
+ * Points sorted into cubic cells
+ *
+ * The points in cell c are order[cell_start[c]] .. order[cell_start[c+1]-1].
+ */
+typedef struct {
+    float* points;
+    int num_points;
+    float cell;
+    int dim;
+    int* cell_start;
+    int* order;
+} AN_GRID;
+
+typedef struct {
+    AN_GRID* grid;
+    AN_OPTIONS* options;
+    int theiler;
+    int num_refs;
+    int ref_step;
+    int usable;
+    double* sums;
+    int* counts;
+    double* hist;
+    volatile int failed;
+    float log_min;
+    float log_step;
+} AN_JOB;
+
+static inline float AN_dist2(const float* a, const float* b) {
+    float dx = a[0] - b[0];
+    float dy = a[1] - b[1];
+    float dz = a[2] - b[2];
+    return dx*dx + dy*dy + dz*dz;
+}
+
+static inline int AN_cellCoord(AN_GRID* grid, float v) {
+    int c = (int)(v/grid->cell);
+    if(c < 0) c = 0;
+    if(c >= grid->dim) c = grid->dim - 1;
+    return c;
+}
+
+static int AN_buildGrid(AN_GRID* grid, float* points, int num_points, float cell) {
+    /** 
+     * Sort points into a grid of cells of the given size
+     *
+     * Uses a counting sort so building is linear in the number of points.
+     */
+    grid->points = points;
+    grid->num_points = num_points;
+    grid->cell = cell;
+    grid->dim = (int)ceilf(1024.0f/cell);
+    if(grid->dim < 1) {
+        grid->dim = 1;
+    }
+    
+    int num_cells = grid->dim*grid->dim*grid->dim;
+    int* cell_of = (int*)BP_alloc(num_points*sizeof(int));
+    grid->cell_start = (int*)BP_calloc(num_cells + 1, sizeof(int));
+    grid->order = (int*)BP_alloc(num_points*sizeof(int));
+    if(!cell_of || !grid->cell_start || !grid->order) {
+        BP_free(cell_of);
+        BP_free(grid->cell_start);
+        BP_free(grid->order);
+        return -1;
+    }
+    
+    for(int i = 0; i < num_points; i++) {
+        float* p = &points[i*3];
+        int c = (AN_cellCoord(grid, p[2])*grid->dim + AN_cellCoord(grid, p[1]))*grid->dim
+                + AN_cellCoord(grid, p[0]);
+        cell_of[i] = c;
+        grid->cell_start[c + 1]++;
+    }
+    for(int c = 0; c < num_cells; c++) {
+        grid->cell_start[c + 1] += grid->cell_start[c];
+    }
+    // fill each cell from its end so the order within a cell is ascending
+    for(int i = num_points - 1; i >= 0; i--) {
+        grid->order[--grid->cell_start[cell_of[i] + 1]] = i;
+    }
+    // cell_start[c+1] now holds the start of cell c
+    for(int c = 0; c < num_cells; c++) {
+        grid->cell_start[c] = grid->cell_start[c + 1];
+    }
+    grid->cell_start[num_cells] = num_points;
+    
+    BP_free(cell_of);
+    return 0;
+}
+
+static void AN_freeGrid(AN_GRID* grid) {
+    BP_free(grid->cell_start);
+    BP_free(grid->order);
+}
+
+static int AN_nearest(AN_GRID* grid, int ref, int theiler, int usable) {
+    /** 
+     * Find the nearest neighbour of point ref
+     *
+     * Points within theiler samples of ref and points at or past usable 
+     * are ignored. Cells are searched in growing shells until no closer
+     * point can exist. Returns -1 if there is no candidate.
+     */
+    float* p = &grid->points[ref*3];
+    int cx = AN_cellCoord(grid, p[0]);
+    int cy = AN_cellCoord(grid, p[1]);
+    int cz = AN_cellCoord(grid, p[2]);
+    float best = 1e30f;
+    int best_j = -1;
+    
+    for(int r = 0; r < grid->dim; r++) {
+        // shells 0 .. r-1 are searched and every point outside them is 
+        // at least this far away
+        float reach = r > 0 ? (float)(r - 1)*grid->cell : 0.0f;
+        if(best_j >= 0 && best <= reach*reach) {
+            break;
+        }
+        for(int z = cz - r; z <= cz + r; z++) {
+            if(z < 0 || z >= grid->dim) continue;
+            for(int y = cy - r; y <= cy + r; y++) {
+                if(y < 0 || y >= grid->dim) continue;
+                int on_face = (z == cz - r || z == cz + r || y == cy - r || y == cy + r);
+                for(int x = cx - r; x <= cx + r; x += (on_face || r == 0) ? 1 : 2*r) {
+                    if(x < 0 || x >= grid->dim) continue;
+                    int c = (z*grid->dim + y)*grid->dim + x;
+                    for(int k = grid->cell_start[c]; k < grid->cell_start[c + 1]; k++) {
+                        int j = grid->order[k];
+                        if(j >= usable || abs(j - ref) <= theiler) {
+                            continue;
+                        }
+                        float d = AN_dist2(p, &grid->points[j*3]);
+                        if(d < best) {
+                            best = d;
+                            best_j = j;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return best_j;
+}
+
+int AN_checkNeighbours(int* samples, int num_samples, float cell, int num_queries) {
+    /** 
+     * Check the grid neighbour search against a brute force one
+     *
+     * \param cell Grid cell size, as used for AN_analyze
+     * \param num_queries Reference points, spread evenly over the samples
+     * \return The number of references whose neighbour from the grid is 
+     * further away than the nearest one, or -1 if there is not enough 
+     * memory
+     */
+    const int theiler = 10;
+    AN_GRID grid;
+    float* points = (float*)BP_alloc(num_samples*3*sizeof(float));
+    if(!points) {
+        return -1;
+    }
+    for(int i = 0; i < num_samples; i++) {
+        points[i*3] = (float)DP_getX1(samples[i]);
+        points[(i*3)+1] = (float)DP_getX2(samples[i]);
+        points[(i*3)+2] = (float)DP_getX3(samples[i]);
+    }
+    if(AN_buildGrid(&grid, points, num_samples, cell)) {
+        BP_free(points);
+        return -1;
+    }
+    
+    int wrong = 0;
+    int step = num_queries > 0 && num_samples > num_queries ? num_samples/num_queries : 1;
+    for(int i = 0; i < num_samples; i += step) {
+        float best = 1e30f;
+        for(int j = 0; j < num_samples; j++) {
+            if(abs(j - i) > theiler) {
+                float d = AN_dist2(&points[i*3], &points[j*3]);
+                if(d < best) {
+                    best = d;
+                }
+            }
+        }
+        int j = AN_nearest(&grid, i, theiler, num_samples);
+        float found = j >= 0 ? AN_dist2(&points[i*3], &points[j*3]) : 1e30f;
+        if(found > best) {
+            wrong++;
+        }
+    }
+    AN_freeGrid(&grid);
+    BP_free(points);
+    return wrong;
+}
+
+static void AN_followPair(AN_JOB* job, double* sums, int* counts, int i, int j) {
+    /** 
+     * Add the log distance between two trajectories at each step
+     */
+    float* points = job->grid->points;
+    for(int k = 0; k < job->options->horizon; k++) {
+        float d = AN_dist2(&points[(i + k)*3], &points[(j + k)*3]);
+        if(d > 0) {
+            sums[k] += 0.5*log((double)d);
+            counts[k]++;
+        }
+    }
+}
+
+static void AN_divergenceRange(void* arg, int chunk, int begin, int end) {
+    /** 
+     * Accumulate the divergence curve for a range of reference points
+     */
+    AN_JOB* job = (AN_JOB*)arg;
+    AN_GRID* grid = job->grid;
+    int horizon = job->options->horizon;
+    double* sums = &job->sums[chunk*horizon];
+    int* counts = &job->counts[chunk*horizon];
+    
+    if(job->options->method != AN_KANTZ) {
+        for(int r = begin; r < end; r++) {
+            int i = r*job->ref_step;
+            int j = AN_nearest(grid, i, job->theiler, job->usable);
+            if(j >= 0) {
+                AN_followPair(job, sums, counts, i, j);
+            }
+        }
+        return;
+    }
+    
+    // Kantz: average the distance over every neighbour within the radius
+    double* local = (double*)BP_alloc(horizon*sizeof(double));
+    if(!local) {
+        job->failed = 1;
+        return;
+    }
+    float eps = job->options->kantz_radius;
+    int reach = (int)ceilf(eps/grid->cell);
+    
+    for(int r = begin; r < end; r++) {
+        int i = r*job->ref_step;
+        float* p = &grid->points[i*3];
+        int cx = AN_cellCoord(grid, p[0]);
+        int cy = AN_cellCoord(grid, p[1]);
+        int cz = AN_cellCoord(grid, p[2]);
+        int found = 0;
+        
+        memset(local, 0, horizon*sizeof(double));
+        for(int z = cz - reach; z <= cz + reach; z++) {
+            if(z < 0 || z >= grid->dim) continue;
+            for(int y = cy - reach; y <= cy + reach; y++) {
+                if(y < 0 || y >= grid->dim) continue;
+                for(int x = cx - reach; x <= cx + reach; x++) {
+                    if(x < 0 || x >= grid->dim) continue;
+                    int c = (z*grid->dim + y)*grid->dim + x;
+                    for(int k = grid->cell_start[c]; k < grid->cell_start[c + 1]; k++) {
+                        int j = grid->order[k];
+                        if(j >= job->usable || abs(j - i) <= job->theiler ||
+                           AN_dist2(p, &grid->points[j*3]) > eps*eps) {
+                            continue;
+                        }
+                        for(int s = 0; s < horizon; s++) {
+                            local[s] += sqrt((double)AN_dist2(&grid->points[(i + s)*3],
+                                                              &grid->points[(j + s)*3]));
+                        }
+                        found++;
+                    }
+                }
+            }
+        }
+        if(!found) {
+            continue;
+        }
+        for(int s = 0; s < horizon; s++) {
+            if(local[s] > 0) {
+                sums[s] += log(local[s]/found);
+                counts[s]++;
+            }
+        }
+    }
+    BP_free(local);
+}
+
+static void AN_correlationRange(void* arg, int chunk, int begin, int end) {
+    /** 
+     * Count close pairs for a range of reference points
+     *
+     * Pairs are binned by log distance and summed into C(r) afterwards.
+     */
+    AN_JOB* job = (AN_JOB*)arg;
+    AN_GRID* grid = job->grid;
+    int num_radii = job->options->num_radii;
+    double* hist = &job->hist[chunk*(num_radii + 1)];
+    float max2 = job->options->max_radius*job->options->max_radius;
+    float min2 = job->options->min_radius*job->options->min_radius;
+    
+    for(int r = begin; r < end; r++) {
+        int i = r*job->ref_step;
+        float* p = &grid->points[i*3];
+        int cx = AN_cellCoord(grid, p[0]);
+        int cy = AN_cellCoord(grid, p[1]);
+        int cz = AN_cellCoord(grid, p[2]);
+        
+        for(int z = cz - 1; z <= cz + 1; z++) {
+            if(z < 0 || z >= grid->dim) continue;
+            for(int y = cy - 1; y <= cy + 1; y++) {
+                if(y < 0 || y >= grid->dim) continue;
+                for(int x = cx - 1; x <= cx + 1; x++) {
+                    if(x < 0 || x >= grid->dim) continue;
+                    int c = (z*grid->dim + y)*grid->dim + x;
+                    for(int k = grid->cell_start[c]; k < grid->cell_start[c + 1]; k++) {
+                        int j = grid->order[k];
+                        if(abs(j - i) <= job->theiler) {
+                            continue;
+                        }
+                        float d = AN_dist2(p, &grid->points[j*3]);
+                        if(d >= max2) {
+                            continue;
+                        }
+                        int bin = 0;
+                        if(d >= min2) {
+                            bin = 1 + (int)((0.5f*logf(d) - job->log_min)/job->log_step);
+                            if(bin > num_radii) bin = num_radii;
+                        }
+                        hist[bin] += 1.0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static float AN_slope(float* x, float* y, int begin, int end) {
+    /** 
+     * Least squares slope of y against x over [begin, end)
+     */
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int n = end - begin;
+    
+    if(n < 2) {
+        return 0;
+    }
+    for(int i = begin; i < end; i++) {
+        sx += x[i];
+        sy += y[i];
+        sxx += (double)x[i]*x[i];
+        sxy += (double)x[i]*y[i];
+    }
+    double den = n*sxx - sx*sx;
+    if(den == 0) {
+        return 0;
+    }
+    return (float)((n*sxy - sx*sy)/den);
+}
+
+void AN_defaultOptions(AN_OPTIONS* options) {
+    /** 
+     * Fill in default analysis settings
+     */
+    options->method = AN_ROSENSTEIN;
+    options->horizon = 120;
+    // skip the initial alignment of the separation with the unstable 
+    // direction and stop before it saturates at the attractor size
+    options->fit_start = 30;
+    options->fit_end = 90;
+    options->theiler = 0;
+    options->max_references = 4000;
+    options->kantz_radius = 8.0f;
+    options->num_radii = 16;
+    options->min_radius = 2.0f;
+    options->max_radius = 128.0f;
+    options->num_threads = 0;
+}
+
+int AN_analyze(int* samples, int num_samples, AN_OPTIONS* options, AN_RESULT* result) {
+    /** 
+     * Estimate the largest Lyapunov exponent and correlation dimension
+     *
+     * \param samples Packed samples from the device or a sweep file
+     * \param options Settings, or 0 for the defaults
+     *
+     * Reference points are spread evenly over the capture and split 
+     * across threads. Returns 0 on success, -1 if there is not enough 
+     * data or memory.
+     */
+    AN_OPTIONS settings;
+    AN_GRID grid;
+    AN_JOB job;
+    
+    if(options) {
+        settings = *options;
+    } else {
+        AN_defaultOptions(&settings);
+    }
+    options = &settings;
+    if(options->horizon > AN_MAX_HORIZON) options->horizon = AN_MAX_HORIZON;
+    if(options->horizon < 2) options->horizon = 2;
+    if(options->num_radii > AN_MAX_RADII) options->num_radii = AN_MAX_RADII;
+    if(options->num_radii < 2) options->num_radii = 2;
+    
+    memset(result, 0, sizeof(AN_RESULT));
+    if(num_samples < options->horizon*4) {
+        return -1;
+    }
+    
+    float* points = (float*)BP_alloc(num_samples*3*sizeof(float));
+    if(!points) {
+        return -1;
+    }
+    
+    // decode and estimate the mean period from the x1 peaks
+    RM_DETECTOR detector;
+    int num_peaks = 0;
+    RM_resetDetector(&detector);
+    for(int i = 0; i < num_samples; i++) {
+        points[i*3] = (float)DP_getX1(samples[i]);
+        points[(i*3)+1] = (float)DP_getX2(samples[i]);
+        points[(i*3)+2] = (float)DP_getX3(samples[i]);
+        if(RM_detect(&detector, DP_getX1(samples[i])) >= 0) {
+            num_peaks++;
+        }
+    }
+    job.theiler = options->theiler;
+    if(job.theiler <= 0) {
+        job.theiler = num_peaks ? num_samples/num_peaks : num_samples/20;
+        if(job.theiler < 10) job.theiler = 10;
+    }
+    
+    int num_threads = options->num_threads > 0 ? options->num_threads : TH_numCores();
+    int horizon = options->horizon;
+    
+    job.options = options;
+    job.grid = &grid;
+    job.usable = num_samples - horizon;
+    job.num_refs = job.usable < options->max_references || options->max_references <= 0 ?
+                   job.usable : options->max_references;
+    job.ref_step = job.usable/job.num_refs;
+    job.sums = (double*)BP_calloc(num_threads*horizon, sizeof(double));
+    job.counts = (int*)BP_calloc(num_threads*horizon, sizeof(int));
+    job.hist = (double*)BP_calloc(num_threads*(options->num_radii + 1), sizeof(double));
+    job.log_min = logf(options->min_radius);
+    job.log_step = (logf(options->max_radius) - job.log_min)/(options->num_radii - 1);
+    
+    job.failed = 0;
+    int failed = !job.sums || !job.counts || !job.hist;
+    
+    /* Lyapunov exponent */
+    float cell = options->method == AN_KANTZ ? options->kantz_radius : 16.0f;
+    if(!failed && !AN_buildGrid(&grid, points, num_samples, cell)) {
+        TH_parallelFor(job.num_refs, AN_divergenceRange, &job, num_threads);
+        AN_freeGrid(&grid);
+        failed = job.failed;
+        
+        float steps[AN_MAX_HORIZON];
+        int valid = horizon;
+        for(int k = 0; k < horizon; k++) {
+            double sum = 0;
+            int count = 0;
+            for(int t = 0; t < num_threads; t++) {
+                sum += job.sums[t*horizon + k];
+                count += job.counts[t*horizon + k];
+            }
+            if(!count && valid == horizon) {
+                valid = k;
+            }
+            steps[k] = (float)k;
+            result->divergence[k] = count ? (float)(sum/count) : 0.0f;
+        }
+        int fit_end = options->fit_end < valid ? options->fit_end : valid;
+        result->lyapunov_per_sample = AN_slope(steps, result->divergence, 
+                                               options->fit_start, fit_end);
+        result->lyapunov = result->lyapunov_per_sample*LIBCHAOS_SAMPLE_FREQUENCY;
+    } else {
+        failed = 1;
+    }
+    
+    /* Correlation dimension */
+    if(!failed && !AN_buildGrid(&grid, points, num_samples, options->max_radius)) {
+        TH_parallelFor(job.num_refs, AN_correlationRange, &job, num_threads);
+        AN_freeGrid(&grid);
+        
+        float log_r[AN_MAX_RADII], log_c[AN_MAX_RADII];
+        double total = 0;
+        double pairs = (double)job.num_refs*(double)(num_samples - 2*job.theiler - 1);
+        int first = -1, last = -1;
+        for(int m = 0; m < options->num_radii; m++) {
+            // bin m holds distances below radius[m]
+            for(int t = 0; t < num_threads; t++) {
+                total += job.hist[t*(options->num_radii + 1) + m];
+            }
+            result->radius[m] = expf(job.log_min + m*job.log_step);
+            result->correlation[m] = pairs > 0 ? (float)(total/pairs) : 0.0f;
+            log_r[m] = logf(result->radius[m]);
+            log_c[m] = result->correlation[m] > 0 ? logf(result->correlation[m]) : 0.0f;
+            if(result->correlation[m] > 0) {
+                if(first < 0) first = m;
+                last = m;
+            }
+        }
+        result->num_radii = options->num_radii;
+        // fit the middle of the curve, away from noise at small r and 
+        // saturation at large r
+        if(first >= 0 && last - first >= 3) {
+            int span = last - first + 1;
+            result->correlation_dimension = AN_slope(log_r, log_c, first + span/4, 
+                                                     last - span/4 + 1);
+        }
+    } else {
+        failed = 1;
+    }
+    
+    result->theiler = job.theiler;
+    result->num_points = num_samples;
+    result->num_references = job.num_refs;
+    result->horizon = horizon;
+    
+    BP_free(job.sums);
+    BP_free(job.counts);
+    BP_free(job.hist);
+    BP_free(points);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * \file analysis.h
+ * \brief Header file for analysis.cpp
+ */
+
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Lyapunov exponent methods */
+#define AN_ROSENSTEIN 0
+#define AN_KANTZ 1
+
+#define AN_MAX_HORIZON 512
+#define AN_MAX_RADII 32
+
+/**
+ * Settings for AN_analyze
+ *
+ * Distances are in sample units (0..1023 on each axis) and times in 
+ * samples. Use AN_defaultOptions to fill in reasonable values.
+ */
+typedef struct {
+    int method;
+    int horizon;
+    int fit_start;
+    int fit_end;
+    int theiler;
+    int max_references;
+    float kantz_radius;
+    int num_radii;
+    float min_radius;
+    float max_radius;
+    int num_threads;
+} AN_OPTIONS;
+
+/**
+ * Results of AN_analyze
+ *
+ * divergence[k] is the mean log distance between neighbouring 
+ * trajectories after k samples. The largest Lyapunov exponent is its 
+ * slope. correlation[m] is the correlation sum C(radius[m]) and the
+ * correlation dimension is the slope of log C against log r.
+ */
+typedef struct {
+    float lyapunov;
+    float lyapunov_per_sample;
+    float correlation_dimension;
+    int theiler;
+    int num_points;
+    int num_references;
+    int horizon;
+    float divergence[AN_MAX_HORIZON];
+    int num_radii;
+    float radius[AN_MAX_RADII];
+    float correlation[AN_MAX_RADII];
+} AN_RESULT;
+
+void AN_defaultOptions(AN_OPTIONS* options);
+int AN_analyze(int* samples, int num_samples, AN_OPTIONS* options, AN_RESULT* result);
+
+#endif
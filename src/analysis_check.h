@@ -0,0 +1,13 @@
+/**
+ * \file analysis_check.h
+ * \brief Self checks of analysis.cpp, for the bench only
+ *
+ * Not part of the library interface.
+ */
+
+#ifndef ANALYSIS_CHECK_H
+#define ANALYSIS_CHECK_H
+
+int AN_checkNeighbours(int* samples, int num_samples, float cell, int num_queries);
+
+#endif
@@ -0,0 +1,272 @@
+/**
+ * \file async.cpp
+ * \brief Routines for running library calls on a worker thread
+ */
+
+#include "async.h"
+
+void AS_init(AS_QUEUE* queue) {
+    /** 
+     * Initialize an empty queue
+     *
+     * The worker thread is started by the first AS_submit.
+     */
+    memset(queue, 0, sizeof(AS_QUEUE));
+    TH_mutexInit(&queue->lock);
+    TH_condInit(&queue->changed);
+}
+
+static void AS_drop(AS_QUEUE* queue, AS_REQUEST* request) {
+    /** 
+     * Drop a reference, the queue lock must be held
+     */
+    if(--request->refs == 0) {
+        free(request->filename);
+        free(request);
+    }
+}
+
+static void AS_finish(AS_REQUEST* request, int status, int result) {
+    /** 
+     * Record the outcome of a request and tell the caller
+     *
+     * The queue lock must not be held, the callback may call back into 
+     * the library.
+     */
+    AS_QUEUE* queue = request->queue;
+    TH_lock(&queue->lock);
+    request->status = status;
+    request->result = result;
+    TH_broadcast(&queue->changed);
+    TH_unlock(&queue->lock);
+    if(request->callback) {
+        request->callback(request->user, request, AS_COMPLETE, result);
+    }
+    TH_lock(&queue->lock);
+    AS_drop(queue, request);
+    TH_unlock(&queue->lock);
+}
+
+static void AS_worker(void* arg) {
+    /** 
+     * Run queued requests until the queue is freed
+     */
+    AS_QUEUE* queue = (AS_QUEUE*)arg;
+    for(;;) {
+        TH_lock(&queue->lock);
+        while(!queue->head && !queue->stop) {
+            TH_wait(&queue->changed, &queue->lock);
+        }
+        if(!queue->head) {
+            TH_unlock(&queue->lock);
+            return;
+        }
+        AS_REQUEST* request = queue->head;
+        queue->head = request->next;
+        if(!queue->head) {
+            queue->tail = 0;
+        }
+        request->status = AS_RUNNING;
+        TH_broadcast(&queue->changed);
+        TH_unlock(&queue->lock);
+        
+        int result = request->function(request);
+        int status = AS_DONE;
+        if(request->stopped) {
+            status = AS_CANCELLED;
+        } else if(result < 0) {
+            status = AS_FAILED;
+        }
+        AS_finish(request, status, result);
+    }
+}
+
+void AS_free(AS_QUEUE* queue) {
+    /** 
+     * Cancel the requests still queued and stop the worker
+     *
+     * Waits for the running request to finish.
+     */
+    TH_lock(&queue->lock);
+    AS_REQUEST* pending = queue->head;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->stop = 1;
+    TH_broadcast(&queue->changed);
+    TH_unlock(&queue->lock);
+    
+    while(pending) {
+        AS_REQUEST* next = pending->next;
+        pending->cancel = 1;
+        AS_finish(pending, AS_CANCELLED, -1);
+        pending = next;
+    }
+    if(queue->started) {
+        TH_join(queue->thread);
+    }
+    TH_condDestroy(&queue->changed);
+    TH_mutexDestroy(&queue->lock);
+    memset(queue, 0, sizeof(AS_QUEUE));
+}
+
+AS_REQUEST* AS_newRequest(AS_FUNCTION function, void* context, libchaos_callback callback, 
+                          void* user) {
+    /** 
+     * Allocate a request that will run function(request)
+     *
+     * The function returns the result and should check cancel when it 
+     * can stop early.
+     */
+    AS_REQUEST* request = (AS_REQUEST*)calloc(1, sizeof(AS_REQUEST));
+    if(!request) {
+        return 0;
+    }
+    request->function = function;
+    request->context = context;
+    request->callback = callback;
+    request->user = user;
+    request->result = -1;
+    return request;
+}
+
+int AS_submit(AS_QUEUE* queue, AS_REQUEST* request) {
+    /** 
+     * Queue a request behind the others
+     *
+     * The caller keeps a reference, given back with AS_release. Returns 0
+     * on success, otherwise the request is freed.
+     */
+    TH_lock(&queue->lock);
+    if(!queue->started) {
+        if(TH_create(&queue->thread, AS_worker, queue)) {
+            TH_unlock(&queue->lock);
+            free(request->filename);
+            free(request);
+            return -1;
+        }
+        queue->started = 1;
+    }
+    request->queue = queue;
+    request->refs = 2;
+    request->status = AS_QUEUED;
+    request->next = 0;
+    if(queue->tail) {
+        queue->tail->next = request;
+    } else {
+        queue->head = request;
+    }
+    queue->tail = request;
+    TH_broadcast(&queue->changed);
+    TH_unlock(&queue->lock);
+    return 0;
+}
+
+int AS_cancel(AS_REQUEST* request) {
+    /** 
+     * Cancel a request
+     *
+     * A queued request is removed at once. A running request stops at 
+     * the next point where it checks. Returns -1 if it already finished.
+     */
+    AS_QUEUE* queue = request->queue;
+    TH_lock(&queue->lock);
+    if(request->status >= AS_DONE) {
+        TH_unlock(&queue->lock);
+        return -1;
+    }
+    request->cancel = 1;
+    if(request->status == AS_QUEUED) {
+        AS_REQUEST** link = &queue->head;
+        AS_REQUEST* previous = 0;
+        while(*link && *link != request) {
+            previous = *link;
+            link = &(*link)->next;
+        }
+        if(*link) {
+            *link = request->next;
+            if(queue->tail == request) {
+                queue->tail = previous;
+            }
+            TH_unlock(&queue->lock);
+            AS_finish(request, AS_CANCELLED, -1);
+            return 0;
+        }
+    }
+    TH_unlock(&queue->lock);
+    return 0;
+}
+
+int AS_wait(AS_REQUEST* request) {
+    /** 
+     * Wait for a request to finish and return its result
+     *
+     * Must not be called from a callback of the same queue.
+     */
+    AS_QUEUE* queue = request->queue;
+    TH_lock(&queue->lock);
+    while(request->status < AS_DONE) {
+        TH_wait(&queue->changed, &queue->lock);
+    }
+    int result = request->result;
+    TH_unlock(&queue->lock);
+    return result;
+}
+
+int AS_getStatus(AS_REQUEST* request) {
+    /** 
+     * Returns AS_QUEUED, AS_RUNNING, AS_DONE, AS_CANCELLED or AS_FAILED
+     */
+    TH_lock(&request->queue->lock);
+    int status = request->status;
+    TH_unlock(&request->queue->lock);
+    return status;
+}
+
+int AS_getProgress(AS_REQUEST* request) {
+    /** 
+     * Returns the last progress reported, in percent
+     */
+    TH_lock(&request->queue->lock);
+    int progress = request->progress;
+    TH_unlock(&request->queue->lock);
+    return progress;
+}
+
+bool AS_checkCancel(AS_REQUEST* request) {
+    /** 
+     * Called by a running request where it is able to stop
+     *
+     * Returns true if the request should stop now. It then finishes as
+     * cancelled.
+     */
+    TH_lock(&request->queue->lock);
+    if(request->cancel) {
+        request->stopped = 1;
+    }
+    TH_unlock(&request->queue->lock);
+    return request->stopped;
+}
+
+void AS_progress(AS_REQUEST* request, int percent) {
+    /** 
+     * Report how far a running request has got
+     */
+    TH_lock(&request->queue->lock);
+    request->progress = percent;
+    TH_unlock(&request->queue->lock);
+    if(request->callback) {
+        request->callback(request->user, request, AS_PROGRESS, percent);
+    }
+}
+
+void AS_release(AS_REQUEST* request) {
+    /** 
+     * Give back the caller's reference
+     *
+     * The request keeps running, its callback is still called.
+     */
+    AS_QUEUE* queue = request->queue;
+    TH_lock(&queue->lock);
+    AS_drop(queue, request);
+    TH_unlock(&queue->lock);
+}
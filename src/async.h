@@ -0,0 +1,80 @@
+/**
+ * \file async.h
+ * \brief Header file for async.cpp
+ */
+
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "libchaos.h"
+#include "threads.h"
+
+/* request status, the same values as the public ones */
+#define AS_QUEUED 0
+#define AS_RUNNING 1
+#define AS_DONE 2
+#define AS_CANCELLED 3
+#define AS_FAILED 4
+
+/* callback events */
+#define AS_PROGRESS 0
+#define AS_COMPLETE 1
+
+struct AS_QUEUE;
+typedef int (*AS_FUNCTION)(struct libchaos_request* request);
+
+/**
+ * One queued call
+ *
+ * refs counts the caller's handle and the queue. args, filename and
+ * peaks belong to the function that runs the request. stopped is set 
+ * when the function gave up because of cancel.
+ */
+struct libchaos_request {
+    int refs;
+    int status;
+    int result;
+    int progress;
+    int cancel;
+    int stopped;
+    AS_FUNCTION function;
+    void* context;
+    int args[5];
+    char* filename;
+    int* peaks;
+    libchaos_callback callback;
+    void* user;
+    struct AS_QUEUE* queue;
+    struct libchaos_request* next;
+};
+typedef struct libchaos_request AS_REQUEST;
+
+/**
+ * Requests run in order by one worker thread
+ */
+typedef struct AS_QUEUE {
+    TH_MUTEX lock;
+    TH_COND changed;
+    TH_THREAD thread;
+    int started;
+    int stop;
+    AS_REQUEST* head;
+    AS_REQUEST* tail;
+} AS_QUEUE;
+
+void AS_init(AS_QUEUE* queue);
+void AS_free(AS_QUEUE* queue);
+AS_REQUEST* AS_newRequest(AS_FUNCTION function, void* context, libchaos_callback callback, 
+                          void* user);
+int AS_submit(AS_QUEUE* queue, AS_REQUEST* request);
+int AS_cancel(AS_REQUEST* request);
+int AS_wait(AS_REQUEST* request);
+int AS_getStatus(AS_REQUEST* request);
+int AS_getProgress(AS_REQUEST* request);
+bool AS_checkCancel(AS_REQUEST* request);
+void AS_progress(AS_REQUEST* request, int percent);
+void AS_release(AS_REQUEST* request);
+
+#endif
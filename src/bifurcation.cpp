@@ -0,0 +1,209 @@
+/**
+ * \file bifurcation.cpp
+ * \brief Routines for accumulating a bifurcation diagram density raster
+ */
+
+#include "bifurcation.h"
+
+int BF_init(BF_RASTER* raster, int amplitude_bins) {
+    /** 
+     * Initialize a density raster
+     *
+     * \param amplitude_bins Number of amplitude rows at full resolution. 
+     * Must be a power of two no larger than 1024.
+     *
+     * Level 0 has one column per MDAC value. Each following level halves
+     * both dimensions so that a zoomed out view can be drawn without 
+     * resampling.
+     */
+    int shift = 0;
+    
+    if(amplitude_bins < 2 || amplitude_bins > BF_AMPLITUDE_VALUES ||
+       (amplitude_bins & (amplitude_bins - 1))) {
+        return -1;
+    }
+    while((BF_AMPLITUDE_VALUES >> shift) > amplitude_bins) {
+        shift++;
+    }
+    
+    if(raster->num_levels) {
+        BF_free(raster);
+    }
+    
+    raster->amplitude_bins = amplitude_bins;
+    raster->amplitude_shift = shift;
+    raster->num_levels = 0;
+    
+    for(int i = 0; i < BF_MAX_LEVELS; i++) {
+        BF_LEVEL* level = &raster->levels[i];
+        int width = BF_MDAC_VALUES >> i;
+        int height = amplitude_bins >> i;
+        
+        if(height < 2) {
+            break;
+        }
+        
+        level->width = width;
+        level->height = height;
+        level->counts = (unsigned int*)calloc(width*height, sizeof(unsigned int));
+        level->image = (unsigned char*)calloc(width*height, 1);
+        level->dirty = (unsigned char*)calloc(width, 1);
+        level->num_dirty = 0;
+        
+        if(!level->counts || !level->image || !level->dirty) {
+            raster->num_levels = i + 1;
+            BF_free(raster);
+            return -1;
+        }
+        raster->num_levels = i + 1;
+    }
+    
+    return 0;
+}
+
+void BF_free(BF_RASTER* raster) {
+    /** 
+     * Free the memory used by a density raster
+     */
+    for(int i = 0; i < raster->num_levels; i++) {
+        free(raster->levels[i].counts);
+        free(raster->levels[i].image);
+        free(raster->levels[i].dirty);
+    }
+    memset(raster, 0, sizeof(BF_RASTER));
+}
+
+void BF_clear(BF_RASTER* raster) {
+    /** 
+     * Remove all peaks from the raster
+     */
+    for(int i = 0; i < raster->num_levels; i++) {
+        BF_LEVEL* level = &raster->levels[i];
+        memset(level->counts, 0, level->width*level->height*sizeof(unsigned int));
+        memset(level->image, 0, level->width*level->height);
+        memset(level->dirty, 0, level->width);
+        level->num_dirty = 0;
+    }
+}
+
+static void BF_addToBin(BF_RASTER* raster, int mdac_value, int row, int amount) {
+    /** 
+     * Add amount to the bin containing (mdac_value, row) on every level
+     *
+     * row is a level 0 amplitude row.
+     */
+    for(int i = 0; i < raster->num_levels; i++) {
+        BF_LEVEL* level = &raster->levels[i];
+        int column = mdac_value >> i;
+        
+        level->counts[(row >> i)*level->width + column] += amount;
+        if(!level->dirty[column]) {
+            level->dirty[column] = 1;
+            level->num_dirty++;
+        }
+    }
+}
+
+int BF_setColumn(BF_RASTER* raster, int mdac_value, int* peaks, int num_peaks) {
+    /** 
+     * Replace the peaks stored for an MDAC value
+     *
+     * \param peaks Peak amplitudes (x1 values)
+     * \param num_peaks Number of entries in peaks
+     *
+     * Any peaks previously stored for this MDAC value are removed first, 
+     * so calling this again for the same value does not count peaks 
+     * twice. Only the bins touched by this column are updated.
+     */
+    if(!raster->num_levels && BF_init(raster)) {
+        return -1;
+    }
+    if(mdac_value < 0 || mdac_value >= BF_MDAC_VALUES) {
+        return -1;
+    }
+    
+    BF_LEVEL* base = &raster->levels[0];
+    
+    // take out the old contribution of this column
+    for(int row = 0; row < base->height; row++) {
+        unsigned int count = base->counts[row*base->width + mdac_value];
+        if(count) {
+            BF_addToBin(raster, mdac_value, row, -(int)count);
+        }
+    }
+    
+    for(int i = 0; i < num_peaks; i++) {
+        int amplitude = peaks[i];
+        if(amplitude < 0 || amplitude >= BF_AMPLITUDE_VALUES) {
+            continue;
+        }
+        BF_addToBin(raster, mdac_value, amplitude >> raster->amplitude_shift, 1);
+    }
+    
+    return 0;
+}
+
+int BF_getNumLevels(BF_RASTER* raster) {
+    /** 
+     * Returns the number of resolution levels in the raster
+     */
+    return raster->num_levels;
+}
+
+unsigned int* BF_getCounts(BF_RASTER* raster, int level, int* width, int* height) {
+    /** 
+     * Get the raw bin counts for a level
+     *
+     * Returns 0 if the level does not exist.
+     */
+    if(level < 0 || level >= raster->num_levels) {
+        return 0;
+    }
+    *width = raster->levels[level].width;
+    *height = raster->levels[level].height;
+    return raster->levels[level].counts;
+}
+
+unsigned char* BF_getImage(BF_RASTER* raster, int level, int* width, int* height) {
+    /** 
+     * Get an 8 bit intensity image of a level
+     *
+     * Each column is normalized to its own maximum on a log scale so 
+     * that MDAC values with few peaks are as visible as busy ones. Only 
+     * columns that changed since the last call are redrawn.
+     *
+     * Returns 0 if the level does not exist.
+     */
+    if(level < 0 || level >= raster->num_levels) {
+        return 0;
+    }
+    
+    BF_LEVEL* l = &raster->levels[level];
+    
+    for(int column = 0; l->num_dirty > 0 && column < l->width; column++) {
+        if(!l->dirty[column]) {
+            continue;
+        }
+        
+        unsigned int max = 0;
+        for(int row = 0; row < l->height; row++) {
+            if(l->counts[row*l->width + column] > max) {
+                max = l->counts[row*l->width + column];
+            }
+        }
+        
+        float scale = max ? 255.0f/logf(1.0f + (float)max) : 0.0f;
+        for(int row = 0; row < l->height; row++) {
+            unsigned int count = l->counts[row*l->width + column];
+            l->image[(l->height - 1 - row)*l->width + column] =
+                (unsigned char)(logf(1.0f + (float)count)*scale + 0.5f);
+        }
+        
+        l->dirty[column] = 0;
+        l->num_dirty--;
+    }
+    
+    *width = l->width;
+    *height = l->height;
+    return l->image;
+}
@@ -0,0 +1,54 @@
+/**
+ * \file bifurcation.h
+ * \brief Header file for bifurcation.cpp
+ */
+
+#ifndef BIFURCATION_H
+#define BIFURCATION_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// number of MDAC columns in the diagram
+#define BF_MDAC_VALUES 4096
+// number of distinct peak amplitudes (x1 is 10 bit)
+#define BF_AMPLITUDE_VALUES 1024
+#define BF_DEFAULT_AMPLITUDE_BINS 256
+#define BF_MAX_LEVELS 8
+
+/**
+ * One resolution level of the density raster
+ *
+ * counts is indexed [row*width + column] with row 0 the lowest amplitude.
+ * image holds the same bins as 8 bit intensities with row 0 the highest
+ * amplitude so that it can be drawn directly.
+ */
+typedef struct {
+    int width;
+    int height;
+    unsigned int* counts;
+    unsigned char* image;
+    unsigned char* dirty;
+    int num_dirty;
+} BF_LEVEL;
+
+/**
+ * MDAC x amplitude density histogram of peak values
+ */
+typedef struct {
+    int amplitude_bins;
+    int amplitude_shift;
+    int num_levels;
+    BF_LEVEL levels[BF_MAX_LEVELS];
+} BF_RASTER;
+
+int BF_init(BF_RASTER* raster, int amplitude_bins = BF_DEFAULT_AMPLITUDE_BINS);
+void BF_free(BF_RASTER* raster);
+void BF_clear(BF_RASTER* raster);
+int BF_setColumn(BF_RASTER* raster, int mdac_value, int* peaks, int num_peaks);
+int BF_getNumLevels(BF_RASTER* raster);
+unsigned int* BF_getCounts(BF_RASTER* raster, int level, int* width, int* height);
+unsigned char* BF_getImage(BF_RASTER* raster, int level, int* width, int* height);
+
+#endif
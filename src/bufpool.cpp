@@ -0,0 +1,304 @@
+/**
+ * \file bufpool.cpp
+ * \brief A pool of aligned buffers shared by the whole library
+ *
+ * Sample buffers, pipeline blocks, frames, the peaks cache and the
+ * scratch space of the analysis are all taken from here. Blocks hold
+ * powers of two bytes after their header and go back on a free list for
+ * their size when freed, so once a session has run for a while every buffer it needs is
+ * a reused one and nothing more is taken from the heap. The pool only
+ * gives memory back to the heap in BP_trim.
+ *
+ * Huge blocks are whole huge pages with the data at their start, their
+ * headers are kept in BP_HUGE by the data address.
+ */
+
+#include "bufpool.h"
+#include "threads.h"
+
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+BP_HEADER* BP_FREE[BP_NUM_CLASSES];
+BP_HEADER* BP_HUGE[BP_HUGE_BUCKETS];
+BP_STATS BP_STATE;
+volatile int BP_LOCK = 0;
+
+static int BP_getClass(size_t size) {
+    /**
+     * The smallest size class with room for size bytes
+     *
+     * The header is outside the class size, so the common power of two
+     * buffers are not pushed into the next class. Returns -1 if the size
+     * is too large for the pool.
+     */
+    for(int size_class = 0; size_class < BP_NUM_CLASSES; size_class++) {
+        if(size <= ((size_t)1 << (size_class + BP_MIN_SHIFT))) {
+            return size_class;
+        }
+    }
+    return -1;
+}
+
+static inline int BP_isHuge(int size_class) {
+    /**
+     * Returns true if blocks of a class are huge pages with the header
+     * out of line
+     */
+    return (1LL << (size_class + BP_MIN_SHIFT)) >= BP_HUGE_SIZE;
+}
+
+static inline long long BP_blockBytes(int size_class) {
+    /**
+     * Bytes taken by a block of a class, with an in line header
+     */
+    long long bytes = 1LL << (size_class + BP_MIN_SHIFT);
+    return BP_isHuge(size_class) ? bytes : bytes + BP_ALIGN;
+}
+
+static inline int BP_hugeBucket(const void* data) {
+    return (int)(((size_t)data/BP_HUGE_SIZE) % BP_HUGE_BUCKETS);
+}
+
+static BP_HEADER* BP_findHeader(void* data) {
+    /**
+     * The header of a buffer, BP_LOCK must be held
+     *
+     * Only huge blocks start on a huge page, but a small one can too, so
+     * it is in line unless the table has it.
+     */
+    if(((size_t)data & (BP_HUGE_SIZE - 1)) == 0) {
+        for(BP_HEADER* block = BP_HUGE[BP_hugeBucket(data)]; block; block = block->chain) {
+            if(block->data == data) {
+                return block;
+            }
+        }
+    }
+    return (BP_HEADER*)((char*)data - BP_ALIGN);
+}
+
+static void* BP_alignedAlloc(size_t bytes, size_t alignment) {
+#ifdef _WIN32
+    return _aligned_malloc(bytes, alignment);
+#else
+    void* memory;
+    if(posix_memalign(&memory, alignment, bytes)) {
+        return 0;
+    }
+    return memory;
+#endif
+}
+
+static void BP_alignedFree(void* memory) {
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+static BP_HEADER* BP_heapAlloc(int size_class) {
+    /**
+     * Take a block of a class from the heap, aligned for its size
+     *
+     * A huge block still has to be put in BP_HUGE.
+     */
+    size_t bytes = (size_t)BP_blockBytes(size_class);
+    if(!BP_isHuge(size_class)) {
+        BP_HEADER* block = (BP_HEADER*)BP_alignedAlloc(bytes, BP_ALIGN);
+        if(block) {
+            block->data = (char*)block + BP_ALIGN;
+        }
+        return block;
+    }
+
+    BP_HEADER* block = (BP_HEADER*)malloc(sizeof(BP_HEADER));
+    char* data = (char*)BP_alignedAlloc(bytes, BP_HUGE_SIZE);
+    if(!block || !data) {
+        free(block);
+        BP_alignedFree(data);
+        return 0;
+    }
+#ifdef MADV_HUGEPAGE
+    // whole huge pages cut the TLB misses of walking a long capture
+    madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+    block->data = data;
+    return block;
+}
+
+static void BP_heapFree(BP_HEADER* block) {
+    /**
+     * Give a block back to the heap, a huge one must be out of BP_HUGE
+     */
+    if(BP_isHuge(block->size_class)) {
+        BP_alignedFree(block->data);
+        free(block);
+    } else {
+        BP_alignedFree(block);
+    }
+}
+
+void* BP_alloc(size_t size) {
+    /**
+     * Get a buffer of at least size bytes, aligned to BP_ALIGN
+     *
+     * The contents are not cleared. Returns 0 if there is no memory.
+     */
+    int size_class = BP_getClass(size);
+    if(size_class < 0) {
+        return 0;
+    }
+    long long bytes = BP_blockBytes(size_class);
+
+    TH_spinLock(&BP_LOCK);
+    BP_HEADER* block = BP_FREE[size_class];
+    if(block) {
+        BP_FREE[size_class] = block->next;
+        BP_STATE.blocks_free[size_class]--;
+        BP_STATE.reuses++;
+    }
+    TH_spinUnlock(&BP_LOCK);
+
+    // the heap is called without the lock held
+    int from_heap = !block;
+    if(from_heap) {
+        block = BP_heapAlloc(size_class);
+        if(!block) {
+            return 0;
+        }
+        block->size_class = size_class;
+    }
+    block->in_use = 1;
+    block->next = 0;
+
+    TH_spinLock(&BP_LOCK);
+    if(from_heap) {
+        if(BP_isHuge(size_class)) {
+            int bucket = BP_hugeBucket(block->data);
+            block->chain = BP_HUGE[bucket];
+            BP_HUGE[bucket] = block;
+        }
+        BP_STATE.held += bytes;
+        BP_STATE.heap_allocations++;
+    }
+    BP_STATE.in_use += bytes;
+    if(BP_STATE.in_use > BP_STATE.high_water) {
+        BP_STATE.high_water = BP_STATE.in_use;
+    }
+    if(++BP_STATE.blocks_in_use[size_class] > BP_STATE.blocks_high_water[size_class]) {
+        BP_STATE.blocks_high_water[size_class] = BP_STATE.blocks_in_use[size_class];
+    }
+    TH_spinUnlock(&BP_LOCK);
+    return block->data;
+}
+
+void* BP_calloc(size_t count, size_t size) {
+    /**
+     * Get a cleared buffer for count items of size bytes
+     */
+    if(size && count > ((size_t)-1)/size) {
+        return 0;
+    }
+    void* data = BP_alloc(count*size);
+    if(data) {
+        memset(data, 0, count*size);
+    }
+    return data;
+}
+
+void BP_free(void* data) {
+    /**
+     * Put a buffer back in the pool, 0 is ignored
+     *
+     * Freeing a buffer twice would put it on the free list twice and hand
+     * it to two users, so it stops the program instead.
+     */
+    if(!data) {
+        return;
+    }
+
+    TH_spinLock(&BP_LOCK);
+    BP_HEADER* block = BP_findHeader(data);
+    int size_class = block->size_class;
+    if(block->in_use != 1) {
+        TH_spinUnlock(&BP_LOCK);
+        fprintf(stderr, "libchaos: buffer %p freed twice or not from the pool\n", data);
+        abort();
+    }
+    block->in_use = 0;
+    block->next = BP_FREE[size_class];
+    BP_FREE[size_class] = block;
+    BP_STATE.blocks_free[size_class]++;
+    BP_STATE.blocks_in_use[size_class]--;
+    BP_STATE.in_use -= BP_blockBytes(size_class);
+    TH_spinUnlock(&BP_LOCK);
+}
+
+size_t BP_getCapacity(void* data) {
+    /**
+     * Returns the bytes a buffer can hold, at least what was asked for
+     */
+    TH_spinLock(&BP_LOCK);
+    int size_class = BP_findHeader(data)->size_class;
+    TH_spinUnlock(&BP_LOCK);
+    return (size_t)1 << (size_class + BP_MIN_SHIFT);
+}
+
+void BP_trim() {
+    /**
+     * Give every buffer not in use back to the heap
+     */
+    BP_HEADER* blocks[BP_NUM_CLASSES];
+    TH_spinLock(&BP_LOCK);
+    for(int size_class = 0; size_class < BP_NUM_CLASSES; size_class++) {
+        blocks[size_class] = BP_FREE[size_class];
+        BP_FREE[size_class] = 0;
+        BP_STATE.held -= BP_STATE.blocks_free[size_class]*BP_blockBytes(size_class);
+        BP_STATE.blocks_free[size_class] = 0;
+        if(!BP_isHuge(size_class)) {
+            continue;
+        }
+        // take the free huge blocks out of the table
+        for(BP_HEADER* block = blocks[size_class]; block; block = block->next) {
+            BP_HEADER** link = &BP_HUGE[BP_hugeBucket(block->data)];
+            while(*link != block) {
+                link = &(*link)->chain;
+            }
+            *link = block->chain;
+        }
+    }
+    TH_spinUnlock(&BP_LOCK);
+
+    for(int size_class = 0; size_class < BP_NUM_CLASSES; size_class++) {
+        while(blocks[size_class]) {
+            BP_HEADER* block = blocks[size_class];
+            blocks[size_class] = block->next;
+            BP_heapFree(block);
+        }
+    }
+}
+
+void BP_getStats(BP_STATS* stats) {
+    /**
+     * Copy what the pool holds
+     */
+    TH_spinLock(&BP_LOCK);
+    *stats = BP_STATE;
+    TH_spinUnlock(&BP_LOCK);
+}
+
+void BP_resetHighWater() {
+    /**
+     * Start the high-water marks again from what is in use now
+     */
+    TH_spinLock(&BP_LOCK);
+    BP_STATE.high_water = BP_STATE.in_use;
+    for(int size_class = 0; size_class < BP_NUM_CLASSES; size_class++) {
+        BP_STATE.blocks_high_water[size_class] = BP_STATE.blocks_in_use[size_class];
+    }
+    TH_spinUnlock(&BP_LOCK);
+}
@@ -0,0 +1,66 @@
+/**
+ * \file bufpool.h
+ * \brief Header file for bufpool.cpp
+ */
+
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stdlib.h>
+#include <string.h>
+
+// data is aligned to a cache line
+#define BP_ALIGN 64
+// blocks of at least this size are aligned to, and advised as, huge pages
+#define BP_HUGE_SIZE (2*1024*1024)
+// buckets of the table holding the headers of huge blocks
+#define BP_HUGE_BUCKETS 64
+// the smallest block holds 1 << BP_MIN_SHIFT bytes, its header is extra
+#define BP_MIN_SHIFT 12
+#define BP_NUM_CLASSES 20
+
+/**
+ * The start of every block, the data follows BP_ALIGN bytes in
+ *
+ * A block of size_class holds 1 << (size_class + BP_MIN_SHIFT) bytes of
+ * data after the header, so a power of two buffer fills its class.
+ * Blocks of BP_HUGE_SIZE or more keep their header out of line instead,
+ * found through a table by the data address, so the data starts on a
+ * huge page and fills whole ones.
+ */
+typedef struct BP_HEADER {
+    int size_class;
+    int in_use;
+    struct BP_HEADER* next;
+    char* data;
+    // the next huge block in the same bucket
+    struct BP_HEADER* chain;
+} BP_HEADER;
+
+/**
+ * What the pool holds
+ *
+ * in_use and held are bytes, including in line headers. heap_allocations counts
+ * the blocks taken from the heap, which stops rising once the pool has
+ * blocks for the steady state.
+ */
+typedef struct {
+    long long in_use;
+    long long high_water;
+    long long held;
+    long long heap_allocations;
+    long long reuses;
+    int blocks_in_use[BP_NUM_CLASSES];
+    int blocks_high_water[BP_NUM_CLASSES];
+    int blocks_free[BP_NUM_CLASSES];
+} BP_STATS;
+
+void* BP_alloc(size_t size);
+void* BP_calloc(size_t count, size_t size);
+void BP_free(void* data);
+size_t BP_getCapacity(void* data);
+void BP_trim();
+void BP_getStats(BP_STATS* stats);
+void BP_resetHighWater();
+
+#endif
@@ -0,0 +1,464 @@
+/**
+ * \file capture.cpp
+ * \brief Routines for capturing at one MDAC value straight to disk
+ *
+ * A capture samples without a break for as long as it is left running.
+ * One thread asks the unit for packets and copies them into large
+ * buffers while another writes full buffers to the file, so the unit is
+ * never kept waiting for the disk. The buffers are whole pages and are
+ * written with O_DIRECT where there is one, which keeps an hour of
+ * samples from pushing everything else out of the page cache. Packet
+ * ids are checked as packets arrive and every gap is kept in the file.
+ */
+
+#include "capture.h"
+#include "bufpool.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#define ftruncate(fd, length) _chsize_s(fd, length)
+#else
+#include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+static int CP_open(const char* filename, int* direct) {
+    /**
+     * Create a capture file, bypassing the page cache if possible
+     *
+     * Some file systems refuse O_DIRECT, they get ordinary writes.
+     */
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_BINARY;
+    int fd = -1;
+    *direct = 0;
+#ifdef O_DIRECT
+    fd = open(filename, flags | O_DIRECT, 0644);
+    if(fd >= 0) {
+        *direct = 1;
+        return fd;
+    }
+#endif
+    fd = open(filename, flags, 0644);
+#ifdef F_NOCACHE
+    if(fd >= 0 && fcntl(fd, F_NOCACHE, 1) != -1) {
+        *direct = 1;
+    }
+#endif
+    return fd;
+}
+
+static int CP_writeAll(int fd, const char* data, long long size) {
+    /**
+     * Write all of size bytes, returns -1 on an error
+     */
+    while(size > 0) {
+        int chunk = size > (1 << 30) ? (1 << 30) : (int)size;
+        int result = (int)write(fd, data, chunk);
+        if(result <= 0) {
+            return -1;
+        }
+        data += result;
+        size -= result;
+    }
+    return 0;
+}
+
+static void CP_addGap(CP_CAPTURE* capture, int packet_id, int last_packet_id) {
+    /**
+     * Keep a gap in the packet ids
+     */
+    int missing = packet_id - last_packet_id - 1;
+    if(missing < 0) {
+        missing = 0;
+    }
+    if(capture->num_gaps == capture->gaps_capacity) {
+        int capacity = capture->gaps_capacity ? capture->gaps_capacity*2 : 256;
+        CP_GAP* gaps = (CP_GAP*)realloc(capture->gaps, capacity*sizeof(CP_GAP));
+        if(!gaps) {
+            // still counted, only the position is lost
+            TH_atomicAdd64(&capture->gap_count, 1);
+            TH_atomicAdd64(&capture->missing_packets, missing);
+            return;
+        }
+        capture->gaps = gaps;
+        capture->gaps_capacity = capacity;
+    }
+    CP_GAP* gap = &capture->gaps[capture->num_gaps++];
+    gap->position = TH_atomicLoad64(&capture->samples);
+    gap->packet_id = packet_id;
+    gap->missing_packets = missing;
+    TH_atomicAdd64(&capture->gap_count, 1);
+    TH_atomicAdd64(&capture->missing_packets, missing);
+    LOG_TEXT(LOG_WARNING, "Capture missing %d packets at sample %lld\n", missing, gap->position);
+}
+
+static int* CP_nextBuffer(CP_CAPTURE* capture) {
+    /**
+     * Wait for the writer to free a buffer, returns 0 after an error
+     */
+    TH_lock(&capture->lock);
+    if(capture->filled - capture->written >= CP_NUM_BUFFERS) {
+        TH_atomicAdd64(&capture->stalls, 1);
+        LOG(LOG_WARNING, "Capture waiting for the disk\n");
+    }
+    while(capture->filled - capture->written >= CP_NUM_BUFFERS &&
+          !TH_atomicLoad(&capture->error)) {
+        TH_wait(&capture->changed, &capture->lock);
+    }
+    int* buffer = (int*)capture->buffers[capture->filled % CP_NUM_BUFFERS];
+    TH_unlock(&capture->lock);
+    return TH_atomicLoad(&capture->error) ? 0 : buffer;
+}
+
+static void CP_readerThread(void* arg) {
+    /**
+     * Take packets from the unit until stopped or max_samples are in
+     */
+    CP_CAPTURE* capture = (CP_CAPTURE*)arg;
+    UC_DEVICE* dev = capture->device;
+    const int per_buffer = CP_BUFFER_SIZE/4;
+    int packet[256];
+    int packet_size = 0;
+    int packet_used = 0;
+    int* buffer = 0;
+    int fill = 0;
+    long long taken = 0;
+
+    TH_lock(capture->device_lock);
+    if(UC_startSample(dev, capture->mdac)) {
+        TH_atomicStore(&capture->error, 1);
+    }
+    int last_packet_id = dev->last_packet_id;
+
+    while(!TH_atomicLoad(&capture->error)) {
+        if(packet_used == packet_size) {
+            if(TH_atomicLoad(&capture->stop) ||
+               (capture->max_samples && taken >= capture->max_samples)) {
+                break;
+            }
+            int packet_id = UC_getData(dev, packet);
+            if(packet_id < 0) {
+                LOG(LOG_ERROR, "Capture lost the unit\n");
+                TH_atomicStore(&capture->error, 1);
+                break;
+            }
+            if(packet_id != last_packet_id + 1) {
+                CP_addGap(capture, packet_id, last_packet_id);
+            }
+            last_packet_id = packet_id;
+            dev->last_packet_id = packet_id;
+            packet_size = CP_PACKET_SAMPLES;
+            if(capture->max_samples && capture->max_samples - taken < packet_size) {
+                packet_size = (int)(capture->max_samples - taken);
+            }
+            packet_used = 0;
+            taken += packet_size;
+        }
+        if(!buffer) {
+            buffer = CP_nextBuffer(capture);
+            fill = 0;
+            if(!buffer) {
+                break;
+            }
+        }
+        int count = packet_size - packet_used;
+        if(count > per_buffer - fill) {
+            count = per_buffer - fill;
+        }
+        memcpy(buffer + fill, packet + 1 + packet_used, count*4);
+        fill += count;
+        packet_used += count;
+        TH_atomicAdd64(&capture->samples, count);
+        if(fill == per_buffer) {
+            TH_lock(&capture->lock);
+            capture->filled++;
+            TH_broadcast(&capture->changed);
+            TH_unlock(&capture->lock);
+            buffer = 0;
+        }
+    }
+    UC_endSample(dev);
+    TH_unlock(capture->device_lock);
+
+    TH_lock(&capture->lock);
+    if(buffer && fill) {
+        capture->last_size = fill*4;
+        capture->filled++;
+    }
+    capture->reader_done = 1;
+    TH_broadcast(&capture->changed);
+    TH_unlock(&capture->lock);
+}
+
+static int CP_finish(CP_CAPTURE* capture, const char* filename) {
+    /**
+     * Trim the padding and write the header and the gaps
+     *
+     * The file is opened again without O_DIRECT, these writes are small
+     * and unaligned.
+     */
+    long long num_samples = TH_atomicLoad64(&capture->samples);
+    long long length = CP_HEADER_SIZE + num_samples*4;
+    int result = 0;
+    if(ftruncate(capture->fd, length)) {
+        result = -1;
+    }
+    close(capture->fd);
+    capture->fd = -1;
+
+    int fd = open(filename, O_WRONLY | O_BINARY);
+    if(fd < 0) {
+        return -1;
+    }
+    CP_FILE_HEADER header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CP_MAGIC, 4);
+    header.version = CP_VERSION;
+    header.mdac = capture->mdac;
+    header.sample_frequency = LIBCHAOS_SAMPLE_FREQUENCY;
+    header.num_samples = num_samples;
+    header.start_time = capture->start_time;
+    header.num_gaps = capture->num_gaps;
+    header.missing_packets = TH_atomicLoad64(&capture->missing_packets);
+    if(lseek(fd, 0, SEEK_SET) != 0 ||
+       CP_writeAll(fd, (const char*)&header, sizeof(header)) ||
+       lseek(fd, 0, SEEK_END) < 0 ||
+       CP_writeAll(fd, (const char*)capture->gaps,
+                   (long long)capture->num_gaps*sizeof(CP_GAP))) {
+        result = -1;
+    }
+    close(fd);
+    return result;
+}
+
+typedef struct {
+    CP_CAPTURE* capture;
+    char* filename;
+} CP_WRITER_ARGS;
+
+static void CP_writerThread(void* arg) {
+    /**
+     * Write buffers out in order as the reader fills them
+     */
+    CP_WRITER_ARGS* args = (CP_WRITER_ARGS*)arg;
+    CP_CAPTURE* capture = args->capture;
+
+    for(;;) {
+        TH_lock(&capture->lock);
+        while(capture->written == capture->filled && !capture->reader_done) {
+            TH_wait(&capture->changed, &capture->lock);
+        }
+        if(capture->written == capture->filled) {
+            TH_unlock(&capture->lock);
+            break;
+        }
+        int size = CP_BUFFER_SIZE;
+        if(capture->reader_done && capture->written == capture->filled - 1 &&
+           capture->last_size) {
+            size = capture->last_size;
+        }
+        char* buffer = capture->buffers[capture->written % CP_NUM_BUFFERS];
+        TH_unlock(&capture->lock);
+
+        // direct writes are whole blocks, the padding is cut off at the end
+        int padded = (size + CP_HEADER_SIZE - 1)/CP_HEADER_SIZE*CP_HEADER_SIZE;
+        memset(buffer + size, 0, padded - size);
+        if(!TH_atomicLoad(&capture->error)) {
+            if(CP_writeAll(capture->fd, buffer, padded)) {
+                LOG(LOG_ERROR, "Capture could not write to disk\n");
+                TH_atomicStore(&capture->error, 1);
+            } else {
+                TH_atomicAdd64(&capture->bytes_written, size);
+            }
+        }
+
+        TH_lock(&capture->lock);
+        capture->written++;
+        TH_broadcast(&capture->changed);
+        TH_unlock(&capture->lock);
+    }
+
+    if(CP_finish(capture, args->filename)) {
+        LOG_TEXT(LOG_ERROR, "Capture could not finish %s\n", args->filename);
+        TH_atomicStore(&capture->error, 1);
+    }
+    LOG_TEXT(LOG_INFO, "Capture of %lld samples finished, %lld gaps\n",
+             TH_atomicLoad64(&capture->samples), TH_atomicLoad64(&capture->gap_count));
+    free(args->filename);
+    free(args);
+    TH_atomicStore(&capture->running, 0);
+}
+
+static void CP_freeBuffers(CP_CAPTURE* capture) {
+    /**
+     * Give the buffers back to the pool
+     */
+    for(int i = 0; i < CP_NUM_BUFFERS; i++) {
+        BP_free(capture->blocks[i]);
+        capture->blocks[i] = 0;
+        capture->buffers[i] = 0;
+    }
+}
+
+int CP_start(CP_CAPTURE* capture, UC_DEVICE* device, TH_MUTEX* device_lock,
+             const char* filename, int mdac, long long max_samples) {
+    /**
+     * Start capturing to a file
+     *
+     * \param device_lock Held by the capture while it uses the device
+     * \param max_samples Stop after this many samples, 0 to run until
+     * CP_stop
+     *
+     * capture must be zeroed or stopped. Returns -1 if the file could
+     * not be created or there is no memory.
+     */
+    if(capture->device) {
+        return -1;
+    }
+    memset(capture, 0, sizeof(CP_CAPTURE));
+    for(int i = 0; i < CP_NUM_BUFFERS; i++) {
+        // the buffers must be page aligned for direct writes
+        capture->blocks[i] = (char*)BP_alloc(CP_BUFFER_SIZE + CP_HEADER_SIZE - BP_ALIGN);
+        if(!capture->blocks[i]) {
+            CP_freeBuffers(capture);
+            return -1;
+        }
+        size_t address = (size_t)capture->blocks[i];
+        address = (address + CP_HEADER_SIZE - 1)/CP_HEADER_SIZE*CP_HEADER_SIZE;
+        capture->buffers[i] = (char*)address;
+    }
+    CP_WRITER_ARGS* args = (CP_WRITER_ARGS*)malloc(sizeof(CP_WRITER_ARGS));
+    char* name = (char*)malloc(strlen(filename) + 1);
+    capture->fd = CP_open(filename, &capture->direct);
+    if(!args || !name || capture->fd < 0) {
+        LOG_TEXT(LOG_ERROR, "File %s failed to open\n", filename);
+        if(capture->fd >= 0) {
+            close(capture->fd);
+        }
+        free(args);
+        free(name);
+        CP_freeBuffers(capture);
+        return -1;
+    }
+    strcpy(name, filename);
+    args->capture = capture;
+    args->filename = name;
+
+    // the header is filled in at the end
+    memset(capture->buffers[0], 0, CP_HEADER_SIZE);
+    if(CP_writeAll(capture->fd, capture->buffers[0], CP_HEADER_SIZE)) {
+        close(capture->fd);
+        free(args);
+        free(name);
+        CP_freeBuffers(capture);
+        return -1;
+    }
+
+    capture->device = device;
+    capture->device_lock = device_lock;
+    capture->mdac = mdac;
+    capture->max_samples = max_samples;
+    capture->start_time = (long long)time(0);
+    TH_mutexInit(&capture->lock);
+    TH_condInit(&capture->changed);
+    capture->running = 1;
+    if(TH_create(&capture->writer, CP_writerThread, args)) {
+        close(capture->fd);
+        free(args);
+        free(name);
+        CP_freeBuffers(capture);
+        TH_condDestroy(&capture->changed);
+        TH_mutexDestroy(&capture->lock);
+        memset(capture, 0, sizeof(CP_CAPTURE));
+        return -1;
+    }
+    if(TH_create(&capture->reader, CP_readerThread, capture)) {
+        // the writer finishes an empty file
+        TH_lock(&capture->lock);
+        capture->reader_done = 1;
+        TH_broadcast(&capture->changed);
+        TH_unlock(&capture->lock);
+        TH_join(capture->writer);
+        CP_freeBuffers(capture);
+        TH_condDestroy(&capture->changed);
+        TH_mutexDestroy(&capture->lock);
+        memset(capture, 0, sizeof(CP_CAPTURE));
+        return -1;
+    }
+    LOG_TEXT(LOG_INFO, "Capturing at MDAC value %d to %s%s\n", mdac, filename,
+             capture->direct ? " with direct writes" : "");
+    return 0;
+}
+
+int CP_stop(CP_CAPTURE* capture) {
+    /**
+     * Stop a capture and wait for the file to be finished
+     *
+     * Returns -1 if there was no capture or it failed part way, the
+     * samples taken up to then are still in the file.
+     */
+    if(!capture->device) {
+        return -1;
+    }
+    TH_atomicStore(&capture->stop, 1);
+    TH_join(capture->reader);
+    TH_join(capture->writer);
+    int result = TH_atomicLoad(&capture->error) ? -1 : 0;
+    CP_freeBuffers(capture);
+    free(capture->gaps);
+    TH_condDestroy(&capture->changed);
+    TH_mutexDestroy(&capture->lock);
+    // the counters are kept until the next capture
+    capture->device = 0;
+    capture->gaps = 0;
+    capture->num_gaps = 0;
+    capture->gaps_capacity = 0;
+    return result;
+}
+
+long long CP_read(const char* filename, long long first, int* dst, int num_samples) {
+    /**
+     * Read packed samples from a capture file
+     *
+     * \param first Index of the first sample to read
+     *
+     * Returns the number of samples read, or -1 if the file is not a
+     * capture.
+     */
+    FILE* file = fopen(filename, "rb");
+    if(!file) {
+        return -1;
+    }
+    CP_FILE_HEADER header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, CP_MAGIC, 4) ||
+       header.version != CP_VERSION || first < 0) {
+        fclose(file);
+        return -1;
+    }
+    if(first >= header.num_samples) {
+        fclose(file);
+        return 0;
+    }
+    if(num_samples > header.num_samples - first) {
+        num_samples = (int)(header.num_samples - first);
+    }
+    long long offset = CP_HEADER_SIZE + first*4;
+#ifdef _WIN32
+    int seek = _fseeki64(file, offset, SEEK_SET);
+#else
+    int seek = fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+    if(seek) {
+        fclose(file);
+        return -1;
+    }
+    long long count = (long long)fread(dst, 4, num_samples, file);
+    fclose(file);
+    return count;
+}
@@ -0,0 +1,101 @@
+/**
+ * \file capture.h
+ * \brief Header file for capture.cpp
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usb_comm.h"
+#include "threads.h"
+
+#define CP_MAGIC "LCCP"
+#define CP_VERSION 1
+// the samples start this far into the file, and are written in blocks of it
+#define CP_HEADER_SIZE 4096
+// each buffer with its alignment fills one 4 MB block of the pool
+#define CP_BUFFER_SIZE (4*1024*1024 - CP_HEADER_SIZE)
+#define CP_NUM_BUFFERS 8
+#define CP_PACKET_SAMPLES 255
+
+/**
+ * The start of a capture file
+ *
+ * num_samples packed samples follow at CP_HEADER_SIZE, then num_gaps
+ * CP_GAPs. Fields are in the byte order of the recording machine.
+ */
+typedef struct {
+    char magic[4];
+    unsigned int version;
+    int mdac;
+    int sample_frequency;
+    long long num_samples;
+    long long start_time;
+    long long num_gaps;
+    long long missing_packets;
+} CP_FILE_HEADER;
+
+/**
+ * Packets missing from a capture
+ *
+ * position is the index of the first sample after the gap. packet_id is
+ * the id of the packet after the gap, missing_packets is 0 when the ids
+ * went backwards.
+ */
+typedef struct {
+    long long position;
+    int packet_id;
+    int missing_packets;
+} CP_GAP;
+
+/**
+ * A capture streaming to disk
+ *
+ * The reader thread holds device_lock for the whole capture and fills
+ * the buffers in turn, the writer thread writes them out in the same
+ * order. filled and written count buffers. The counters read by other
+ * threads are only changed atomically.
+ */
+typedef struct {
+    UC_DEVICE* device;
+    TH_MUTEX* device_lock;
+    int mdac;
+    long long max_samples;
+    int fd;
+    int direct;
+    long long start_time;
+    TH_THREAD reader;
+    TH_THREAD writer;
+    volatile int running;
+    volatile int stop;
+    volatile int error;
+
+    char* blocks[CP_NUM_BUFFERS];
+    char* buffers[CP_NUM_BUFFERS];
+    int last_size;
+    long long filled;
+    long long written;
+    int reader_done;
+    TH_MUTEX lock;
+    TH_COND changed;
+
+    CP_GAP* gaps;
+    int num_gaps;
+    int gaps_capacity;
+
+    volatile long long samples;
+    volatile long long bytes_written;
+    volatile long long missing_packets;
+    volatile long long gap_count;
+    volatile long long stalls;
+} CP_CAPTURE;
+
+int CP_start(CP_CAPTURE* capture, UC_DEVICE* device, TH_MUTEX* device_lock,
+             const char* filename, int mdac, long long max_samples);
+int CP_stop(CP_CAPTURE* capture);
+long long CP_read(const char* filename, long long first, int* dst, int num_samples);
+
+#endif
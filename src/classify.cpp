@@ -0,0 +1,416 @@
+/**
+ * \file classify.cpp
+ * \brief Labels the taps of a sweep by the kind of motion
+ *
+ * Each tap is called a fixed point, period p or chaotic from its x1
+ * peaks: a period p orbit brings every peak back p peaks later, and x1
+ * then matches itself one orbit later, which the autocorrelation checks.
+ * The strongest line of the spectrum gives the tap's frequency. Taps are
+ * independent, so a sweep file is classified a batch of taps at a time
+ * across all cores.
+ */
+
+#include "classify.h"
+#include "libchaos.h"
+#include "data_processing.h"
+#include "returnmap.h"
+#include "stft.h"
+#include "bufpool.h"
+#include "log.h"
+
+// spectrum segments and autocorrelation are limited to this many samples
+#define CL_MAX_SPECTRUM_SIZE 8192
+#define CL_MAX_SEGMENTS 8
+#define CL_MAX_CORRELATION_SAMPLES 16384
+
+typedef struct {
+    int** samples;
+    int* lengths;
+    CL_OPTIONS* options;
+    CL_RESULT* results;
+} CL_JOB;
+
+void CL_defaultOptions(CL_OPTIONS* options) {
+    /**
+     * Fill in settings that suit the unit's noise
+     */
+    options->delta = 8;
+    options->tolerance = 6;
+    options->max_period = 16;
+    options->min_peaks = 16;
+    options->fixed_amplitude = 16;
+    options->min_correlation = 0.8f;
+}
+
+static float CL_correlation(const float* x1, int num_samples, float lag, int* best_lag) {
+    /**
+     * Highest autocorrelation of x1 within a fifth of lag
+     *
+     * x1 has its mean taken out. Each lag is normalised over the samples
+     * it overlaps.
+     */
+    if(num_samples > CL_MAX_CORRELATION_SAMPLES) {
+        num_samples = CL_MAX_CORRELATION_SAMPLES;
+    }
+    int first = (int)(lag*0.8f);
+    int last = (int)(lag*1.2f + 1);
+    if(first < 1) first = 1;
+    if(last > num_samples/2) last = num_samples/2;
+    float best = -1;
+    *best_lag = 0;
+    for(int k = first; k <= last; k++) {
+        double dot = 0, a = 0, b = 0;
+        for(int i = 0; i + k < num_samples; i++) {
+            dot += x1[i]*x1[i+k];
+            a += x1[i]*x1[i];
+            b += x1[i+k]*x1[i+k];
+        }
+        float r = a > 0 && b > 0 ? (float)(dot/sqrt(a*b)) : 0;
+        if(r > best) {
+            best = r;
+            *best_lag = k;
+        }
+    }
+    return best;
+}
+
+static float CL_frequency(const float* x1, int num_samples, float* work) {
+    /**
+     * Frequency of the strongest line of the spectrum in Hz
+     *
+     * The power of up to CL_MAX_SEGMENTS windows is averaged and the peak
+     * bin refined with a parabola through the log power.
+     *
+     * \param work Room for 2*CL_MAX_SPECTRUM_SIZE floats
+     */
+    int size = ST_MIN_SIZE;
+    while(size*2 <= num_samples && size*2 <= CL_MAX_SPECTRUM_SIZE) {
+        size *= 2;
+    }
+    const ST_PLAN* plan = ST_getPlan(size, ST_HANN);
+    if(!plan || num_samples < size) {
+        return 0;
+    }
+    int bins = size/2;
+    float* power = work + size;
+    float* sum = work + size + bins;
+    memset(sum, 0, bins*sizeof(float));
+    int num_segments = num_samples/size;
+    if(num_segments > CL_MAX_SEGMENTS) {
+        num_segments = CL_MAX_SEGMENTS;
+    }
+    int step = num_segments > 1 ? (num_samples - size)/(num_segments - 1) : 0;
+    for(int s = 0; s < num_segments; s++) {
+        ST_power(plan, x1 + s*step, work, power);
+        for(int k = 0; k < bins; k++) {
+            sum[k] += power[k];
+        }
+    }
+    int peak = 1;
+    for(int k = 2; k < bins; k++) {
+        if(sum[k] > sum[peak]) {
+            peak = k;
+        }
+    }
+    float offset = 0;
+    if(peak + 1 < bins && sum[peak-1] > 0 && sum[peak+1] > 0) {
+        float a = logf(sum[peak-1]), b = logf(sum[peak]), c = logf(sum[peak+1]);
+        float curve = a - 2*b + c;
+        if(curve < 0) {
+            offset = 0.5f*(a - c)/curve;
+        }
+    }
+    return (peak + offset)*(LIBCHAOS_SAMPLE_FREQUENCY)/size;
+}
+
+int CL_classify(int* samples, int num_samples, CL_OPTIONS* options, CL_RESULT* result) {
+    /**
+     * Decide what kind of motion a tap shows
+     *
+     * \param samples Packed samples of one tap, after the transient
+     * \param options Settings, or 0 for the defaults
+     *
+     * The mdac of the result is left for the caller. Taps with too few
+     * peaks to tell are CL_UNKNOWN. Returns -1 if there are fewer than
+     * ST_MIN_SIZE samples or no memory.
+     */
+    CL_OPTIONS settings;
+    if(!options) {
+        CL_defaultOptions(&settings);
+        options = &settings;
+    }
+    memset(result, 0, sizeof(CL_RESULT));
+    result->type = CL_UNKNOWN;
+    result->num_samples = num_samples;
+    if(num_samples < ST_MIN_SIZE) {
+        return -1;
+    }
+
+    float* x1 = (float*)BP_alloc(num_samples*sizeof(float));
+    float* work = (float*)BP_alloc(2*CL_MAX_SPECTRUM_SIZE*sizeof(float));
+    int* peaks = (int*)BP_alloc((num_samples/2 + 1)*sizeof(int));
+    int* positions = (int*)BP_alloc((num_samples/2 + 1)*sizeof(int));
+    if(!x1 || !work || !peaks || !positions) {
+        BP_free(x1);
+        BP_free(work);
+        BP_free(peaks);
+        BP_free(positions);
+        return -1;
+    }
+
+    RM_DETECTOR detector;
+    RM_resetDetector(&detector, options->delta);
+    int num_peaks = 0;
+    int low = 1 << 30, high = -1;
+    double mean = 0;
+    for(int i = 0; i < num_samples; i++) {
+        int value = DP_getX1(samples[i]);
+        x1[i] = (float)value;
+        mean += value;
+        if(value < low) low = value;
+        if(value > high) high = value;
+        int peak = RM_detect(&detector, value);
+        if(peak >= 0) {
+            peaks[num_peaks] = peak;
+            positions[num_peaks++] = i;
+        }
+    }
+    mean /= num_samples;
+    for(int i = 0; i < num_samples; i++) {
+        x1[i] -= (float)mean;
+    }
+
+    result->num_peaks = num_peaks;
+    if(num_peaks) {
+        double sum = 0, squares = 0;
+        result->peak_min = result->peak_max = (float)peaks[0];
+        for(int i = 0; i < num_peaks; i++) {
+            sum += peaks[i];
+            squares += (double)peaks[i]*peaks[i];
+            if(peaks[i] < result->peak_min) result->peak_min = (float)peaks[i];
+            if(peaks[i] > result->peak_max) result->peak_max = (float)peaks[i];
+        }
+        result->peak_mean = (float)(sum/num_peaks);
+        double variance = squares/num_peaks - (sum/num_peaks)*(sum/num_peaks);
+        result->peak_std = (float)sqrt(variance > 0 ? variance : 0);
+    }
+
+    if(high - low <= options->fixed_amplitude) {
+        result->type = CL_FIXED_POINT;
+        result->num_peaks = 0;
+    } else {
+        result->frequency = CL_frequency(x1, num_samples, work);
+    }
+
+    if(result->type != CL_FIXED_POINT && num_peaks >= options->min_peaks) {
+        float spacing = (float)(positions[num_peaks-1] - positions[0])/(num_peaks - 1);
+        int max_period = options->max_period < CL_MAX_PERIOD ? options->max_period : CL_MAX_PERIOD;
+        int lag;
+        result->type = CL_CHAOTIC;
+        for(int p = 1; p <= max_period && num_peaks - p >= 2*p; p++) {
+            double squares = 0;
+            for(int i = 0; i + p < num_peaks; i++) {
+                double d = peaks[i+p] - peaks[i];
+                squares += d*d;
+            }
+            if(sqrt(squares/(num_peaks - p)) > options->tolerance) {
+                continue;
+            }
+            float correlation = CL_correlation(x1, num_samples, p*spacing, &lag);
+            if(correlation >= options->min_correlation) {
+                result->type = CL_PERIODIC;
+                result->period = p;
+                result->correlation = correlation;
+                break;
+            }
+        }
+        if(result->type == CL_CHAOTIC) {
+            result->correlation = CL_correlation(x1, num_samples, spacing, &lag);
+        }
+    }
+
+    BP_free(x1);
+    BP_free(work);
+    BP_free(peaks);
+    BP_free(positions);
+    return 0;
+}
+
+static void CL_classifyRange(void* arg, int chunk, int begin, int end) {
+    /**
+     * Classify the taps of one chunk
+     */
+    CL_JOB* job = (CL_JOB*)arg;
+    for(int i = begin; i < end; i++) {
+        int mdac = job->results[i].mdac;
+        CL_classify(job->samples[i], job->lengths[i], job->options, &job->results[i]);
+        job->results[i].mdac = mdac;
+    }
+}
+
+int CL_classifyTaps(int** samples, int* lengths, int num_taps, CL_OPTIONS* options,
+                    CL_RESULT* results, int num_threads) {
+    /**
+     * Classify taps in parallel
+     *
+     * The mdac of each result is kept, the rest is filled in.
+     *
+     * \param num_threads Threads to use, 0 for one per core
+     * \return The number of threads used
+     */
+    CL_JOB job;
+    job.samples = samples;
+    job.lengths = lengths;
+    job.options = options;
+    job.results = results;
+    return TH_parallelFor(num_taps, CL_classifyRange, &job, num_threads);
+}
+
+void CL_init(CL_TABLE* table) {
+    /**
+     * Get an empty table ready
+     */
+    memset(table, 0, sizeof(CL_TABLE));
+    CL_defaultOptions(&table->options);
+    TH_mutexInit(&table->lock);
+}
+
+void CL_free(CL_TABLE* table) {
+    /**
+     * Free the summaries of a table
+     */
+    BP_free(table->taps);
+    TH_mutexDestroy(&table->lock);
+    memset(table, 0, sizeof(CL_TABLE));
+}
+
+void CL_clear(CL_TABLE* table) {
+    /**
+     * Forget all summaries, keeping the memory
+     */
+    TH_lock(&table->lock);
+    table->num_taps = 0;
+    TH_unlock(&table->lock);
+}
+
+int CL_append(CL_TABLE* table, CL_RESULT* result) {
+    /**
+     * Add a summary to the end of a table
+     *
+     * Returns -1 if there is no memory for it.
+     */
+    TH_lock(&table->lock);
+    if(table->num_taps == table->capacity) {
+        int capacity = table->capacity ? table->capacity*2 : 256;
+        CL_RESULT* taps = (CL_RESULT*)BP_alloc(capacity*sizeof(CL_RESULT));
+        if(!taps) {
+            TH_unlock(&table->lock);
+            return -1;
+        }
+        if(table->num_taps) {
+            memcpy(taps, table->taps, table->num_taps*sizeof(CL_RESULT));
+        }
+        BP_free(table->taps);
+        table->taps = taps;
+        table->capacity = capacity;
+    }
+    table->taps[table->num_taps++] = *result;
+    TH_unlock(&table->lock);
+    return 0;
+}
+
+int CL_get(CL_TABLE* table, int index, CL_RESULT* result) {
+    /**
+     * Copy out a summary, returns -1 if there is no such tap
+     */
+    TH_lock(&table->lock);
+    int ret_val = -1;
+    if(index >= 0 && index < table->num_taps) {
+        *result = table->taps[index];
+        ret_val = 0;
+    }
+    TH_unlock(&table->lock);
+    return ret_val;
+}
+
+int CL_classifyFile(CL_TABLE* table, char* filename, int num_threads) {
+    /**
+     * Replace the summaries of a table with those of a sweep file
+     *
+     * Taps are read until CL_BATCH_SAMPLES or CL_MAX_BATCH_TAPS are held,
+     * then classified together in parallel.
+     *
+     * \return The number of taps classified, or -1 if the file could not
+     * be read
+     */
+    DP_SWEEP sweep;
+    if(DP_openSweep(&sweep, filename)) {
+        LOG_TEXT(LOG_ERROR, "File %s failed to open\n", filename);
+        return -1;
+    }
+    int* data = (int*)BP_alloc(CL_BATCH_SAMPLES*sizeof(int));
+    int** samples = (int**)BP_alloc(CL_MAX_BATCH_TAPS*sizeof(int*));
+    int* lengths = (int*)BP_alloc(CL_MAX_BATCH_TAPS*sizeof(int));
+    CL_RESULT* results = (CL_RESULT*)BP_alloc(CL_MAX_BATCH_TAPS*sizeof(CL_RESULT));
+    if(!data || !samples || !lengths || !results) {
+        BP_free(data);
+        BP_free(samples);
+        BP_free(lengths);
+        BP_free(results);
+        DP_closeSweep(&sweep);
+        return -1;
+    }
+
+    CL_clear(table);
+    int total = 0;
+    int done = 0;
+    while(!done) {
+        int num_taps = 0;
+        int used = 0;
+        while(num_taps < CL_MAX_BATCH_TAPS && used + CL_MAX_TAP_SAMPLES <= CL_BATCH_SAMPLES) {
+            int length = DP_readSweepTap(&sweep, data + used, CL_MAX_TAP_SAMPLES,
+                                         &results[num_taps].mdac);
+            if(length <= 0) {
+                done = 1;
+                break;
+            }
+            samples[num_taps] = data + used;
+            lengths[num_taps] = length;
+            used += length;
+            num_taps++;
+        }
+        CL_classifyTaps(samples, lengths, num_taps, &table->options, results, num_threads);
+        for(int i = 0; i < num_taps; i++) {
+            CL_append(table, &results[i]);
+        }
+        total += num_taps;
+    }
+
+    DP_closeSweep(&sweep);
+    BP_free(data);
+    BP_free(samples);
+    BP_free(lengths);
+    BP_free(results);
+    return total;
+}
+
+int CL_write(CL_TABLE* table, FILE* file) {
+    /**
+     * Write a table as CSV, one row per tap
+     *
+     * Returns -1 if the file could not be written.
+     */
+    static const char* names[] = {"unknown", "fixed", "periodic", "chaotic"};
+    TH_lock(&table->lock);
+    fprintf(file, "mdac,type,period,frequency,num_peaks,peak_min,peak_max,peak_mean,"
+                  "peak_std,correlation\n");
+    for(int i = 0; i < table->num_taps; i++) {
+        CL_RESULT* tap = &table->taps[i];
+        fprintf(file, "%d,%s,%d,%.2f,%d,%.0f,%.0f,%.2f,%.2f,%.3f\n", tap->mdac,
+                names[tap->type + 1], tap->period, tap->frequency, tap->num_peaks,
+                tap->peak_min, tap->peak_max, tap->peak_mean, tap->peak_std,
+                tap->correlation);
+    }
+    TH_unlock(&table->lock);
+    return ferror(file) ? -1 : 0;
+}
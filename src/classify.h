@@ -0,0 +1,93 @@
+/**
+ * \file classify.h
+ * \brief Header file for classify.cpp
+ */
+
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "threads.h"
+
+/* kinds of motion, the same values as the public ones */
+#define CL_UNKNOWN -1
+#define CL_FIXED_POINT 0
+#define CL_PERIODIC 1
+#define CL_CHAOTIC 2
+
+#define CL_MAX_PERIOD 32
+// longest tap read from a file, the rest of a tap is skipped
+#define CL_MAX_TAP_SAMPLES (1 << 18)
+// samples read from a file before its taps are classified together
+#define CL_BATCH_SAMPLES (1 << 22)
+#define CL_MAX_BATCH_TAPS 1024
+
+/**
+ * Settings for CL_classify
+ *
+ * Amplitudes are in sample units. A tap is a fixed point if x1 moves by
+ * no more than fixed_amplitude, and period p if each peak is within
+ * tolerance (RMS) of the peak p later and x1 correlates by at least
+ * min_correlation with itself one orbit later.
+ */
+typedef struct {
+    int delta;
+    float tolerance;
+    int max_period;
+    int min_peaks;
+    int fixed_amplitude;
+    float min_correlation;
+} CL_OPTIONS;
+
+/**
+ * Summary of one tap
+ *
+ * frequency is the strongest line of the x1 spectrum in Hz. correlation
+ * is the autocorrelation of x1 one orbit later, one peak later for
+ * chaotic taps, and is near 1 for clean periodic motion.
+ */
+typedef struct {
+    int mdac;
+    int type;
+    int period;
+    int num_samples;
+    int num_peaks;
+    float frequency;
+    float peak_min;
+    float peak_max;
+    float peak_mean;
+    float peak_std;
+    float correlation;
+} CL_RESULT;
+
+/**
+ * Summaries of a sweep, in the order the taps came
+ *
+ * enabled makes the sweep stage add every tap of a running sweep.
+ * Changed under lock, so the stage may add taps while they are read.
+ */
+typedef struct {
+    CL_RESULT* taps;
+    int num_taps;
+    int capacity;
+    int enabled;
+    CL_OPTIONS options;
+    TH_MUTEX lock;
+} CL_TABLE;
+
+void CL_defaultOptions(CL_OPTIONS* options);
+int CL_classify(int* samples, int num_samples, CL_OPTIONS* options, CL_RESULT* result);
+int CL_classifyTaps(int** samples, int* lengths, int num_taps, CL_OPTIONS* options,
+                    CL_RESULT* results, int num_threads);
+void CL_init(CL_TABLE* table);
+void CL_free(CL_TABLE* table);
+void CL_clear(CL_TABLE* table);
+int CL_append(CL_TABLE* table, CL_RESULT* result);
+int CL_get(CL_TABLE* table, int index, CL_RESULT* result);
+int CL_classifyFile(CL_TABLE* table, char* filename, int num_threads);
+int CL_write(CL_TABLE* table, FILE* file);
+
+#endif
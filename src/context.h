@@ -0,0 +1,113 @@
+/**
+ * \file context.h
+ * \brief State held by a libchaos_context
+ */
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include "libchaos.h"
+#include "usb_comm.h"
+#include "data_processing.h"
+#include "peaks.h"
+#include "returnmap.h"
+#include "trigger.h"
+#include "poincare.h"
+#include "voxels.h"
+#include "lod.h"
+#include "stft.h"
+#include "classify.h"
+#include "threads.h"
+#include "frames.h"
+#include "shmring.h"
+#include "server.h"
+#include "scan.h"
+#include "pipeline.h"
+#include "async.h"
+#include "capture.h"
+#include "acquire.h"
+
+#define POINTS_AFTER_TRIGGER 300
+// samples an asynchronous sweep takes each time it holds the context
+#define LC_ASYNC_SWEEP_PART (255*32)
+
+/**
+ * Everything one connection to a chaos unit works with
+ *
+ * lock is recursive so public functions may call each other.
+ */
+struct libchaos_context {
+    TH_MUTEX lock;
+    UC_DEVICE device;
+    PEAKS_STATE peaks;
+    SC_SCAN scan;
+    FILE* csv;
+
+    // sample sweep to CSV, sweeping is set while an asynchronous sweep 
+    // has the unit
+    int* data;
+    int start;
+    int end;
+    int step;
+    int mdac;
+    int num_samples;
+    int calls_this_tap;
+    int sweeping;
+
+    // basic plot
+    int num_plot_points;
+    int plot_data[MAX_PLOT_POINTS];
+    float fft_data[NUM_FFT_PLOT_POINTS*2];
+    int fft_enabled;
+    int last_mdac_value;
+    int last_fft;
+    int fft_mdac;
+    int fft_due;
+    FR_STATS plot_statistics;
+    
+    // derived products are worked out on demand. plot_generation counts
+    // plots, product_generation is the plot each product was last worked
+    // out for and product_read the plot after it was last read.
+    unsigned int plot_generation;
+    unsigned int product_generation[FR_NUM_PRODUCTS];
+    unsigned int product_read[FR_NUM_PRODUCTS];
+
+    RM_BUILDER return_map;
+    TR_TRIGGER trigger;
+    TR_RESULT trigger_result;
+    int trigger_index;
+    AQ_ACQUISITION acquisition;
+    PS_SECTION section;
+    VX_GRID voxels;
+    LOD_PYRAMID history;
+    ST_SPECTROGRAM spectrogram;
+    CL_TABLE classes;
+    FR_POOL frames;
+    SR_RING publisher;
+    SV_SERVER server;
+    
+    // analysis stages, user_stages is indexed by stream*PL_MAX_STAGES +
+    // stage
+    PL_PIPELINE plot_pipeline;
+    PL_PIPELINE sweep_pipeline;
+    void* user_stages[2*PL_MAX_STAGES];
+    
+    // asynchronous requests
+    AS_QUEUE requests;
+    
+    // continuous capture, holds lock while running
+    CP_CAPTURE capture;
+};
+
+/**
+ * Holds a context's lock for the life of a scope
+ */
+class LC_LOCK {
+public:
+    LC_LOCK(libchaos_context* ctx) : lock(&ctx->lock) { TH_lock(lock); }
+    ~LC_LOCK() { TH_unlock(lock); }
+private:
+    TH_MUTEX* lock;
+};
+
+#endif
@@ -4,8 +4,9 @@
  */
 
 #include "data_processing.h"
-
-FILE * DP_CSV;
+#include "log.h"
+#include "trace.h"
+#include "kernels.h"
 
 int DP_getX1(int data_point) {
     /** 
@@ -28,75 +29,267 @@ int DP_getX3(int data_point) {
     return (int)((data_point & 0xFFC00000) >> 22);
 }
 
-int DP_newCSV(char* filename) {
+int DP_pack(int x1, int x2, int x3) {
+    /** 
+     * Pack 10 bit x1, x2 and x3 values into a sample point
+     *
+     * This is the inverse of DP_getX1, DP_getX2 and DP_getX3.
+     */
+    return (int)(((unsigned int)(x1 & 0x3FF) << 2) |
+                 ((unsigned int)(x2 & 0x3FF) << 12) |
+                 ((unsigned int)(x3 & 0x3FF) << 22));
+}
+
+int DP_newCSV(FILE** csv, char* filename) {
     /** 
      * Create a new CSV file
      *
      * Deletes existing file if it exists    
      */
-    return (int)((DP_CSV = fopen(filename,"w")) != 0);
+    return (int)((*csv = fopen(filename,"w")) != 0);
 }
 
-void DP_appendToCSV(int* src_data, int length, int mdac_value) {
+static char* DP_formatInt(char* dst, int value) {
+    /** 
+     * Write an int as decimal text, returning the end of the text
+     *
+     * Much cheaper than fprintf for the millions of numbers in a sweep.
+     */
+    char digits[12];
+    int num_digits = 0;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    if(value < 0) {
+        *dst++ = '-';
+    }
+    do {
+        digits[num_digits++] = (char)('0' + magnitude%10);
+        magnitude /= 10;
+    } while(magnitude);
+    while(num_digits) {
+        *dst++ = digits[--num_digits];
+    }
+    return dst;
+}
+
+void DP_appendToCSV(FILE* csv, int* src_data, int length, int mdac_value) {
     /** 
      * Append data to the CSV file
      *
      * newCSV must be called before this so that the data has a place 
-     * to go
+     * to go. Samples are decoded and formatted DP_CSV_CHUNK at a time
+     * and each chunk is written with one fwrite.
      */
-    int x1, x2, x3;
+    TRACE_SCOPE(TRACE_CSV);
+    short x1[DP_CSV_CHUNK], x2[DP_CSV_CHUNK], x3[DP_CSV_CHUNK];
+    // the longest row is "-2147483648,1023,1023,1023\n"
+    char text[DP_CSV_CHUNK*28];
+    char prefix[16];
+    int prefix_length = DP_formatInt(prefix, mdac_value) - prefix;
+    prefix[prefix_length++] = ',';
     int x1_prev = 0, x2_prev = 0, x3_prev = 0;
-    unsigned int data;
     
-    for(int i = 0; i<length; i++) {
-        data = *(unsigned int*)&src_data[i];
-        x1 = DP_getX1(data);
-        x2 = DP_getX2(data);
-        x3 = DP_getX3(data);
-        if((abs(x1 - x1_prev) > 100 || 
-            abs(x2 - x2_prev) > 100 || 
-            abs(x3 - x3_prev) > 100) &&
-            (i > 0) && i < length - 4) {
-           fprintf(DEBUG_FILE,"ERROR: Discontinuity at point %d\n",i);
-        }
-        fprintf(DP_CSV,"%d,%d,%d,%d\n",mdac_value,x1,x2,x3);
-        x1_prev = x1;
-        x2_prev = x2;
-        x3_prev = x3;
+    for(int start = 0; start < length; start += DP_CSV_CHUNK) {
+        int count = length - start < DP_CSV_CHUNK ? length - start : DP_CSV_CHUNK;
+        KN->decode(src_data + start, x1, x2, x3, count);
+        char* end = text;
+        for(int j = 0; j < count; j++) {
+            int i = start + j;
+            if((abs(x1[j] - x1_prev) > 100 || 
+                abs(x2[j] - x2_prev) > 100 || 
+                abs(x3[j] - x3_prev) > 100) &&
+                (i > 0) && i < length - 4) {
+               LOG(LOG_ERROR, "ERROR: Discontinuity at point %d\n",i);
+            }
+            memcpy(end, prefix, prefix_length);
+            end += prefix_length;
+            end = DP_formatInt(end, x1[j]);
+            *end++ = ',';
+            end = DP_formatInt(end, x2[j]);
+            *end++ = ',';
+            end = DP_formatInt(end, x3[j]);
+            *end++ = '\n';
+            x1_prev = x1[j];
+            x2_prev = x2[j];
+            x3_prev = x3[j];
+        }
+        fwrite(text, 1, end - text, csv);
     }
 }
 
-void DP_writeCSV() {
+void DP_writeCSV(FILE* csv) {
     /** 
      * Write the data to the CSV file
      */
-    fclose(DP_CSV);
+    fclose(csv);
 }
 
-int DP_getReturnMapPoints(int* dst, int len, int* src, int num_samples) {
+int DP_openSweep(DP_SWEEP* sweep, char* filename) {
     /** 
-     * Get the points for a return map.
+     * Open a CSV file written by a sample sweep for reading
+     *
+     * Returns 0 on success
+     */
+    sweep->file = fopen(filename, "r");
+    sweep->pending = 0;
+    sweep->continuing = 0;
+    return sweep->file ? 0 : -1;
+}
+
+void DP_closeSweep(DP_SWEEP* sweep) {
+    /** 
+     * Close a sweep file
+     */
+    if(sweep->file) {
+        fclose(sweep->file);
+    }
+    sweep->file = 0;
+}
+
+static int DP_readSweepRow(DP_SWEEP* sweep, int* mdac_value, int* sample) {
+    /** 
+     * Read the next mdac,x1,x2,x3 row of a sweep file
+     *
+     * Returns 0 at the end of the file
+     */
+    char line[64];
+    
+    while(fgets(line, sizeof(line), sweep->file)) {
+        int values[4];
+        char* p = line;
+        int i;
+        for(i = 0; i < 4; i++) {
+            char* end;
+            values[i] = (int)strtol(p, &end, 10);
+            if(end == p) {
+                break;
+            }
+            p = (*end == ',') ? end + 1 : end;
+        }
+        if(i == 4) {
+            *mdac_value = values[0];
+            *sample = DP_pack(values[1], values[2], values[3]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int DP_readSweepTap(DP_SWEEP* sweep, int* dst, int len, int* mdac_value) {
+    /** 
+     * Read the samples for the next tap in a sweep file
+     *
+     * \param dst Buffer for the packed samples
+     * \param len Size of dst. Samples past this are skipped.
+     * \param mdac_value Set to the MDAC value of the tap
+     * \return The number of samples in the tap, 0 at the end of the file
      */
-    int* peaks = (int*)malloc(sizeof(int) * (num_samples / 20));
-    int num_peaks;
-    int i;
-    int max_points;
+    int count = 0;
+    int row_mdac, sample;
     
-    num_peaks = peaks_findPeaks(peaks, num_samples / 20, src, num_samples, 5);
+    if(!sweep->pending) {
+        if(!DP_readSweepRow(sweep, &sweep->pending_mdac, &sweep->pending_sample)) {
+            return 0;
+        }
+        sweep->pending = 1;
+    }
     
-    if ( len < num_peaks ) {
-        max_points = len;
-    } else {
-        max_points = num_peaks;
+    *mdac_value = sweep->pending_mdac;
+    sample = sweep->pending_sample;
+    sweep->pending = 0;
+    sweep->continuing = 0;
+    
+    for(;;) {
+        if(count < len) {
+            dst[count] = sample;
+        }
+        count++;
+        if(!DP_readSweepRow(sweep, &row_mdac, &sample)) {
+            break;
+        }
+        if(row_mdac != *mdac_value) {
+            sweep->pending = 1;
+            sweep->pending_mdac = row_mdac;
+            sweep->pending_sample = sample;
+            break;
+        }
     }
+    return count < len ? count : len;
+}
+
+int DP_readSweepBlock(DP_SWEEP* sweep, int* dst, int len, int* mdac_value, int* first) {
+    /** 
+     * Read the next samples of a sweep file, at most len of one tap
+     *
+     * A tap longer than len is returned over several calls, so taps of 
+     * any length can be streamed through a fixed buffer.
+     *
+     * \param mdac_value Set to the MDAC value of the tap
+     * \param first Set to 1 if the samples start a tap and 0 if they 
+     * continue the tap of the last call
+     * \return The number of samples read, 0 at the end of the file
+     */
+    int count = 0;
+    int row_mdac, sample;
     
-    for( i = 0 ; i < (max_points-2); i+=1 ) {
-        dst[i*3] = peaks[i];
-        dst[(i*3)+1] = peaks[i+1];
-        dst[(i*3)+2] = peaks[i+2];
+    if(!sweep->pending) {
+        if(!DP_readSweepRow(sweep, &sweep->pending_mdac, &sweep->pending_sample)) {
+            return 0;
+        }
+        sweep->pending = 1;
+    }
+    
+    *mdac_value = sweep->pending_mdac;
+    *first = !sweep->continuing;
+    sweep->continuing = 0;
+    
+    while(count < len) {
+        dst[count++] = sweep->pending_sample;
+        if(!DP_readSweepRow(sweep, &row_mdac, &sample)) {
+            sweep->pending = 0;
+            return count;
+        }
+        sweep->pending_mdac = row_mdac;
+        sweep->pending_sample = sample;
+        if(row_mdac != *mdac_value) {
+            return count;
+        }
+    }
+    // the tap goes on past dst
+    sweep->continuing = 1;
+    return count;
+}
+
+int DP_getReturnMapPoints(int* dst, int len, int* src, int num_samples) {
+    /** 
+     * Get the points for a return map.
+     *
+     * Each point is three consecutive peaks (x_n, x_n+1, x_n+2). At most
+     * len points are written to dst. Returns the number of points written.
+     */
+    RM_DETECTOR detector;
+    int history[2];
+    int num_peaks = 0;
+    int num_points = 0;
+    
+    RM_resetDetector(&detector);
+    
+    for(int i = 0; i < num_samples && num_points < len; i++) {
+        int peak = RM_detect(&detector, DP_getX1(src[i]));
+        if(peak < 0) {
+            continue;
+        }
+        if(num_peaks >= 2) {
+            dst[num_points*3] = history[0];
+            dst[(num_points*3)+1] = history[1];
+            dst[(num_points*3)+2] = peak;
+            num_points++;
+        }
+        history[0] = history[1];
+        history[1] = peak;
+        num_peaks++;
     }
 
-    return max_points - 3;
+    return num_points;
 }
 
 void DP_swap(float* a, float* b) {
@@ -122,13 +315,11 @@ void DP_FFT(int* in, float* out, unsigned int length) {
      * squaring the value) it also places the data on a log scale so 
      * that it is more useful.
      */
+    TRACE_SCOPE(TRACE_FFT);
     unsigned int i;
 
     // convert plot data to floats for FFT
-    for( i = 0; i < length; i++ ) {
-        out[i*2] = (float)(DP_getX1(in[i]));
-        out[(i*2)+1] = 0;
-    }
+    KN->fftInput(in, out, length);
     
     // perform the FFT
     DP_runFFT(out, length);
@@ -213,34 +404,27 @@ void DP_runFFT(float* data, unsigned long nn) {
     }
 }
 
-int DP_findTriggerIndex(int points_after_trigger) {
+int DP_findTriggerIndex(TR_TRIGGER* trigger, int* samples, int num_samples, 
+                        int points_after_trigger, TR_RESULT* result) {
     /** 
      * Set the trigger index
      *
      * This looks for the same location in the waveform as the previous
      * trigger and then sets this value in the library.
+     *
+     * Only the first num_samples - points_after_trigger samples are 
+     * searched so that a full trace follows the trigger. Returns 0 if the
+     * trigger did not fire. A phase trigger with auto_seed set then 
+     * picks a new target for the next frame.
      */
-    // find TRIGGER_INDEX
-    static int x1_trig = 0;
-    static int x2_trig = 0;
-    const int sensativity = 2;
-    int x1,x2,x3;
+    int end = num_samples - points_after_trigger;
+    int trigger_index = TR_find(trigger, samples, 1, end, result);
     
-    int trigger_index = 0;
-
-    for(int i = 0; i < libchaos_getNumPlotPoints()-points_after_trigger; i++) {
-        libchaos_getPlotPoint(&x1,&x2,&x3, i);
-        if(x1 < x1_trig + sensativity &&
-           x1 > x1_trig - sensativity &&
-           x2 < x2_trig + sensativity &&
-           x2 > x2_trig - sensativity) {
-            trigger_index = i;
-            break;
+    if(trigger_index < 0) {
+        if(trigger->mode == TR_PHASE && trigger->auto_seed) {
+            TR_seedPhase(trigger, samples, 0, end);
         }
-    }
-    if(trigger_index==0) {
-        x1_trig = x1;
-        x2_trig = x2;
+        return 0;
     }
     return trigger_index;
 }
@@ -12,17 +12,41 @@
 
 #include "libchaos.h"
 #include "peaks.h"
+#include "returnmap.h"
+#include "trigger.h"
 
-void DP_appendToCSV(int* src_data, int length, int mdac_value);
-int DP_newCSV(char* filename);
-void DP_writeCSV();
+// samples decoded and formatted at a time when writing CSV files
+#define DP_CSV_CHUNK 1024
+
+/**
+ * Reader for the CSV files written by a sample sweep
+ *
+ * continuing is set while DP_readSweepBlock has more of a tap to give.
+ */
+typedef struct {
+    FILE* file;
+    int pending;
+    int pending_mdac;
+    int pending_sample;
+    int continuing;
+} DP_SWEEP;
+
+void DP_appendToCSV(FILE* csv, int* src_data, int length, int mdac_value);
+int DP_newCSV(FILE** csv, char* filename);
+void DP_writeCSV(FILE* csv);
 int DP_getX1(int data_point);
 int DP_getX2(int data_point);
 int DP_getX3(int data_point);
+int DP_pack(int x1, int x2, int x3);
+int DP_openSweep(DP_SWEEP* sweep, char* filename);
+void DP_closeSweep(DP_SWEEP* sweep);
+int DP_readSweepTap(DP_SWEEP* sweep, int* dst, int len, int* mdac_value);
+int DP_readSweepBlock(DP_SWEEP* sweep, int* dst, int len, int* mdac_value, int* first);
 int DP_getReturnMapPoints(int* dst, int len, int* src, int num_samples);
 void DP_swap(float* a, float* b);
 void DP_FFT(int* in, float* out, unsigned int length);
 void DP_runFFT(float* data, unsigned long nn);
-int DP_findTriggerIndex(int points_after_trigger);
+int DP_findTriggerIndex(TR_TRIGGER* trigger, int* samples, int num_samples, 
+                        int points_after_trigger, TR_RESULT* result);
 
 #endif
@@ -0,0 +1,584 @@
+/**
+ * \file default_context.cpp
+ * \brief The context used by the libchaos_ functions without one
+ *
+ * Each function here forwards to its libchaos_ctx_ version, or fails
+ * with -1, 0 or false if the default context could not be made.
+ */
+
+#include "libchaos.h"
+#include "threads.h"
+
+libchaos_context* volatile DEFAULT_CONTEXT = 0;
+
+/**
+ * Set ctx to the default context, or return fail if it could not be made
+ */
+#define DEFAULT_CONTEXT_OR(fail) \
+    libchaos_context* ctx = libchaos_default(); \
+    if(!ctx) { \
+        return fail; \
+    }
+
+libchaos_context* libchaos_default() {
+    /** 
+     * Get the context used by the functions without one
+     *
+     * It is created on first use and connects to the first unit found.
+     * Threads racing to create it each build one and the first to publish
+     * it wins, the others destroy theirs, so nothing is built under a 
+     * lock. Returns 0 if there is no memory for it.
+     */
+    libchaos_context* ctx = (libchaos_context*)TH_loadPointer((void* volatile*)&DEFAULT_CONTEXT);
+    if(!ctx) {
+        libchaos_context* created = libchaos_create();
+        if(!created) {
+            return 0;
+        }
+        if(TH_compareAndSwapPointer((void* volatile*)&DEFAULT_CONTEXT, 0, created)) {
+            ctx = created;
+        } else {
+            libchaos_destroy(created);
+            ctx = (libchaos_context*)TH_loadPointer((void* volatile*)&DEFAULT_CONTEXT);
+        }
+    }
+    return ctx;
+}
+
+/* Forwarding */
+
+int libchaos_init() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_init(ctx);
+}
+
+int libchaos_connect() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_connect(ctx);
+}
+
+bool libchaos_isConnected() {
+    DEFAULT_CONTEXT_OR(false);
+    return libchaos_ctx_isConnected(ctx);
+}
+
+int libchaos_reconnect() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_reconnect(ctx);
+}
+
+int libchaos_close() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_close(ctx);
+}
+
+int libchaos_testDevice() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_testDevice(ctx);
+}
+
+int libchaos_startRecording(const char* filename) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_startRecording(ctx, filename);
+}
+
+int libchaos_stopRecording() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_stopRecording(ctx);
+}
+
+int libchaos_startReplay(const char* filename, int flags) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_startReplay(ctx, filename, flags);
+}
+
+int libchaos_stopReplay() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_stopReplay(ctx);
+}
+
+int libchaos_startSimulation(double speed, double drop_rate, unsigned int seed) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_startSimulation(ctx, speed, drop_rate, seed);
+}
+
+int libchaos_stopSimulation() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_stopSimulation(ctx);
+}
+
+int libchaos_startCapture(const char* filename, int mdac_value, long long num_samples) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_startCapture(ctx, filename, mdac_value, num_samples);
+}
+
+int libchaos_stopCapture() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_stopCapture(ctx);
+}
+
+int libchaos_isCapturing() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_isCapturing(ctx);
+}
+
+int libchaos_getCaptureStats(long long* num_samples, long long* bytes_written, 
+                             long long* num_gaps, long long* missing_packets) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getCaptureStats(ctx, num_samples, bytes_written, 
+                                        num_gaps, missing_packets);
+}
+
+int libchaos_startSampleToCSV(char* filename, int start, int end, int step, int periods) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_startSampleToCSV(ctx, filename, start, 
+                                         end, step, periods);
+}
+
+int libchaos_samplePartToCSV() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_samplePartToCSV(ctx);
+}
+
+int libchaos_endSampleToCSV() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_endSampleToCSV(ctx);
+}
+
+int libchaos_sampleToCSV(char* filename, int start, int end, int step, int periods) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_sampleToCSV(ctx, filename, start, end, 
+                                    step, periods);
+}
+
+int libchaos_getMDACValue() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getMDACValue(ctx);
+}
+
+int libchaos_setMDACValue(int tap) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setMDACValue(ctx, tap);
+}
+
+int libchaos_readPlot(int mdac_value) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_readPlot(ctx, mdac_value);
+}
+
+int libchaos_getPlotPoint(int* x1, int*x2, int* x3, int index) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getPlotPoint(ctx, x1, x2, x3, index);
+}
+
+int libchaos_getNumPlotPoints() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getNumPlotPoints(ctx);
+}
+
+int libchaos_setNumPlotPoints(int num) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setNumPlotPoints(ctx, num);
+}
+
+int libchaos_getPlotStatistics(int channel, int* min, int* max, float* mean, 
+                               float* deviation) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getPlotStatistics(ctx, channel, min, max, mean, 
+                                          deviation);
+}
+
+int libchaos_startPublishing(const char* name, int num_slots, int slot_samples) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_startPublishing(ctx, name, num_slots, slot_samples);
+}
+
+void libchaos_stopPublishing() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_stopPublishing(ctx);
+}
+
+int libchaos_startServer(const char* address, int queue_length, int policy) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_startServer(ctx, address, queue_length, policy);
+}
+
+void libchaos_stopServer() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_stopServer(ctx);
+}
+
+int libchaos_getServerStats(int* clients, long long* messages, long long* dropped, 
+                            long long* disconnected) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getServerStats(ctx, clients, messages, dropped, 
+                                       disconnected);
+}
+
+int libchaos_scanBifurcation(int num_taps) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_scanBifurcation(ctx, num_taps);
+}
+
+int libchaos_setScanFocus(int first, int last) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setScanFocus(ctx, first, last);
+}
+
+int libchaos_getTriggerIndex() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getTriggerIndex(ctx);
+}
+
+int libchaos_getTriggerQuality() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getTriggerQuality(ctx);
+}
+
+int libchaos_setLevelTrigger(int channel, int level, int edge, int hysteresis) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setLevelTrigger(ctx, channel, level, edge, 
+                                        hysteresis);
+}
+
+int libchaos_setPhaseTrigger(int x1, int x2, int x3, int radius) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setPhaseTrigger(ctx, x1, x2, x3, radius);
+}
+
+int libchaos_setTransientData(int amount) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setTransientData(ctx, amount);
+}
+
+int libchaos_enableTriggeredAcquisition(int pre_trigger) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_enableTriggeredAcquisition(ctx, pre_trigger);
+}
+
+void libchaos_disableTriggeredAcquisition() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_disableTriggeredAcquisition(ctx);
+}
+
+int libchaos_getAcquisitionStats(long long* frames, long long* timeouts, long long* gaps) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getAcquisitionStats(ctx, frames, timeouts, gaps);
+}
+
+libchaos_request* libchaos_readPlotAsync(int mdac_value, libchaos_callback callback, 
+                                         void* user) {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_readPlotAsync(ctx, mdac_value, callback, user);
+}
+
+libchaos_request* libchaos_getPeaksAsync(int mdac_value, libchaos_callback callback, 
+                                         void* user) {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getPeaksAsync(ctx, mdac_value, callback, user);
+}
+
+libchaos_request* libchaos_sweepAsync(char* filename, int start, int end, int step, 
+                                      int periods, libchaos_callback callback, void* user) {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_sweepAsync(ctx, filename, start, end, step, periods, 
+                                   callback, user);
+}
+
+libchaos_request* libchaos_scanBifurcationAsync(libchaos_callback callback, void* user) {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_scanBifurcationAsync(ctx, callback, user);
+}
+
+int libchaos_addStage(int stream, const char* name, libchaos_stage_function function, 
+                      void* user, int queue_length, int policy) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_addStage(ctx, stream, name, function, user, 
+                                 queue_length, policy);
+}
+
+int libchaos_removeStage(int stage) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_removeStage(ctx, stage);
+}
+
+int libchaos_findStage(int stream, const char* name) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_findStage(ctx, stream, name);
+}
+
+int libchaos_getStageStats(int stage, long long* blocks, long long* dropped, 
+                           double* busy_time, double* max_time, double* wait_time) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getStageStats(ctx, stage, blocks, dropped, 
+                                      busy_time, max_time, wait_time);
+}
+
+const libchaos_frame* libchaos_acquireFrame() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_acquireFrame(ctx);
+}
+
+int* libchaos_getPeaks(int mdac_value) {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getPeaks(ctx, mdac_value);
+}
+
+bool libchaos_peaksCacheHit(int mdac_value) {
+    DEFAULT_CONTEXT_OR(false);
+    return libchaos_ctx_peaksCacheHit(ctx, mdac_value);
+}
+
+int libchaos_setPeaksPerMDAC(int peaks_per_mdac) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setPeaksPerMDAC(ctx, peaks_per_mdac);
+}
+
+unsigned char* libchaos_getBifurcationImage(int level, int* width, int* height) {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getBifurcationImage(ctx, level, width, height);
+}
+
+unsigned int* libchaos_getBifurcationCounts(int level, int* width, int* height) {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getBifurcationCounts(ctx, level, width, height);
+}
+
+int libchaos_getNumBifurcationLevels() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getNumBifurcationLevels(ctx);
+}
+
+int libchaos_setBifurcationResolution(int amplitude_bins) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setBifurcationResolution(ctx, amplitude_bins);
+}
+
+int libchaos_getReturnMap1Point(int* x1, int* x2, int index) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getReturnMap1Point(ctx, x1, x2, index);
+}
+
+int libchaos_getReturnMap2Point(int* x1, int* x2, int index) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getReturnMap2Point(ctx, x1, x2, index);
+}
+
+int libchaos_getReturnMapPoint(int* xn, int* xnk, int index, int order) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getReturnMapPoint(ctx, xn, xnk, index, order);
+}
+
+int libchaos_getNumReturnMapPoints() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getNumReturnMapPoints(ctx);
+}
+
+int libchaos_getNumReturnMapPointsOfOrder(int order) {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getNumReturnMapPointsOfOrder(ctx, order);
+}
+
+int libchaos_getNumReturnMapPeaks() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getNumReturnMapPeaks(ctx);
+}
+
+int libchaos_setReturnMapCapacity(int num_peaks) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setReturnMapCapacity(ctx, num_peaks);
+}
+
+void libchaos_refreshReturnMapPoints() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_refreshReturnMapPoints(ctx);
+}
+
+int libchaos_setPoincareSection(float a, float b, float c, float d, 
+                                int direction, int interpolation) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setPoincareSection(ctx, a, b, c, d, 
+                                           direction, interpolation);
+}
+
+int libchaos_setPoincareCapacity(int num_points) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setPoincareCapacity(ctx, num_points);
+}
+
+void libchaos_clearPoincarePoints() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_clearPoincarePoints(ctx);
+}
+
+int libchaos_getNumPoincarePoints() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getNumPoincarePoints(ctx);
+}
+
+int libchaos_getPoincarePoint(float* x1, float* x2, float* x3, int index) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getPoincarePoint(ctx, x1, x2, x3, index);
+}
+
+int libchaos_poincareSweep(char* filename, int mdac_value) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_poincareSweep(ctx, filename, mdac_value);
+}
+
+int libchaos_enableVoxels(int resolution, float decay) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_enableVoxels(ctx, resolution, decay);
+}
+
+void libchaos_disableVoxels() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_disableVoxels(ctx);
+}
+
+unsigned int libchaos_getVoxelGeneration() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getVoxelGeneration(ctx);
+}
+
+int libchaos_getChangedVoxelBricks(unsigned int since, int* bricks, int max_bricks) {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getChangedVoxelBricks(ctx, since, bricks, 
+                                              max_bricks);
+}
+
+float* libchaos_getVoxelBrick(int brick, int* bx, int* by, int* bz) {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getVoxelBrick(ctx, brick, bx, by, bz);
+}
+
+int libchaos_enableHistory(int raw_samples, int bins_per_level) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_enableHistory(ctx, raw_samples, bins_per_level);
+}
+
+void libchaos_disableHistory() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_disableHistory(ctx);
+}
+
+long long libchaos_getHistoryLength() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getHistoryLength(ctx);
+}
+
+int libchaos_getHistoryWindow(int channel, long long start, long long end, 
+                              int pixels, int* min, int* max) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getHistoryWindow(ctx, channel, start, end, 
+                                         pixels, min, max);
+}
+
+int libchaos_loadHistorySweep(char* filename, int mdac_value) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_loadHistorySweep(ctx, filename, mdac_value);
+}
+
+int libchaos_enableSpectrogram(int stream, int size, int hop, int window, int num_rows) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_enableSpectrogram(ctx, stream, size, hop, window, 
+                                          num_rows);
+}
+
+void libchaos_disableSpectrogram() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_disableSpectrogram(ctx);
+}
+
+int libchaos_setSpectrogramRange(float min_db, float max_db) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_setSpectrogramRange(ctx, min_db, max_db);
+}
+
+int libchaos_addSpectrogramSamples(int* samples, int num_samples, int mdac_value) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_addSpectrogramSamples(ctx, samples, num_samples, 
+                                              mdac_value);
+}
+
+long long libchaos_getSpectrogramRows() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getSpectrogramRows(ctx);
+}
+
+int libchaos_getSpectrogramBins() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getSpectrogramBins(ctx);
+}
+
+int libchaos_getSpectrogram(long long first, int num_rows, float* power, int* mdac_values) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getSpectrogram(ctx, first, num_rows, power, 
+                                       mdac_values);
+}
+
+int libchaos_getSpectrogramImage(long long first, int num_rows, unsigned char* image, 
+                                 int* mdac_values) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getSpectrogramImage(ctx, first, num_rows, image, 
+                                            mdac_values);
+}
+
+int libchaos_classifySweep(char* filename) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_classifySweep(ctx, filename);
+}
+
+void libchaos_enableClassification() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_enableClassification(ctx);
+}
+
+void libchaos_disableClassification() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_disableClassification(ctx);
+}
+
+int libchaos_getNumClassifiedTaps() {
+    DEFAULT_CONTEXT_OR(0);
+    return libchaos_ctx_getNumClassifiedTaps(ctx);
+}
+
+int libchaos_getTapClass(int index, int* mdac_value, int* type, int* period, 
+                         float* frequency, float* peak_spread) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getTapClass(ctx, index, mdac_value, type, period, 
+                                    frequency, peak_spread);
+}
+
+int libchaos_writeClassification(const char* filename) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_writeClassification(ctx, filename);
+}
+
+void libchaos_getFFTPlotPoint(float* val, int index) {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_getFFTPlotPoint(ctx, val, index);
+}
+
+void libchaos_enableFFT() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_enableFFT(ctx);
+}
+
+void libchaos_disableFFT() {
+    DEFAULT_CONTEXT_OR();
+    libchaos_ctx_disableFFT(ctx);
+}
+
+int libchaos_characterize(int mdac_value, int num_samples, float* lyapunov, 
+                          float* dimension) {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_characterize(ctx, mdac_value, num_samples, 
+                                     lyapunov, dimension);
+}
+
+int libchaos_getFirmwareVersion() {
+    DEFAULT_CONTEXT_OR(-1);
+    return libchaos_ctx_getFirmwareVersion(ctx);
+}
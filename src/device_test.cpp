@@ -4,14 +4,16 @@
  */
 
 #include "device_test.h"
+#include "log.h"
 
-int DT_testDevice() {
+int DT_testDevice(UC_DEVICE* dev, int tries) {
     /** 
      * Run the device self tests
+     *
+     * \param tries Number of retries already made after a reset
      */
     char buf[64];
     int bytes_read;
-    static int tries = 0;
     const int max_tries = 5;
     
     for(int i = 0; i < 8; i++) {
@@ -22,74 +24,69 @@ int DT_testDevice() {
     buf[0] = CMD_ping;
     buf[1] = 64;
         
-    fprintf(DEBUG_FILE,"Write test...");
-    if(UC_write(buf,8) != 8) {
-        fprintf(DEBUG_FILE,"\nTest write failed\n");
-        if(UC_reset()) {
+    LOG(LOG_INFO, "Write test...");
+    if(UC_write(dev, buf,8) != 8) {
+        LOG(LOG_ERROR, "\nTest write failed\n");
+        if(UC_reset(dev)) {
             return -1;
         } else {
             if( tries < max_tries ) {
-                tries++;
-                return(DT_testDevice());
+                return(DT_testDevice(dev, tries + 1));
             }
         }
     }
-    fprintf(DEBUG_FILE,"Success\n");
+    LOG(LOG_INFO, "Success\n");
 
-    fprintf(DEBUG_FILE,"Read test...");
-    if((bytes_read = UC_read(buf,64)) != 64) {
-        fprintf(DEBUG_FILE,"\nTest read failed. Read %d bytes.\n",bytes_read);
-        if(UC_reset()) {
+    LOG(LOG_INFO, "Read test...");
+    if((bytes_read = UC_read(dev, buf,64)) != 64) {
+        LOG(LOG_ERROR, "\nTest read failed. Read %d bytes.\n",bytes_read);
+        if(UC_reset(dev)) {
             return -1;
         } else {
             if( tries < max_tries ) {
-                tries++;
-                return(DT_testDevice());
+                return(DT_testDevice(dev, tries + 1));
             }
         }
     }
     if(buf[0] != 0x55) {
-        fprintf(DEBUG_FILE,"\nIncorrect value in test response: %x\n",buf[0]);
-        if(UC_reset()) {
+        LOG(LOG_ERROR, "\nIncorrect value in test response: %x\n",buf[0]);
+        if(UC_reset(dev)) {
             return -1;
         } else {
             if( tries < max_tries ) {
-                tries++;
-                return(DT_testDevice());
+                return(DT_testDevice(dev, tries + 1));
             }
         }
     }
-    fprintf(DEBUG_FILE,"Success\n");
+    LOG(LOG_INFO, "Success\n");
     
     /* LED test */
     buf[0] = CMD_LED_test;
         
-    fprintf(DEBUG_FILE,"Flashing LEDs...");
-    if(UC_write(buf,8) != 8) {
-        fprintf(DEBUG_FILE,"\nWrite failed\n");
-        if(UC_reset()) {
+    LOG(LOG_INFO, "Flashing LEDs...");
+    if(UC_write(dev, buf,8) != 8) {
+        LOG(LOG_ERROR, "\nWrite failed\n");
+        if(UC_reset(dev)) {
             return -1;
         } else {
             if( tries < max_tries ) {
-                tries++;
-                return(DT_testDevice());
+                return(DT_testDevice(dev, tries + 1));
             }
         }
     }
 
-    bytes_read = UC_read(buf,1);
+    bytes_read = UC_read(dev, buf,1);
     if(bytes_read != 1) {
-        fprintf(DEBUG_FILE,"\nRead failed. Read %d bytes.\n",bytes_read);
-        if(UC_reset()) {
+        LOG(LOG_ERROR, "\nRead failed. Read %d bytes.\n",bytes_read);
+        if(UC_reset(dev)) {
             return -1;
         } else {
             if( tries < max_tries ) {
-                tries++;
-                return(DT_testDevice());
+                return(DT_testDevice(dev, tries + 1));
             }
         }
     }
-    fprintf(DEBUG_FILE,"Complete\n");
+    LOG(LOG_INFO, "Complete\n");
     
     return 0;
 }
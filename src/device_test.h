@@ -9,6 +9,6 @@
 #include "libchaos.h"
 #include "usb_comm.h"
 
-int DT_testDevice();
+int DT_testDevice(UC_DEVICE* dev, int tries = 0);
 
 #endif
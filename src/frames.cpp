@@ -0,0 +1,151 @@
+/**
+ * \file frames.cpp
+ * \brief Routines for handing plot frames to other threads without locks
+ */
+
+#include "frames.h"
+#include "bufpool.h"
+
+FR_FRAME* FR_newFrame() {
+    /** 
+     * Allocate an empty frame
+     */
+    return (FR_FRAME*)BP_calloc(1, sizeof(FR_FRAME));
+}
+
+int FR_init(FR_POOL* pool, int num_frames) {
+    /** 
+     * Allocate the frames of a pool
+     *
+     * \param num_frames Frames allocated up front. Three is enough for
+     * one reader to hold a frame while the next is published. More are
+     * allocated, up to FR_MAX_FRAMES, when readers hold on to frames.
+     *
+     * pool must be zeroed or freed.
+     */
+    if(num_frames < 2 || num_frames > FR_MAX_FRAMES) {
+        return -1;
+    }
+    for(int i = 0; i < num_frames; i++) {
+        pool->frames[i] = FR_newFrame();
+        if(!pool->frames[i]) {
+            FR_free(pool);
+            return -1;
+        }
+        pool->num_frames++;
+    }
+    return 0;
+}
+
+void FR_free(FR_POOL* pool) {
+    /** 
+     * Free every frame of a pool
+     *
+     * No reader may hold a frame.
+     */
+    for(int i = 0; i < pool->num_frames; i++) {
+        RM_free(&pool->frames[i]->return_map);
+        BP_free(pool->frames[i]);
+    }
+    memset(pool, 0, sizeof(FR_POOL));
+}
+
+FR_FRAME* FR_begin(FR_POOL* pool) {
+    /** 
+     * Get a frame to fill in
+     *
+     * \return A frame no reader holds, or 0 if every frame is held. The
+     * producer never waits for a reader, a frame is dropped instead.
+     */
+    for(int i = 0; i < pool->num_frames; i++) {
+        // a reader may briefly hold a reference to a frame it finds is
+        // no longer published, so claim the frame atomically
+        if(TH_compareAndSwap(&pool->frames[i]->refs, 0, 1)) {
+            pool->frames[i]->pool = pool;
+            pool->frames[i]->products = 0;
+            return pool->frames[i];
+        }
+    }
+    if(pool->num_frames < FR_MAX_FRAMES) {
+        FR_FRAME* frame = FR_newFrame();
+        if(frame) {
+            frame->refs = 1;
+            frame->pool = pool;
+            pool->frames[pool->num_frames++] = frame;
+            return frame;
+        }
+    }
+    return 0;
+}
+
+void FR_publish(FR_POOL* pool, FR_FRAME* frame) {
+    /** 
+     * Make a frame from FR_begin the current one
+     *
+     * The pool keeps the reference taken by FR_begin until the next 
+     * frame replaces this one.
+     */
+    frame->sequence = ++pool->sequence;
+    FR_FRAME* old = (FR_FRAME*)TH_exchangePointer((void* volatile*)&pool->published, frame);
+    if(old) {
+        FR_release(old);
+    }
+}
+
+FR_FRAME* FR_acquire(FR_POOL* pool) {
+    /** 
+     * Take a reference to the current frame
+     *
+     * \return The frame, or 0 if none has been published. It stays 
+     * unchanged until FR_release.
+     *
+     * Safe to call from any thread at the same time as FR_publish.
+     */
+    for(;;) {
+        FR_FRAME* frame = (FR_FRAME*)TH_loadPointer((void* volatile*)&pool->published);
+        if(!frame) {
+            return 0;
+        }
+        TH_atomicAdd(&frame->refs, 1);
+        // the frame may have been replaced and claimed for writing 
+        // before the reference was taken
+        if(TH_loadPointer((void* volatile*)&pool->published) == frame) {
+            return frame;
+        }
+        FR_release(frame);
+    }
+}
+
+void FR_release(FR_FRAME* frame) {
+    /** 
+     * Drop a reference taken by FR_acquire
+     */
+    TH_atomicAdd(&frame->refs, -1);
+}
+
+bool FR_use(FR_FRAME* frame, int product) {
+    /** 
+     * Note a read of a derived product of a frame
+     *
+     * Products read are carried by the following frames until they are
+     * left unread for FR_IDLE_FRAMES frames.
+     *
+     * \return Whether the frame carries the product
+     */
+    // sequences start at 1, 0 means never read
+    int read = (int)frame->sequence;
+    if(TH_atomicLoad(&frame->pool->wanted[product]) != read) {
+        TH_atomicStore(&frame->pool->wanted[product], read);
+    }
+    return (frame->products & (1 << product)) != 0;
+}
+
+bool FR_wanted(FR_POOL* pool, int product) {
+    /** 
+     * Check whether readers took a product from a frame lately
+     *
+     * Called by the producer before publishing the next frame.
+     */
+    unsigned int read = (unsigned int)TH_atomicLoad(&pool->wanted[product]);
+    return read && pool->sequence - read < FR_IDLE_FRAMES;
+}
@@ -0,0 +1,89 @@
+/**
+ * \file frames.h
+ * \brief Header file for frames.cpp
+ */
+
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "returnmap.h"
+#include "threads.h"
+
+#define NUM_FFT_PLOT_POINTS 8192
+#define MAX_PLOT_POINTS 8192
+
+#define FR_POOL_SIZE 3
+#define FR_MAX_FRAMES 16
+
+/* derived products of a frame, bit (1 << product) of a frame's products */
+#define FR_TRIGGER 0
+#define FR_FFT 1
+#define FR_RETURN_MAP 2
+#define FR_STATISTICS 3
+#define FR_NUM_PRODUCTS 4
+// frames a product is still worked out for after it was last read
+#define FR_IDLE_FRAMES 20
+
+struct FR_POOL;
+
+/**
+ * Range and spread of each channel of a plot, x1 to x3
+ */
+typedef struct {
+    int min[3];
+    int max[3];
+    float mean[3];
+    float deviation[3];
+} FR_STATS;
+
+/**
+ * One published plot frame
+ *
+ * A frame is not changed while it is published or held by a reader. 
+ * refs counts the readers plus one for the pool while it is published 
+ * or being written. products has a bit for each derived product the 
+ * frame carries, the others were not being read when it was published.
+ */
+struct libchaos_frame {
+    volatile int refs;
+    struct FR_POOL* pool;
+    unsigned int sequence;
+    int products;
+    int mdac;
+    int num_points;
+    int plot_data[MAX_PLOT_POINTS];
+    float fft_data[NUM_FFT_PLOT_POINTS*2];
+    int trigger_index;
+    int trigger_quality;
+    RM_BUILDER return_map;
+    FR_STATS statistics;
+};
+typedef struct libchaos_frame FR_FRAME;
+
+/**
+ * Frames written by one producer and read by any number of threads
+ *
+ * Only the producer touches frames and num_frames. Readers only follow 
+ * published, and store the sequence of the frame they read a product of
+ * in wanted.
+ */
+typedef struct FR_POOL {
+    FR_FRAME* frames[FR_MAX_FRAMES];
+    int num_frames;
+    FR_FRAME* volatile published;
+    unsigned int sequence;
+    volatile int wanted[FR_NUM_PRODUCTS];
+} FR_POOL;
+
+int FR_init(FR_POOL* pool, int num_frames = FR_POOL_SIZE);
+void FR_free(FR_POOL* pool);
+FR_FRAME* FR_begin(FR_POOL* pool);
+void FR_publish(FR_POOL* pool, FR_FRAME* frame);
+FR_FRAME* FR_acquire(FR_POOL* pool);
+void FR_release(FR_FRAME* frame);
+bool FR_use(FR_FRAME* frame, int product);
+bool FR_wanted(FR_POOL* pool, int product);
+
+#endif
@@ -0,0 +1,391 @@
+/**
+ * \file kernels.cpp
+ * \brief The hot routines, built for several instruction sets
+ *
+ * Each routine is written once and built for each instruction set with
+ * target attributes, so one library uses the widest vectors of the
+ * machine it runs on. KN points to the set in use. It starts as the
+ * generic set and is chosen by KN_init when the first context is
+ * initialized.
+ *
+ * The peak search keeps the state machine of peaks_findPeaks but tests a
+ * whole vector of samples at once. A running maximum (or minimum) across
+ * the vector shows whether any sample in it ends the current peak, and
+ * only then is the vector looked at sample by sample.
+ *
+ * The AVX-512 set takes the AVX2 decode and FFT input conversion. Built
+ * for AVX-512 they were slower than with AVX2, and only the peak search
+ * gains from the wider vectors.
+ */
+
+#include "kernels.h"
+#include "threads.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KN_X86 1
+#endif
+
+#define KN_INLINE static inline __attribute__((always_inline))
+
+KN_INLINE int KN_x1(const int* samples, int i) {
+    return (int)(((unsigned int)samples[i] >> 2) & 0x3FF);
+}
+
+KN_INLINE void KN_decodeBody(const int* samples, short* x1, short* x2, short* x3,
+                             int num_samples) {
+    /**
+     * Split packed samples into their channels
+     */
+    const unsigned int* in = (const unsigned int*)samples;
+    for(int i = 0; i < num_samples; i++) {
+        x1[i] = (short)((in[i] >> 2) & 0x3FF);
+        x2[i] = (short)((in[i] >> 12) & 0x3FF);
+        x3[i] = (short)(in[i] >> 22);
+    }
+}
+
+KN_INLINE void KN_fftInputBody(const int* samples, float* out, int num_samples) {
+    /**
+     * Make the complex FFT input from x1, imaginary parts are 0
+     */
+    const unsigned int* in = (const unsigned int*)samples;
+    for(int i = 0; i < num_samples; i++) {
+        out[i*2] = (float)((in[i] >> 2) & 0x3FF);
+        out[i*2 + 1] = 0;
+    }
+}
+
+/**
+ * The state of the peak search, as in peaks_findPeaks
+ */
+typedef struct {
+    int count;
+    int max;
+    int min;
+    int look_for_max;
+} KN_PEAKS;
+
+KN_INLINE int KN_findPeaksScalar(KN_PEAKS* state, int* dst, int len, const int* samples,
+                                 int start, int num_samples, int delta) {
+    /**
+     * The peak search one sample at a time from start
+     *
+     * Returns 1 once len peaks have been found.
+     */
+    for(int i = start; i < num_samples; i++) {
+        int current = KN_x1(samples, i);
+        if(current > state->max) {
+            state->max = current;
+        }
+        if(current < state->min) {
+            state->min = current;
+        }
+        if(state->look_for_max) {
+            if(current < state->max - delta) {
+                dst[state->count++] = state->max;
+                if(state->count >= len) {
+                    return 1;
+                }
+                state->min = current;
+                state->look_for_max = 0;
+            }
+        } else if(current > state->min + delta) {
+            state->max = current;
+            state->look_for_max = 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Vectors of W ints, the attribute cannot depend on a template argument
+ *
+ * shift(out, v, fill, k) moves the lanes of v up by k, filling from fill.
+ * Vectors are passed by pointer, these are only used inlined.
+ */
+template<int W> struct KN_VECTOR;
+
+template<> struct KN_VECTOR<8> {
+    typedef int V __attribute__((vector_size(32)));
+    typedef unsigned int U __attribute__((vector_size(32)));
+    KN_INLINE void shift(V* out, const V* v, const V* fill, int k) {
+        if(k == 1) {
+            *out = __builtin_shuffle(*v, *fill, (V){8, 0, 1, 2, 3, 4, 5, 6});
+        } else if(k == 2) {
+            *out = __builtin_shuffle(*v, *fill, (V){8, 9, 0, 1, 2, 3, 4, 5});
+        } else {
+            *out = __builtin_shuffle(*v, *fill, (V){8, 9, 10, 11, 0, 1, 2, 3});
+        }
+    }
+};
+
+template<> struct KN_VECTOR<16> {
+    typedef int V __attribute__((vector_size(64)));
+    typedef unsigned int U __attribute__((vector_size(64)));
+    KN_INLINE void shift(V* out, const V* v, const V* fill, int k) {
+        if(k == 1) {
+            *out = __builtin_shuffle(*v, *fill, (V){16, 0, 1, 2, 3, 4, 5, 6,
+                                                    7, 8, 9, 10, 11, 12, 13, 14});
+        } else if(k == 2) {
+            *out = __builtin_shuffle(*v, *fill, (V){16, 17, 0, 1, 2, 3, 4, 5,
+                                                    6, 7, 8, 9, 10, 11, 12, 13});
+        } else if(k == 4) {
+            *out = __builtin_shuffle(*v, *fill, (V){16, 17, 18, 19, 0, 1, 2, 3,
+                                                    4, 5, 6, 7, 8, 9, 10, 11});
+        } else {
+            *out = __builtin_shuffle(*v, *fill, (V){16, 17, 18, 19, 20, 21, 22, 23,
+                                                    0, 1, 2, 3, 4, 5, 6, 7});
+        }
+    }
+};
+
+template<int W>
+KN_INLINE int KN_findPeaksBody(int* dst, int len, const int* samples, int num_samples,
+                               int delta) {
+    /**
+     * The peak search W samples at a time
+     *
+     * In the vector the running maximum P of the samples so far,
+     * starting from the maximum carried in, is built in log2(W) shifts.
+     * A sample below P - delta ends the peak at P. Finding a minimum is
+     * the same with the comparisons turned round.
+     */
+    typedef typename KN_VECTOR<W>::V V;
+    typedef typename KN_VECTOR<W>::U U;
+    KN_PEAKS state = {0, -1, 2000, 0};
+    int i = 0;
+
+    while(i + W <= num_samples) {
+        U packed;
+        memcpy(&packed, samples + i, sizeof(U));
+        V x = (V)((packed >> 2) & 0x3FF);
+        V running;
+        V hits;
+        if(state.look_for_max) {
+            V fill = x*0 + state.max;
+            running = x > fill ? x : fill;
+            for(int k = 1; k < W; k <<= 1) {
+                V shifted;
+                KN_VECTOR<W>::shift(&shifted, &running, &fill, k);
+                running = running > shifted ? running : shifted;
+            }
+            hits = x < running - delta;
+        } else {
+            V fill = x*0 + state.min;
+            running = x < fill ? x : fill;
+            for(int k = 1; k < W; k <<= 1) {
+                V shifted;
+                KN_VECTOR<W>::shift(&shifted, &running, &fill, k);
+                running = running < shifted ? running : shifted;
+            }
+            hits = x > running + delta;
+        }
+
+        long long any[W/2];
+        memcpy(any, &hits, sizeof(V));
+        long long mask = 0;
+        for(int k = 0; k < W/2; k++) {
+            mask |= any[k];
+        }
+        if(!mask) {
+            if(state.look_for_max) {
+                state.max = running[W - 1];
+            } else {
+                state.min = running[W - 1];
+            }
+            i += W;
+            continue;
+        }
+
+        int lane = 0;
+        while(!hits[lane]) {
+            lane++;
+        }
+        if(state.look_for_max) {
+            dst[state.count++] = running[lane];
+            if(state.count >= len) {
+                return state.count;
+            }
+            state.min = x[lane];
+            state.look_for_max = 0;
+        } else {
+            state.max = x[lane];
+            state.look_for_max = 1;
+        }
+        i += lane + 1;
+    }
+    KN_findPeaksScalar(&state, dst, len, samples, i, num_samples, delta);
+    return state.count;
+}
+
+/* the generic set */
+
+static void KN_decodeGeneric(const int* samples, short* x1, short* x2, short* x3,
+                             int num_samples) {
+    KN_decodeBody(samples, x1, x2, x3, num_samples);
+}
+
+static void KN_fftInputGeneric(const int* samples, float* out, int num_samples) {
+    KN_fftInputBody(samples, out, num_samples);
+}
+
+static int KN_findPeaksGeneric(int* dst, int len, const int* samples, int num_samples,
+                               int delta) {
+    KN_PEAKS state = {0, -1, 2000, 0};
+    KN_findPeaksScalar(&state, dst, len, samples, 0, num_samples, delta);
+    return state.count;
+}
+
+static const KN_KERNELS KN_GENERIC_KERNELS = {
+    KN_GENERIC, "generic", KN_decodeGeneric, KN_fftInputGeneric, KN_findPeaksGeneric
+};
+
+#ifdef KN_X86
+
+/* one set for each instruction set, the same code built for each */
+#define KN_VARIANT(suffix, isa) \
+    __attribute__((target(isa))) \
+    static void KN_decode##suffix(const int* samples, short* x1, short* x2, short* x3, \
+                                  int num_samples) { \
+        KN_decodeBody(samples, x1, x2, x3, num_samples); \
+    } \
+    __attribute__((target(isa))) \
+    static void KN_fftInput##suffix(const int* samples, float* out, int num_samples) { \
+        KN_fftInputBody(samples, out, num_samples); \
+    }
+
+#define KN_PEAKS_VARIANT(suffix, isa, width) \
+    __attribute__((target(isa))) \
+    static int KN_findPeaks##suffix(int* dst, int len, const int* samples, \
+                                    int num_samples, int delta) { \
+        return KN_findPeaksBody<width>(dst, len, samples, num_samples, delta); \
+    }
+
+KN_VARIANT(SSE2, "sse2")
+KN_VARIANT(AVX2, "avx2")
+// without a packed 32 bit max, SSE2 is slower than one sample at a time
+KN_PEAKS_VARIANT(AVX2, "avx2", 8)
+KN_PEAKS_VARIANT(AVX512, "avx512f,avx512bw", 16)
+
+static const KN_KERNELS KN_SSE2_KERNELS = {
+    KN_SSE2, "sse2", KN_decodeSSE2, KN_fftInputSSE2, KN_findPeaksGeneric
+};
+static const KN_KERNELS KN_AVX2_KERNELS = {
+    KN_AVX2, "avx2", KN_decodeAVX2, KN_fftInputAVX2, KN_findPeaksAVX2
+};
+static const KN_KERNELS KN_AVX512_KERNELS = {
+    KN_AVX512, "avx512", KN_decodeAVX2, KN_fftInputAVX2, KN_findPeaksAVX512
+};
+
+#endif
+
+const KN_KERNELS* KN = &KN_GENERIC_KERNELS;
+// set once the instruction set has been chosen, by KN_init or KN_select
+volatile int KN_CHOSEN = 0;
+
+static const KN_KERNELS* KN_get(int isa) {
+    /**
+     * The set for an instruction set, 0 if it was not built
+     */
+    switch(isa) {
+    case KN_GENERIC:
+        return &KN_GENERIC_KERNELS;
+#ifdef KN_X86
+    case KN_SSE2:
+        return &KN_SSE2_KERNELS;
+    case KN_AVX2:
+        return &KN_AVX2_KERNELS;
+    case KN_AVX512:
+        return &KN_AVX512_KERNELS;
+#endif
+    }
+    return 0;
+}
+
+int KN_isSupported(int isa) {
+    /**
+     * Returns 1 if this machine can run an instruction set's routines
+     */
+    if(!KN_get(isa)) {
+        return 0;
+    }
+#ifdef KN_X86
+    __builtin_cpu_init();
+    switch(isa) {
+    case KN_SSE2:
+        return __builtin_cpu_supports("sse2") ? 1 : 0;
+    case KN_AVX2:
+        return __builtin_cpu_supports("avx2") ? 1 : 0;
+    case KN_AVX512:
+        // the set also uses the AVX2 routines
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512f") && 
+               __builtin_cpu_supports("avx512bw") ? 1 : 0;
+    }
+#endif
+    return 1;
+}
+
+int KN_getBest() {
+    /**
+     * Returns the widest instruction set this machine supports
+     */
+    for(int isa = KN_NUM_ISAS - 1; isa > KN_GENERIC; isa--) {
+        if(KN_isSupported(isa)) {
+            return isa;
+        }
+    }
+    return KN_GENERIC;
+}
+
+int KN_select(int isa) {
+    /**
+     * Use the routines for an instruction set
+     *
+     * \param isa KN_BEST for the widest one supported
+     *
+     * Only change this while nothing is being processed. Returns the
+     * instruction set chosen, or -1 if it is not supported here.
+     */
+    if(isa == KN_BEST) {
+        isa = KN_getBest();
+    }
+    if(!KN_isSupported(isa)) {
+        return -1;
+    }
+    KN = KN_get(isa);
+    TH_atomicStore(&KN_CHOSEN, 1);
+    return isa;
+}
+
+void KN_init() {
+    /**
+     * Choose the instruction set the first time a context is initialized
+     *
+     * The widest one supported is used unless LIBCHAOS_ISA names another
+     * ("generic", "sse2", "avx2" or "avx512"), which is for testing the
+     * narrower routines. A choice made with KN_select is kept.
+     */
+    if(!TH_compareAndSwap(&KN_CHOSEN, 0, 1)) {
+        return;
+    }
+    int isa = KN_BEST;
+    const char* name = getenv("LIBCHAOS_ISA");
+    if(name) {
+        for(int i = 0; i < KN_NUM_ISAS; i++) {
+            if(KN_getName(i) && !strcmp(name, KN_getName(i))) {
+                isa = i;
+            }
+        }
+    }
+    if(KN_select(isa) < 0) {
+        KN_select(KN_BEST);
+    }
+}
+
+const char* KN_getName(int isa) {
+    /**
+     * Returns the name of an instruction set, or 0 if it was not built
+     */
+    const KN_KERNELS* kernels = KN_get(isa);
+    return kernels ? kernels->name : 0;
+}
@@ -0,0 +1,39 @@
+/**
+ * \file kernels.h
+ * \brief Header file for kernels.cpp
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdlib.h>
+#include <string.h>
+
+/* instruction sets, the same values as the public ones */
+#define KN_BEST -1
+#define KN_GENERIC 0
+#define KN_SSE2 1
+#define KN_AVX2 2
+#define KN_AVX512 3
+#define KN_NUM_ISAS 4
+
+/**
+ * The routines on the hot paths, built for one instruction set
+ */
+typedef struct {
+    int isa;
+    const char* name;
+    void (*decode)(const int* samples, short* x1, short* x2, short* x3, int num_samples);
+    void (*fftInput)(const int* samples, float* out, int num_samples);
+    int (*findPeaks)(int* dst, int len, const int* samples, int num_samples, int delta);
+} KN_KERNELS;
+
+extern const KN_KERNELS* KN;
+
+void KN_init();
+int KN_select(int isa);
+int KN_isSupported(int isa);
+int KN_getBest();
+const char* KN_getName(int isa);
+
+#endif
@@ -9,186 +9,535 @@
 #include "device_test.h"
 #include "data_processing.h"
 #include "peaks.h"
+#include "bifurcation.h"
+#include "returnmap.h"
+#include "trigger.h"
+#include "analysis.h"
+#include "poincare.h"
+#include "voxels.h"
+#include "lod.h"
+#include "context.h"
+#include "log.h"
+#include "trace.h"
+#include "replay.h"
+#include "kernels.h"
+#include "bufpool.h"
+#include "capture.h"
+#include "simulator.h"
 
-// debug mode
-// 0 = to file DEBUG_FILENAME
-// 1 = to stdout
-#define DEBUG_MODE 0
-
-FILE* DEBUG_FILE = 0x00;
-
-int * DATA;
-int START;
-int MDAC_VALUE;
-int END;
-int STEP;
-int NUM_SAMPLES;
-
-#define NUM_FFT_PLOT_POINTS 8192
-#define RETURN_MAP_MAX_POINTS 600
-#define POINTS_AFTER_TRIGGER 300
-#define MAX_PLOT_POINTS 8192
-int NUM_PLOT_POINTS = 2040;
-int PLOT_DATA[MAX_PLOT_POINTS];
-float FFT_DATA[NUM_FFT_PLOT_POINTS*2];
-int PLOT_RETURN_MAP_POINTS[RETURN_MAP_MAX_POINTS*3];
-int PLOT_RETURN_MAP_NUM_POINTS = 0;
-int TRIGGER_INDEX;
-int FFT_ENABLED = 1;
+static void LC_triggerStage(void* arg, PL_BLOCK* block);
+static void LC_fftStage(void* arg, PL_BLOCK* block);
+static void LC_returnMapStage(void* arg, PL_BLOCK* block);
+static void LC_sectionStage(void* arg, PL_BLOCK* block);
+static void LC_voxelStage(void* arg, PL_BLOCK* block);
+static void LC_historyStage(void* arg, PL_BLOCK* block);
+static void LC_spectrogramStage(void* arg, PL_BLOCK* block);
+static void LC_sweepSpectrogramStage(void* arg, PL_BLOCK* block);
+static void LC_classifyStage(void* arg, PL_BLOCK* block);
+static void LC_csvStage(void* arg, PL_BLOCK* block);
+static void LC_publishStage(void* arg, PL_BLOCK* block);
+static void LC_sweepPublishStage(void* arg, PL_BLOCK* block);
+static void LC_serverStage(void* arg, PL_BLOCK* block);
+static void LC_sweepServerStage(void* arg, PL_BLOCK* block);
+
+static int LC_claimDevice(libchaos_context* ctx) {
+    /** 
+     * Stop the sample a triggered acquisition leaves running, before the
+     * unit is used for anything else
+     *
+     * A command sent while the unit streams would start a second sample 
+     * and leave the first one running. The next triggered frame starts 
+     * the sample again. The context must be locked.
+     *
+     * Returns -1 while an asynchronous sweep has the unit. The caller 
+     * then fails at once instead of waiting for the sweep to end.
+     */
+    if(ctx->sweeping) {
+        LOG(LOG_WARNING, "The unit is busy with a sweep\n");
+        return -1;
+    }
+    AQ_stop(&ctx->acquisition, &ctx->device);
+    return 0;
+}
+
+/* Contexts */
+
+libchaos_context* libchaos_create() {
+    /** 
+     * Create a context for one chaos unit
+     *
+     * The context starts with the same settings as the library always 
+     * has. Call libchaos_ctx_selectDevice and then libchaos_ctx_init to
+     * connect to the unit.
+     */
+    // follow a point in phase space, picking a new one when it is lost
+    static const TR_TRIGGER default_trigger = 
+        {TR_PHASE, 1, 0, TR_RISING, 0, {0, 0, -1}, 3, 1};
+    
+    libchaos_context* ctx = (libchaos_context*)calloc(1, sizeof(libchaos_context));
+    if(!ctx) {
+        return 0;
+    }
+    TH_mutexInit(&ctx->lock);
+    AS_init(&ctx->requests);
+    UC_initDevice(&ctx->device);
+    ctx->num_plot_points = 2040;
+    ctx->fft_enabled = 1;
+    ctx->fft_mdac = -1;
+    ctx->trigger = default_trigger;
+    CL_init(&ctx->classes);
+    SC_init(&ctx->scan);
+    
+    if(PL_init(&ctx->plot_pipeline)) {
+        libchaos_destroy(ctx);
+        return 0;
+    }
+    if(PL_init(&ctx->sweep_pipeline)) {
+        libchaos_destroy(ctx);
+        return 0;
+    }
+    PL_addStage(&ctx->plot_pipeline, "trigger", LC_triggerStage, ctx, 1, PL_WAIT, 1);
+    PL_addStage(&ctx->plot_pipeline, "fft", LC_fftStage, ctx, 1, PL_WAIT, 1);
+    PL_addStage(&ctx->plot_pipeline, "return map", LC_returnMapStage, ctx, 1, PL_WAIT, 1);
+    PL_addStage(&ctx->plot_pipeline, "poincare", LC_sectionStage, ctx, 1, PL_WAIT, 1);
+    PL_addStage(&ctx->plot_pipeline, "voxels", LC_voxelStage, ctx, 1, PL_WAIT, 1);
+    PL_addStage(&ctx->plot_pipeline, "history", LC_historyStage, ctx, 1, PL_WAIT, 1);
+    PL_addStage(&ctx->plot_pipeline, "spectrogram", LC_spectrogramStage, ctx, 1, PL_WAIT, 1);
+    PL_addStage(&ctx->plot_pipeline, "publish", LC_publishStage, ctx, 1, PL_WAIT, 1);
+    // a server held up by a client drops blocks rather than sampling
+    PL_addStage(&ctx->plot_pipeline, "server", LC_serverStage, ctx, 4, PL_DROP);
+    PL_addStage(&ctx->sweep_pipeline, "csv", LC_csvStage, ctx);
+    PL_addStage(&ctx->sweep_pipeline, "spectrogram", LC_sweepSpectrogramStage, ctx);
+    PL_addStage(&ctx->sweep_pipeline, "classify", LC_classifyStage, ctx);
+    PL_addStage(&ctx->sweep_pipeline, "publish", LC_sweepPublishStage, ctx);
+    PL_addStage(&ctx->sweep_pipeline, "server", LC_sweepServerStage, ctx, 16, PL_DROP);
+    return ctx;
+}
+
+void libchaos_destroy(libchaos_context* ctx) {
+    /** 
+     * Close the unit and free everything held by a context
+     *
+     * No other thread may be using the context.
+     */
+    if(!ctx) {
+        return;
+    }
+    // requests still queued are cancelled, request handles must be 
+    // released first
+    AS_free(&ctx->requests);
+    PL_free(&ctx->plot_pipeline);
+    PL_free(&ctx->sweep_pipeline);
+    SV_stop(&ctx->server);
+    for(int i = 0; i < 2*PL_MAX_STAGES; i++) {
+        free(ctx->user_stages[i]);
+    }
+    CP_stop(&ctx->capture);
+    AQ_free(&ctx->acquisition, &ctx->device);
+    RP_stopRecording(&ctx->device);
+    UC_setTransport(&ctx->device, 0);
+    if(ctx->csv) {
+        fclose(ctx->csv);
+    }
+    BP_free(ctx->data);
+    peaks_freeCache(&ctx->peaks);
+    RM_free(&ctx->return_map);
+    PS_free(&ctx->section);
+    VX_free(&ctx->voxels);
+    LOD_free(&ctx->history);
+    ST_free(&ctx->spectrogram);
+    CL_free(&ctx->classes);
+    FR_free(&ctx->frames);
+    SR_close(&ctx->publisher);
+    TH_mutexDestroy(&ctx->lock);
+    free(ctx);
+}
+
+int libchaos_ctx_selectDevice(libchaos_context* ctx, int index) {
+    /** 
+     * Pick which attached unit the context connects to
+     *
+     * \param index 0 for the first unit found on the bus, 1 for the 
+     * second and so on
+     *
+     * Takes effect at the next connect.
+     */
+    LC_LOCK guard(ctx);
+    if(index < 0) {
+        return -1;
+    }
+    ctx->device.index = index;
+    return 0;
+}
 
 /* main routines */
 
-int libchaos_init() {
+int libchaos_ctx_init(libchaos_context* ctx) {
     /** 
      * Initialize the chaos library
      */
-    // setup the debugging/logging file
-    if(DEBUG_MODE == 0) {
-        if(!DEBUG_FILE) {
-            DEBUG_FILE = fopen("libchaos.log","w");
-        }
-    } else if (DEBUG_MODE == 1) {
-        DEBUG_FILE = stdout;
+    LC_LOCK guard(ctx);
+    // the log and the choice of kernels are shared by every context
+    LOG_start();
+    KN_init();
+    if(LC_claimDevice(ctx)) {
+        return -1;
     }
     
     // connect to the chaos circuit
-    int result = UC_init();
+    int result = UC_init(&ctx->device);
     return result;
 }
 
-int libchaos_connect() {
+int libchaos_ctx_connect(libchaos_context* ctx) {
     /** 
      * Connect to the chaos unit
      */
-    int result = UC_connect();
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    int result = UC_connect(&ctx->device);
     return result;
 }
 
-bool libchaos_isConnected() {
+bool libchaos_ctx_isConnected(libchaos_context* ctx) {
     /** 
      * Returns true if the device is connected.
      * If there is no connection to the device, this function attempts to create one. 
      */
-     if(UC_isConnected() == false) {
-        UC_connect();
+    LC_LOCK guard(ctx);
+     if(UC_isConnected(&ctx->device) == false) {
+        UC_connect(&ctx->device);
      }
-     return UC_isConnected();
+     return UC_isConnected(&ctx->device);
 }
 
-int libchaos_reconnect() {
+int libchaos_ctx_reconnect(libchaos_context* ctx) {
     /** 
      * Reconnect to the device
      */
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
     // close the USB connection
-    UC_close();
+    UC_close(&ctx->device);
     
-    int result = UC_init();
+    int result = UC_init(&ctx->device);
     return result;
 }
 
-int libchaos_close() {
+int libchaos_ctx_close(libchaos_context* ctx) {
     /** 
      * Close libchaos
      */
-    return UC_close();
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    return UC_close(&ctx->device);
 }
 
-int libchaos_testDevice() {
+int libchaos_ctx_testDevice(libchaos_context* ctx) {
     /** 
      * Run the device test
      */
-    return DT_testDevice();
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    return DT_testDevice(&ctx->device);
+}
+
+/* Record and replay */
+
+int libchaos_ctx_startRecording(libchaos_context* ctx, const char* filename) {
+    /** 
+     * Record everything sent to and read from the unit to a file
+     *
+     * The recording holds the raw packets with their ids and timing, 
+     * and the commands that change the MDAC. Returns -1 if the file 
+     * could not be created.
+     */
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    return RP_startRecording(&ctx->device, filename);
+}
+
+int libchaos_ctx_stopRecording(libchaos_context* ctx) {
+    /** 
+     * Finish a recording
+     */
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    RP_stopRecording(&ctx->device);
+    return 0;
+}
+
+int libchaos_ctx_startReplay(libchaos_context* ctx, const char* filename, int flags) {
+    /** 
+     * Play a recording back in place of the unit
+     *
+     * \param flags LIBCHAOS_REPLAY_FAST to answer as fast as the library 
+     * asks, or LIBCHAOS_REPLAY_PACED to keep to the recorded timing. Add 
+     * LIBCHAOS_REPLAY_LOOP to start over at the end of the recording.
+     *
+     * The library must make the same calls as when the recording was 
+     * made to get the same data back. When the recording runs out the 
+     * unit appears to have gone away. Returns -1 if the file is not a 
+     * recording.
+     */
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    return RP_startReplay(&ctx->device, filename, flags);
+}
+
+int libchaos_ctx_stopReplay(libchaos_context* ctx) {
+    /** 
+     * Go back to the unit on the bus
+     */
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    return RP_stopReplay(&ctx->device);
+}
+
+/* Simulated unit */
+
+int libchaos_ctx_startSimulation(libchaos_context* ctx, double speed, double drop_rate, 
+                                 unsigned int seed) {
+    /** 
+     * Talk to a simulated unit in place of the one on the bus
+     *
+     * \param speed Multiple of the unit's sample rate to run at, 0 to 
+     * answer as fast as the library asks
+     * \param drop_rate Fraction of data packets to lose, for testing gap 
+     * detection
+     * \param seed Picks the attractor's starting point and noise
+     *
+     * The samples come from a model of the unit's circuit. Returns -1 if 
+     * a setting is out of range.
+     */
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    return SM_start(&ctx->device, speed, drop_rate, seed);
+}
+
+int libchaos_ctx_stopSimulation(libchaos_context* ctx) {
+    /** 
+     * Go back to the unit on the bus
+     */
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    return SM_stop(&ctx->device);
+}
+
+/* Continuous capture */
+
+int libchaos_ctx_startCapture(libchaos_context* ctx, const char* filename, int mdac_value, 
+                              long long num_samples) {
+    /** 
+     * Start sampling at one MDAC value straight to a file
+     *
+     * \param num_samples Stop after this many samples, 0 to capture until 
+     * libchaos_ctx_stopCapture
+     *
+     * Sampling runs on its own thread without a break, a second thread 
+     * writes the samples to disk. The capture has the unit to itself, 
+     * other calls on the context wait until it is stopped. Missing 
+     * packets are found from their ids and kept with the samples. Read 
+     * the file with libchaos_readCapture. Returns -1 if a capture is 
+     * already running or the file could not be created.
+     */
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    return CP_start(&ctx->capture, &ctx->device, &ctx->lock, filename, mdac_value, 
+                    num_samples);
+}
+
+int libchaos_ctx_stopCapture(libchaos_context* ctx) {
+    /** 
+     * Stop a capture and wait for its file to be finished
+     *
+     * Must also be called when a capture of num_samples has ended by 
+     * itself. Returns -1 if there was no capture or it failed, for 
+     * example when the unit went away or the disk filled. The samples 
+     * taken until then are still in the file.
+     */
+    // the capture holds the context's lock until it stops
+    return CP_stop(&ctx->capture);
+}
+
+int libchaos_ctx_isCapturing(libchaos_context* ctx) {
+    /** 
+     * Returns 1 while a capture is sampling or writing
+     */
+    return TH_atomicLoad(&ctx->capture.running);
+}
+
+int libchaos_ctx_getCaptureStats(libchaos_context* ctx, long long* num_samples, 
+                                 long long* bytes_written, long long* num_gaps, 
+                                 long long* missing_packets) {
+    /** 
+     * Get the progress of the running or last capture
+     *
+     * \param num_samples Set to the samples taken
+     * \param bytes_written Set to the bytes of samples on disk
+     * \param num_gaps Set to the number of breaks in the packet ids
+     * \param missing_packets Set to the packets lost in them, 255 
+     * samples each
+     *
+     * Safe to call from any thread while the capture runs. Returns the 
+     * number of times sampling had to wait for the disk.
+     */
+    CP_CAPTURE* capture = &ctx->capture;
+    *num_samples = TH_atomicLoad64(&capture->samples);
+    *bytes_written = TH_atomicLoad64(&capture->bytes_written);
+    *num_gaps = TH_atomicLoad64(&capture->gap_count);
+    *missing_packets = TH_atomicLoad64(&capture->missing_packets);
+    return (int)TH_atomicLoad64(&capture->stalls);
+}
+
+long long libchaos_readCapture(const char* filename, long long first, int* samples, 
+                               int num_samples) {
+    /** 
+     * Read packed samples from a file written by a capture
+     *
+     * \param first Index of the first sample to read
+     *
+     * Returns the number of samples read, 0 past the end, or -1 if the 
+     * file is not a capture.
+     */
+    return CP_read(filename, first, samples, num_samples);
 }
 
 /* Sample To CSV */
 
-int libchaos_startSampleToCSV(char* filename, int start, int end, int step, int periods) {
+static int LC_startSweep(libchaos_context* ctx, char* filename, int start, int end, 
+                         int step, int periods) {
     /** 
-     * Start a sample sweep to a CSV file
+     * Start a sample sweep to a CSV file, the context must be locked
      */
-    START = start;
-    END = end;
-    STEP = step;
-    NUM_SAMPLES = periods * 60;
-    MDAC_VALUE = start;
+    ctx->start = start;
+    ctx->end = end;
+    ctx->step = step;
+    ctx->num_samples = periods * 60;
+    ctx->mdac = start;
+    ctx->calls_this_tap = 0;
     
-    fprintf(DEBUG_FILE, "Starting partitioned sample sweep:\n");
-    fprintf(DEBUG_FILE, "start:%d end:%d step:%d samples:%d\n",START,END,STEP,NUM_SAMPLES);
+    LOG(LOG_INFO, "Starting partitioned sample sweep:\n");
+    LOG(LOG_INFO, "start:%d end:%d step:%d samples:%d\n",ctx->start,ctx->end,ctx->step,ctx->num_samples);
 
-    DATA = (int*)malloc(NUM_SAMPLES*4);
+    // a sweep that was not ended gives its buffer back
+    BP_free(ctx->data);
+    ctx->data = (int*)BP_alloc(ctx->num_samples*4);
+    if(!ctx->data) {
+        return -1;
+    }
     
-    if(!DP_newCSV(filename)) {
-        fprintf(DEBUG_FILE, "File %s failed to open\n", filename);
+    if(!DP_newCSV(&ctx->csv, filename)) {
+        LOG_TEXT(LOG_ERROR, "File %s failed to open\n", filename);
+        BP_free(ctx->data);
+        ctx->data = 0;
         return -1;
     }
+    if(ctx->classes.enabled) {
+        CL_clear(&ctx->classes);
+    }
     
     return 0;
 }
 
-int libchaos_samplePartToCSV() {
+static int LC_sweepPart(libchaos_context* ctx, int samples_per_call) {
     /** 
-     * Take the next chunk of data
+     * Take the next chunk of a sweep, the context must be locked
+     *
+     * \param samples_per_call Length of the chunk, the same for every 
+     * call of a sweep
      *
-     * This function should be called over and over until it returns 0
+     * Returns the percent complete, 0 once the sweep is done or -1 if 
+     * the device could not be read
      */
-    static int calls_this_tap = 0;
+    TRACE_SCOPE(TRACE_SWEEP_PART);
     int * start_ptr;
     int length;
-    const int samples_per_call = 1020*64;
     
     // if this is the first call for this tap value
     // inform the device that we are beginning sampling
-    if( calls_this_tap == 0) {
-        UC_startSample(MDAC_VALUE);
+    if( ctx->calls_this_tap == 0) {
+        AQ_stop(&ctx->acquisition, &ctx->device);
+        if(UC_startSample(&ctx->device, ctx->mdac)) {
+            return -1;
+        }
     }
 
     // set up the start pointer for this call to point to the correct location
     // in the data
-    start_ptr = DATA + calls_this_tap*samples_per_call;
+    start_ptr = ctx->data + ctx->calls_this_tap*samples_per_call;
     
     // set the length to it maximum or what we have left
-    if ((calls_this_tap+1)*samples_per_call > NUM_SAMPLES) {
-        length = NUM_SAMPLES - calls_this_tap*samples_per_call;
+    if ((ctx->calls_this_tap+1)*samples_per_call > ctx->num_samples) {
+        length = ctx->num_samples - ctx->calls_this_tap*samples_per_call;
     } else {
         length = samples_per_call;
     }
 
     // get the sample portion
-    fprintf(DEBUG_FILE,"Collecting %d samples for tap number %d...",length,MDAC_VALUE);
-    UC_sampleCurrent(start_ptr, length);
-    fprintf(DEBUG_FILE,"Done\n");
+    LOG(LOG_DEBUG, "Collecting %d samples for tap number %d...",length,ctx->mdac);
+    if(UC_sampleCurrent(&ctx->device, start_ptr, length)) {
+        UC_endSample(&ctx->device);
+        ctx->calls_this_tap = 0;
+        return -1;
+    }
+    LOG(LOG_DEBUG, "Done\n");
     
     // calculate the percentage complete
-    int total = END-START;
-    if ( total < STEP ) {
+    int total = ctx->end-ctx->start;
+    if ( total < ctx->step ) {
         total = 1;
     } else {
-        total = (total+1) / STEP;
+        total = (total+1) / ctx->step;
     }
-    int position = (MDAC_VALUE-START)/STEP;
+    int position = (ctx->mdac-ctx->start)/ctx->step;
     int percent_complete = (position*100)/(total+1);
     float weight = 100.0/float(total+1);
-    percent_complete += (int)(float(weight) * float((float)calls_this_tap*(float)samples_per_call/(float)NUM_SAMPLES));
+    percent_complete += (int)(float(weight) * float((float)ctx->calls_this_tap*(float)samples_per_call/(float)ctx->num_samples));
     if( percent_complete >= 100 ) percent_complete = 99;
     if( percent_complete <= 0 ) percent_complete = 1;
-    fprintf(DEBUG_FILE, "%d percent complete\n",percent_complete);
+    LOG(LOG_DEBUG, "%d percent complete\n",percent_complete);
 
     // if this isn't the last call
-    bool more_left = calls_this_tap*samples_per_call + length < NUM_SAMPLES; 
+    bool more_left = ctx->calls_this_tap*samples_per_call + length < ctx->num_samples; 
     if ( more_left ) {
-        calls_this_tap++;
+        ctx->calls_this_tap++;
         return percent_complete;
     } else {
         // were done with this tap
-        UC_endSample();
-        fprintf(DEBUG_FILE,"Storing data...");
-        DP_appendToCSV(DATA,NUM_SAMPLES,MDAC_VALUE);
-        fprintf(DEBUG_FILE,"Done\n");
+        UC_endSample(&ctx->device);
+        ctx->calls_this_tap = 0;
+        // written by the CSV stage while the next tap is sampled
+        if(PL_push(&ctx->sweep_pipeline, ctx->data, ctx->num_samples, ctx->mdac)) {
+            LOG(LOG_ERROR, "No memory to hand tap %d to its stages\n", ctx->mdac);
+            return -1;
+        }
 
-        MDAC_VALUE += STEP;
-        if(MDAC_VALUE <= END) {
+        ctx->mdac += ctx->step;
+        if(ctx->mdac <= ctx->end) {
             // more taps left
-            calls_this_tap = 0;
             return percent_complete;
         } else {
             // all done
@@ -197,312 +546,2609 @@ int libchaos_samplePartToCSV() {
     }
 }
 
-int libchaos_endSampleToCSV() {
+static void LC_endSweep(libchaos_context* ctx) {
+    /** 
+     * Write the sweep's file and free its memory, the context must be 
+     * locked
+     */
+    // a tap left part way through is ended first
+    if(ctx->calls_this_tap) {
+        UC_endSample(&ctx->device);
+        ctx->calls_this_tap = 0;
+    }
+    PL_flush(&ctx->sweep_pipeline);
+    DP_writeCSV(ctx->csv);
+    ctx->csv = 0;
+    BP_free(ctx->data);
+    ctx->data = 0;
+    LOG(LOG_INFO, "Sample sweep finished\n");
+}
+
+int libchaos_ctx_startSampleToCSV(libchaos_context* ctx, char* filename, int start, 
+                                  int end, int step, int periods) {
+    /** 
+     * Start a sample sweep to a CSV file
+     *
+     * Returns -1 if the file could not be opened or an asynchronous 
+     * sweep is running
+     */
+    LC_LOCK guard(ctx);
+    if(ctx->sweeping) {
+        return -1;
+    }
+    return LC_startSweep(ctx, filename, start, end, step, periods);
+}
+
+int libchaos_ctx_samplePartToCSV(libchaos_context* ctx) {
+    /** 
+     * Take the next chunk of data
+     *
+     * This function should be called over and over until it returns 0. 
+     * It returns -1 if the device could not be read or an asynchronous 
+     * sweep is running, the sweep should then be ended.
+     */
+    LC_LOCK guard(ctx);
+    if(ctx->sweeping) {
+        return -1;
+    }
+    return LC_sweepPart(ctx, 1020*64);
+}
+
+int libchaos_ctx_endSampleToCSV(libchaos_context* ctx) {
     /** 
      * End a sample sweep to CSV
      *
      * Write the file, and free the memory used
      */
-    DP_writeCSV();
-    free(DATA);
-    fprintf(DEBUG_FILE,"Sample sweep finished\n");
+    LC_LOCK guard(ctx);
+    if(ctx->sweeping) {
+        return -1;
+    }
+    LC_endSweep(ctx);
     return 0;
 }
 
-int libchaos_sampleToCSV(char* filename, int mdac_start, int mdac_end, 
-                         int mdac_step, int periods) {
+int libchaos_ctx_sampleToCSV(libchaos_context* ctx, char* filename, int mdac_start, 
+                             int mdac_end, int mdac_step, int periods) {
     /** 
      * Perform a sample sweep to a CSV file
+     *
+     * Returns -1 if a tap could not be read or handed to the CSV stage,
+     * the file then holds the taps before it
      */
+    LC_LOCK guard(ctx);
     int mdac_value;
     int num_samples = periods * 60;
     int* data;
     
-    data = (int*)malloc(num_samples*4);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    data = (int*)BP_alloc(num_samples*4);
+    if(!data) {
+        return -1;
+    }
     
-    if(!DP_newCSV(filename)) {
-        fprintf(DEBUG_FILE, "File %s failed to open\n", filename);
+    if(!DP_newCSV(&ctx->csv, filename)) {
+        LOG_TEXT(LOG_ERROR, "File %s failed to open\n", filename);
+        BP_free(data);
         return -1;
     }
+    if(ctx->classes.enabled) {
+        CL_clear(&ctx->classes);
+    }
+    int ret_val = 0;
     for( mdac_value = mdac_start; mdac_value<=mdac_end; mdac_value += mdac_step) {
-        fprintf(DEBUG_FILE,"Collecting %d samples for tap number %d...",num_samples,mdac_value);
-        UC_sample(data,num_samples,mdac_value);
-        fprintf(DEBUG_FILE,"Done\n");
-        fprintf(DEBUG_FILE,"Storing data to data.csv...");
-        DP_appendToCSV(data,num_samples,mdac_value);
-        fprintf(DEBUG_FILE,"Done\n");
-    }
-    DP_writeCSV();
-    free(data);
+        LOG(LOG_DEBUG, "Collecting %d samples for tap number %d...",num_samples,mdac_value);
+        if(UC_sample(&ctx->device, data,num_samples,mdac_value)) {
+            ret_val = -1;
+            break;
+        }
+        LOG(LOG_DEBUG, "Done\n");
+        if(PL_push(&ctx->sweep_pipeline, data, num_samples, mdac_value)) {
+            LOG(LOG_ERROR, "No memory to hand tap %d to its stages\n", mdac_value);
+            ret_val = -1;
+            break;
+        }
+    }
+    // the file keeps the taps taken before a failure
+    PL_flush(&ctx->sweep_pipeline);
+    DP_writeCSV(ctx->csv);
+    ctx->csv = 0;
+    BP_free(data);
     printf("----- Data collection finished. -----\n\n");
-    return 0;
+    return ret_val;
 }
 
-/* Version Information */
+/* Logging */
 
-int libchaos_getFirmwareVersion() {
+void libchaos_setLogLevel(int level) {
     /** 
-     * Get the current MDAC value from the device
+     * Only log messages at or below a level
+     *
+     * \param level LIBCHAOS_LOG_OFF, LIBCHAOS_LOG_ERROR, 
+     * LIBCHAOS_LOG_WARNING, LIBCHAOS_LOG_INFO (the default) or 
+     * LIBCHAOS_LOG_DEBUG
+     *
+     * Messages above LOG_COMPILE_LEVEL are left out of the build and 
+     * cannot be turned on.
      */
-    return  UC_getVersion();
+    LOG_setLevel(level);
 }
 
-int libchaos_getVersion() {
+int libchaos_setLogFile(const char* filename) {
     /** 
-     * Get the current MDAC value from the device
+     * Send log messages to a file, they go nowhere until this is called
+     *
+     * \param filename 0 for stdout, "" for nowhere
+     *
+     * Messages are written by a background thread, which opens the file
+     * on its next pass.
      */
-    return LIBCHAOS_VERSION;
+    return LOG_setFile(filename);
 }
 
-/* MDAC */
-
-int libchaos_getMDACValue() {
+int libchaos_getNumDroppedLogMessages() {
     /** 
-     * Get the current MDAC value from the device
+     * Returns the number of log messages lost because they came in faster 
+     * than they could be written
      */
-    int mdac_value;
-    UC_getStatus(&mdac_value);
-    return mdac_value;
+    return LOG_getDropped();
 }
 
-int libchaos_setMDACValue(int mdac_value) {
+/* Tracing */
+
+void libchaos_setTracing(int flags) {
     /** 
-     * Set the current MDAC value on the device
+     * Choose what the timers through the library record
+     *
+     * \param flags LIBCHAOS_TRACE_OFF (the default), or 
+     * LIBCHAOS_TRACE_HISTOGRAMS and/or LIBCHAOS_TRACE_EVENTS
+     *
+     * Histograms give the count and spread of the time spent in each 
+     * stage, events keep every timed scope for libchaos_writeTraceEvents.
+     * Timing is shared by every context.
      */
-    return(UC_setMDAC(mdac_value));
+    TRACE_setFlags(flags);
 }
 
-int libchaos_mdacToResistance(int mdac) {
+void libchaos_resetTrace() {
     /** 
-     * Convert given MDAC value to a resistance
-     *
-     * \param mdac Value of the MDAC
-     * \return resistance in Ohms
+     * Throw away the times and events recorded so far
      */
-    return int((21100.0*36000.0)/(21100.0+float((mdac)/4095.0)*36000.0));
+    TRACE_reset();
 }
 
-int libchaos_resistanceToMdac(int resistance) {
+int libchaos_getNumTraceStages() {
     /** 
-     * Convert a given resistance to an MDAC value.
-     *
-     * \param resistance Resistance in Ohms
-     * \return MDAC value
+     * Returns the number of stages that are timed
      */
-    return int(4095.0*(21100.0)/float(resistance)-((4095.0*21100.0)/36000.0));
+    return TRACE_NUM_STAGES;
 }
 
-/* Basic Plot */
+const char* libchaos_getTraceStageName(int stage) {
+    /** 
+     * Returns the name of a timed stage, or 0 if there is no such stage
+     */
+    return TRACE_getName(stage);
+}
 
-int libchaos_readPlot(int mdac_value) {
+int libchaos_getTraceStats(int stage, long long* count, double* total_time, 
+                           double* max_time) {
     /** 
-     * Read plot data from the device at the current MDAC value
+     * Get the time spent in a stage
      *
-     * This data gets stored to a buffer inside of libchaos. It can be 
-     * accessed via calls to getNextPlotPoint.
-     * 
-     * An mdac_value of -1 (or any invalid value) will not change the mdac and
-     * use the current value.
+     * \param count Set to the number of times the stage ran
+     * \param total_time, max_time Set to the total and longest time, in 
+     * seconds
      */
-    static int last_mdac_value = 0;
-    static int last_fft = 0;
-    
-    int ret_val;
-    int current_mdac = libchaos_getMDACValue();
-    
-    last_fft++;
-
-    // check to see if the FFT should run this time
-    if((last_fft > 20 || (current_mdac != last_mdac_value)) && FFT_ENABLED) {
-        last_fft = 0;
-        // get the data from the device
-        ret_val = UC_sample(PLOT_DATA, NUM_FFT_PLOT_POINTS, mdac_value);
-        DP_FFT(PLOT_DATA, FFT_DATA, NUM_FFT_PLOT_POINTS);
-    } else {
-        ret_val = UC_sample(PLOT_DATA, NUM_PLOT_POINTS, mdac_value);
-    }
-    
-    // get the trigger location
-    TRIGGER_INDEX = DP_findTriggerIndex(POINTS_AFTER_TRIGGER);
-
-    // check to see if the MDAC value has changed since last call
-    if(current_mdac != last_mdac_value) {
-        PLOT_RETURN_MAP_NUM_POINTS = 0;
-    } else {
-    }
-    last_mdac_value = current_mdac;
-    
-    // parse more return map data if needed
-    if( PLOT_RETURN_MAP_NUM_POINTS < RETURN_MAP_MAX_POINTS - 50 ) {
-        PLOT_RETURN_MAP_NUM_POINTS += 
-            DP_getReturnMapPoints(PLOT_RETURN_MAP_POINTS+PLOT_RETURN_MAP_NUM_POINTS*3,
-                                  RETURN_MAP_MAX_POINTS-PLOT_RETURN_MAP_NUM_POINTS,
-                                  PLOT_DATA,
-                                  NUM_PLOT_POINTS);
+    TRACE_HISTOGRAM histogram;
+    if(TRACE_getHistogram(stage, &histogram)) {
+        return -1;
     }
-    
-    return(ret_val);
+    *count = histogram.count;
+    *total_time = histogram.total*1e-9;
+    *max_time = histogram.max*1e-9;
+    return 0;
 }
 
-void libchaos_refreshReturnMapPoints() {
+double libchaos_getTracePercentile(int stage, double fraction) {
     /** 
-     * Causes the library to recollect return map data
+     * Estimate the time in seconds that a fraction of a stage's runs 
+     * finished within, to within a factor of two
+     *
+     * Returns -1 if the stage has not been timed.
      */
-    PLOT_RETURN_MAP_NUM_POINTS = 0;
-    return;
+    long long time = TRACE_getPercentile(stage, fraction);
+    return time < 0 ? -1 : time*1e-9;
 }
 
-int libchaos_getTriggerIndex() {
+int libchaos_writeTraceSummary(const char* filename) {
     /** 
-     * Get the trigger index for the plot
+     * Write a table of the time spent in each stage
      *
-     * The trigger index should be at approximately the same location in 
-     * the waveform as the previous trigger index if the trigger 
-     * succeeded.
+     * \param filename 0 for stdout
      */
-    return TRIGGER_INDEX;
+    FILE* file = filename ? fopen(filename, "w") : stdout;
+    if(!file) {
+        return -1;
+    }
+    TRACE_writeSummary(file);
+    if(filename) {
+        fclose(file);
+    }
+    return 0;
 }
 
-int libchaos_getPlotPoint(int* x1, int*x2, int* x3, int index) {
+int libchaos_writeTraceEvents(const char* filename) {
     /** 
-     * Get the data at a specified plot point.
+     * Write the recorded events as a Chrome trace JSON file
+     *
+     * The file can be opened in Perfetto or chrome://tracing. Returns the 
+     * number of events written or -1 if the file could not be opened.
      */
-    
-     if(index > NUM_PLOT_POINTS) {
-        return -1;
-     } else if (index < 0) {
+    FILE* file = fopen(filename, "w");
+    if(!file) {
         return -1;
-     }
-     
-     int tmp1 = DP_getX1(PLOT_DATA[index]);
-     int tmp2 = DP_getX2(PLOT_DATA[index]);
-     int tmp3 = DP_getX3(PLOT_DATA[index]);
-     
-     *x1 = tmp1;
-     *x2 = tmp2;
-     *x3 = tmp3;
-     
-     return 0;
+    }
+    int written = TRACE_writeEvents(file);
+    fclose(file);
+    return written;
 }
 
-int libchaos_getNumPlotPoints() {
+/* Buffers */
+
+void libchaos_getBufferStats(long long* in_use, long long* high_water, long long* held, 
+                             long long* heap_allocations) {
     /** 
-     * Returns the number of plots available for plotting
+     * Get the memory taken by sample buffers, in bytes
+     *
+     * \param in_use Set to the bytes handed out now
+     * \param high_water Set to the most bytes handed out at once
+     * \param held Set to the bytes kept by the pool, in use or not
+     * \param heap_allocations Set to the number of buffers ever taken 
+     * from the heap
+     *
+     * Sample buffers, frames, pipeline blocks, the peaks cache and the 
+     * scratch space of the analysis come from one pool shared by every 
+     * context and are reused. Once a session is running steadily 
+     * heap_allocations stops going up.
      */
-     
-     return NUM_PLOT_POINTS;
+    BP_STATS stats;
+    BP_getStats(&stats);
+    *in_use = stats.in_use;
+    *high_water = stats.high_water;
+    *held = stats.held;
+    *heap_allocations = stats.heap_allocations;
 }
 
-int libchaos_setNumPlotPoints(int num) {
+void libchaos_resetBufferHighWater() {
     /** 
-     * Set the number of points on a plot
+     * Start the high-water mark again from the bytes in use now
      */
+    BP_resetHighWater();
+}
+
+void libchaos_trimBuffers() {
+    /** 
+     * Give the buffers not in use back to the system
+     *
+     * Useful after a large sweep, the buffers are taken from the heap 
+     * again when they are next needed.
+     */
+    BP_trim();
+}
+
+/* Instruction sets */
+
+int libchaos_setISA(int isa) {
+    /** 
+     * Choose the instruction set the hot routines use
+     *
+     * \param isa LIBCHAOS_ISA_BEST for the widest one the processor 
+     * supports, or one of the other LIBCHAOS_ISA_ values
+     *
+     * The best one is chosen when the first context is initialized, so 
+     * this is only needed to compare them. The choice is shared by every 
+     * context and must not be changed while any is capturing. Returns 
+     * the instruction set now in use, or -1 if the processor does not 
+     * support the one asked for.
+     */
+    return KN_select(isa);
+}
+
+int libchaos_getISA() {
+    /** 
+     * Returns the instruction set the hot routines use
+     */
+    return KN->isa;
+}
+
+const char* libchaos_getISAName(int isa) {
+    /** 
+     * Returns the name of an instruction set, or 0 if it is not built 
+     * into this library
+     */
+    return KN_getName(isa);
+}
+
+/* Version Information */
+
+int libchaos_ctx_getFirmwareVersion(libchaos_context* ctx) {
+    /** 
+     * Get the current MDAC value from the device
+     */
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    return  UC_getVersion(&ctx->device);
+}
+
+int libchaos_getVersion() {
+    /** 
+     * Get the current MDAC value from the device
+     */
+    return LIBCHAOS_VERSION;
+}
+
+/* MDAC */
+
+int libchaos_ctx_getMDACValue(libchaos_context* ctx) {
+    /** 
+     * Get the current MDAC value from the device
+     */
+    LC_LOCK guard(ctx);
+    int mdac_value;
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    UC_getStatus(&ctx->device, &mdac_value);
+    return mdac_value;
+}
+
+int libchaos_ctx_setMDACValue(libchaos_context* ctx, int mdac_value) {
+    /** 
+     * Set the current MDAC value on the device
+     */
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    return(UC_setMDAC(&ctx->device, mdac_value));
+}
+
+int libchaos_mdacToResistance(int mdac) {
+    /** 
+     * Convert given MDAC value to a resistance
+     *
+     * \param mdac Value of the MDAC
+     * \return resistance in Ohms
+     */
+    return int((21100.0*36000.0)/(21100.0+float((mdac)/4095.0)*36000.0));
+}
+
+int libchaos_resistanceToMdac(int resistance) {
+    /** 
+     * Convert a given resistance to an MDAC value.
+     *
+     * \param resistance Resistance in Ohms
+     * \return MDAC value
+     */
+    return int(4095.0*(21100.0)/float(resistance)-((4095.0*21100.0)/36000.0));
+}
+
+/* Basic Plot */
+
+static int LC_plotLength(libchaos_context* ctx, PL_BLOCK* block) {
+    /** 
+     * Number of samples of a block that make up the plot
+     *
+     * Blocks taken for the FFT are longer than the plot.
+     */
+    if(block->num_samples < ctx->num_plot_points) {
+        return block->num_samples;
+    }
+    return ctx->num_plot_points;
+}
+
+static void LC_use(libchaos_context* ctx, int product) {
+    /** 
+     * Note a read of a derived product of the plot
+     *
+     * Reads are stamped with the next plot, so reads before the first 
+     * plot count too.
+     */
+    ctx->product_read[product] = ctx->plot_generation + 1;
+}
+
+static bool LC_wanted(libchaos_context* ctx, int product) {
+    /** 
+     * Check whether a derived product is being read
+     *
+     * Products read through the context or a published frame within the
+     * last FR_IDLE_FRAMES plots are worked out with every plot. The others
+     * wait until they are read, or are skipped.
+     */
+    unsigned int read = ctx->product_read[product];
+    if(read && (int)(ctx->plot_generation - read) < FR_IDLE_FRAMES) {
+        return true;
+    }
+    return FR_wanted(&ctx->frames, product);
+}
+
+static void LC_updateTrigger(libchaos_context* ctx) {
+    /** 
+     * Find the trigger point of the plot unless it is already known
+     *
+     * Triggered acquisition hands it over with the frame.
+     */
+    if(ctx->product_generation[FR_TRIGGER] == ctx->plot_generation) {
+        return;
+    }
+    TRACE_SCOPE(TRACE_TRIGGER);
+    ctx->trigger_index = DP_findTriggerIndex(&ctx->trigger, ctx->plot_data, 
+                                             ctx->num_plot_points,
+                                             POINTS_AFTER_TRIGGER, &ctx->trigger_result);
+    ctx->product_generation[FR_TRIGGER] = ctx->plot_generation;
+}
+
+static void LC_updateReturnMap(libchaos_context* ctx) {
+    /** 
+     * Add the peaks of the plot to the return map unless already done
+     *
+     * The ring keeps the most recent peaks. Every plot is a separate 
+     * capture, even a triggered frame skips the samples since the last 
+     * one, so the stream is broken before each plot and no peak or 
+     * point spans two of them. Plots taken while it was not read are 
+     * left out.
+     */
+    if(ctx->product_generation[FR_RETURN_MAP] == ctx->plot_generation) {
+        return;
+    }
+    TRACE_SCOPE(TRACE_RETURN_MAP);
+    RM_breakStream(&ctx->return_map);
+    RM_process(&ctx->return_map, ctx->plot_data, ctx->num_plot_points);
+    ctx->product_generation[FR_RETURN_MAP] = ctx->plot_generation;
+}
+
+static void LC_updateStatistics(libchaos_context* ctx) {
+    /** 
+     * Work out the range and spread of each channel of the plot
+     */
+    if(ctx->product_generation[FR_STATISTICS] == ctx->plot_generation) {
+        return;
+    }
+    FR_STATS* stats = &ctx->plot_statistics;
+    long long sum[3] = {0, 0, 0};
+    long long squares[3] = {0, 0, 0};
+    int n = ctx->num_plot_points;
+    for(int c = 0; c < 3; c++) {
+        stats->min[c] = 1023;
+        stats->max[c] = 0;
+    }
+    for(int i = 0; i < n; i++) {
+        int x[3] = {DP_getX1(ctx->plot_data[i]), DP_getX2(ctx->plot_data[i]), 
+                    DP_getX3(ctx->plot_data[i])};
+        for(int c = 0; c < 3; c++) {
+            if(x[c] < stats->min[c]) stats->min[c] = x[c];
+            if(x[c] > stats->max[c]) stats->max[c] = x[c];
+            sum[c] += x[c];
+            squares[c] += x[c]*x[c];
+        }
+    }
+    for(int c = 0; c < 3; c++) {
+        double mean = (double)sum[c]/n;
+        double variance = (double)squares[c]/n - mean*mean;
+        stats->mean[c] = (float)mean;
+        stats->deviation[c] = variance > 0 ? (float)sqrt(variance) : 0.0f;
+    }
+    ctx->product_generation[FR_STATISTICS] = ctx->plot_generation;
+}
+
+static void LC_triggerStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Find the trigger point of the plot while it is being read
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(LC_wanted(ctx, FR_TRIGGER)) {
+        LC_updateTrigger(ctx);
+    }
+}
+
+static void LC_fftStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Take the FFT when readPlot asked for one
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(ctx->fft_due && block->num_samples >= NUM_FFT_PLOT_POINTS) {
+        DP_FFT(block->samples, ctx->fft_data, NUM_FFT_PLOT_POINTS);
+    }
+}
+
+static void LC_returnMapStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Add the peaks of the plot to the return map while it is being read
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(LC_wanted(ctx, FR_RETURN_MAP)) {
+        LC_updateReturnMap(ctx);
+    }
+}
+
+static void LC_sectionStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Add the crossings of the plot to the Poincare section
+     *
+     * Each frame is a separate capture so crossings are not joined 
+     * across frames.
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(ctx->section.capacity) {
+        PS_breakStream(&ctx->section);
+        PS_process(&ctx->section, block->samples, LC_plotLength(ctx, block));
+    }
+}
+
+static void LC_voxelStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Add the plot to the attractor density
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(ctx->voxels.bricks) {
+        VX_beginFrame(&ctx->voxels);
+        VX_add(&ctx->voxels, block->samples, LC_plotLength(ctx, block));
+    }
+}
+
+static void LC_historyStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Append the plot to the waveform history
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(ctx->history.raw) {
+        LOD_append(&ctx->history, block->samples, LC_plotLength(ctx, block));
+    }
+}
+
+static void LC_spectrogramStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Add the plot to the spectrogram
+     *
+     * Each frame is a separate capture so windows do not span frames.
+     */
+    TRACE_SCOPE(TRACE_STFT);
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(ctx->spectrogram.plan && ctx->spectrogram.stream == LIBCHAOS_PLOT_STREAM) {
+        ST_add(&ctx->spectrogram, block->x1, LC_plotLength(ctx, block), block->mdac, 0);
+    }
+}
+
+static void LC_sweepSpectrogramStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Add a tap of a sample sweep to the spectrogram
+     */
+    TRACE_SCOPE(TRACE_STFT);
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(ctx->spectrogram.plan && ctx->spectrogram.stream == LIBCHAOS_SWEEP_STREAM) {
+        ST_add(&ctx->spectrogram, block->x1, block->num_samples, block->mdac, 0);
+    }
+}
+
+static void LC_classifyStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Classify a tap of a sample sweep while the next one is sampled
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(ctx->classes.enabled) {
+        CL_RESULT result;
+        CL_classify(block->samples, block->num_samples, &ctx->classes.options, &result);
+        result.mdac = block->mdac;
+        CL_append(&ctx->classes, &result);
+    }
+}
+
+static void LC_publishStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Hand the plot to other processes
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(ctx->publisher.header) {
+        SR_write(&ctx->publisher, LIBCHAOS_PLOT_STREAM, block->mdac, block->position, 
+                 block->samples, block->x1, block->x2, block->x3, 
+                 LC_plotLength(ctx, block));
+    }
+}
+
+static void LC_sweepPublishStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Hand a tap of a sample sweep to other processes
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(ctx->publisher.header) {
+        SR_write(&ctx->publisher, LIBCHAOS_SWEEP_STREAM, block->mdac, block->position, 
+                 block->samples, block->x1, block->x2, block->x3, block->num_samples);
+    }
+}
+
+static void LC_serverStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Send the plot to the server's clients
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(ctx->server.running) {
+        SV_send(&ctx->server, SV_SAMPLES, block->mdac, block->position, block->samples, 
+                LC_plotLength(ctx, block)*sizeof(int));
+    }
+}
+
+static void LC_sweepServerStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Send a tap of a sample sweep and its peaks to the server's clients
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    if(ctx->server.running) {
+        int peaks[SV_MAX_PEAKS];
+        unsigned short values[SV_MAX_PEAKS];
+        SV_send(&ctx->server, SV_TAP, block->mdac, block->position, block->samples, 
+                block->num_samples*sizeof(int));
+        int n = peaks_findPeaks(peaks, SV_MAX_PEAKS, block->samples, block->num_samples, 2);
+        for(int i = 0; i < n; i++) {
+            values[i] = (unsigned short)peaks[i];
+        }
+        SV_send(&ctx->server, SV_PEAKS, block->mdac, block->position, values, 
+                n*sizeof(unsigned short));
+    }
+}
+
+static void LC_csvStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Write a tap of a sample sweep to the CSV file
+     */
+    libchaos_context* ctx = (libchaos_context*)arg;
+    LOG(LOG_DEBUG, "Storing data...");
+    DP_appendToCSV(ctx->csv, block->samples, block->num_samples, block->mdac);
+    LOG(LOG_DEBUG, "Done\n");
+}
+
+int libchaos_ctx_readPlot(libchaos_context* ctx, int mdac_value) {
+    /** 
+     * Read plot data from the device at the current MDAC value
+     *
+     * This data gets stored to a buffer inside of libchaos. It can be 
+     * accessed via calls to getNextPlotPoint.
+     * 
+     * An mdac_value of -1 (or any invalid value) will not change the mdac and
+     * use the current value.
+     *
+     * The trigger point, FFT, return map and statistics are only worked 
+     * out while something reads them, through the context or a frame. 
+     * One not read for FR_IDLE_FRAMES plots is skipped until it is read 
+     * again, and the first read works it out for the current plot. The
+     * FFT needs a longer capture, so it is only taken while it is read,
+     * every 20 plots or when the MDAC value changed.
+     *
+     * Returns -1 if the device could not be read or an asynchronous 
+     * sweep has it.
+     */
+    LC_LOCK guard(ctx);
+    if(ctx->sweeping) {
+        return -1;
+    }
+    TRACE_SCOPE(TRACE_PLOT);
+    int ret_val;
+    int current_mdac;
+    
+    if(ctx->acquisition.streaming && ctx->acquisition.session == ctx->device.sessions) {
+        // asking the unit would stop the sample left running between frames
+        current_mdac = ctx->acquisition.mdac;
+    } else {
+        current_mdac = libchaos_ctx_getMDACValue(ctx);
+    }
+    // check to see if the FFT should run this time
+    bool fft_due = ctx->fft_enabled && LC_wanted(ctx, FR_FFT) && 
+                   (ctx->last_fft >= 20 || current_mdac != ctx->fft_mdac);
+    int length = fft_due ? NUM_FFT_PLOT_POINTS : ctx->num_plot_points;
+    int triggered = 0;
+    if(ctx->acquisition.enabled) {
+        // the sample keeps the MDAC value read above unless given a new one
+        triggered = AQ_readFrame(&ctx->acquisition, &ctx->device, &ctx->trigger, 
+                                 mdac_value >= 0 ? mdac_value : current_mdac, 
+                                 ctx->plot_data, length, &ctx->trigger_result);
+        ret_val = triggered < 0 ? -1 : 0;
+    } else {
+        // get the data from the device
+        ret_val = UC_sample(&ctx->device, ctx->plot_data, length, mdac_value);
+    }
+    // a failed read leaves the last plot and its products as they were
+    if(ret_val) {
+        return -1;
+    }
+    
+    ctx->plot_generation++;
+    ctx->last_fft++;
+    ctx->fft_due = fft_due;
+    if(fft_due) {
+        ctx->last_fft = 0;
+        ctx->fft_mdac = current_mdac;
+    }
+    if(ctx->acquisition.enabled) {
+        // the frame came with its trigger point
+        ctx->trigger_index = triggered > 0 ? ctx->trigger_result.index : 0;
+        ctx->product_generation[FR_TRIGGER] = ctx->plot_generation;
+    }
+    
+    // check to see if the MDAC value has changed since last call
+    if(!ctx->return_map.capacity) {
+        RM_init(&ctx->return_map);
+    } else if(current_mdac != ctx->last_mdac_value) {
+        RM_reset(&ctx->return_map);
+    }
+    ctx->last_mdac_value = current_mdac;
+    
+    // the built in stages run in parallel and are waited for, user 
+    // stages carry on in the background
+    if(PL_push(&ctx->plot_pipeline, ctx->plot_data, 
+               ctx->fft_due ? NUM_FFT_PLOT_POINTS : ctx->num_plot_points, current_mdac, true)) {
+        LOG(LOG_ERROR, "No memory to hand the plot to its stages\n");
+        ret_val = -1;
+    }
+    
+    // hand the frame to readers on other threads
+    if(!ctx->frames.num_frames) {
+        FR_init(&ctx->frames);
+    }
+    TRACE_SCOPE(TRACE_PUBLISH);
+    FR_FRAME* frame = FR_begin(&ctx->frames);
+    if(frame) {
+        frame->mdac = current_mdac;
+        frame->num_points = ctx->num_plot_points;
+        memcpy(frame->plot_data, ctx->plot_data, ctx->num_plot_points*sizeof(int));
+        // frames only carry the products their readers take
+        if(FR_wanted(&ctx->frames, FR_TRIGGER)) {
+            LC_updateTrigger(ctx);
+            frame->trigger_index = ctx->trigger_index;
+            frame->trigger_quality = ctx->trigger_result.quality;
+            frame->products |= 1 << FR_TRIGGER;
+        }
+        if(FR_wanted(&ctx->frames, FR_FFT)) {
+            memcpy(frame->fft_data, ctx->fft_data, sizeof(ctx->fft_data));
+            frame->products |= 1 << FR_FFT;
+        }
+        if(FR_wanted(&ctx->frames, FR_RETURN_MAP)) {
+            LC_updateReturnMap(ctx);
+            if(RM_copy(&frame->return_map, &ctx->return_map)) {
+                RM_free(&frame->return_map);
+            } else {
+                frame->products |= 1 << FR_RETURN_MAP;
+            }
+        }
+        if(FR_wanted(&ctx->frames, FR_STATISTICS)) {
+            LC_updateStatistics(ctx);
+            frame->statistics = ctx->plot_statistics;
+            frame->products |= 1 << FR_STATISTICS;
+        }
+        FR_publish(&ctx->frames, frame);
+    }
+    
+    return(ret_val);
+}
+
+int libchaos_ctx_enableTriggeredAcquisition(libchaos_context* ctx, int pre_trigger) {
+    /** 
+     * Keep sampling between plots and cut each frame around its trigger
+     *
+     * \param pre_trigger Samples of each frame before the trigger point, 
+     * the rest of libchaos_getNumPlotPoints follow it
+     *
+     * libchaos_readPlot returns as soon as the trigger fires and the frame
+     * is complete, with the trigger index at pre_trigger, instead of 
+     * taking a full capture and searching it. The next frame starts after
+     * the end of the last one. Other calls that sample stop it, it starts
+     * again with the next plot.
+     */
+    LC_LOCK guard(ctx);
+    if(pre_trigger < 0 || pre_trigger >= MAX_PLOT_POINTS) {
+        return -1;
+    }
+    if(ctx->acquisition.enabled) {
+        ctx->acquisition.pre_trigger = pre_trigger;
+        return 0;
+    }
+    return AQ_init(&ctx->acquisition, pre_trigger);
+}
+
+void libchaos_ctx_disableTriggeredAcquisition(libchaos_context* ctx) {
+    /** 
+     * Go back to a fresh capture for every plot
+     */
+    LC_LOCK guard(ctx);
+    AQ_free(&ctx->acquisition, &ctx->device);
+}
+
+int libchaos_ctx_getAcquisitionStats(libchaos_context* ctx, long long* frames, 
+                                     long long* timeouts, long long* gaps) {
+    /** 
+     * Get counts of triggered acquisition since it was enabled
+     *
+     * \param frames Set to the number of triggered frames
+     * \param timeouts Set to the number of frames returned untriggered
+     * \param gaps Set to the number of times packets went missing
+     * \return -1 if triggered acquisition is off
+     */
+    LC_LOCK guard(ctx);
+    *frames = ctx->acquisition.frames;
+    *timeouts = ctx->acquisition.timeouts;
+    *gaps = ctx->acquisition.gaps;
+    return ctx->acquisition.enabled ? 0 : -1;
+}
+
+void libchaos_ctx_refreshReturnMapPoints(libchaos_context* ctx) {
+    /** 
+     * Causes the library to recollect return map data
+     */
+    LC_LOCK guard(ctx);
+    RM_reset(&ctx->return_map);
+    return;
+}
+
+int libchaos_ctx_getTriggerIndex(libchaos_context* ctx) {
+    /** 
+     * Get the trigger index for the plot
+     *
+     * The trigger index should be at approximately the same location in 
+     * the waveform as the previous trigger index if the trigger 
+     * succeeded.
+     */
+    LC_LOCK guard(ctx);
+    LC_use(ctx, FR_TRIGGER);
+    LC_updateTrigger(ctx);
+    return ctx->trigger_index;
+}
+
+int libchaos_ctx_getTriggerQuality(libchaos_context* ctx) {
+    /** 
+     * Get how closely the last trigger point matched the trigger
+     *
+     * \return 0 (no match) to 100 (exact match)
+     */
+    LC_LOCK guard(ctx);
+    LC_use(ctx, FR_TRIGGER);
+    LC_updateTrigger(ctx);
+    return ctx->trigger_result.quality;
+}
+
+int libchaos_ctx_getPlotStatistics(libchaos_context* ctx, int channel, int* min, int* max, 
+                                   float* mean, float* deviation) {
+    /** 
+     * Get the range, mean and standard deviation of a channel of the plot
+     *
+     * \param channel 1, 2 or 3 for x1, x2 or x3
+     * \return -1 for a bad channel or before the first plot
+     */
+    LC_LOCK guard(ctx);
+    if(channel < 1 || channel > 3 || !ctx->plot_generation) {
+        return -1;
+    }
+    LC_use(ctx, FR_STATISTICS);
+    LC_updateStatistics(ctx);
+    *min = ctx->plot_statistics.min[channel - 1];
+    *max = ctx->plot_statistics.max[channel - 1];
+    *mean = ctx->plot_statistics.mean[channel - 1];
+    *deviation = ctx->plot_statistics.deviation[channel - 1];
+    return 0;
+}
+
+int libchaos_ctx_setLevelTrigger(libchaos_context* ctx, int channel, int level, 
+                                 int edge, int hysteresis) {
+    /** 
+     * Trigger the plot when a channel crosses a level
+     *
+     * \param channel 1, 2 or 3 for x1, x2 or x3
+     * \param level Value from 0 to 1023
+     * \param edge LIBCHAOS_RISING, LIBCHAOS_FALLING or LIBCHAOS_EITHER
+     * \param hysteresis How far the signal must first move away from the 
+     * level on the other side. 0 for a plain level trigger.
+     */
+    LC_LOCK guard(ctx);
+    if(channel < 1 || channel > 3 || level < 0 || level > 1023 || 
+       edge < TR_RISING || edge > TR_EITHER || hysteresis < 0) {
+        return -1;
+    }
+    if(hysteresis > 0) {
+        TR_setHysteresis(&ctx->trigger, channel, level, edge, hysteresis);
+    } else {
+        TR_setLevel(&ctx->trigger, channel, level, edge);
+    }
+    return 0;
+}
+
+int libchaos_ctx_setPhaseTrigger(libchaos_context* ctx, int x1, int x2, int x3, 
+                                 int radius) {
+    /** 
+     * Trigger the plot where the trajectory passes near a point
+     *
+     * \param x3 Pass -1 to only match on x1 and x2
+     * \param radius Largest distance accepted as a match, at most 4095
+     *
+     * Passing -1 for x1 follows whatever point was used for the last 
+     * frame and picks a new one when it is lost. This is the default.
+     */
+    LC_LOCK guard(ctx);
+    if(radius < 0 || radius > TR_MAX_RADIUS) {
+        return -1;
+    }
+    if(x1 < 0) {
+        TR_setPhase(&ctx->trigger, ctx->trigger.target[0], ctx->trigger.target[1], 
+                    x3, radius, 1);
+    } else {
+        TR_setPhase(&ctx->trigger, x1, x2, x3, radius, 0);
+    }
+    return 0;
+}
+
+int libchaos_ctx_getPlotPoint(libchaos_context* ctx, int* x1, int*x2, int* x3, 
+                              int index) {
+    /** 
+     * Get the data at a specified plot point.
+     */
+    LC_LOCK guard(ctx);
+    
+     if(index > ctx->num_plot_points) {
+        return -1;
+     } else if (index < 0) {
+        return -1;
+     }
+     
+     int tmp1 = DP_getX1(ctx->plot_data[index]);
+     int tmp2 = DP_getX2(ctx->plot_data[index]);
+     int tmp3 = DP_getX3(ctx->plot_data[index]);
+     
+     *x1 = tmp1;
+     *x2 = tmp2;
+     *x3 = tmp3;
+     
+     return 0;
+}
+
+int libchaos_ctx_getNumPlotPoints(libchaos_context* ctx) {
+    /** 
+     * Returns the number of plots available for plotting
+     */
+    LC_LOCK guard(ctx);
+     
+     return ctx->num_plot_points;
+}
+
+int libchaos_ctx_setNumPlotPoints(libchaos_context* ctx, int num) {
+    /** 
+     * Set the number of points on a plot
+     */
+    LC_LOCK guard(ctx);
     if( num >= 1020 && num <= MAX_PLOT_POINTS) {
-        NUM_PLOT_POINTS = num;
+        ctx->num_plot_points = num;
+        return 0;
+    }
+    return -1;
+}
+
+int libchaos_ctx_setTransientData(libchaos_context* ctx, int amount) {
+    /** 
+     * Set the amount of transient data to drop
+     *
+     * \param amount Number of packets to drop before storing data.
+     */
+    LC_LOCK guard(ctx);
+    if( amount >= 0 && amount <= 24 ) {
+        ctx->device.transient_data = amount;
+        return 0;
+    }
+    return -1;
+}
+
+/* FFT */
+void libchaos_ctx_getFFTPlotPoint(libchaos_context* ctx, float* val, int index) {
+    /** 
+     * Get an FFT plot point
+     *
+     * The FFT is only taken while it is read, the first read after a 
+     * pause gets the last one taken until the next plot.
+     */
+    LC_LOCK guard(ctx);
+    LC_use(ctx, FR_FFT);
+    *val = (ctx->fft_data[(index*2)]);
+}
+
+void libchaos_ctx_enableFFT(libchaos_context* ctx) {
+    /** 
+     * Enable the FFT
+     */
+    LC_LOCK guard(ctx);
+    ctx->fft_enabled = 1;
+}
+
+void libchaos_ctx_disableFFT(libchaos_context* ctx) {
+    /** 
+     * Disable the FFT
+     */
+    LC_LOCK guard(ctx);
+    ctx->fft_enabled = 0;
+}
+
+/* Return Map */
+int libchaos_ctx_getReturnMap1Point(libchaos_context* ctx, int* x1, int* x2, 
+                                    int index) {
+    /** 
+     * Get the data at a specified return map point.
+     */
+    LC_LOCK guard(ctx);
+    LC_use(ctx, FR_RETURN_MAP);
+    LC_updateReturnMap(ctx);
+    return RM_getPoint(&ctx->return_map, 1, index, x1, x2);
+}
+
+int libchaos_ctx_getReturnMap2Point(libchaos_context* ctx, int* x1, int* x2, 
+                                    int index) {
+    /** 
+     * Get the data at a specified return map point.
+     */
+    LC_LOCK guard(ctx);
+    LC_use(ctx, FR_RETURN_MAP);
+    LC_updateReturnMap(ctx);
+    return RM_getPoint(&ctx->return_map, 2, index, x1, x2);
+}
+
+int libchaos_ctx_getReturnMapPoint(libchaos_context* ctx, int* xn, int* xnk, 
+                                   int index, int order) {
+    /** 
+     * Get a point (x_n, x_n+k) of a return map of any order
+     *
+     * \param order k, at least 1
+     * \param index Point number, 0 is the oldest. Points of order k are 
+     * valid up to libchaos_getNumReturnMapPointsOfOrder(k).
+     */
+    LC_LOCK guard(ctx);
+    LC_use(ctx, FR_RETURN_MAP);
+    LC_updateReturnMap(ctx);
+    return RM_getPoint(&ctx->return_map, order, index, xn, xnk);
+}
+
+int libchaos_ctx_getNumReturnMapPoints(libchaos_context* ctx) {
+    /** 
+     * Returns the number of plots available for plotting
+     *
+     * This is the number of points valid for both return map 1 and 2.
+     */
+    LC_LOCK guard(ctx);
+    LC_use(ctx, FR_RETURN_MAP);
+    LC_updateReturnMap(ctx);
+     
+     return RM_getNumPoints(&ctx->return_map, 2);
+}
+
+int libchaos_ctx_getNumReturnMapPointsOfOrder(libchaos_context* ctx, int order) {
+    /** 
+     * Returns the number of points (x_n, x_n+k) of a return map
+     *
+     * Each plot is a separate capture and no point pairs peaks from two 
+     * plots, so there are fewer points than peaks less k.
+     */
+    LC_LOCK guard(ctx);
+    LC_use(ctx, FR_RETURN_MAP);
+    LC_updateReturnMap(ctx);
+    return RM_getNumPoints(&ctx->return_map, order);
+}
+
+int libchaos_ctx_getNumReturnMapPeaks(libchaos_context* ctx) {
+    /** 
+     * Returns the number of peaks held for the return maps
+     */
+    LC_LOCK guard(ctx);
+    LC_use(ctx, FR_RETURN_MAP);
+    LC_updateReturnMap(ctx);
+    return RM_getNumPeaks(&ctx->return_map);
+}
+
+int libchaos_ctx_setReturnMapCapacity(libchaos_context* ctx, int num_peaks) {
+    /** 
+     * Set how many of the most recent peaks are kept for the return maps
+     *
+     * Collected peaks are discarded.
+     */
+    LC_LOCK guard(ctx);
+    return RM_init(&ctx->return_map, num_peaks);
+}
+
+/* Asynchronous requests */
+
+static int LC_readPlotRequest(AS_REQUEST* request) {
+    /** 
+     * Run libchaos_ctx_readPlot for libchaos_ctx_readPlotAsync
+     */
+    libchaos_context* ctx = (libchaos_context*)request->context;
+    return libchaos_ctx_readPlot(ctx, request->args[0]);
+}
+
+static int LC_getPeaksRequest(AS_REQUEST* request) {
+    /** 
+     * Run libchaos_ctx_getPeaks for libchaos_ctx_getPeaksAsync
+     */
+    libchaos_context* ctx = (libchaos_context*)request->context;
+    LC_LOCK guard(ctx);
+    request->peaks = libchaos_ctx_getPeaks(ctx, request->args[0]);
+    if(!request->peaks) {
+        return -1;
+    }
+    return peaks_getNumPeaks(&ctx->peaks, request->args[0]);
+}
+
+static int LC_sweepRequest(AS_REQUEST* request) {
+    /** 
+     * Run a sample sweep for libchaos_ctx_sweepAsync
+     *
+     * The context is locked for one part of LC_ASYNC_SWEEP_PART samples
+     * at a time, about a tenth of a second, so it can be read while the
+     * sweep runs. sweeping makes the calls that would use the
+     * unit in between fail instead of changing the MDAC value part way
+     * through a tap. Returns -1 if the sweep failed or was cancelled.
+     */
+    libchaos_context* ctx = (libchaos_context*)request->context;
+    int* args = request->args;
+    {
+        LC_LOCK guard(ctx);
+        if(LC_claimDevice(ctx) || 
+           LC_startSweep(ctx, request->filename, args[0], args[1], args[2], args[3])) {
+            return -1;
+        }
+        ctx->sweeping = 1;
+    }
+    int percent_complete;
+    for(;;) {
+        {
+            LC_LOCK guard(ctx);
+            percent_complete = LC_sweepPart(ctx, LC_ASYNC_SWEEP_PART);
+        }
+        if(percent_complete <= 0) {
+            break;
+        }
+        AS_progress(request, percent_complete);
+        if(AS_checkCancel(request)) {
+            break;
+        }
+    }
+    LC_LOCK guard(ctx);
+    LC_endSweep(ctx);
+    ctx->sweeping = 0;
+    if(percent_complete < 0 || request->stopped) {
+        return -1;
+    }
+    AS_progress(request, 100);
+    return 0;
+}
+
+static int LC_scanRequest(AS_REQUEST* request) {
+    /** 
+     * Run a progressive scan for libchaos_ctx_scanBifurcationAsync
+     *
+     * The context is locked for one tap at a time, so the diagram can be
+     * drawn and the focus moved while the scan runs.
+     */
+    libchaos_context* ctx = (libchaos_context*)request->context;
+    int last_percent = -1;
+    for(;;) {
+        int remaining = libchaos_ctx_scanBifurcation(ctx, 1);
+        if(remaining == 0) {
+            AS_progress(request, 100);
+        }
+        if(remaining <= 0) {
+            return remaining;
+        }
+        int percent = 100 - (remaining*100 + SC_NUM_TAPS - 1)/SC_NUM_TAPS;
+        if(percent != last_percent) {
+            AS_progress(request, percent);
+            last_percent = percent;
+        }
+        if(AS_checkCancel(request)) {
+            return remaining;
+        }
+    }
+}
+
+static libchaos_request* LC_submit(libchaos_context* ctx, AS_REQUEST* request) {
+    /** 
+     * Queue a request on the context's worker thread
+     */
+    if(!request || AS_submit(&ctx->requests, request)) {
+        return 0;
+    }
+    return request;
+}
+
+libchaos_request* libchaos_ctx_readPlotAsync(libchaos_context* ctx, int mdac_value, 
+                                             libchaos_callback callback, void* user) {
+    /** 
+     * Start a libchaos_ctx_readPlot on the context's worker thread
+     *
+     * \param callback Called on the worker thread with LIBCHAOS_COMPLETE 
+     * once the frame is published, may be 0
+     * \return A handle to give back with libchaos_releaseRequest, or 0
+     *
+     * Requests on one context run one after another in the order they 
+     * were made. The result is the value libchaos_ctx_readPlot returns.
+     */
+    AS_REQUEST* request = AS_newRequest(LC_readPlotRequest, ctx, callback, user);
+    if(request) {
+        request->args[0] = mdac_value;
+    }
+    return LC_submit(ctx, request);
+}
+
+libchaos_request* libchaos_ctx_getPeaksAsync(libchaos_context* ctx, int mdac_value, 
+                                             libchaos_callback callback, void* user) {
+    /** 
+     * Start a libchaos_ctx_getPeaks on the context's worker thread
+     *
+     * The result is the number of peaks, which libchaos_getRequestPeaks 
+     * returns once the request is done.
+     */
+    AS_REQUEST* request = AS_newRequest(LC_getPeaksRequest, ctx, callback, user);
+    if(request) {
+        request->args[0] = mdac_value;
+    }
+    return LC_submit(ctx, request);
+}
+
+libchaos_request* libchaos_ctx_scanBifurcationAsync(libchaos_context* ctx, 
+                                                    libchaos_callback callback, void* user) {
+    /** 
+     * Run libchaos_ctx_scanBifurcation on the context's worker thread 
+     * until every MDAC value has been taken
+     *
+     * callback gets LIBCHAOS_PROGRESS with the percent of MDAC values 
+     * taken. The result is the number still missing, 0 unless the 
+     * request was cancelled, or -1 if the device could not be read.
+     */
+    return LC_submit(ctx, AS_newRequest(LC_scanRequest, ctx, callback, user));
+}
+
+libchaos_request* libchaos_ctx_sweepAsync(libchaos_context* ctx, char* filename, int start, 
+                                          int end, int step, int periods, 
+                                          libchaos_callback callback, void* user) {
+    /** 
+     * Start a sample sweep to a CSV file on the context's worker thread
+     *
+     * callback gets LIBCHAOS_PROGRESS with the percent complete after each
+     * part of the sweep. A cancelled sweep stops after the current part
+     * and the file keeps the taps already finished.
+     *
+     * The context is only held for one part at a time, so it can be read
+     * while the sweep runs. Calls that would use the unit fail with -1 
+     * until the sweep ends. The result is 0, or -1 with the status 
+     * LIBCHAOS_FAILED or LIBCHAOS_CANCELLED.
+     */
+    AS_REQUEST* request = AS_newRequest(LC_sweepRequest, ctx, callback, user);
+    if(request) {
+        request->args[0] = start;
+        request->args[1] = end;
+        request->args[2] = step;
+        request->args[3] = periods;
+        request->filename = (char*)malloc(strlen(filename) + 1);
+        if(!request->filename) {
+            free(request);
+            return 0;
+        }
+        strcpy(request->filename, filename);
+    }
+    return LC_submit(ctx, request);
+}
+
+int libchaos_cancel(libchaos_request* request) {
+    /** 
+     * Cancel a request
+     *
+     * A queued request never runs. A running sweep stops after the 
+     * current part, other requests run to the end. Either way the 
+     * callback gets LIBCHAOS_COMPLETE. Returns -1 if the request had 
+     * already finished.
+     */
+    return AS_cancel(request);
+}
+
+int libchaos_wait(libchaos_request* request) {
+    /** 
+     * Wait for a request to finish and return its result
+     *
+     * Must not be called from a callback.
+     */
+    return AS_wait(request);
+}
+
+int libchaos_getRequestStatus(libchaos_request* request) {
+    /** 
+     * Returns LIBCHAOS_QUEUED, LIBCHAOS_RUNNING, LIBCHAOS_DONE, 
+     * LIBCHAOS_CANCELLED or LIBCHAOS_FAILED
+     *
+     * A request that ran to the end with a negative result has failed.
+     */
+    return AS_getStatus(request);
+}
+
+int libchaos_getRequestResult(libchaos_request* request) {
+    /** 
+     * Returns the result of a finished request, -1 if it did not finish
+     */
+    if(AS_getStatus(request) < AS_DONE) {
+        return -1;
+    }
+    return request->result;
+}
+
+int libchaos_getRequestProgress(libchaos_request* request) {
+    /** 
+     * Returns the last progress reported by a request, in percent
+     */
+    return AS_getProgress(request);
+}
+
+int* libchaos_getRequestPeaks(libchaos_request* request) {
+    /** 
+     * Returns the peaks found by a finished libchaos_getPeaksAsync
+     */
+    if(AS_getStatus(request) < AS_DONE) {
+        return 0;
+    }
+    return request->peaks;
+}
+
+void libchaos_releaseRequest(libchaos_request* request) {
+    /** 
+     * Give back a request handle
+     *
+     * The request is not cancelled. Every handle must be given back 
+     * before its context is destroyed.
+     */
+    if(request) {
+        AS_release(request);
+    }
+}
+
+/* Analysis stages */
+
+typedef struct {
+    libchaos_stage_function function;
+    void* user;
+} LC_USER_STAGE;
+
+static void LC_userStage(void* arg, PL_BLOCK* block) {
+    /** 
+     * Pass a block to a stage added with libchaos_ctx_addStage
+     */
+    LC_USER_STAGE* stage = (LC_USER_STAGE*)arg;
+    stage->function(stage->user, block->mdac, block->samples, block->x1, block->x2, 
+                    block->x3, block->num_samples);
+}
+
+static PL_PIPELINE* LC_getStream(libchaos_context* ctx, int stream) {
+    /** 
+     * Returns the pipeline of a stream, or 0
+     */
+    if(stream == LIBCHAOS_PLOT_STREAM) {
+        return &ctx->plot_pipeline;
+    } else if(stream == LIBCHAOS_SWEEP_STREAM) {
+        return &ctx->sweep_pipeline;
+    }
+    return 0;
+}
+
+int libchaos_ctx_addStage(libchaos_context* ctx, int stream, const char* name, 
+                          libchaos_stage_function function, void* user, 
+                          int queue_length, int policy) {
+    /** 
+     * Run a function on every block of samples of a stream
+     *
+     * \param stream LIBCHAOS_PLOT_STREAM for every libchaos_readPlot 
+     * capture, LIBCHAOS_SWEEP_STREAM for every tap of a sample sweep
+     * \param queue_length Blocks that may wait for the function
+     * \param policy LIBCHAOS_WAIT to hold up the capture when the queue
+     * is full, LIBCHAOS_DROP to throw away the oldest waiting block
+     * \return A stage number, or -1
+     *
+     * The function runs on a worker thread, one block at a time and in 
+     * order. It must not call libchaos with the same context.
+     */
+    LC_LOCK guard(ctx);
+    PL_PIPELINE* pipeline = LC_getStream(ctx, stream);
+    if(!pipeline || !function) {
+        return -1;
+    }
+    LC_USER_STAGE* stage = (LC_USER_STAGE*)malloc(sizeof(LC_USER_STAGE));
+    if(!stage) {
+        return -1;
+    }
+    stage->function = function;
+    stage->user = user;
+    int number = PL_addStage(pipeline, name, LC_userStage, stage, queue_length, policy);
+    if(number < 0) {
+        free(stage);
+        return -1;
+    }
+    number += stream*PL_MAX_STAGES;
+    ctx->user_stages[number] = stage;
+    return number;
+}
+
+int libchaos_ctx_removeStage(libchaos_context* ctx, int stage) {
+    /** 
+     * Remove a stage added with libchaos_ctx_addStage
+     *
+     * Returns once the stage function is no longer running.
+     */
+    LC_LOCK guard(ctx);
+    if(stage < 0 || stage >= 2*PL_MAX_STAGES || !ctx->user_stages[stage]) {
+        return -1;
+    }
+    PL_removeStage(LC_getStream(ctx, stage/PL_MAX_STAGES), stage % PL_MAX_STAGES);
+    free(ctx->user_stages[stage]);
+    ctx->user_stages[stage] = 0;
+    return 0;
+}
+
+int libchaos_ctx_findStage(libchaos_context* ctx, int stream, const char* name) {
+    /** 
+     * Get the number of a stage from its name
+     *
+     * The built in plot stages are "trigger", "fft", "return map", 
+     * "poincare", "voxels", "history", "spectrogram", "publish" and 
+     * "server". Sweeps have "csv", "spectrogram", "classify", "publish" 
+     * and "server".
+     */
+    LC_LOCK guard(ctx);
+    PL_PIPELINE* pipeline = LC_getStream(ctx, stream);
+    if(!pipeline) {
+        return -1;
+    }
+    int number = PL_findStage(pipeline, name);
+    return number < 0 ? -1 : number + stream*PL_MAX_STAGES;
+}
+
+int libchaos_ctx_getStageStats(libchaos_context* ctx, int stage, long long* blocks, 
+                               long long* dropped, double* busy_time, double* max_time, 
+                               double* wait_time) {
+    /** 
+     * Get how a stage is keeping up
+     *
+     * \param blocks Set to the number of blocks processed
+     * \param dropped Set to the number of blocks thrown away
+     * \param busy_time, max_time Set to the total and longest time spent 
+     * on a block, in seconds
+     * \param wait_time Set to how long captures were held up by the 
+     * stage, in seconds
+     */
+    LC_LOCK guard(ctx);
+    PL_STATS stats;
+    if(stage < 0 || stage >= 2*PL_MAX_STAGES || 
+       PL_getStats(LC_getStream(ctx, stage/PL_MAX_STAGES), stage % PL_MAX_STAGES, &stats)) {
+        return -1;
+    }
+    *blocks = stats.blocks;
+    *dropped = stats.dropped;
+    *busy_time = stats.busy_time;
+    *max_time = stats.max_time;
+    *wait_time = stats.wait_time;
+    return 0;
+}
+
+/* Frames */
+
+const libchaos_frame* libchaos_ctx_acquireFrame(libchaos_context* ctx) {
+    /** 
+     * Get the most recent frame taken by libchaos_ctx_readPlot
+     *
+     * \return The frame, or 0 before the first libchaos_ctx_readPlot
+     *
+     * The frame is a consistent snapshot that does not change until it 
+     * is given back with libchaos_releaseFrame. This does not take the 
+     * context lock, so a renderer never waits for a capture in progress.
+     */
+    return FR_acquire(&ctx->frames);
+}
+
+void libchaos_releaseFrame(const libchaos_frame* frame) {
+    /** 
+     * Give back a frame from libchaos_acquireFrame
+     */
+    FR_release((FR_FRAME*)frame);
+}
+
+unsigned int libchaos_frameGetSequence(const libchaos_frame* frame) {
+    /** 
+     * Returns the frame number, which increases by one for each frame
+     */
+    return frame->sequence;
+}
+
+int libchaos_frameGetMDACValue(const libchaos_frame* frame) {
+    /** 
+     * Returns the MDAC value the frame was taken at
+     */
+    return frame->mdac;
+}
+
+int libchaos_frameGetNumPlotPoints(const libchaos_frame* frame) {
+    /** 
+     * Returns the number of plot points in the frame
+     */
+    return frame->num_points;
+}
+
+int libchaos_frameGetPlotPoint(const libchaos_frame* frame, int* x1, int* x2, int* x3, 
+                               int index) {
+    /** 
+     * Get the data at a plot point of a frame
+     */
+    if(index < 0 || index >= frame->num_points) {
+        return -1;
+    }
+    *x1 = DP_getX1(frame->plot_data[index]);
+    *x2 = DP_getX2(frame->plot_data[index]);
+    *x3 = DP_getX3(frame->plot_data[index]);
+    return 0;
+}
+
+int libchaos_frameGetTriggerIndex(const libchaos_frame* frame) {
+    /** 
+     * Returns the trigger index of a frame
+     *
+     * Frames only carry the trigger point, FFT, return map and statistics
+     * while they are read. The first read of one asks for it in the 
+     * following frames and gets nothing from this one, 0 here.
+     */
+    if(!FR_use((FR_FRAME*)frame, FR_TRIGGER)) {
+        return 0;
+    }
+    return frame->trigger_index;
+}
+
+int libchaos_frameGetTriggerQuality(const libchaos_frame* frame) {
+    /** 
+     * Returns how closely the trigger point of a frame matched, 0 to 100
+     */
+    if(!FR_use((FR_FRAME*)frame, FR_TRIGGER)) {
+        return 0;
+    }
+    return frame->trigger_quality;
+}
+
+void libchaos_frameGetFFTPlotPoint(const libchaos_frame* frame, float* val, int index) {
+    /** 
+     * Get an FFT plot point of a frame, 0 if the frame has no FFT
+     */
+    *val = FR_use((FR_FRAME*)frame, FR_FFT) ? frame->fft_data[index*2] : 0.0f;
+}
+
+int libchaos_frameGetPlotStatistics(const libchaos_frame* frame, int channel, int* min, 
+                                    int* max, float* mean, float* deviation) {
+    /** 
+     * Get the range, mean and standard deviation of a channel of a frame
+     *
+     * \param channel 1, 2 or 3 for x1, x2 or x3
+     * \return -1 for a bad channel or a frame without statistics
+     */
+    if(channel < 1 || channel > 3 || !FR_use((FR_FRAME*)frame, FR_STATISTICS)) {
+        return -1;
+    }
+    *min = frame->statistics.min[channel - 1];
+    *max = frame->statistics.max[channel - 1];
+    *mean = frame->statistics.mean[channel - 1];
+    *deviation = frame->statistics.deviation[channel - 1];
+    return 0;
+}
+
+int libchaos_frameGetNumReturnMapPeaks(const libchaos_frame* frame) {
+    /** 
+     * Returns the number of return map peaks held by a frame
+     */
+    if(!FR_use((FR_FRAME*)frame, FR_RETURN_MAP)) {
+        return 0;
+    }
+    return RM_getNumPeaks((RM_BUILDER*)&frame->return_map);
+}
+
+int libchaos_frameGetNumReturnMapPoints(const libchaos_frame* frame, int order) {
+    /** 
+     * Returns the number of return map points of an order held by a frame
+     */
+    if(!FR_use((FR_FRAME*)frame, FR_RETURN_MAP)) {
+        return 0;
+    }
+    return RM_getNumPoints((RM_BUILDER*)&frame->return_map, order);
+}
+
+int libchaos_frameGetReturnMapPoint(const libchaos_frame* frame, int* xn, int* xnk, 
+                                    int index, int order) {
+    /** 
+     * Get a point (x_n, x_n+k) of the return map held by a frame
+     */
+    if(!FR_use((FR_FRAME*)frame, FR_RETURN_MAP)) {
+        return -1;
+    }
+    return RM_getPoint((RM_BUILDER*)&frame->return_map, order, index, xn, xnk);
+}
+
+/* Shared memory */
+
+struct libchaos_subscriber {
+    SR_RING ring;
+};
+
+int libchaos_ctx_startPublishing(libchaos_context* ctx, const char* name, int num_slots, 
+                                 int slot_samples) {
+    /** 
+     * Publish every plot and sweep tap to a shared memory ring
+     *
+     * \param name Name other processes pass to libchaos_subscribe
+     * \param num_slots Blocks held, a reader further behind loses blocks
+     * \param slot_samples Longest block in one slot, longer ones are split
+     *
+     * Only the process that opened the unit can sample, this lets any 
+     * number of local processes watch what it samples without a copy or
+     * a system call per block. The publisher never waits for a reader.
+     * A ring already published is replaced. Returns -1 if another live 
+     * process publishes under name.
+     */
+    LC_LOCK guard(ctx);
+    PL_flush(&ctx->plot_pipeline);
+    PL_flush(&ctx->sweep_pipeline);
+    SR_close(&ctx->publisher);
+    return SR_create(&ctx->publisher, name, num_slots, slot_samples);
+}
+
+void libchaos_ctx_stopPublishing(libchaos_context* ctx) {
+    /** 
+     * Stop publishing and remove the ring's name
+     *
+     * Subscribers keep the blocks they have mapped until they unsubscribe.
+     */
+    LC_LOCK guard(ctx);
+    PL_flush(&ctx->plot_pipeline);
+    PL_flush(&ctx->sweep_pipeline);
+    SR_close(&ctx->publisher);
+}
+
+libchaos_subscriber* libchaos_subscribe(const char* name) {
+    /** 
+     * Map a ring published by libchaos_startPublishing, maybe in another
+     * process
+     *
+     * \return The subscriber, or 0 if no ring has that name. It starts at
+     * the next block published.
+     *
+     * A subscriber is used by one thread at a time, and does not need the
+     * unit or libchaos_init.
+     */
+    libchaos_subscriber* subscriber = 
+        (libchaos_subscriber*)calloc(1, sizeof(libchaos_subscriber));
+    if(!subscriber) {
+        return 0;
+    }
+    if(SR_open(&subscriber->ring, name)) {
+        free(subscriber);
+        return 0;
+    }
+    return subscriber;
+}
+
+void libchaos_unsubscribe(libchaos_subscriber* subscriber) {
+    /** 
+     * Unmap a ring and free the subscriber
+     */
+    if(subscriber) {
+        SR_close(&subscriber->ring);
+        free(subscriber);
+    }
+}
+
+const libchaos_shared_block* libchaos_subscriberNext(libchaos_subscriber* subscriber) {
+    /** 
+     * Take the next block published
+     *
+     * \return The block, or 0 if there is no new one yet
+     *
+     * The block is read where it lies in the ring and the publisher may 
+     * overwrite it at any time. Once done with it, call 
+     * libchaos_subscriberValid to find out whether what was read holds.
+     */
+    return SR_next(&subscriber->ring);
+}
+
+int libchaos_subscriberValid(libchaos_subscriber* subscriber) {
+    /** 
+     * Check that the last block taken was not overwritten while it was read
+     *
+     * \return 1 if everything read from it so far is good, 0 if not
+     */
+    return SR_valid(&subscriber->ring) ? 1 : 0;
+}
+
+long long libchaos_subscriberMissed(libchaos_subscriber* subscriber) {
+    /** 
+     * Returns the number of blocks overwritten before they were taken
+     */
+    return subscriber->ring.missed;
+}
+
+int libchaos_subscriberPublishing(libchaos_subscriber* subscriber) {
+    /** 
+     * Returns 1 while the publisher has not stopped, 0 once it has
+     */
+    return TH_atomicLoad(&subscriber->ring.header->publishing);
+}
+
+long long libchaos_sharedBlockGetSequence(const libchaos_shared_block* block) {
+    /** 
+     * Returns the block number, which increases by one for each block
+     */
+    return block->sequence;
+}
+
+int libchaos_sharedBlockGetStream(const libchaos_shared_block* block) {
+    /** 
+     * Returns LIBCHAOS_PLOT_STREAM or LIBCHAOS_SWEEP_STREAM
+     */
+    return block->stream;
+}
+
+int libchaos_sharedBlockGetMDACValue(const libchaos_shared_block* block) {
+    /** 
+     * Returns the MDAC value the block was taken at
+     */
+    return block->mdac;
+}
+
+int libchaos_sharedBlockGetNumSamples(const libchaos_shared_block* block) {
+    /** 
+     * Returns the number of samples in the block
+     */
+    return block->num_samples;
+}
+
+long long libchaos_sharedBlockGetPosition(const libchaos_shared_block* block) {
+    /** 
+     * Returns the position of the first sample in its stream
+     *
+     * A block split across slots continues at the position of the one 
+     * before.
+     */
+    return block->position;
+}
+
+long long libchaos_sharedBlockGetTime(const libchaos_shared_block* block) {
+    /** 
+     * Returns when the block was published, in nanoseconds of the 
+     * publisher's monotonic clock
+     */
+    return block->time;
+}
+
+const int* libchaos_sharedBlockGetSamples(const libchaos_shared_block* block) {
+    /** 
+     * Returns the packed samples of a block
+     */
+    return SR_samples((SR_SLOT*)block);
+}
+
+const short* libchaos_sharedBlockGetChannel(libchaos_subscriber* subscriber, 
+                                            const libchaos_shared_block* block, 
+                                            int channel) {
+    /** 
+     * Returns x1, x2 or x3 of a block
+     *
+     * \param channel 1, 2 or 3
+     */
+    if(channel < 1 || channel > 3) {
+        return 0;
+    }
+    return SR_channel(&subscriber->ring, (SR_SLOT*)block, channel);
+}
+
+/* Server */
+
+int libchaos_ctx_startServer(libchaos_context* ctx, const char* address, int queue_length, 
+                             int policy) {
+    /** 
+     * Stream plots, sweep taps and their peaks to local clients
+     *
+     * \param address "unix:path" for a Unix domain socket or "tcp:port"
+     * for a port on the loopback interface, "tcp:0" picks a free one. A 
+     * path that exists must be a socket, which is replaced.
+     * \param queue_length Messages held for each client
+     * \param policy What a client's full queue does by default, 
+     * LIBCHAOS_DROP_NEWEST, LIBCHAOS_DROP_OLDEST or LIBCHAOS_BLOCK, which
+     * holds up the other clients for up to a second before the client is
+     * dropped
+     * \return The TCP port, 0 for a Unix domain socket, -1 on error
+     *
+     * Sampling never waits for a client. While a LIBCHAOS_BLOCK client 
+     * holds up the server, no new messages reach the other clients 
+     * either, and the plots and taps that arrive meanwhile are dropped 
+     * for every client, so only use it when that client matters most. The message 
+     * framing is described in server.cpp. A server already running is 
+     * replaced. Not available on Windows.
+     */
+    LC_LOCK guard(ctx);
+    PL_flush(&ctx->plot_pipeline);
+    PL_flush(&ctx->sweep_pipeline);
+    SV_stop(&ctx->server);
+    return SV_start(&ctx->server, address, queue_length, policy);
+}
+
+void libchaos_ctx_stopServer(libchaos_context* ctx) {
+    /** 
+     * Disconnect every client and stop the server
+     */
+    LC_LOCK guard(ctx);
+    PL_flush(&ctx->plot_pipeline);
+    PL_flush(&ctx->sweep_pipeline);
+    SV_stop(&ctx->server);
+}
+
+int libchaos_ctx_getServerStats(libchaos_context* ctx, int* clients, long long* messages, 
+                                long long* dropped, long long* disconnected) {
+    /** 
+     * Get counts since the server started
+     *
+     * \param clients Set to the clients connected
+     * \param messages Set to the messages sent, each to every client
+     * \param dropped Set to the messages clients lost to full queues
+     * \param disconnected Set to the clients that went away or were dropped
+     * \return -1 if the server is not running
+     */
+    LC_LOCK guard(ctx);
+    SV_stats(&ctx->server, clients, messages, dropped, disconnected);
+    return ctx->server.running ? 0 : -1;
+}
+
+/* Poincare section */
+
+int libchaos_ctx_setPoincareSection(libchaos_context* ctx, float a, float b, 
+                                    float c, float d, int direction, 
+                                    int interpolation) {
+    /** 
+     * Collect crossings of the plane a*x1 + b*x2 + c*x3 = d
+     *
+     * \param direction LIBCHAOS_RISING for crossings in the direction of
+     * (a, b, c), LIBCHAOS_FALLING for the opposite or LIBCHAOS_EITHER
+     * \param interpolation LIBCHAOS_LINEAR or LIBCHAOS_CUBIC
+     *
+     * Once set, every libchaos_readPlot frame is searched for crossings.
+     * Points already collected are discarded. Returns -1 for an unknown
+     * direction or interpolation or a plane without a normal.
+     */
+    LC_LOCK guard(ctx);
+    if(direction < PS_POSITIVE || direction > PS_BOTH || 
+       (interpolation != PS_LINEAR && interpolation != PS_CUBIC) ||
+       (a == 0 && b == 0 && c == 0)) {
+        return -1;
+    }
+    if(!ctx->section.capacity && PS_init(&ctx->section)) {
+        return -1;
+    }
+    PS_setPlane(&ctx->section, a, b, c, d, direction, interpolation);
+    PS_clear(&ctx->section);
+    return 0;
+}
+
+int libchaos_ctx_setPoincareCapacity(libchaos_context* ctx, int num_points) {
+    /** 
+     * Set how many of the most recent crossings are kept
+     */
+    LC_LOCK guard(ctx);
+    return PS_init(&ctx->section, num_points);
+}
+
+void libchaos_ctx_clearPoincarePoints(libchaos_context* ctx) {
+    /** 
+     * Throw away the collected crossings
+     */
+    LC_LOCK guard(ctx);
+    PS_clear(&ctx->section);
+}
+
+int libchaos_ctx_getNumPoincarePoints(libchaos_context* ctx) {
+    /** 
+     * Returns the number of crossings available
+     */
+    LC_LOCK guard(ctx);
+    return PS_getNumPoints(&ctx->section);
+}
+
+int libchaos_ctx_getPoincarePoint(libchaos_context* ctx, float* x1, float* x2, 
+                                  float* x3, int index) {
+    /** 
+     * Get a crossing point, 0 is the oldest
+     */
+    LC_LOCK guard(ctx);
+    return PS_getPoint(&ctx->section, index, x1, x2, x3, 0);
+}
+
+int libchaos_ctx_poincareSweep(libchaos_context* ctx, char* filename, int mdac_value) {
+    /** 
+     * Find the crossings for one tap of a sweep file
+     *
+     * \param filename CSV file written by libchaos_sampleToCSV
+     * \param mdac_value Tap to use
+     * \return The number of crossings found, or -1 if the file could not 
+     * be read
+     *
+     * The section must be set with libchaos_setPoincareSection first. 
+     * Points already collected are discarded.
+     */
+    LC_LOCK guard(ctx);
+    const int block_size = 1 << 16;
+    DP_SWEEP sweep;
+    int tap;
+    int first;
+    int num_samples;
+    int found = 0;
+    
+    if(!ctx->section.capacity) {
+        return -1;
+    }
+    int* data = (int*)BP_alloc(block_size*sizeof(int));
+    if(!data) {
+        return -1;
+    }
+    if(DP_openSweep(&sweep, filename)) {
+        LOG_TEXT(LOG_ERROR, "File %s failed to open\n", filename);
+        BP_free(data);
+        return -1;
+    }
+    
+    PS_clear(&ctx->section);
+    // long taps are read in blocks that continue the stream
+    while((num_samples = DP_readSweepBlock(&sweep, data, block_size, &tap, &first)) > 0) {
+        if(tap == mdac_value) {
+            if(first) {
+                PS_breakStream(&ctx->section);
+            }
+            found += PS_process(&ctx->section, data, num_samples);
+        }
+    }
+    
+    DP_closeSweep(&sweep);
+    BP_free(data);
+    return found;
+}
+
+/* Attractor density */
+
+int libchaos_ctx_enableVoxels(libchaos_context* ctx, int resolution, float decay) {
+    /** 
+     * Start accumulating a 3-D density of the attractor
+     *
+     * \param resolution Voxels along each axis, a power of two from 8 to
+     * 1024
+     * \param decay Factor applied to the density at each 
+     * libchaos_readPlot, 1 keeps everything
+     *
+     * The density is stored in bricks of 8x8x8 voxels that are only 
+     * allocated where the attractor goes.
+     */
+    LC_LOCK guard(ctx);
+    return VX_init(&ctx->voxels, resolution, decay);
+}
+
+void libchaos_ctx_disableVoxels(libchaos_context* ctx) {
+    /** 
+     * Stop accumulating the density and free its memory
+     */
+    LC_LOCK guard(ctx);
+    VX_free(&ctx->voxels);
+}
+
+unsigned int libchaos_ctx_getVoxelGeneration(libchaos_context* ctx) {
+    /** 
+     * Returns the current density generation
+     *
+     * The generation increases with every frame. Pass it to 
+     * libchaos_getChangedVoxelBricks on the next redraw.
+     */
+    LC_LOCK guard(ctx);
+    return ctx->voxels.generation;
+}
+
+int libchaos_ctx_getChangedVoxelBricks(libchaos_context* ctx, unsigned int since, 
+                                       int* bricks, int max_bricks) {
+    /** 
+     * List the bricks that gained samples or were freed after a generation
+     *
+     * \return The number of entries written to bricks
+     */
+    LC_LOCK guard(ctx);
+    if(!ctx->voxels.bricks) {
         return 0;
     }
-    return -1;
+    return VX_getChangedBricks(&ctx->voxels, since, bricks, max_bricks);
 }
 
-int libchaos_setTransientData(int amount) {
+float* libchaos_ctx_getVoxelBrick(libchaos_context* ctx, int brick, int* bx, 
+                                  int* by, int* bz) {
     /** 
-     * Set the amount of transient data to drop
+     * Get the 8x8x8 densities of a brick
      *
-     * \param amount Number of packets to drop before storing data.
+     * \param bx, by, bz Set to the position of the brick in units of 8 
+     * voxels
+     * \return Densities with x varying fastest, or 0 if the brick is empty
      */
-    if( amount >= 0 && amount <= 24 ) {
-        UC_TRANSIENT_DATA = amount;
+    LC_LOCK guard(ctx);
+    if(!ctx->voxels.bricks) {
         return 0;
     }
-    return -1;
+    return VX_getBrick(&ctx->voxels, brick, bx, by, bz);
 }
 
-/* FFT */
-void libchaos_getFFTPlotPoint(float* val, int index) {
+/* Waveform history */
+
+int libchaos_ctx_enableHistory(libchaos_context* ctx, int raw_samples, 
+                               int bins_per_level) {
     /** 
-     * Get an FFT plot point
+     * Start keeping a min/max history of the plot data
+     *
+     * \param raw_samples Number of recent samples kept at full resolution
+     * \param bins_per_level Size of each level of the min/max pyramid. 
+     * Level k covers bins_per_level*(16 << k) samples, so with 12 levels
+     * even a small value reaches back hours.
+     *
+     * Every libchaos_readPlot frame is appended to the history.
      */
-    *val = (FFT_DATA[(index*2)]);
+    LC_LOCK guard(ctx);
+    return LOD_init(&ctx->history, raw_samples, bins_per_level);
 }
 
-void libchaos_enableFFT() {
+void libchaos_ctx_disableHistory(libchaos_context* ctx) {
     /** 
-     * Enable the FFT
+     * Stop keeping the history and free its memory
      */
-    FFT_ENABLED = 1;
+    LC_LOCK guard(ctx);
+    LOD_free(&ctx->history);
 }
 
-void libchaos_disableFFT() {
+long long libchaos_ctx_getHistoryLength(libchaos_context* ctx) {
     /** 
-     * Disable the FFT
+     * Returns the number of samples appended to the history
      */
-    FFT_ENABLED = 0;
+    LC_LOCK guard(ctx);
+    return ctx->history.num_samples;
 }
 
-/* Return Map */
-int libchaos_getReturnMap1Point(int* x1, int* x2, int index) {
+int libchaos_ctx_getHistoryWindow(libchaos_context* ctx, int channel, 
+                                  long long start, long long end, int pixels, 
+                                  int* min, int* max) {
     /** 
-     * Get the data at a specified return map point.
+     * Get the min/max of a channel over a window of the history
+     *
+     * \param channel 1, 2 or 3 for x1, x2 or x3
+     * \param start, end Window in samples from the start of the history
+     * \param pixels Number of entries to fill in min and max
+     *
+     * The cost depends on pixels, not the length of the window. Pixels
+     * that are no longer held get -1.
+     */
+    LC_LOCK guard(ctx);
+    return LOD_query(&ctx->history, channel, start, end, pixels, min, max);
+}
+
+int libchaos_ctx_loadHistorySweep(libchaos_context* ctx, char* filename, 
+                                  int mdac_value) {
+    /** 
+     * Replace the history with one tap of a sweep file
+     *
+     * \return The number of samples loaded, or -1 if the file could not
+     * be read
      */
+    LC_LOCK guard(ctx);
+    const int block_size = 1 << 16;
+    DP_SWEEP sweep;
+    int tap;
+    int first;
+    int num_samples;
+    int total = 0;
     
-     if(index > NUM_PLOT_POINTS) {
+    if(!ctx->history.raw && LOD_init(&ctx->history)) {
         return -1;
-     } else if (index < 0) {
+    }
+    int* data = (int*)BP_alloc(block_size*sizeof(int));
+    if(!data) {
         return -1;
-     }
-     
-     *x1 = PLOT_RETURN_MAP_POINTS[index*3];
-     *x2 = PLOT_RETURN_MAP_POINTS[(index*3)+1];
-     
-     return 0;
+    }
+    if(DP_openSweep(&sweep, filename)) {
+        LOG_TEXT(LOG_ERROR, "File %s failed to open\n", filename);
+        BP_free(data);
+        return -1;
+    }
+    
+    LOD_clear(&ctx->history);
+    // long taps are read in blocks and appended in turn
+    while((num_samples = DP_readSweepBlock(&sweep, data, block_size, &tap, &first)) > 0) {
+        if(tap == mdac_value) {
+            LOD_append(&ctx->history, data, num_samples);
+            total += num_samples;
+        }
+    }
+    
+    DP_closeSweep(&sweep);
+    BP_free(data);
+    return total;
 }
 
-int libchaos_getReturnMap2Point(int* x1, int* x2, int index) {
+/* Spectrogram */
+
+int libchaos_ctx_enableSpectrogram(libchaos_context* ctx, int stream, int size, int hop, 
+                                   int window, int num_rows) {
     /** 
-     * Get the data at a specified return map point.
+     * Start turning a stream into rows of log power against frequency
+     *
+     * \param stream LIBCHAOS_PLOT_STREAM for every libchaos_readPlot 
+     * frame, LIBCHAOS_SWEEP_STREAM for every tap of a sample sweep, -1 
+     * for only the samples given to libchaos_addSpectrogramSamples
+     * \param size Samples in each transform, a power of 2 from 64 to 65536
+     * \param hop Samples between rows
+     * \param window One of LIBCHAOS_WINDOW_*
+     * \param num_rows Rows kept, older rows are overwritten
+     *
+     * Each row has size/2 bins of x1, bin k is at 
+     * k*LIBCHAOS_SAMPLE_FREQUENCY/size Hz. Windows do not span two frames
+     * or taps. A spectrogram already running is replaced.
      */
-    
-     if(index > NUM_PLOT_POINTS) {
+    LC_LOCK guard(ctx);
+    PL_flush(&ctx->plot_pipeline);
+    PL_flush(&ctx->sweep_pipeline);
+    ST_free(&ctx->spectrogram);
+    if(stream < -1 || stream > LIBCHAOS_SWEEP_STREAM ||
+       ST_init(&ctx->spectrogram, size, hop, window, num_rows)) {
         return -1;
-     } else if (index < 0) {
+    }
+    ctx->spectrogram.stream = stream;
+    return 0;
+}
+
+void libchaos_ctx_disableSpectrogram(libchaos_context* ctx) {
+    /** 
+     * Stop the spectrogram and free its rows
+     */
+    LC_LOCK guard(ctx);
+    PL_flush(&ctx->plot_pipeline);
+    PL_flush(&ctx->sweep_pipeline);
+    ST_free(&ctx->spectrogram);
+}
+
+int libchaos_ctx_setSpectrogramRange(libchaos_context* ctx, float min_db, float max_db) {
+    /** 
+     * Set the dB values shown as 0 and 255 by libchaos_getSpectrogramImage
+     *
+     * Only rows made from now on use the new range. The default is 0 to 
+     * 120 dB.
+     */
+    LC_LOCK guard(ctx);
+    if(!ctx->spectrogram.plan || max_db <= min_db) {
         return -1;
-     }
-     
-     *x1 = PLOT_RETURN_MAP_POINTS[index*3];
-     *x2 = PLOT_RETURN_MAP_POINTS[(index*3)+2];
-     
-     return 0;
+    }
+    ST_setRange(&ctx->spectrogram, min_db, max_db);
+    return 0;
 }
 
-int libchaos_getNumReturnMapPoints() {
+int libchaos_ctx_addSpectrogramSamples(libchaos_context* ctx, int* samples, 
+                                       int num_samples, int mdac_value) {
     /** 
-     * Returns the number of plots available for plotting
+     * Add samples that follow the last ones added, such as a capture file
+     *
+     * \return Rows made, or -1 if no spectrogram is running
      */
-     
-     return PLOT_RETURN_MAP_NUM_POINTS;
+    LC_LOCK guard(ctx);
+    if(!ctx->spectrogram.plan) {
+        return -1;
+    }
+    short x1[1024];
+    int rows = 0;
+    for(int i = 0; i < num_samples; i += 1024) {
+        int length = num_samples - i < 1024 ? num_samples - i : 1024;
+        for(int j = 0; j < length; j++) {
+            x1[j] = (short)DP_getX1(samples[i + j]);
+        }
+        rows += ST_add(&ctx->spectrogram, x1, length, mdac_value, 1);
+    }
+    return rows;
+}
+
+long long libchaos_ctx_getSpectrogramRows(libchaos_context* ctx) {
+    /** 
+     * Returns the number of rows made since the spectrogram was enabled
+     */
+    LC_LOCK guard(ctx);
+    if(!ctx->spectrogram.plan) {
+        return 0;
+    }
+    TH_lock(&ctx->spectrogram.lock);
+    long long rows = ctx->spectrogram.rows;
+    TH_unlock(&ctx->spectrogram.lock);
+    return rows;
+}
+
+int libchaos_ctx_getSpectrogramBins(libchaos_context* ctx) {
+    /** 
+     * Returns the number of values in a row, 0 if no spectrogram is running
+     */
+    LC_LOCK guard(ctx);
+    return ctx->spectrogram.bins;
+}
+
+int libchaos_ctx_getSpectrogram(libchaos_context* ctx, long long first, int num_rows, 
+                                float* power, int* mdac_values) {
+    /** 
+     * Copy rows of log power in dB
+     *
+     * \param first Row number, counted from the first row made
+     * \param power Room for num_rows rows of libchaos_getSpectrogramBins
+     * values
+     * \param mdac_values Gets the MDAC value of each row, or 0
+     * \return Rows copied, -1 if first is no longer kept
+     */
+    LC_LOCK guard(ctx);
+    if(!ctx->spectrogram.plan) {
+        return -1;
+    }
+    return ST_getRows(&ctx->spectrogram, first, num_rows, power, 0, mdac_values);
+}
+
+int libchaos_ctx_getSpectrogramImage(libchaos_context* ctx, long long first, int num_rows, 
+                                     unsigned char* image, int* mdac_values) {
+    /** 
+     * Copy rows as bytes for display, scaled by libchaos_setSpectrogramRange
+     *
+     * Same as libchaos_getSpectrogram with one byte per value.
+     */
+    LC_LOCK guard(ctx);
+    if(!ctx->spectrogram.plan) {
+        return -1;
+    }
+    return ST_getRows(&ctx->spectrogram, first, num_rows, 0, image, mdac_values);
+}
+
+/* Classification */
+
+int libchaos_ctx_classifySweep(libchaos_context* ctx, char* filename) {
+    /** 
+     * Classify every tap of a sweep file, spread over all processor cores
+     *
+     * \param filename CSV file written by libchaos_sampleToCSV
+     * \return The number of taps classified, or -1 if the file could not
+     * be read
+     *
+     * The summaries replace those the context holds.
+     */
+    LC_LOCK guard(ctx);
+    PL_flush(&ctx->sweep_pipeline);
+    return CL_classifyFile(&ctx->classes, filename, 0);
+}
+
+void libchaos_ctx_enableClassification(libchaos_context* ctx) {
+    /** 
+     * Classify each tap of the sample sweeps that follow as it is taken
+     *
+     * Each sweep starts a new set of summaries.
+     */
+    LC_LOCK guard(ctx);
+    ctx->classes.enabled = 1;
+}
+
+void libchaos_ctx_disableClassification(libchaos_context* ctx) {
+    /** 
+     * Stop classifying sweep taps, the summaries are kept
+     */
+    LC_LOCK guard(ctx);
+    PL_flush(&ctx->sweep_pipeline);
+    ctx->classes.enabled = 0;
+}
+
+int libchaos_ctx_getNumClassifiedTaps(libchaos_context* ctx) {
+    /** 
+     * Returns the number of taps summarised so far
+     */
+    LC_LOCK guard(ctx);
+    TH_lock(&ctx->classes.lock);
+    int num_taps = ctx->classes.num_taps;
+    TH_unlock(&ctx->classes.lock);
+    return num_taps;
+}
+
+int libchaos_ctx_getTapClass(libchaos_context* ctx, int index, int* mdac_value, int* type, 
+                             int* period, float* frequency, float* peak_spread) {
+    /** 
+     * Get the summary of a classified tap
+     *
+     * \param type Set to LIBCHAOS_FIXED_POINT, LIBCHAOS_PERIODIC, 
+     * LIBCHAOS_CHAOTIC or LIBCHAOS_UNKNOWN when there were too few peaks
+     * to tell
+     * \param period Set to the number of peaks in one orbit of a periodic
+     * tap, 0 otherwise
+     * \param frequency Set to the strongest frequency of x1 in Hz
+     * \param peak_spread Set to the highest less the lowest x1 peak
+     * \return 0, or -1 if there is no such tap
+     */
+    LC_LOCK guard(ctx);
+    CL_RESULT result;
+    if(CL_get(&ctx->classes, index, &result)) {
+        return -1;
+    }
+    *mdac_value = result.mdac;
+    *type = result.type;
+    *period = result.period;
+    *frequency = result.frequency;
+    *peak_spread = result.peak_max - result.peak_min;
+    return 0;
+}
+
+int libchaos_ctx_writeClassification(libchaos_context* ctx, const char* filename) {
+    /** 
+     * Write the summaries as a CSV table, one row per tap
+     *
+     * Besides the values of libchaos_getTapClass the table has the number
+     * of peaks, their lowest, highest, mean and standard deviation, and 
+     * the autocorrelation of x1 one orbit later.
+     */
+    LC_LOCK guard(ctx);
+    FILE* file = fopen(filename, "w");
+    if(!file) {
+        LOG_TEXT(LOG_ERROR, "File %s failed to open\n", filename);
+        return -1;
+    }
+    int ret_val = CL_write(&ctx->classes, file);
+    if(fclose(file)) {
+        ret_val = -1;
+    }
+    return ret_val;
 }
 
 /* Peaks */
 
-int* libchaos_getPeaks(int mdac_value) {
+int* libchaos_ctx_getPeaks(libchaos_context* ctx, int mdac_value) {
     /** 
      * Get some peaks for a given MDAC value
+     *
+     * Returns 0 if the device could not be read
      */
-     
-     return peaks_getPeaksAtMDAC(mdac_value);
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return 0;
+    }
+    return peaks_getPeaksAtMDAC(&ctx->peaks, &ctx->device, mdac_value);
 }
 
-int libchaos_setPeaksPerMDAC(int peaks_per_mdac) {
+int libchaos_ctx_setPeaksPerMDAC(libchaos_context* ctx, int peaks_per_mdac) {
     /** 
      * Set the number of peaks to take store at each MDAC value
+     *
+     * The cache is emptied. Returns -1 if there is no memory for the new
+     * one, the cache is then made again at the default size on next use.
      */
-    peaks_initCache(peaks_per_mdac);
+    LC_LOCK guard(ctx);
+    // the cache is emptied either way
+    SC_clearVisited(&ctx->scan);
+    if(!peaks_initCache(&ctx->peaks, peaks_per_mdac)) {
+        return -1;
+    }
     return 0;
 }
 
-bool libchaos_peaksCacheHit(int mdac_value) {
+bool libchaos_ctx_peaksCacheHit(libchaos_context* ctx, int mdac_value) {
     /** 
      * Check to see if the give MDAC value will score a cache hit
      */
-    return peaks_isCacheHit(mdac_value);
+    LC_LOCK guard(ctx);
+    return peaks_isCacheHit(&ctx->peaks, mdac_value);
+}
+
+/* Bifurcation diagram */
+
+unsigned char* libchaos_ctx_getBifurcationImage(libchaos_context* ctx, int level, 
+                                                int* width, int* height) {
+    /** 
+     * Get the bifurcation diagram as an 8 bit image
+     *
+     * \param level Resolution level, 0 is one column per MDAC value and 
+     * each following level halves the width and height
+     * \param width Set to the image width
+     * \param height Set to the image height
+     * \return Row-major image with the highest amplitude in the first row, 
+     * or 0 if the level does not exist
+     *
+     * The diagram is built from the peaks cache. It fills in as calls to 
+     * libchaos_getPeaks take new data. The buffer belongs to libchaos and
+     * is only updated when this function is called.
+     */
+    LC_LOCK guard(ctx);
+    if(!BF_getNumLevels(&ctx->peaks.diagram)) {
+        BF_init(&ctx->peaks.diagram);
+    }
+    return BF_getImage(&ctx->peaks.diagram, level, width, height);
+}
+
+unsigned int* libchaos_ctx_getBifurcationCounts(libchaos_context* ctx, int level, 
+                                                int* width, int* height) {
+    /** 
+     * Get the raw peak counts of the bifurcation diagram
+     *
+     * Counts are row-major with the lowest amplitude in the first row.
+     */
+    LC_LOCK guard(ctx);
+    if(!BF_getNumLevels(&ctx->peaks.diagram)) {
+        BF_init(&ctx->peaks.diagram);
+    }
+    return BF_getCounts(&ctx->peaks.diagram, level, width, height);
+}
+
+int libchaos_ctx_getNumBifurcationLevels(libchaos_context* ctx) {
+    /** 
+     * Returns the number of resolution levels in the bifurcation diagram
+     */
+    LC_LOCK guard(ctx);
+    if(!BF_getNumLevels(&ctx->peaks.diagram)) {
+        BF_init(&ctx->peaks.diagram);
+    }
+    return BF_getNumLevels(&ctx->peaks.diagram);
+}
+
+int libchaos_ctx_setBifurcationResolution(libchaos_context* ctx, int amplitude_bins) {
+    /** 
+     * Set the number of amplitude bins in the bifurcation diagram
+     *
+     * \param amplitude_bins Power of two from 2 to 1024
+     *
+     * The diagram is rebuilt from the peaks already in the cache.
+     */
+    LC_LOCK guard(ctx);
+    if(BF_init(&ctx->peaks.diagram, amplitude_bins)) {
+        return -1;
+    }
+    peaks_fillDiagram(&ctx->peaks, &ctx->peaks.diagram);
+    return 0;
+}
+
+int libchaos_ctx_scanBifurcation(libchaos_context* ctx, int num_taps) {
+    /** 
+     * Take peaks at the next MDAC values of a progressive scan
+     *
+     * \param num_taps Most MDAC values to take
+     * \return MDAC values the scan has still to take, -1 if the device
+     * could not be read
+     *
+     * Instead of 0 to 4095 in turn, the scan takes MDAC values in an 
+     * order that covers the whole range evenly at every step and then 
+     * halves the gaps, so the bifurcation diagram's coarse levels are 
+     * complete within a few dozen taps and the finer ones fill in as 
+     * the scan goes on. Values already cached are skipped, and values
+     * without peaks count as taken. Call it repeatedly, or use 
+     * libchaos_scanBifurcationAsync.
+     */
+    LC_LOCK guard(ctx);
+    if(!ctx->peaks.initialized) {
+        if(!peaks_initCache(&ctx->peaks)) {
+            return -1;
+        }
+        SC_clearVisited(&ctx->scan);
+    }
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    for(int i = 0; i < num_taps; i++) {
+        int mdac = SC_next(&ctx->scan, &ctx->peaks);
+        if(mdac < 0) {
+            break;
+        }
+        if(!peaks_getPeaksAtMDAC(&ctx->peaks, &ctx->device, mdac)) {
+            return -1;
+        }
+        SC_markVisited(&ctx->scan, mdac);
+    }
+    return SC_remaining(&ctx->scan);
+}
+
+int libchaos_ctx_setScanFocus(libchaos_context* ctx, int first, int last) {
+    /** 
+     * Have a progressive scan fill in a range of MDAC values first
+     *
+     * \param first First MDAC value of the range, -1 to scan evenly again
+     * \param last Last MDAC value of the range
+     *
+     * Three of every four taps come from the range, coarse to fine, until
+     * it is complete. Set it to the part of the diagram being viewed.
+     */
+    LC_LOCK guard(ctx);
+    return SC_setFocus(&ctx->scan, first, last);
+}
+
+/* Characterization */
+
+int libchaos_characterizeSamples(int* samples, int num_samples, float* lyapunov, float* dimension) {
+    /** 
+     * Estimate the largest Lyapunov exponent and correlation dimension
+     *
+     * \param samples Packed samples as stored by the library
+     * \param lyapunov Set to the largest Lyapunov exponent in 1/s
+     * \param dimension Set to the correlation dimension
+     *
+     * The work is spread over all processor cores.
+     */
+    AN_RESULT result;
+    int ret_val = AN_analyze(samples, num_samples, 0, &result);
+    *lyapunov = result.lyapunov;
+    *dimension = result.correlation_dimension;
+    return ret_val;
+}
+
+int libchaos_ctx_characterize(libchaos_context* ctx, int mdac_value, 
+                              int num_samples, float* lyapunov, float* dimension) {
+    /** 
+     * Take a capture at an MDAC value and characterize the attractor
+     *
+     * \param num_samples Length of the capture, tens of thousands of 
+     * samples give stable results
+     */
+    LC_LOCK guard(ctx);
+    if(LC_claimDevice(ctx)) {
+        return -1;
+    }
+    int* data = (int*)BP_alloc(num_samples*sizeof(int));
+    if(!data) {
+        return -1;
+    }
+    if(UC_sample(&ctx->device, data, num_samples, mdac_value)) {
+        BP_free(data);
+        return -1;
+    }
+    int ret_val = libchaos_characterizeSamples(data, num_samples, lyapunov, dimension);
+    BP_free(data);
+    return ret_val;
+}
+
+int libchaos_characterizeSweep(char* filename, int* mdac_values, float* lyapunov, 
+                               float* dimension, int max_taps) {
+    /** 
+     * Characterize every tap of a sweep file
+     *
+     * \param filename CSV file written by libchaos_sampleToCSV
+     * \param mdac_values, lyapunov, dimension Arrays of max_taps entries
+     * that receive one result per tap in file order
+     * \return The number of taps processed, or -1 if the file could not be
+     * read
+     */
+    const int max_samples = 1 << 20;
+    DP_SWEEP sweep;
+    int num_taps = 0;
+    int num_samples;
+    int mdac_value;
+    
+    int* data = (int*)BP_alloc(max_samples*sizeof(int));
+    if(!data) {
+        return -1;
+    }
+    if(DP_openSweep(&sweep, filename)) {
+        LOG_TEXT(LOG_ERROR, "File %s failed to open\n", filename);
+        BP_free(data);
+        return -1;
+    }
+    
+    while(num_taps < max_taps && 
+          (num_samples = DP_readSweepTap(&sweep, data, max_samples, &mdac_value)) > 0) {
+        mdac_values[num_taps] = mdac_value;
+        if(libchaos_characterizeSamples(data, num_samples, &lyapunov[num_taps], 
+                                        &dimension[num_taps])) {
+            LOG(LOG_WARNING, "Not enough data to characterize tap %d\n", mdac_value);
+        }
+        num_taps++;
+    }
+    
+    DP_closeSweep(&sweep);
+    BP_free(data);
+    return num_taps;
 }
@@ -11,11 +11,104 @@
 // sampling frequency in Hz
 #define LIBCHAOS_SAMPLE_FREQUENCY 60*1200
 
+// trigger edges
+#define LIBCHAOS_RISING 1
+#define LIBCHAOS_FALLING 2
+#define LIBCHAOS_EITHER 3
+
+// interpolation
+#define LIBCHAOS_LINEAR 0
+#define LIBCHAOS_CUBIC 1
+
+// analysis stage streams and full queue policies
+#define LIBCHAOS_PLOT_STREAM 0
+#define LIBCHAOS_SWEEP_STREAM 1
+#define LIBCHAOS_WAIT 0
+#define LIBCHAOS_DROP 1
+
+// log levels
+#define LIBCHAOS_LOG_OFF -1
+#define LIBCHAOS_LOG_ERROR 0
+#define LIBCHAOS_LOG_WARNING 1
+#define LIBCHAOS_LOG_INFO 2
+#define LIBCHAOS_LOG_DEBUG 3
+
+// what tracing records
+#define LIBCHAOS_TRACE_OFF 0
+#define LIBCHAOS_TRACE_HISTOGRAMS 1
+#define LIBCHAOS_TRACE_EVENTS 2
+
+// how a recording is played back
+#define LIBCHAOS_REPLAY_FAST 0
+#define LIBCHAOS_REPLAY_PACED 1
+#define LIBCHAOS_REPLAY_LOOP 2
+
+// instruction sets used for the hot routines
+#define LIBCHAOS_ISA_BEST -1
+#define LIBCHAOS_ISA_GENERIC 0
+#define LIBCHAOS_ISA_SSE2 1
+#define LIBCHAOS_ISA_AVX2 2
+#define LIBCHAOS_ISA_AVX512 3
+
+// kinds of motion found by classification
+#define LIBCHAOS_UNKNOWN -1
+#define LIBCHAOS_FIXED_POINT 0
+#define LIBCHAOS_PERIODIC 1
+#define LIBCHAOS_CHAOTIC 2
+
+// spectrogram windows
+#define LIBCHAOS_WINDOW_RECTANGULAR 0
+#define LIBCHAOS_WINDOW_HANN 1
+#define LIBCHAOS_WINDOW_HAMMING 2
+#define LIBCHAOS_WINDOW_BLACKMAN 3
+
+// server messages and what a client's full queue does
+#define LIBCHAOS_MESSAGE_HELLO 0
+#define LIBCHAOS_MESSAGE_SAMPLES 1
+#define LIBCHAOS_MESSAGE_TAP 2
+#define LIBCHAOS_MESSAGE_PEAKS 3
+#define LIBCHAOS_DROP_NEWEST 0
+#define LIBCHAOS_DROP_OLDEST 1
+#define LIBCHAOS_BLOCK 2
+
+// asynchronous request status and callback events
+#define LIBCHAOS_QUEUED 0
+#define LIBCHAOS_RUNNING 1
+#define LIBCHAOS_DONE 2
+#define LIBCHAOS_CANCELLED 3
+#define LIBCHAOS_FAILED 4
+#define LIBCHAOS_PROGRESS 0
+#define LIBCHAOS_COMPLETE 1
+
 #include <stdio.h>
 #include <usb.h>
 
 extern FILE* DEBUG_FILE;
 
+/*
+ * Each chaos unit is driven through its own libchaos_context. Calls on 
+ * one context are serialised by its lock, so a context may be shared 
+ * between threads, while separate contexts run in parallel. The 
+ * libchaos_ functions without a context use libchaos_default(). 
+ * Every context logs through the one background writer that owns 
+ * DEBUG_FILE.
+ */
+typedef struct libchaos_context libchaos_context;
+typedef struct libchaos_frame libchaos_frame;
+typedef struct libchaos_request libchaos_request;
+typedef struct libchaos_subscriber libchaos_subscriber;
+typedef struct libchaos_shared_block libchaos_shared_block;
+typedef void (*libchaos_callback)(void* user, libchaos_request* request, int event, int value);
+typedef void (*libchaos_stage_function)(void* user, int mdac_value, const int* samples, 
+                                        const short* x1, const short* x2, 
+                                        const short* x3, int num_samples);
+
+/* Contexts */
+libchaos_context* libchaos_create();
+void libchaos_destroy(libchaos_context* ctx);
+libchaos_context* libchaos_default();
+int libchaos_ctx_selectDevice(libchaos_context* ctx, int index);
+
 /* Main */
 int libchaos_init();
 int libchaos_connect() ;
@@ -24,6 +117,25 @@ int libchaos_reconnect();
 int libchaos_close();
 int libchaos_testDevice();
 
+/* Record and replay */
+int libchaos_startRecording(const char* filename);
+int libchaos_stopRecording();
+int libchaos_startReplay(const char* filename, int flags);
+int libchaos_stopReplay();
+
+/* Simulated unit */
+int libchaos_startSimulation(double speed, double drop_rate, unsigned int seed);
+int libchaos_stopSimulation();
+
+/* Continuous capture */
+int libchaos_startCapture(const char* filename, int mdac_value, long long num_samples);
+int libchaos_stopCapture();
+int libchaos_isCapturing();
+int libchaos_getCaptureStats(long long* num_samples, long long* bytes_written, 
+                             long long* num_gaps, long long* missing_packets);
+long long libchaos_readCapture(const char* filename, long long first, int* samples, 
+                               int num_samples);
+
 /* Sample To CSV */
 int libchaos_startSampleToCSV(char* filename, int start, int end, int step, int periods);
 int libchaos_samplePartToCSV();
@@ -42,26 +154,381 @@ int libchaos_getPlotPoint(int* x1, int*x2, int* x3, int index);
 int libchaos_getNumPlotPoints();
 int libchaos_setNumPlotPoints(int num);
 int libchaos_getTriggerIndex();
+int libchaos_getTriggerQuality();
+int libchaos_getPlotStatistics(int channel, int* min, int* max, float* mean, 
+                               float* deviation);
+int libchaos_setLevelTrigger(int channel, int level, int edge, int hysteresis);
+int libchaos_setPhaseTrigger(int x1, int x2, int x3, int radius);
 int libchaos_setTransientData(int amount);
 
+/* Triggered acquisition */
+int libchaos_enableTriggeredAcquisition(int pre_trigger);
+void libchaos_disableTriggeredAcquisition();
+int libchaos_getAcquisitionStats(long long* frames, long long* timeouts, long long* gaps);
+
+/* Asynchronous requests */
+libchaos_request* libchaos_readPlotAsync(int mdac_value, libchaos_callback callback, 
+                                         void* user);
+libchaos_request* libchaos_getPeaksAsync(int mdac_value, libchaos_callback callback, 
+                                         void* user);
+libchaos_request* libchaos_sweepAsync(char* filename, int start, int end, int step, 
+                                      int periods, libchaos_callback callback, void* user);
+libchaos_request* libchaos_scanBifurcationAsync(libchaos_callback callback, void* user);
+int libchaos_cancel(libchaos_request* request);
+int libchaos_wait(libchaos_request* request);
+int libchaos_getRequestStatus(libchaos_request* request);
+int libchaos_getRequestResult(libchaos_request* request);
+int libchaos_getRequestProgress(libchaos_request* request);
+int* libchaos_getRequestPeaks(libchaos_request* request);
+void libchaos_releaseRequest(libchaos_request* request);
+
+/* Analysis stages */
+int libchaos_addStage(int stream, const char* name, libchaos_stage_function function, 
+                      void* user, int queue_length, int policy);
+int libchaos_removeStage(int stage);
+int libchaos_findStage(int stream, const char* name);
+int libchaos_getStageStats(int stage, long long* blocks, long long* dropped, 
+                           double* busy_time, double* max_time, double* wait_time);
+
+/* Frames */
+const libchaos_frame* libchaos_acquireFrame();
+void libchaos_releaseFrame(const libchaos_frame* frame);
+unsigned int libchaos_frameGetSequence(const libchaos_frame* frame);
+int libchaos_frameGetMDACValue(const libchaos_frame* frame);
+int libchaos_frameGetNumPlotPoints(const libchaos_frame* frame);
+int libchaos_frameGetPlotPoint(const libchaos_frame* frame, int* x1, int* x2, int* x3, 
+                               int index);
+int libchaos_frameGetTriggerIndex(const libchaos_frame* frame);
+int libchaos_frameGetTriggerQuality(const libchaos_frame* frame);
+void libchaos_frameGetFFTPlotPoint(const libchaos_frame* frame, float* val, int index);
+int libchaos_frameGetPlotStatistics(const libchaos_frame* frame, int channel, int* min, 
+                                    int* max, float* mean, float* deviation);
+int libchaos_frameGetNumReturnMapPeaks(const libchaos_frame* frame);
+int libchaos_frameGetNumReturnMapPoints(const libchaos_frame* frame, int order);
+int libchaos_frameGetReturnMapPoint(const libchaos_frame* frame, int* xn, int* xnk, 
+                                    int index, int order);
+
+/* Shared memory */
+int libchaos_startPublishing(const char* name, int num_slots, int slot_samples);
+void libchaos_stopPublishing();
+libchaos_subscriber* libchaos_subscribe(const char* name);
+void libchaos_unsubscribe(libchaos_subscriber* subscriber);
+const libchaos_shared_block* libchaos_subscriberNext(libchaos_subscriber* subscriber);
+int libchaos_subscriberValid(libchaos_subscriber* subscriber);
+long long libchaos_subscriberMissed(libchaos_subscriber* subscriber);
+int libchaos_subscriberPublishing(libchaos_subscriber* subscriber);
+long long libchaos_sharedBlockGetSequence(const libchaos_shared_block* block);
+int libchaos_sharedBlockGetStream(const libchaos_shared_block* block);
+int libchaos_sharedBlockGetMDACValue(const libchaos_shared_block* block);
+int libchaos_sharedBlockGetNumSamples(const libchaos_shared_block* block);
+long long libchaos_sharedBlockGetPosition(const libchaos_shared_block* block);
+long long libchaos_sharedBlockGetTime(const libchaos_shared_block* block);
+const int* libchaos_sharedBlockGetSamples(const libchaos_shared_block* block);
+const short* libchaos_sharedBlockGetChannel(libchaos_subscriber* subscriber, 
+                                            const libchaos_shared_block* block, 
+                                            int channel);
+
+/* Server */
+int libchaos_startServer(const char* address, int queue_length, int policy);
+void libchaos_stopServer();
+int libchaos_getServerStats(int* clients, long long* messages, long long* dropped, 
+                            long long* disconnected);
+
 /* Peaks */
 int* libchaos_getPeaks(int mdac_value);
 bool libchaos_peaksCacheHit(int mdac_value);
 int libchaos_setPeaksPerMDAC(int peaks_per_mdac);
 
+/* Bifurcation diagram */
+unsigned char* libchaos_getBifurcationImage(int level, int* width, int* height);
+unsigned int* libchaos_getBifurcationCounts(int level, int* width, int* height);
+int libchaos_getNumBifurcationLevels();
+int libchaos_setBifurcationResolution(int amplitude_bins);
+int libchaos_scanBifurcation(int num_taps);
+int libchaos_setScanFocus(int first, int last);
+
 /* Return map */
 int libchaos_getReturnMap1Point(int* x1, int* x2, int index);
 int libchaos_getReturnMap2Point(int* x1, int* x2, int index);
+int libchaos_getReturnMapPoint(int* xn, int* xnk, int index, int order);
 int libchaos_getNumReturnMapPoints();
+int libchaos_getNumReturnMapPointsOfOrder(int order);
+int libchaos_getNumReturnMapPeaks();
+int libchaos_setReturnMapCapacity(int num_peaks);
 void libchaos_refreshReturnMapPoints();
 
+/* Poincare section */
+int libchaos_setPoincareSection(float a, float b, float c, float d, 
+                                int direction, int interpolation);
+int libchaos_setPoincareCapacity(int num_points);
+void libchaos_clearPoincarePoints();
+int libchaos_getNumPoincarePoints();
+int libchaos_getPoincarePoint(float* x1, float* x2, float* x3, int index);
+int libchaos_poincareSweep(char* filename, int mdac_value);
+
+/* Attractor density */
+int libchaos_enableVoxels(int resolution, float decay);
+void libchaos_disableVoxels();
+unsigned int libchaos_getVoxelGeneration();
+int libchaos_getChangedVoxelBricks(unsigned int since, int* bricks, int max_bricks);
+float* libchaos_getVoxelBrick(int brick, int* bx, int* by, int* bz);
+
+/* Waveform history */
+int libchaos_enableHistory(int raw_samples, int bins_per_level);
+void libchaos_disableHistory();
+long long libchaos_getHistoryLength();
+int libchaos_getHistoryWindow(int channel, long long start, long long end, 
+                              int pixels, int* min, int* max);
+int libchaos_loadHistorySweep(char* filename, int mdac_value);
+
+/* Spectrogram */
+int libchaos_enableSpectrogram(int stream, int size, int hop, int window, int num_rows);
+void libchaos_disableSpectrogram();
+int libchaos_setSpectrogramRange(float min_db, float max_db);
+int libchaos_addSpectrogramSamples(int* samples, int num_samples, int mdac_value);
+long long libchaos_getSpectrogramRows();
+int libchaos_getSpectrogramBins();
+int libchaos_getSpectrogram(long long first, int num_rows, float* power, int* mdac_values);
+int libchaos_getSpectrogramImage(long long first, int num_rows, unsigned char* image, 
+                                 int* mdac_values);
+
 /* FFT */
 void libchaos_getFFTPlotPoint(float* val, int index);
 void libchaos_enableFFT();
 void libchaos_disableFFT();
 
+/* Characterization */
+int libchaos_characterizeSamples(int* samples, int num_samples, float* lyapunov, float* dimension);
+int libchaos_characterize(int mdac_value, int num_samples, float* lyapunov, float* dimension);
+int libchaos_characterizeSweep(char* filename, int* mdac_values, float* lyapunov, 
+                               float* dimension, int max_taps);
+
+/* Classification */
+int libchaos_classifySweep(char* filename);
+void libchaos_enableClassification();
+void libchaos_disableClassification();
+int libchaos_getNumClassifiedTaps();
+int libchaos_getTapClass(int index, int* mdac_value, int* type, int* period, 
+                         float* frequency, float* peak_spread);
+int libchaos_writeClassification(const char* filename);
+
+/* Logging */
+void libchaos_setLogLevel(int level);
+int libchaos_setLogFile(const char* filename);
+int libchaos_getNumDroppedLogMessages();
+
+/* Tracing */
+void libchaos_setTracing(int flags);
+void libchaos_resetTrace();
+int libchaos_getNumTraceStages();
+const char* libchaos_getTraceStageName(int stage);
+int libchaos_getTraceStats(int stage, long long* count, double* total_time, 
+                           double* max_time);
+double libchaos_getTracePercentile(int stage, double fraction);
+int libchaos_writeTraceSummary(const char* filename);
+int libchaos_writeTraceEvents(const char* filename);
+
+/* Buffers */
+void libchaos_getBufferStats(long long* in_use, long long* high_water, long long* held, 
+                             long long* heap_allocations);
+void libchaos_resetBufferHighWater();
+void libchaos_trimBuffers();
+
+/* Instruction sets */
+int libchaos_setISA(int isa);
+int libchaos_getISA();
+const char* libchaos_getISAName(int isa);
+
 /* Version Information */
 int libchaos_getFirmwareVersion();
 int libchaos_getVersion();
 
+/* Main, per context */
+int libchaos_ctx_init(libchaos_context* ctx);
+int libchaos_ctx_connect(libchaos_context* ctx);
+bool libchaos_ctx_isConnected(libchaos_context* ctx);
+int libchaos_ctx_reconnect(libchaos_context* ctx);
+int libchaos_ctx_close(libchaos_context* ctx);
+int libchaos_ctx_testDevice(libchaos_context* ctx);
+
+/* Record and replay, per context */
+int libchaos_ctx_startRecording(libchaos_context* ctx, const char* filename);
+int libchaos_ctx_stopRecording(libchaos_context* ctx);
+int libchaos_ctx_startReplay(libchaos_context* ctx, const char* filename, int flags);
+int libchaos_ctx_stopReplay(libchaos_context* ctx);
+
+/* Simulated unit, per context */
+int libchaos_ctx_startSimulation(libchaos_context* ctx, double speed, double drop_rate, 
+                                 unsigned int seed);
+int libchaos_ctx_stopSimulation(libchaos_context* ctx);
+
+/* Continuous capture, per context */
+int libchaos_ctx_startCapture(libchaos_context* ctx, const char* filename, int mdac_value, 
+                              long long num_samples);
+int libchaos_ctx_stopCapture(libchaos_context* ctx);
+int libchaos_ctx_isCapturing(libchaos_context* ctx);
+int libchaos_ctx_getCaptureStats(libchaos_context* ctx, long long* num_samples, 
+                                 long long* bytes_written, long long* num_gaps, 
+                                 long long* missing_packets);
+
+/* Sample To CSV, per context */
+int libchaos_ctx_startSampleToCSV(libchaos_context* ctx, char* filename, 
+                                  int start, int end, int step, int periods);
+int libchaos_ctx_samplePartToCSV(libchaos_context* ctx);
+int libchaos_ctx_endSampleToCSV(libchaos_context* ctx);
+int libchaos_ctx_sampleToCSV(libchaos_context* ctx, char* filename, int start, 
+                             int end, int step, int periods);
+
+/* MDAC, per context */
+int libchaos_ctx_getMDACValue(libchaos_context* ctx);
+int libchaos_ctx_setMDACValue(libchaos_context* ctx, int tap);
+
+/* Basic plot, per context */
+int libchaos_ctx_readPlot(libchaos_context* ctx, int mdac_value);
+int libchaos_ctx_getPlotPoint(libchaos_context* ctx, int* x1, int*x2, int* x3, int index);
+int libchaos_ctx_getNumPlotPoints(libchaos_context* ctx);
+int libchaos_ctx_setNumPlotPoints(libchaos_context* ctx, int num);
+int libchaos_ctx_getTriggerIndex(libchaos_context* ctx);
+int libchaos_ctx_getTriggerQuality(libchaos_context* ctx);
+int libchaos_ctx_getPlotStatistics(libchaos_context* ctx, int channel, int* min, int* max, 
+                                   float* mean, float* deviation);
+int libchaos_ctx_setLevelTrigger(libchaos_context* ctx, int channel, int level, 
+                                 int edge, int hysteresis);
+int libchaos_ctx_setPhaseTrigger(libchaos_context* ctx, int x1, int x2, int x3, 
+                                 int radius);
+int libchaos_ctx_setTransientData(libchaos_context* ctx, int amount);
+
+/* Triggered acquisition, per context */
+int libchaos_ctx_enableTriggeredAcquisition(libchaos_context* ctx, int pre_trigger);
+void libchaos_ctx_disableTriggeredAcquisition(libchaos_context* ctx);
+int libchaos_ctx_getAcquisitionStats(libchaos_context* ctx, long long* frames, 
+                                     long long* timeouts, long long* gaps);
+
+/* Asynchronous requests, per context */
+libchaos_request* libchaos_ctx_readPlotAsync(libchaos_context* ctx, int mdac_value, 
+                                             libchaos_callback callback, void* user);
+libchaos_request* libchaos_ctx_getPeaksAsync(libchaos_context* ctx, int mdac_value, 
+                                             libchaos_callback callback, void* user);
+libchaos_request* libchaos_ctx_sweepAsync(libchaos_context* ctx, char* filename, int start, 
+                                          int end, int step, int periods, 
+                                          libchaos_callback callback, void* user);
+libchaos_request* libchaos_ctx_scanBifurcationAsync(libchaos_context* ctx, 
+                                                    libchaos_callback callback, void* user);
+
+/* Analysis stages, per context */
+int libchaos_ctx_addStage(libchaos_context* ctx, int stream, const char* name, 
+                          libchaos_stage_function function, void* user, 
+                          int queue_length, int policy);
+int libchaos_ctx_removeStage(libchaos_context* ctx, int stage);
+int libchaos_ctx_findStage(libchaos_context* ctx, int stream, const char* name);
+int libchaos_ctx_getStageStats(libchaos_context* ctx, int stage, long long* blocks, 
+                               long long* dropped, double* busy_time, double* max_time, 
+                               double* wait_time);
+
+/* Frames, per context */
+const libchaos_frame* libchaos_ctx_acquireFrame(libchaos_context* ctx);
+
+/* Shared memory, per context */
+int libchaos_ctx_startPublishing(libchaos_context* ctx, const char* name, int num_slots, 
+                                 int slot_samples);
+void libchaos_ctx_stopPublishing(libchaos_context* ctx);
+
+/* Server, per context */
+int libchaos_ctx_startServer(libchaos_context* ctx, const char* address, int queue_length, 
+                             int policy);
+void libchaos_ctx_stopServer(libchaos_context* ctx);
+int libchaos_ctx_getServerStats(libchaos_context* ctx, int* clients, long long* messages, 
+                                long long* dropped, long long* disconnected);
+
+/* Peaks, per context */
+int* libchaos_ctx_getPeaks(libchaos_context* ctx, int mdac_value);
+bool libchaos_ctx_peaksCacheHit(libchaos_context* ctx, int mdac_value);
+int libchaos_ctx_setPeaksPerMDAC(libchaos_context* ctx, int peaks_per_mdac);
+
+/* Bifurcation diagram, per context */
+unsigned char* libchaos_ctx_getBifurcationImage(libchaos_context* ctx, int level, 
+                                                int* width, int* height);
+unsigned int* libchaos_ctx_getBifurcationCounts(libchaos_context* ctx, int level, 
+                                                int* width, int* height);
+int libchaos_ctx_getNumBifurcationLevels(libchaos_context* ctx);
+int libchaos_ctx_setBifurcationResolution(libchaos_context* ctx, int amplitude_bins);
+int libchaos_ctx_scanBifurcation(libchaos_context* ctx, int num_taps);
+int libchaos_ctx_setScanFocus(libchaos_context* ctx, int first, int last);
+
+/* Return map, per context */
+int libchaos_ctx_getReturnMap1Point(libchaos_context* ctx, int* x1, int* x2, int index);
+int libchaos_ctx_getReturnMap2Point(libchaos_context* ctx, int* x1, int* x2, int index);
+int libchaos_ctx_getReturnMapPoint(libchaos_context* ctx, int* xn, int* xnk, 
+                                   int index, int order);
+int libchaos_ctx_getNumReturnMapPoints(libchaos_context* ctx);
+int libchaos_ctx_getNumReturnMapPointsOfOrder(libchaos_context* ctx, int order);
+int libchaos_ctx_getNumReturnMapPeaks(libchaos_context* ctx);
+int libchaos_ctx_setReturnMapCapacity(libchaos_context* ctx, int num_peaks);
+void libchaos_ctx_refreshReturnMapPoints(libchaos_context* ctx);
+
+/* Poincare section, per context */
+int libchaos_ctx_setPoincareSection(libchaos_context* ctx, float a, float b, 
+                                    float c, float d, int direction, 
+                                    int interpolation);
+int libchaos_ctx_setPoincareCapacity(libchaos_context* ctx, int num_points);
+void libchaos_ctx_clearPoincarePoints(libchaos_context* ctx);
+int libchaos_ctx_getNumPoincarePoints(libchaos_context* ctx);
+int libchaos_ctx_getPoincarePoint(libchaos_context* ctx, float* x1, float* x2, 
+                                  float* x3, int index);
+int libchaos_ctx_poincareSweep(libchaos_context* ctx, char* filename, int mdac_value);
+
+/* Attractor density, per context */
+int libchaos_ctx_enableVoxels(libchaos_context* ctx, int resolution, float decay);
+void libchaos_ctx_disableVoxels(libchaos_context* ctx);
+unsigned int libchaos_ctx_getVoxelGeneration(libchaos_context* ctx);
+int libchaos_ctx_getChangedVoxelBricks(libchaos_context* ctx, unsigned int since, 
+                                       int* bricks, int max_bricks);
+float* libchaos_ctx_getVoxelBrick(libchaos_context* ctx, int brick, int* bx, 
+                                  int* by, int* bz);
+
+/* Waveform history, per context */
+int libchaos_ctx_enableHistory(libchaos_context* ctx, int raw_samples, 
+                               int bins_per_level);
+void libchaos_ctx_disableHistory(libchaos_context* ctx);
+long long libchaos_ctx_getHistoryLength(libchaos_context* ctx);
+int libchaos_ctx_getHistoryWindow(libchaos_context* ctx, int channel, 
+                                  long long start, long long end, int pixels, 
+                                  int* min, int* max);
+int libchaos_ctx_loadHistorySweep(libchaos_context* ctx, char* filename, int mdac_value);
+
+/* Spectrogram, per context */
+int libchaos_ctx_enableSpectrogram(libchaos_context* ctx, int stream, int size, int hop, 
+                                   int window, int num_rows);
+void libchaos_ctx_disableSpectrogram(libchaos_context* ctx);
+int libchaos_ctx_setSpectrogramRange(libchaos_context* ctx, float min_db, float max_db);
+int libchaos_ctx_addSpectrogramSamples(libchaos_context* ctx, int* samples, 
+                                       int num_samples, int mdac_value);
+long long libchaos_ctx_getSpectrogramRows(libchaos_context* ctx);
+int libchaos_ctx_getSpectrogramBins(libchaos_context* ctx);
+int libchaos_ctx_getSpectrogram(libchaos_context* ctx, long long first, int num_rows, 
+                                float* power, int* mdac_values);
+int libchaos_ctx_getSpectrogramImage(libchaos_context* ctx, long long first, int num_rows, 
+                                     unsigned char* image, int* mdac_values);
+
+/* FFT, per context */
+void libchaos_ctx_getFFTPlotPoint(libchaos_context* ctx, float* val, int index);
+void libchaos_ctx_enableFFT(libchaos_context* ctx);
+void libchaos_ctx_disableFFT(libchaos_context* ctx);
+
+/* Characterization, per context */
+int libchaos_ctx_characterize(libchaos_context* ctx, int mdac_value, 
+                              int num_samples, float* lyapunov, float* dimension);
+
+/* Classification, per context */
+int libchaos_ctx_classifySweep(libchaos_context* ctx, char* filename);
+void libchaos_ctx_enableClassification(libchaos_context* ctx);
+void libchaos_ctx_disableClassification(libchaos_context* ctx);
+int libchaos_ctx_getNumClassifiedTaps(libchaos_context* ctx);
+int libchaos_ctx_getTapClass(libchaos_context* ctx, int index, int* mdac_value, int* type, 
+                             int* period, float* frequency, float* peak_spread);
+int libchaos_ctx_writeClassification(libchaos_context* ctx, const char* filename);
+
+/* Version Information, per context */
+int libchaos_ctx_getFirmwareVersion(libchaos_context* ctx);
+
 #endif
@@ -0,0 +1,285 @@
+/**
+ * \file lod.cpp
+ * \brief Routines for keeping a multi-resolution min/max view of a stream
+ */
+
+#include "lod.h"
+#include "data_processing.h"
+
+static const LOD_BIN LOD_EMPTY = {{0xFFFF, 0xFFFF, 0xFFFF}, {0, 0, 0}};
+
+static inline void LOD_merge(LOD_BIN* dst, const LOD_BIN* src) {
+    for(int c = 0; c < 3; c++) {
+        if(src->min[c] < dst->min[c]) dst->min[c] = src->min[c];
+        if(src->max[c] > dst->max[c]) dst->max[c] = src->max[c];
+    }
+}
+
+static inline void LOD_mergeSample(LOD_BIN* dst, int sample) {
+    unsigned short v[3];
+    v[0] = (unsigned short)DP_getX1(sample);
+    v[1] = (unsigned short)DP_getX2(sample);
+    v[2] = (unsigned short)DP_getX3(sample);
+    for(int c = 0; c < 3; c++) {
+        if(v[c] < dst->min[c]) dst->min[c] = v[c];
+        if(v[c] > dst->max[c]) dst->max[c] = v[c];
+    }
+}
+
+int LOD_init(LOD_PYRAMID* pyramid, int raw_capacity, int bins_per_level, int num_levels) {
+    /** 
+     * Initialize a pyramid
+     *
+     * \param raw_capacity Number of recent raw samples kept
+     * \param bins_per_level Bins kept on each level
+     * \param num_levels Number of levels. Level k bins cover 
+     * 16 << k samples.
+     *
+     * Memory use is about 4*raw_capacity + 12*bins_per_level*num_levels 
+     * bytes.
+     */
+    if(raw_capacity < 1 || bins_per_level < 1 || num_levels < 1 || 
+       num_levels > LOD_MAX_LEVELS) {
+        return -1;
+    }
+    if(pyramid->raw) {
+        LOD_free(pyramid);
+    }
+    
+    pyramid->raw = (int*)malloc(raw_capacity*sizeof(int));
+    pyramid->raw_capacity = raw_capacity;
+    pyramid->capacity = bins_per_level;
+    pyramid->num_levels = num_levels;
+    int failed = !pyramid->raw;
+    for(int k = 0; k < num_levels; k++) {
+        pyramid->levels[k].bins = (LOD_BIN*)malloc(bins_per_level*sizeof(LOD_BIN));
+        failed |= !pyramid->levels[k].bins;
+    }
+    if(failed) {
+        LOD_free(pyramid);
+        return -1;
+    }
+    LOD_clear(pyramid);
+    return 0;
+}
+
+void LOD_free(LOD_PYRAMID* pyramid) {
+    /** 
+     * Free the memory used by a pyramid
+     */
+    free(pyramid->raw);
+    for(int k = 0; k < pyramid->num_levels; k++) {
+        free(pyramid->levels[k].bins);
+    }
+    memset(pyramid, 0, sizeof(LOD_PYRAMID));
+}
+
+void LOD_clear(LOD_PYRAMID* pyramid) {
+    /** 
+     * Throw away all samples and restart the stream at position 0
+     */
+    pyramid->num_samples = 0;
+    for(int k = 0; k < pyramid->num_levels; k++) {
+        pyramid->levels[k].count = 0;
+        pyramid->levels[k].partial = LOD_EMPTY;
+        pyramid->levels[k].partial_children = 0;
+    }
+}
+
+static void LOD_push(LOD_PYRAMID* pyramid, int k, const LOD_BIN* bin) {
+    /** 
+     * Store a completed bin on level k and pass it up
+     *
+     * Every second bin completes a bin on the level above.
+     */
+    LOD_BIN current = *bin;
+    
+    for(; k < pyramid->num_levels; k++) {
+        LOD_LEVEL* level = &pyramid->levels[k];
+        level->bins[level->count % pyramid->capacity] = current;
+        level->count++;
+        
+        if(k + 1 >= pyramid->num_levels) {
+            break;
+        }
+        LOD_LEVEL* up = &pyramid->levels[k + 1];
+        LOD_merge(&up->partial, &current);
+        if(++up->partial_children < 2) {
+            break;
+        }
+        current = up->partial;
+        up->partial = LOD_EMPTY;
+        up->partial_children = 0;
+    }
+}
+
+void LOD_append(LOD_PYRAMID* pyramid, int* samples, int num_samples) {
+    /** 
+     * Add samples to the end of the stream
+     */
+    const int bin_size = 1 << LOD_BASE_SHIFT;
+    LOD_LEVEL* base = &pyramid->levels[0];
+    
+    if(!pyramid->raw) {
+        return;
+    }
+    
+    for(int i = 0; i < num_samples; i++) {
+        pyramid->raw[pyramid->num_samples % pyramid->raw_capacity] = samples[i];
+        pyramid->num_samples++;
+        LOD_mergeSample(&base->partial, samples[i]);
+        if(++base->partial_children == bin_size) {
+            LOD_BIN done = base->partial;
+            base->partial = LOD_EMPTY;
+            base->partial_children = 0;
+            LOD_push(pyramid, 0, &done);
+        }
+    }
+}
+
+static long long LOD_oldest(LOD_PYRAMID* pyramid, int k) {
+    /** 
+     * Returns the first sample still covered by level k, -1 being raw
+     */
+    if(k < 0) {
+        return pyramid->num_samples - pyramid->raw_capacity;
+    }
+    return (pyramid->levels[k].count - pyramid->capacity) << (LOD_BASE_SHIFT + k);
+}
+
+static int LOD_overlap(LOD_PYRAMID* pyramid, int k, long long s0, long long s1, LOD_BIN* out) {
+    /** 
+     * Merge every complete level k bin that overlaps [s0, s1)
+     */
+    LOD_LEVEL* level = &pyramid->levels[k];
+    int shift = LOD_BASE_SHIFT + k;
+    long long oldest = level->count - pyramid->capacity;
+    int found = 0;
+    
+    for(long long b = s0 >> shift; b <= (s1 - 1) >> shift; b++) {
+        if(b >= oldest && b >= 0 && b < level->count) {
+            LOD_merge(out, &level->bins[b % pyramid->capacity]);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+static int LOD_range(LOD_PYRAMID* pyramid, int k, long long s0, long long s1, LOD_BIN* out) {
+    /** 
+     * Merge the min/max of samples [s0, s1) into out
+     *
+     * Whole bins of level k are used where they exist. The ragged ends 
+     * and bins that are not complete yet come from level k-1, with level
+     * -1 being the raw samples. Where the finer level no longer holds the
+     * samples, the level k bins overlapping them are used instead, which
+     * can only widen the result. Returns 1 if any data was found.
+     */
+    if(s0 >= s1) {
+        return 0;
+    }
+    
+    if(k < 0) {
+        long long oldest = LOD_oldest(pyramid, -1);
+        int found = 0;
+        if(s0 < oldest) s0 = oldest;
+        if(s1 > pyramid->num_samples) s1 = pyramid->num_samples;
+        for(long long i = s0; i < s1; i++) {
+            LOD_mergeSample(out, pyramid->raw[i % pyramid->raw_capacity]);
+            found = 1;
+        }
+        return found;
+    }
+    
+    LOD_LEVEL* level = &pyramid->levels[k];
+    int shift = LOD_BASE_SHIFT + k;
+    long long b0 = (s0 + (1LL << shift) - 1) >> shift;
+    long long b1 = s1 >> shift;
+    int finer = s0 >= LOD_oldest(pyramid, k - 1);
+    int found = 0;
+    
+    if(b1 > level->count) {
+        b1 = level->count;
+    }
+    
+    if(b0 >= b1) {
+        if(finer || (s0 >> shift) >= level->count) {
+            found = LOD_range(pyramid, k - 1, s0, s1, out);
+        }
+        if(!found) {
+            found = LOD_overlap(pyramid, k, s0, s1, out);
+        }
+        return found;
+    }
+    
+    for(long long b = b0; b < b1; b++) {
+        if(b >= level->count - pyramid->capacity) {
+            LOD_merge(out, &level->bins[b % pyramid->capacity]);
+            found = 1;
+        }
+    }
+    
+    // the left edge is the oldest part of the range
+    if(finer) {
+        found |= LOD_range(pyramid, k - 1, s0, b0 << shift, out);
+    } else if(s0 < (b0 << shift)) {
+        found |= LOD_overlap(pyramid, k, s0, b0 << shift, out);
+    }
+    if((b1 << shift) >= LOD_oldest(pyramid, k - 1)) {
+        found |= LOD_range(pyramid, k - 1, b1 << shift, s1, out);
+    } else if((b1 << shift) < s1) {
+        found |= LOD_overlap(pyramid, k, b1 << shift, s1, out);
+    }
+    return found;
+}
+
+int LOD_query(LOD_PYRAMID* pyramid, int channel, long long start, long long end, 
+              int pixels, int* min, int* max) {
+    /** 
+     * Get the min/max of a channel for each pixel of a time window
+     *
+     * \param channel 1, 2 or 3 for x1, x2 or x3
+     * \param start, end Window in stream samples
+     * \param pixels Number of columns to fill in min and max
+     * \return pixels, or -1 on bad arguments
+     *
+     * The level is picked so that each pixel merges only a few bins, so
+     * the cost depends on pixels and not on the length of the window.
+     * Pixels with no data left in the pyramid get -1.
+     */
+    if(!pyramid->raw || channel < 1 || channel > 3 || pixels < 1 || end <= start) {
+        return -1;
+    }
+    
+    // finest level whose bins are no wider than a pixel
+    double per_pixel = (double)(end - start)/pixels;
+    int k = -1;
+    while(k + 1 < pyramid->num_levels && 
+          (double)(1LL << (LOD_BASE_SHIFT + k + 1)) <= per_pixel) {
+        k++;
+    }
+    
+    for(int p = 0; p < pixels; p++) {
+        long long s0 = start + (long long)(per_pixel*p);
+        long long s1 = start + (long long)(per_pixel*(p + 1));
+        if(s1 <= s0) {
+            s1 = s0 + 1;
+        }
+        
+        // go coarser while this level no longer holds the pixel
+        int level = k;
+        while(level + 1 < pyramid->num_levels && s0 < LOD_oldest(pyramid, level)) {
+            level++;
+        }
+        
+        LOD_BIN bin = LOD_EMPTY;
+        if(LOD_range(pyramid, level, s0, s1, &bin)) {
+            min[p] = bin.min[channel - 1];
+            max[p] = bin.max[channel - 1];
+        } else {
+            min[p] = -1;
+            max[p] = -1;
+        }
+    }
+    return pixels;
+}
@@ -0,0 +1,65 @@
+/**
+ * \file lod.h
+ * \brief Header file for lod.cpp
+ */
+
+#ifndef LOD_H
+#define LOD_H
+
+#include <stdlib.h>
+#include <string.h>
+
+// samples in a level 0 bin is 1 << LOD_BASE_SHIFT
+#define LOD_BASE_SHIFT 4
+#define LOD_MAX_LEVELS 16
+#define LOD_DEFAULT_LEVELS 12
+#define LOD_DEFAULT_RAW (1 << 20)
+#define LOD_DEFAULT_BINS (1 << 16)
+
+/**
+ * Minimum and maximum of each channel over a span of samples
+ */
+typedef struct {
+    unsigned short min[3];
+    unsigned short max[3];
+} LOD_BIN;
+
+/**
+ * One level of the pyramid
+ *
+ * Bin b covers samples [b << shift, (b+1) << shift) and lives in slot 
+ * b % capacity. Bins below count are complete. partial collects the bin
+ * being filled from partial_children entries of the level below.
+ */
+typedef struct {
+    LOD_BIN* bins;
+    long long count;
+    LOD_BIN partial;
+    int partial_children;
+} LOD_LEVEL;
+
+/**
+ * Min/max pyramid over a sample stream
+ *
+ * Every level keeps the same number of bins, so coarse levels reach much
+ * further back than fine ones while the total memory stays fixed. The
+ * newest raw samples are kept as well for fully zoomed in views.
+ */
+typedef struct {
+    int* raw;
+    int raw_capacity;
+    int capacity;
+    int num_levels;
+    LOD_LEVEL levels[LOD_MAX_LEVELS];
+    long long num_samples;
+} LOD_PYRAMID;
+
+int LOD_init(LOD_PYRAMID* pyramid, int raw_capacity = LOD_DEFAULT_RAW, 
+             int bins_per_level = LOD_DEFAULT_BINS, int num_levels = LOD_DEFAULT_LEVELS);
+void LOD_free(LOD_PYRAMID* pyramid);
+void LOD_clear(LOD_PYRAMID* pyramid);
+void LOD_append(LOD_PYRAMID* pyramid, int* samples, int num_samples);
+int LOD_query(LOD_PYRAMID* pyramid, int channel, long long start, long long end, 
+              int pixels, int* min, int* max);
+
+#endif
@@ -0,0 +1,272 @@
+/**
+ * \file log.cpp
+ * \brief Routines for logging without blocking the caller
+ *
+ * Messages go into a ring that any thread may add to. A log thread 
+ * formats them and writes them to DEBUG_FILE, which is unset, so 
+ * messages are thrown away, until LOG_setFile is called. When the ring 
+ * is full messages are dropped and counted rather than waiting.
+ */
+
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+FILE* DEBUG_FILE = 0x00;
+
+volatile int LOG_LEVEL = LOG_INFO;
+
+LOG_RECORD LOG_RING[LOG_RING_SIZE];
+volatile int LOG_READY = 0;
+volatile int LOG_HEAD = 0;
+int LOG_TAIL = 0;
+volatile int LOG_DROPPED = 0;
+
+// guards starting and stopping the thread
+volatile int LOG_LOCK = 0;
+// guards the sink asked for by LOG_setFile, DEBUG_FILE is the log thread's own
+volatile int LOG_FILE_LOCK = 0;
+char LOG_FILENAME[256] = "";
+int LOG_TO_STDOUT = 0;
+// bumped by every LOG_setFile
+int LOG_FILE_REQUEST = 0;
+int LOG_STARTED = 0;
+volatile int LOG_STOP = 0;
+TH_THREAD LOG_THREAD;
+
+static void LOG_init() {
+    /** 
+     * Number the slots of the ring before first use
+     */
+    TH_spinLock(&LOG_LOCK);
+    if(!LOG_READY) {
+        for(int i = 0; i < LOG_RING_SIZE; i++) {
+            LOG_RING[i].sequence = i;
+        }
+        TH_atomicStore(&LOG_READY, 1);
+    }
+    TH_spinUnlock(&LOG_LOCK);
+}
+
+static LOG_RECORD* LOG_claim(int* position) {
+    /** 
+     * Reserve the next slot of the ring
+     *
+     * Returns 0 if the ring is full.
+     */
+    if(!TH_atomicLoad(&LOG_READY)) {
+        LOG_init();
+    }
+    for(;;) {
+        int head = TH_atomicLoad(&LOG_HEAD);
+        LOG_RECORD* record = &LOG_RING[head & (LOG_RING_SIZE - 1)];
+        int difference = (int)((unsigned int)TH_atomicLoad(&record->sequence) - 
+                               (unsigned int)head);
+        if(difference == 0) {
+            if(TH_compareAndSwap(&LOG_HEAD, head, (int)((unsigned int)head + 1))) {
+                *position = head;
+                return record;
+            }
+        } else if(difference < 0) {
+            // the log thread has not caught up
+            TH_atomicAdd(&LOG_DROPPED, 1);
+            return 0;
+        }
+    }
+}
+
+static void LOG_commit(LOG_RECORD* record, int position) {
+    /** 
+     * Hand a filled slot to the log thread
+     */
+    TH_atomicStore(&record->sequence, (int)((unsigned int)position + 1));
+}
+
+void LOG_write(int level, const char* format, int a0, int a1, int a2, int a3, int a4, 
+               int a5) {
+    /** 
+     * Queue a message without formatting it
+     *
+     * format must stay valid until it is written, so only pass string 
+     * literals, and only use integer conversions. Use the LOG macro 
+     * rather than calling this directly.
+     */
+    int position;
+    LOG_RECORD* record = LOG_claim(&position);
+    if(!record) {
+        return;
+    }
+    record->level = level;
+    record->format = format;
+    record->args[0] = a0;
+    record->args[1] = a1;
+    record->args[2] = a2;
+    record->args[3] = a3;
+    record->args[4] = a4;
+    record->args[5] = a5;
+    LOG_commit(record, position);
+}
+
+void LOG_printf(int level, const char* format, ...) {
+    /** 
+     * Format a message now and queue it
+     *
+     * Messages longer than LOG_TEXT_LENGTH are cut short.
+     */
+    int position;
+    LOG_RECORD* record = LOG_claim(&position);
+    if(!record) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record->text, LOG_TEXT_LENGTH, format, args);
+    va_end(args);
+    record->level = level;
+    record->format = 0;
+    LOG_commit(record, position);
+}
+
+static int LOG_drain() {
+    /** 
+     * Write every message in the ring, called by the log thread only
+     *
+     * Returns the number of messages taken.
+     */
+    static int reported_dropped = 0;
+    static int file_request = 0;
+    int count = 0;
+    
+    // only the request is taken under the lock, the file is changed outside it
+    char filename[sizeof(LOG_FILENAME)];
+    int to_stdout = -1;
+    TH_spinLock(&LOG_FILE_LOCK);
+    if(LOG_FILE_REQUEST != file_request) {
+        file_request = LOG_FILE_REQUEST;
+        strcpy(filename, LOG_FILENAME);
+        to_stdout = LOG_TO_STDOUT;
+    }
+    TH_spinUnlock(&LOG_FILE_LOCK);
+    if(to_stdout >= 0) {
+        if(DEBUG_FILE && DEBUG_FILE != stdout) {
+            fclose(DEBUG_FILE);
+        }
+        DEBUG_FILE = 0;
+        if(to_stdout) {
+            DEBUG_FILE = stdout;
+        } else if(filename[0]) {
+            DEBUG_FILE = fopen(filename, "w");
+        }
+    }
+    for(;;) {
+        LOG_RECORD* record = &LOG_RING[LOG_TAIL & (LOG_RING_SIZE - 1)];
+        if(TH_atomicLoad(&record->sequence) != (int)((unsigned int)LOG_TAIL + 1)) {
+            break;
+        }
+        if(DEBUG_FILE) {
+            if(record->format) {
+                int* a = record->args;
+                fprintf(DEBUG_FILE, record->format, a[0], a[1], a[2], a[3], a[4], a[5]);
+            } else {
+                fputs(record->text, DEBUG_FILE);
+            }
+        }
+        TH_atomicStore(&record->sequence, (int)((unsigned int)LOG_TAIL + LOG_RING_SIZE));
+        LOG_TAIL = (int)((unsigned int)LOG_TAIL + 1);
+        count++;
+    }
+    int dropped = TH_atomicLoad(&LOG_DROPPED);
+    if(dropped != reported_dropped && DEBUG_FILE) {
+        fprintf(DEBUG_FILE, "%d log messages dropped\n", dropped - reported_dropped);
+        reported_dropped = dropped;
+    }
+    if(count && DEBUG_FILE) {
+        fflush(DEBUG_FILE);
+    }
+    return count;
+}
+
+static void LOG_thread(void* arg) {
+    /** 
+     * Write messages until LOG_stop
+     */
+    while(!TH_atomicLoad(&LOG_STOP)) {
+        if(!LOG_drain()) {
+            TH_sleep(10);
+        }
+    }
+    LOG_drain();
+}
+
+void LOG_start() {
+    /** 
+     * Start the log thread if it is not running
+     *
+     * Messages logged before this are kept until the ring fills. The 
+     * thread is stopped, and the ring written out, at exit.
+     */
+    if(!TH_atomicLoad(&LOG_READY)) {
+        LOG_init();
+    }
+    TH_spinLock(&LOG_LOCK);
+    if(!LOG_STARTED) {
+        TH_atomicStore(&LOG_STOP, 0);
+        if(!TH_create(&LOG_THREAD, LOG_thread, 0)) {
+            static int registered = 0;
+            if(!registered) {
+                atexit(LOG_stop);
+                registered = 1;
+            }
+            LOG_STARTED = 1;
+        }
+    }
+    TH_spinUnlock(&LOG_LOCK);
+}
+
+void LOG_stop() {
+    /** 
+     * Write out the ring and stop the log thread
+     */
+    TH_spinLock(&LOG_LOCK);
+    if(LOG_STARTED) {
+        TH_atomicStore(&LOG_STOP, 1);
+        TH_join(LOG_THREAD);
+        LOG_STARTED = 0;
+    }
+    TH_spinUnlock(&LOG_LOCK);
+}
+
+void LOG_setLevel(int level) {
+    /** 
+     * Only log messages at or below level, LOG_OFF for none
+     */
+    TH_atomicStore(&LOG_LEVEL, level);
+}
+
+int LOG_setFile(const char* filename) {
+    /** 
+     * Send messages to a new file
+     *
+     * \param filename 0 for stdout, "" to throw messages away
+     *
+     * The old file is closed, and the new one opened, by the log thread 
+     * on its next pass. Returns -1 if the name is too long.
+     */
+    if(filename && strlen(filename) >= sizeof(LOG_FILENAME)) {
+        return -1;
+    }
+    TH_spinLock(&LOG_FILE_LOCK);
+    strcpy(LOG_FILENAME, filename ? filename : "");
+    LOG_TO_STDOUT = !filename;
+    LOG_FILE_REQUEST++;
+    TH_spinUnlock(&LOG_FILE_LOCK);
+    return 0;
+}
+
+int LOG_getDropped() {
+    /** 
+     * Returns the number of messages dropped because the ring was full
+     */
+    return TH_atomicLoad(&LOG_DROPPED);
+}
@@ -0,0 +1,71 @@
+/**
+ * \file log.h
+ * \brief Header file for log.cpp
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "libchaos.h"
+#include "threads.h"
+
+/* levels, the same values as the public ones */
+#define LOG_OFF -1
+#define LOG_ERROR 0
+#define LOG_WARNING 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+// messages above this level are not compiled in
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+#define LOG_RING_SIZE 1024
+#define LOG_MAX_ARGS 6
+#define LOG_TEXT_LENGTH 96
+
+extern volatile int LOG_LEVEL;
+
+#define LOG_ENABLED(level) ((level) <= LOG_COMPILE_LEVEL && (level) <= LOG_LEVEL)
+
+/**
+ * Log a message whose format is a string literal with only integer 
+ * conversions. Formatting is left to the log thread.
+ */
+#define LOG(level, ...) \
+    do { if(LOG_ENABLED(level)) LOG_write(level, __VA_ARGS__); } while(0)
+
+/**
+ * Log a message with any printf conversions. It is formatted by the 
+ * caller, so keep it off hot paths.
+ */
+#define LOG_TEXT(level, ...) \
+    do { if(LOG_ENABLED(level)) LOG_printf(level, __VA_ARGS__); } while(0)
+
+/**
+ * One message waiting in the ring
+ *
+ * sequence tells producers and the log thread who owns the slot. When 
+ * format is 0 the message is already formatted in text.
+ */
+typedef struct {
+    volatile int sequence;
+    int level;
+    const char* format;
+    int args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_LENGTH];
+} LOG_RECORD;
+
+void LOG_write(int level, const char* format, int a0 = 0, int a1 = 0, int a2 = 0, 
+               int a3 = 0, int a4 = 0, int a5 = 0);
+void LOG_printf(int level, const char* format, ...);
+void LOG_start();
+void LOG_stop();
+void LOG_setLevel(int level);
+int LOG_setFile(const char* filename);
+int LOG_getDropped();
+
+#endif
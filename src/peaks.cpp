@@ -4,149 +4,162 @@
  */
  
 #include "peaks.h"
+#include "log.h"
+#include "trace.h"
+#include "kernels.h"
+#include "bufpool.h"
 
-int PEAKS_INITIALIZED = 0;
-int PEAKS_PER_MDAC = 0;
-int* PEAKS_CACHE[4096];
-int* PEAKS_SAMPLES;
-int PEAKS_NUM_SAMPLES;
-
-int peaks_initCache(int peaks_per_mdac) {
+int peaks_initCache(PEAKS_STATE* state, int peaks_per_mdac) {
     /** 
      * Initialize the peaks cache
+     *
+     * state must be zeroed before the first call. The cache for every 
+     * MDAC value is one buffer from the pool, cut into rows.
      */
 
     const int samples_per_peak = 75;
 
-    if(PEAKS_INITIALIZED) {
-        for(int i = 0; i < 4096; i++) {
-            free(PEAKS_CACHE[i]);
-        }
-        free(PEAKS_SAMPLES);
+    if(state->initialized) {
+        BP_free(state->cache[0]);
+        BP_free(state->samples);
     }
     
-    PEAKS_PER_MDAC = peaks_per_mdac;
-    PEAKS_INITIALIZED = 1;
+    state->per_mdac = peaks_per_mdac;
+    state->initialized = 1;
     
+    int* rows = (int*)BP_alloc(4096*peaks_per_mdac*sizeof(int));
     for(int i = 0; i < 4096; i++) {
-        // allocate the spcae
-        PEAKS_CACHE[i] = (int*)malloc(peaks_per_mdac*4);
-        // set the initial value to -1
-        PEAKS_CACHE[i][0] = -1;
+        state->cache[i] = rows ? rows + i*peaks_per_mdac : 0;
+        state->count[i] = 0;
     }
     
-    PEAKS_NUM_SAMPLES = PEAKS_PER_MDAC*samples_per_peak;
-    PEAKS_SAMPLES = (int*)malloc(PEAKS_NUM_SAMPLES*sizeof(int));
+    // the diagram only holds what is in the cache
+    BF_clear(&state->diagram);
+    
+    state->num_samples = state->per_mdac*samples_per_peak;
+    state->samples = (int*)BP_alloc(state->num_samples*sizeof(int));
+    if(!rows || !state->samples) {
+        BP_free(rows);
+        BP_free(state->samples);
+        memset(state->cache, 0, sizeof(state->cache));
+        state->samples = 0;
+        state->initialized = 0;
+        return 0;
+    }
+    for(int i = 0; i < 4096; i++) {
+        // set the initial value to -1
+        state->cache[i][0] = -1;
+    }
     
     // mark as cache initialized
-    return((int)(PEAKS_CACHE != 0));
+    return 1;
+}
+
+void peaks_freeCache(PEAKS_STATE* state) {
+    /** 
+     * Free the peaks cache and its diagram
+     */
+    if(state->initialized) {
+        BP_free(state->cache[0]);
+        BP_free(state->samples);
+    }
+    BF_free(&state->diagram);
+    memset(state, 0, sizeof(PEAKS_STATE));
 }
 
-int peaks_isCacheHit(int mdac_value) {
+int peaks_isCacheHit(PEAKS_STATE* state, int mdac_value) {
     /** 
      * Return true if the peaks are in the cache
      */
-    if(mdac_value < 4096 && mdac_value > -1) {
-        return(PEAKS_CACHE[mdac_value][0] != -1);
+    if(state->initialized && mdac_value < 4096 && mdac_value > -1) {
+        return(state->cache[mdac_value][0] != -1);
+    } else {
+        return 0;
+    }
+}
+
+int peaks_getNumPeaks(PEAKS_STATE* state, int mdac_value) {
+    /** 
+     * Return the number of valid peaks cached for an MDAC value
+     */
+    if(peaks_isCacheHit(state, mdac_value)) {
+        return state->count[mdac_value];
     } else {
         return 0;
     }
 }
 
-int* peaks_getPeaksAtMDAC(int mdac_value, int delta) {
+int peaks_fillDiagram(PEAKS_STATE* state, BF_RASTER* raster) {
+    /** 
+     * Add every cached MDAC value to a bifurcation raster
+     *
+     * Returns the number of MDAC values added
+     */
+    int filled = 0;
+    
+    if(!state->initialized) {
+        return 0;
+    }
+    
+    for(int i = 0; i < 4096; i++) {
+        if(peaks_isCacheHit(state, i)) {
+            BF_setColumn(raster, i, state->cache[i], state->count[i]);
+            filled++;
+        }
+    }
+    return filled;
+}
+
+int* peaks_getPeaksAtMDAC(PEAKS_STATE* state, UC_DEVICE* dev, int mdac_value, int delta) {
     /** 
      * Get some peaks for a given MDAC value
+     *
+     * Returns 0 if the cache could not be allocated or the device could
+     * not be read, the MDAC value is then left uncached
      */
 
-    if(!PEAKS_INITIALIZED) {
-        peaks_initCache();
+    if(!state->initialized && !peaks_initCache(state)) {
+        return 0;
     }
     
     if(mdac_value > 4095 || mdac_value < 0) {
             // TODO: this should throw some sort of error
-            return PEAKS_CACHE[0];
+            return state->cache[0];
     }
     
-    if(peaks_isCacheHit(mdac_value)) {
+    if(peaks_isCacheHit(state, mdac_value)) {
         // just return a pointer to the data if we already have it
-        return PEAKS_CACHE[mdac_value];
+        return state->cache[mdac_value];
     } else {
         // otherwise, find the peaks
-        fprintf(DEBUG_FILE, "Taking peaks detection data %d\r\n", mdac_value);
-        UC_sample(PEAKS_SAMPLES, PEAKS_NUM_SAMPLES, mdac_value);
-        peaks_findPeaks(PEAKS_CACHE[mdac_value], //dst
-                        PEAKS_PER_MDAC, //len
-                        PEAKS_SAMPLES, //source data
-                        PEAKS_NUM_SAMPLES, //num_samples in source
-                        delta);
+        LOG(LOG_DEBUG, "Taking peaks detection data %d\r\n", mdac_value);
+        if(UC_sample(dev, state->samples, state->num_samples, mdac_value)) {
+            LOG(LOG_ERROR, "Could not take peaks detection data %d\n", mdac_value);
+            return 0;
+        }
+        state->count[mdac_value] = 
+            peaks_findPeaks(state->cache[mdac_value], //dst
+                            state->per_mdac, //len
+                            state->samples, //source data
+                            state->num_samples, //num_samples in source
+                            delta);
+        BF_setColumn(&state->diagram, mdac_value, 
+                     state->cache[mdac_value], state->count[mdac_value]);
     }
 	
-	return PEAKS_CACHE[mdac_value];
+	return state->cache[mdac_value];
 }
 
 int peaks_findPeaks(int* dst, int len, int* sample_data, int num_samples, int delta) {
     /** 
      * Find peaks and store them to memory buffer
      *
+     * A peak is the highest x1 reached before x1 falls by more than 
+     * delta, after having risen by more than delta from the last 
+     * minimum. The search is done by the kernels for this machine.
+     *
      * Returns the number of peaks detected
      */
-    int min = 2000;
-    int max = -1;
-    int max_position = -1;
-    int min_position = -1;
-    int look_for_max = false;
-    int max_count = 0;
-
-    // Loop through data
-    for(int i = 0; i < num_samples; i++)
-    {
-        int current = DP_getX1(sample_data[i]);
-        // Is this a potential max?
-        if(current > max) {
-            max = current;
-            max_position = i;
-        }
-        // Is this a potential min?
-        if(current < min) {
-            min = current;
-            min_position = i;
-        }
-        if(look_for_max == true) {
-            // If we are looking for a max and we go back down by delta,
-            // then we must have found one. Let's store it!
-            if(current < max - delta) {
-            
-                // Fit max to parabola
-                /*const float timestep = 1/float(LIBCHAOS_SAMPLE_FREQUENCY);
-                int xprev = DP_getX1(sample_data[max_position - 1]);
-                int xnext = DP_getX1(sample_data[max_position + 1]);
-                
-                float aa = (xprev + xnext - 2*current)/(2*timestep*timestep);
-                float bb = (4*current-xnext-3*xprev)/(2*timestep);
-                float cc = xprev;
-                
-                dst[max_count] = int(cc-bb*bb/(4*aa));*/
-				dst[max_count] = DP_getX1(sample_data[max_position]);
-                max_count++;
-                if(max_count >= len) {
-                    // Stop looking for maxes
-                    break;
-                }
-                // Reset minimum
-                min = current;
-                min_position = i;
-                // Find the next minimum
-                look_for_max = false;
-            }
-        } else {
-            if (current > min + delta) {
-                // Reset maximum
-                max = current;
-                max_position = i;
-                // Find the next maximum
-                look_for_max = true;
-            }
-        }
-    }
-    return max_count;
+    TRACE_SCOPE(TRACE_PEAKS);
+    return KN->findPeaks(dst, len, sample_data, num_samples, delta);
 }
@@ -9,10 +9,30 @@
 #include "libchaos.h"
 #include "usb_comm.h"
 #include "data_processing.h"
+#include "bifurcation.h"
 
-int peaks_initCache(int peaks_per_mdac = 10);
-int* peaks_getPeaksAtMDAC(int mdac_value, int delta = 2);
-int peaks_isCacheHit(int mdac_value);
+/**
+ * Peaks found at each MDAC value
+ *
+ * cache[m][0] is -1 until MDAC value m has been sampled. diagram is the
+ * bifurcation raster of everything in the cache.
+ */
+typedef struct {
+    int initialized;
+    int per_mdac;
+    int* cache[4096];
+    int count[4096];
+    int* samples;
+    int num_samples;
+    BF_RASTER diagram;
+} PEAKS_STATE;
+
+int peaks_initCache(PEAKS_STATE* state, int peaks_per_mdac = 10);
+void peaks_freeCache(PEAKS_STATE* state);
+int* peaks_getPeaksAtMDAC(PEAKS_STATE* state, UC_DEVICE* dev, int mdac_value, int delta = 2);
+int peaks_isCacheHit(PEAKS_STATE* state, int mdac_value);
+int peaks_getNumPeaks(PEAKS_STATE* state, int mdac_value);
+int peaks_fillDiagram(PEAKS_STATE* state, BF_RASTER* raster);
 int peaks_findPeaks(int* dst, int len, int* sample_data, int num_samples, int delta);
 
 #endif
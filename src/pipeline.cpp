@@ -0,0 +1,419 @@
+/**
+ * \file pipeline.cpp
+ * \brief Routines for running analysis stages on a stream of samples
+ */
+
+#include "pipeline.h"
+#include "data_processing.h"
+#include "trace.h"
+#include "kernels.h"
+#include "bufpool.h"
+
+// one pool of workers is shared by every pipeline
+TH_POOL PL_POOL;
+int PL_POOL_USERS = 0;
+volatile int PL_POOL_LOCK = 0;
+
+static void PL_runStage(void* arg);
+
+int PL_init(PL_PIPELINE* pipeline) {
+    /** 
+     * Initialize a pipeline with no stages
+     */
+    memset(pipeline, 0, sizeof(PL_PIPELINE));
+    
+    TH_spinLock(&PL_POOL_LOCK);
+    if(!PL_POOL_USERS) {
+        // keep a spare worker so a slow stage cannot hold up all others
+        int workers = TH_numCores();
+        if(workers < 2) {
+            workers = 2;
+        }
+        if(TH_poolCreate(&PL_POOL, workers)) {
+            TH_spinUnlock(&PL_POOL_LOCK);
+            return -1;
+        }
+    }
+    PL_POOL_USERS++;
+    TH_spinUnlock(&PL_POOL_LOCK);
+    
+    TH_mutexInit(&pipeline->lock);
+    TH_condInit(&pipeline->changed);
+    pipeline->pool = &PL_POOL;
+    return 0;
+}
+
+void PL_free(PL_PIPELINE* pipeline) {
+    /** 
+     * Wait for the stages to finish and free the pipeline
+     */
+    if(!pipeline->pool) {
+        return;
+    }
+    PL_flush(pipeline);
+    for(int i = 0; i < PL_MAX_STAGES; i++) {
+        free(pipeline->stages[i].queue);
+    }
+    while(pipeline->free_blocks) {
+        PL_BLOCK* block = pipeline->free_blocks;
+        pipeline->free_blocks = block->next;
+        BP_free(block->samples);
+        BP_free(block->x1);
+        BP_free(block->x2);
+        BP_free(block->x3);
+        free(block);
+    }
+    TH_condDestroy(&pipeline->changed);
+    TH_mutexDestroy(&pipeline->lock);
+    memset(pipeline, 0, sizeof(PL_PIPELINE));
+    
+    TH_spinLock(&PL_POOL_LOCK);
+    if(--PL_POOL_USERS == 0) {
+        TH_poolDestroy(&PL_POOL);
+    }
+    TH_spinUnlock(&PL_POOL_LOCK);
+}
+
+int PL_addStage(PL_PIPELINE* pipeline, const char* name, PL_FUNCTION function, void* arg, 
+                int queue_length, int policy, int sync) {
+    /** 
+     * Add a stage that is called as function(arg, block) for every block
+     *
+     * \param queue_length Blocks that may wait for the stage
+     * \param policy PL_WAIT to hold up PL_push while the queue is full, 
+     * PL_DROP to throw away the oldest waiting block instead
+     * \param sync Non-zero for PL_push to wait for the stage when asked
+     * \return The stage number, or -1 if there is no room
+     */
+    if(queue_length < 1 || (policy != PL_WAIT && policy != PL_DROP)) {
+        return -1;
+    }
+    PL_BLOCK** queue = (PL_BLOCK**)malloc(queue_length*sizeof(PL_BLOCK*));
+    if(!queue) {
+        return -1;
+    }
+    
+    TH_lock(&pipeline->lock);
+    for(int i = 0; i < PL_MAX_STAGES; i++) {
+        PL_STAGE* stage = &pipeline->stages[i];
+        if(!stage->used && !stage->scheduled) {
+            free(stage->queue);
+            memset(stage, 0, sizeof(PL_STAGE));
+            strncpy(stage->name, name, sizeof(stage->name) - 1);
+            stage->function = function;
+            stage->arg = arg;
+            stage->policy = policy;
+            stage->sync = sync;
+            stage->queue = queue;
+            stage->queue_length = queue_length;
+            stage->pipeline = pipeline;
+            stage->used = 1;
+            TH_unlock(&pipeline->lock);
+            return i;
+        }
+    }
+    TH_unlock(&pipeline->lock);
+    free(queue);
+    return -1;
+}
+
+static void PL_releaseBlock(PL_PIPELINE* pipeline, PL_BLOCK* block) {
+    /** 
+     * Drop a reference to a block, the pipeline lock must be held
+     */
+    if(--block->refs == 0) {
+        block->next = pipeline->free_blocks;
+        pipeline->free_blocks = block;
+        TH_broadcast(&pipeline->changed);
+    }
+}
+
+int PL_removeStage(PL_PIPELINE* pipeline, int stage_number) {
+    /** 
+     * Remove a stage
+     *
+     * Blocks waiting for the stage are discarded. Returns once the stage 
+     * is no longer running, so its arg may then be freed.
+     */
+    if(stage_number < 0 || stage_number >= PL_MAX_STAGES) {
+        return -1;
+    }
+    PL_STAGE* stage = &pipeline->stages[stage_number];
+    
+    TH_lock(&pipeline->lock);
+    if(!stage->used) {
+        TH_unlock(&pipeline->lock);
+        return -1;
+    }
+    stage->used = 0;
+    while(stage->count) {
+        PL_BLOCK* block = stage->queue[stage->head];
+        stage->head = (stage->head + 1) % stage->queue_length;
+        stage->count--;
+        if(stage->sync) {
+            block->pending_sync--;
+        }
+        PL_releaseBlock(pipeline, block);
+    }
+    TH_broadcast(&pipeline->changed);
+    while(stage->scheduled) {
+        TH_wait(&pipeline->changed, &pipeline->lock);
+    }
+    TH_unlock(&pipeline->lock);
+    return 0;
+}
+
+int PL_findStage(PL_PIPELINE* pipeline, const char* name) {
+    /** 
+     * Returns the number of the stage with a name, or -1
+     */
+    int found = -1;
+    TH_lock(&pipeline->lock);
+    for(int i = 0; i < PL_MAX_STAGES && found < 0; i++) {
+        if(pipeline->stages[i].used && !strcmp(pipeline->stages[i].name, name)) {
+            found = i;
+        }
+    }
+    TH_unlock(&pipeline->lock);
+    return found;
+}
+
+int PL_getNumStages(PL_PIPELINE* pipeline) {
+    /** 
+     * Returns the number of stages in the pipeline
+     */
+    int num_stages = 0;
+    TH_lock(&pipeline->lock);
+    for(int i = 0; i < PL_MAX_STAGES; i++) {
+        num_stages += pipeline->stages[i].used;
+    }
+    TH_unlock(&pipeline->lock);
+    return num_stages;
+}
+
+static void PL_schedule(PL_STAGE* stage) {
+    /** 
+     * Queue the stage on the pool if it has blocks and is not already 
+     * queued, the pipeline lock must be held
+     */
+    if(!stage->scheduled && stage->count) {
+        stage->scheduled = 1;
+        if(TH_poolSubmit(stage->pipeline->pool, PL_runStage, stage)) {
+            // no memory for the task, run the stage here
+            TH_unlock(&stage->pipeline->lock);
+            PL_runStage(stage);
+            TH_lock(&stage->pipeline->lock);
+        }
+    }
+}
+
+static void PL_runStage(void* arg) {
+    /** 
+     * Run a stage on the oldest block waiting for it
+     *
+     * Only one of these runs per stage at a time, so a stage sees its 
+     * blocks in order.
+     */
+    PL_STAGE* stage = (PL_STAGE*)arg;
+    PL_PIPELINE* pipeline = stage->pipeline;
+    
+    TH_lock(&pipeline->lock);
+    if(!stage->count) {
+        // the stage was removed
+        stage->scheduled = 0;
+        TH_broadcast(&pipeline->changed);
+        TH_unlock(&pipeline->lock);
+        return;
+    }
+    PL_BLOCK* block = stage->queue[stage->head];
+    stage->head = (stage->head + 1) % stage->queue_length;
+    stage->count--;
+    TH_broadcast(&pipeline->changed);
+    TH_unlock(&pipeline->lock);
+    
+    double start = TH_seconds();
+    stage->function(stage->arg, block);
+    double elapsed = TH_seconds() - start;
+    
+    TH_lock(&pipeline->lock);
+    stage->blocks++;
+    stage->busy_time += elapsed;
+    if(elapsed > stage->max_time) {
+        stage->max_time = elapsed;
+    }
+    if(stage->sync) {
+        block->pending_sync--;
+    }
+    PL_releaseBlock(pipeline, block);
+    stage->scheduled = 0;
+    if(stage->used) {
+        PL_schedule(stage);
+    }
+    TH_broadcast(&pipeline->changed);
+    TH_unlock(&pipeline->lock);
+}
+
+static PL_BLOCK* PL_getBlock(PL_PIPELINE* pipeline, int num_samples) {
+    /** 
+     * Get an unused block with room for num_samples
+     *
+     * Waits for the stages when PL_MAX_BLOCKS are in use. The pipeline 
+     * lock must be held.
+     */
+    while(!pipeline->free_blocks && pipeline->num_blocks >= PL_MAX_BLOCKS) {
+        TH_wait(&pipeline->changed, &pipeline->lock);
+    }
+    PL_BLOCK* block = pipeline->free_blocks;
+    if(block) {
+        pipeline->free_blocks = block->next;
+    } else {
+        block = (PL_BLOCK*)calloc(1, sizeof(PL_BLOCK));
+        if(!block) {
+            return 0;
+        }
+        pipeline->num_blocks++;
+    }
+    if(block->capacity < num_samples) {
+        BP_free(block->samples);
+        BP_free(block->x1);
+        BP_free(block->x2);
+        BP_free(block->x3);
+        block->samples = (int*)BP_alloc(num_samples*sizeof(int));
+        block->x1 = (short*)BP_alloc(num_samples*sizeof(short));
+        block->x2 = (short*)BP_alloc(num_samples*sizeof(short));
+        block->x3 = (short*)BP_alloc(num_samples*sizeof(short));
+        if(!block->samples || !block->x1 || !block->x2 || !block->x3) {
+            block->capacity = 0;
+            block->next = pipeline->free_blocks;
+            pipeline->free_blocks = block;
+            return 0;
+        }
+        // the pool rounds up, so use all of it before growing again
+        int capacity = (int)(BP_getCapacity(block->samples)/sizeof(int));
+        int channel_capacity = (int)(BP_getCapacity(block->x1)/sizeof(short));
+        block->capacity = capacity < channel_capacity ? capacity : channel_capacity;
+    }
+    block->refs = 1;
+    block->pending_sync = 0;
+    return block;
+}
+
+int PL_push(PL_PIPELINE* pipeline, int* samples, int num_samples, int mdac, bool wait_sync) {
+    /** 
+     * Hand a block of packed samples to every stage
+     *
+     * \param wait_sync Return only once the sync stages have processed 
+     * the block
+     * \return 0, or -1 if there was no memory for the block
+     *
+     * The samples are copied, so the caller may reuse them at once.
+     */
+    TH_lock(&pipeline->lock);
+    if(!PL_getNumStages(pipeline)) {
+        TH_unlock(&pipeline->lock);
+        return 0;
+    }
+    PL_BLOCK* block = PL_getBlock(pipeline, num_samples);
+    if(!block) {
+        TH_unlock(&pipeline->lock);
+        return -1;
+    }
+    block->mdac = mdac;
+    block->position = pipeline->position;
+    block->num_samples = num_samples;
+    pipeline->position += num_samples;
+    TH_unlock(&pipeline->lock);
+    
+    // only this thread knows about the block until it is queued
+    {
+        TRACE_SCOPE(TRACE_DECODE);
+        memcpy(block->samples, samples, num_samples*sizeof(int));
+        KN->decode(samples, block->x1, block->x2, block->x3, num_samples);
+    }
+    
+    TH_lock(&pipeline->lock);
+    for(int i = 0; i < PL_MAX_STAGES; i++) {
+        PL_STAGE* stage = &pipeline->stages[i];
+        if(!stage->used) {
+            continue;
+        }
+        if(stage->count == stage->queue_length) {
+            if(stage->policy == PL_DROP) {
+                PL_BLOCK* oldest = stage->queue[stage->head];
+                stage->head = (stage->head + 1) % stage->queue_length;
+                stage->count--;
+                if(stage->sync) {
+                    oldest->pending_sync--;
+                }
+                PL_releaseBlock(pipeline, oldest);
+                stage->dropped++;
+            } else {
+                double start = TH_seconds();
+                stage->waits++;
+                while(stage->used && stage->count == stage->queue_length) {
+                    TH_wait(&pipeline->changed, &pipeline->lock);
+                }
+                stage->wait_time += TH_seconds() - start;
+                if(!stage->used) {
+                    continue;
+                }
+            }
+        }
+        stage->queue[(stage->head + stage->count) % stage->queue_length] = block;
+        stage->count++;
+        block->refs++;
+        if(stage->sync) {
+            block->pending_sync++;
+        }
+        PL_schedule(stage);
+    }
+    if(wait_sync) {
+        while(block->pending_sync) {
+            TH_wait(&pipeline->changed, &pipeline->lock);
+        }
+    }
+    PL_releaseBlock(pipeline, block);
+    TH_unlock(&pipeline->lock);
+    return 0;
+}
+
+void PL_flush(PL_PIPELINE* pipeline) {
+    /** 
+     * Wait until every stage has processed every block pushed
+     */
+    TH_lock(&pipeline->lock);
+    for(int i = 0; i < PL_MAX_STAGES; i++) {
+        PL_STAGE* stage = &pipeline->stages[i];
+        while(stage->count || stage->scheduled) {
+            TH_wait(&pipeline->changed, &pipeline->lock);
+        }
+    }
+    TH_unlock(&pipeline->lock);
+}
+
+int PL_getStats(PL_PIPELINE* pipeline, int stage_number, PL_STATS* stats) {
+    /** 
+     * Get the counters and timings of a stage
+     *
+     * Times are in seconds. wait_time is how long PL_push was held up by 
+     * the stage.
+     */
+    if(stage_number < 0 || stage_number >= PL_MAX_STAGES) {
+        return -1;
+    }
+    PL_STAGE* stage = &pipeline->stages[stage_number];
+    TH_lock(&pipeline->lock);
+    if(!stage->used) {
+        TH_unlock(&pipeline->lock);
+        return -1;
+    }
+    stats->blocks = stage->blocks;
+    stats->dropped = stage->dropped;
+    stats->waits = stage->waits;
+    stats->queued = stage->count;
+    stats->busy_time = stage->busy_time;
+    stats->max_time = stage->max_time;
+    stats->wait_time = stage->wait_time;
+    TH_unlock(&pipeline->lock);
+    return 0;
+}
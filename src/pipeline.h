@@ -0,0 +1,106 @@
+/**
+ * \file pipeline.h
+ * \brief Header file for pipeline.cpp
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "threads.h"
+
+#define PL_MAX_STAGES 16
+#define PL_MAX_BLOCKS 64
+#define PL_DEFAULT_QUEUE 4
+
+/* what a stage does with a block when its queue is full */
+#define PL_WAIT 0
+#define PL_DROP 1
+
+/**
+ * Samples handed to the stages of a pipeline
+ *
+ * The packed samples are decoded once into x1, x2 and x3. A block is 
+ * shared by every stage and must not be changed by them.
+ */
+typedef struct PL_BLOCK {
+    int refs;
+    int pending_sync;
+    int mdac;
+    long long position;
+    int num_samples;
+    int capacity;
+    int* samples;
+    short* x1;
+    short* x2;
+    short* x3;
+    struct PL_BLOCK* next;
+} PL_BLOCK;
+
+typedef void (*PL_FUNCTION)(void* arg, PL_BLOCK* block);
+
+struct PL_PIPELINE;
+
+/**
+ * One analysis run on every block pushed into a pipeline
+ *
+ * A stage sees blocks one at a time and in order. Different stages run
+ * at the same time on the shared pool. Sync stages are waited for by
+ * PL_push.
+ */
+typedef struct {
+    int used;
+    char name[32];
+    PL_FUNCTION function;
+    void* arg;
+    int policy;
+    int sync;
+    PL_BLOCK** queue;
+    int queue_length;
+    int head;
+    int count;
+    int scheduled;
+    struct PL_PIPELINE* pipeline;
+    
+    // statistics
+    long long blocks;
+    long long dropped;
+    long long waits;
+    double busy_time;
+    double max_time;
+    double wait_time;
+} PL_STAGE;
+
+typedef struct {
+    long long blocks;
+    long long dropped;
+    long long waits;
+    int queued;
+    double busy_time;
+    double max_time;
+    double wait_time;
+} PL_STATS;
+
+typedef struct PL_PIPELINE {
+    TH_MUTEX lock;
+    TH_COND changed;
+    PL_STAGE stages[PL_MAX_STAGES];
+    PL_BLOCK* free_blocks;
+    int num_blocks;
+    long long position;
+    TH_POOL* pool;
+} PL_PIPELINE;
+
+int PL_init(PL_PIPELINE* pipeline);
+void PL_free(PL_PIPELINE* pipeline);
+int PL_addStage(PL_PIPELINE* pipeline, const char* name, PL_FUNCTION function, void* arg, 
+                int queue_length = PL_DEFAULT_QUEUE, int policy = PL_WAIT, int sync = 0);
+int PL_removeStage(PL_PIPELINE* pipeline, int stage);
+int PL_findStage(PL_PIPELINE* pipeline, const char* name);
+int PL_getNumStages(PL_PIPELINE* pipeline);
+int PL_push(PL_PIPELINE* pipeline, int* samples, int num_samples, int mdac, bool wait_sync = false);
+void PL_flush(PL_PIPELINE* pipeline);
+int PL_getStats(PL_PIPELINE* pipeline, int stage, PL_STATS* stats);
+
+#endif
@@ -0,0 +1,235 @@
+/**
+ * \file poincare.cpp
+ * \brief Routines for extracting Poincare sections from a sample stream
+ */
+
+#include "poincare.h"
+#include "data_processing.h"
+
+int PS_init(PS_SECTION* section, int capacity) {
+    /** 
+     * Initialize a section with room for capacity crossings
+     *
+     * The plane defaults to x1 = 512 crossed in the positive direction.
+     */
+    if(capacity < 1) {
+        return -1;
+    }
+    float* points = (float*)malloc(capacity*3*sizeof(float));
+    double* times = (double*)malloc(capacity*sizeof(double));
+    if(!points || !times) {
+        free(points);
+        free(times);
+        return -1;
+    }
+    
+    if(!section->capacity) {
+        PS_setPlane(section, 1, 0, 0, 512, PS_POSITIVE, PS_LINEAR);
+    }
+    free(section->points);
+    free(section->times);
+    section->points = points;
+    section->times = times;
+    section->capacity = capacity;
+    PS_clear(section);
+    return 0;
+}
+
+void PS_free(PS_SECTION* section) {
+    /** 
+     * Free the memory used by a section
+     */
+    free(section->points);
+    free(section->times);
+    memset(section, 0, sizeof(PS_SECTION));
+}
+
+void PS_setPlane(PS_SECTION* section, float a, float b, float c, float d, 
+                 int direction, int interpolation) {
+    /** 
+     * Set the plane a*x1 + b*x2 + c*x3 = d
+     *
+     * \param direction PS_POSITIVE, PS_NEGATIVE or PS_BOTH
+     * \param interpolation PS_LINEAR or PS_CUBIC
+     *
+     * Points already collected are kept.
+     */
+    section->normal[0] = a;
+    section->normal[1] = b;
+    section->normal[2] = c;
+    section->offset = d;
+    section->direction = direction;
+    section->interpolation = interpolation;
+    PS_breakStream(section);
+}
+
+void PS_clear(PS_SECTION* section) {
+    /** 
+     * Throw away all collected crossings
+     */
+    section->head = 0;
+    section->num_points = 0;
+    section->position = 0;
+    PS_breakStream(section);
+}
+
+void PS_breakStream(PS_SECTION* section) {
+    /** 
+     * Mark a gap in the stream
+     *
+     * The next block is not joined to the last one. Use this between 
+     * separate captures.
+     */
+    section->num_history = 0;
+}
+
+static void PS_store(PS_SECTION* section, float* point, double time) {
+    float* dst = &section->points[section->head*3];
+    dst[0] = point[0];
+    dst[1] = point[1];
+    dst[2] = point[2];
+    section->times[section->head] = time;
+    section->head++;
+    if(section->head == section->capacity) {
+        section->head = 0;
+    }
+    if(section->num_points < section->capacity) {
+        section->num_points++;
+    }
+}
+
+static inline float PS_cubic(float p0, float p1, float p2, float p3, float t) {
+    /** 
+     * Catmull-Rom interpolation between p1 (t=0) and p2 (t=1)
+     */
+    return p1 + 0.5f*t*(p2 - p0 + t*(2.0f*p0 - 5.0f*p1 + 4.0f*p2 - p3 + 
+                                     t*(3.0f*(p1 - p2) + p3 - p0)));
+}
+
+static inline float PS_cubicSlope(float p0, float p1, float p2, float p3, float t) {
+    return 0.5f*(p2 - p0 + t*(2.0f*(2.0f*p0 - 5.0f*p1 + 4.0f*p2 - p3) + 
+                             t*3.0f*(3.0f*(p1 - p2) + p3 - p0)));
+}
+
+static inline int PS_crosses(PS_SECTION* section, float s1, float s2) {
+    return ((section->direction & PS_POSITIVE) && s1 < 0 && s2 >= 0) ||
+           ((section->direction & PS_NEGATIVE) && s1 >= 0 && s2 < 0);
+}
+
+int PS_process(PS_SECTION* section, int* samples, int num_samples) {
+    /** 
+     * Find the crossings in a block of samples
+     *
+     * The block continues the stream from the last call unless 
+     * PS_breakStream was called. Cubic interpolation needs the sample 
+     * after a crossing, so a crossing in the last interval of a block is
+     * reported with the next block. Returns the number of crossings 
+     * found.
+     */
+    float n0 = section->normal[0];
+    float n1 = section->normal[1];
+    float n2 = section->normal[2];
+    float d = section->offset;
+    int cubic = section->interpolation == PS_CUBIC;
+    int found = 0;
+    
+    if(!section->capacity) {
+        return 0;
+    }
+    
+    for(int i = 0; i < num_samples; i++) {
+        int h = section->num_history;
+        float (*hist)[3] = section->history;
+        float* side = section->side;
+        
+        // shift the history along once it is full
+        if(h == 4) {
+            memmove(hist[0], hist[1], 3*3*sizeof(float));
+            memmove(&side[0], &side[1], 3*sizeof(float));
+            h = 3;
+        }
+        hist[h][0] = (float)DP_getX1(samples[i]);
+        hist[h][1] = (float)DP_getX2(samples[i]);
+        hist[h][2] = (float)DP_getX3(samples[i]);
+        side[h] = n0*hist[h][0] + n1*hist[h][1] + n2*hist[h][2] - d;
+        section->num_history = ++h;
+        section->position += 1.0;
+        
+        if(!cubic) {
+            if(h >= 2 && PS_crosses(section, side[h-2], side[h-1])) {
+                float t = side[h-2]/(side[h-2] - side[h-1]);
+                float point[3];
+                for(int k = 0; k < 3; k++) {
+                    point[k] = hist[h-2][k] + t*(hist[h-1][k] - hist[h-2][k]);
+                }
+                PS_store(section, point, section->position - 2.0 + t);
+                found++;
+            }
+            continue;
+        }
+        
+        // cubic: the crossing interval is between the second and third 
+        // newest samples, the newest one shapes the curve
+        if(h >= 3 && PS_crosses(section, side[h-3], side[h-2])) {
+            float* p0 = hist[h >= 4 ? h-4 : h-3];
+            float* p1 = hist[h-3];
+            float* p2 = hist[h-2];
+            float* p3 = hist[h-1];
+            float s0 = h >= 4 ? side[h-4] : side[h-3];
+            float s1 = side[h-3], s2 = side[h-2], s3 = side[h-1];
+            
+            // start from the linear estimate and polish with Newton steps
+            float t = s1/(s1 - s2);
+            for(int iter = 0; iter < 3; iter++) {
+                float f = PS_cubic(s0, s1, s2, s3, t);
+                float df = PS_cubicSlope(s0, s1, s2, s3, t);
+                if(df == 0) {
+                    break;
+                }
+                float next = t - f/df;
+                if(next < 0 || next > 1) {
+                    break;
+                }
+                t = next;
+            }
+            float point[3];
+            for(int k = 0; k < 3; k++) {
+                point[k] = PS_cubic(p0[k], p1[k], p2[k], p3[k], t);
+            }
+            PS_store(section, point, section->position - 3.0 + t);
+            found++;
+        }
+    }
+    return found;
+}
+
+int PS_getNumPoints(PS_SECTION* section) {
+    /** 
+     * Returns the number of crossings held
+     */
+    return section->num_points;
+}
+
+int PS_getPoint(PS_SECTION* section, int index, float* x1, float* x2, float* x3, double* time) {
+    /** 
+     * Get a crossing point
+     *
+     * \param index Crossing number, 0 is the oldest
+     * \param time Set to the stream position of the crossing in samples,
+     * may be 0
+     */
+    if(index < 0 || index >= section->num_points) {
+        return -1;
+    }
+    int i = section->head - section->num_points + index;
+    if(i < 0) {
+        i += section->capacity;
+    }
+    *x1 = section->points[i*3];
+    *x2 = section->points[(i*3)+1];
+    *x3 = section->points[(i*3)+2];
+    if(time) {
+        *time = section->times[i];
+    }
+    return 0;
+}
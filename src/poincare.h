@@ -0,0 +1,56 @@
+/**
+ * \file poincare.h
+ * \brief Header file for poincare.cpp
+ */
+
+#ifndef POINCARE_H
+#define POINCARE_H
+
+#include <stdlib.h>
+#include <string.h>
+
+/* crossing directions, the same values as the trigger edges */
+#define PS_POSITIVE 1
+#define PS_NEGATIVE 2
+#define PS_BOTH 3
+
+/* interpolation between the samples either side of a crossing */
+#define PS_LINEAR 0
+#define PS_CUBIC 1
+
+#define PS_DEFAULT_CAPACITY 4096
+
+/**
+ * Poincare section through (x1, x2, x3) space
+ *
+ * The plane is normal . x = offset. A crossing in the direction of the
+ * normal is positive. Crossings are stored in a ring of capacity points
+ * along with the stream position at which they happened.
+ */
+typedef struct {
+    float normal[3];
+    float offset;
+    int direction;
+    int interpolation;
+    float* points;
+    double* times;
+    int capacity;
+    int head;
+    int num_points;
+    double position;
+    float history[4][3];
+    float side[4];
+    int num_history;
+} PS_SECTION;
+
+int PS_init(PS_SECTION* section, int capacity = PS_DEFAULT_CAPACITY);
+void PS_free(PS_SECTION* section);
+void PS_setPlane(PS_SECTION* section, float a, float b, float c, float d, 
+                 int direction, int interpolation);
+void PS_clear(PS_SECTION* section);
+void PS_breakStream(PS_SECTION* section);
+int PS_process(PS_SECTION* section, int* samples, int num_samples);
+int PS_getNumPoints(PS_SECTION* section);
+int PS_getPoint(PS_SECTION* section, int index, float* x1, float* x2, float* x3, double* time);
+
+#endif
@@ -0,0 +1,234 @@
+/**
+ * \file replay.cpp
+ * \brief Routines for recording and playing back the USB traffic
+ *
+ * A recording holds every write to and read from the unit with its
+ * timing, including the packet ids, samples and MDAC changes. Played
+ * back, it stands in for the unit, so a session can be repeated exactly
+ * without the hardware.
+ */
+
+#include "replay.h"
+#include "threads.h"
+
+int RP_startRecording(UC_DEVICE* dev, const char* filename) {
+    /**
+     * Record the traffic of a device to a file
+     *
+     * A recording already running is stopped first. Returns -1 if the
+     * file could not be created.
+     */
+    RP_stopRecording(dev);
+    struct RP_RECORDER* recorder = (struct RP_RECORDER*)malloc(sizeof(struct RP_RECORDER));
+    if(!recorder) {
+        return -1;
+    }
+    recorder->file = fopen(filename, "wb");
+    if(!recorder->file) {
+        free(recorder);
+        return -1;
+    }
+    unsigned int version = RP_VERSION;
+    fwrite(RP_MAGIC, 1, 4, recorder->file);
+    fwrite(&version, sizeof(version), 1, recorder->file);
+    recorder->last_time = TH_nanoseconds();
+    dev->recorder = recorder;
+    return 0;
+}
+
+void RP_stopRecording(UC_DEVICE* dev) {
+    /**
+     * Finish the recording of a device, if there is one
+     */
+    if(dev->recorder) {
+        fclose(dev->recorder->file);
+        free(dev->recorder);
+        dev->recorder = 0;
+    }
+}
+
+void RP_record(struct RP_RECORDER* recorder, int type, char* buf, int size, int result) {
+    /**
+     * Add a write or read to a recording, called by UC_write and UC_read
+     *
+     * \param size The size of the buffer
+     * \param result What usb_bulk_write or usb_bulk_read returned
+     */
+    long long now = TH_nanoseconds();
+    RP_HEADER header;
+    header.type = type;
+    header.reserved = 0;
+    if(type == RP_READ) {
+        size = result > 0 ? (result < size ? result : size) : 0;
+    }
+    header.size = size;
+    header.result = result;
+    header.delta = (unsigned int)((now - recorder->last_time)/1000);
+    // the remainder is carried so the times do not drift
+    recorder->last_time += (long long)header.delta*1000;
+    fwrite(&header, sizeof(header), 1, recorder->file);
+    if(size) {
+        fwrite(buf, 1, size, recorder->file);
+    }
+}
+
+static char* RP_next(RP_REPLAY* replay, int type, RP_HEADER* header) {
+    /**
+     * Move to the next record of a type
+     *
+     * Records of other types are skipped. With RP_LOOP the recording
+     * starts over at its end. Fills in header and returns the bytes of
+     * the record, or 0 when there are no more records, which looks like 
+     * the unit going away.
+     */
+    long first = 8;
+    int wrapped = 0;
+    for(;;) {
+        if(replay->position + (long)sizeof(RP_HEADER) > replay->size) {
+            if(!(replay->flags & RP_LOOP) || wrapped) {
+                return 0;
+            }
+            replay->position = first;
+            replay->start = TH_nanoseconds();
+            replay->elapsed = 0;
+            wrapped = 1;
+            continue;
+        }
+        // records are packed, so the header may not be aligned
+        memcpy(header, replay->data + replay->position, sizeof(RP_HEADER));
+        char* bytes = replay->data + replay->position + sizeof(RP_HEADER);
+        if(replay->position + (long)sizeof(RP_HEADER) + header->size > replay->size) {
+            // cut short, the recording was not finished
+            replay->position = replay->size;
+            continue;
+        }
+        replay->position += sizeof(RP_HEADER) + header->size;
+        replay->elapsed += header->delta;
+        if(header->type == type) {
+            return bytes;
+        }
+    }
+}
+
+static void RP_wait(RP_REPLAY* replay) {
+    /**
+     * Hold back paced playback until the recorded time
+     */
+    if(!(replay->flags & RP_PACED)) {
+        return;
+    }
+    long long target = replay->start + replay->elapsed*1000;
+    for(;;) {
+        long long remaining = target - TH_nanoseconds();
+        if(remaining <= 0) {
+            return;
+        }
+        // sleeping is too coarse for the last couple of milliseconds
+        if(remaining > 2000000) {
+            TH_sleep(1);
+        }
+    }
+}
+
+static int RP_write(void* state, char* buf, int size) {
+    /**
+     * Play back a write, returning what the unit returned
+     */
+    RP_REPLAY* replay = (RP_REPLAY*)state;
+    RP_HEADER header;
+    if(!RP_next(replay, RP_WRITE, &header)) {
+        return -1;
+    }
+    RP_wait(replay);
+    return header.result;
+}
+
+static int RP_read(void* state, char* buf, int size) {
+    /**
+     * Play back a read into buf
+     */
+    RP_REPLAY* replay = (RP_REPLAY*)state;
+    RP_HEADER header;
+    char* bytes = RP_next(replay, RP_READ, &header);
+    if(!bytes) {
+        return -1;
+    }
+    RP_wait(replay);
+    int length = header.size < size ? header.size : size;
+    memcpy(buf, bytes, length);
+    return header.result < size ? header.result : size;
+}
+
+static void RP_free(void* state) {
+    /**
+     * Free a replay when its device stops using it
+     */
+    RP_REPLAY* replay = (RP_REPLAY*)state;
+    free(replay->data);
+    free(replay);
+}
+
+int RP_startReplay(UC_DEVICE* dev, const char* filename, int flags) {
+    /**
+     * Play a recording back in place of the unit
+     *
+     * \param flags RP_FAST to play back as fast as the library asks,
+     * RP_PACED to keep to the recorded timing, and RP_LOOP to start
+     * over at the end
+     *
+     * Returns -1 if the file could not be read or is not a recording.
+     */
+    FILE* file = fopen(filename, "rb");
+    if(!file) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    RP_REPLAY* replay = (RP_REPLAY*)calloc(1, sizeof(RP_REPLAY));
+    char* data = size >= 8 ? (char*)malloc(size) : 0;
+    unsigned int version;
+    if(!replay || !data || fread(data, 1, size, file) != (size_t)size ||
+       memcmp(data, RP_MAGIC, 4)) {
+        fclose(file);
+        free(data);
+        free(replay);
+        return -1;
+    }
+    fclose(file);
+    memcpy(&version, data + 4, sizeof(version));
+    if(version != RP_VERSION) {
+        free(data);
+        free(replay);
+        return -1;
+    }
+
+    replay->data = data;
+    replay->size = size;
+    replay->position = 8;
+    replay->flags = flags;
+    replay->start = TH_nanoseconds();
+    replay->elapsed = 0;
+
+    UC_TRANSPORT transport;
+    transport.write = RP_write;
+    transport.read = RP_read;
+    transport.free = RP_free;
+    transport.state = replay;
+    UC_setTransport(dev, &transport);
+    return 0;
+}
+
+int RP_stopReplay(UC_DEVICE* dev) {
+    /**
+     * Go back to the unit on the bus
+     *
+     * Returns -1 if the device was not playing back a recording.
+     */
+    if(dev->transport.write != RP_write) {
+        return -1;
+    }
+    UC_setTransport(dev, 0);
+    return 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * \file replay.h
+ * \brief Header file for replay.cpp
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usb_comm.h"
+
+#define RP_MAGIC "LCRP"
+#define RP_VERSION 1
+
+/* record types */
+#define RP_WRITE 1
+#define RP_READ 2
+
+/* replay flags, the same values as the public ones */
+#define RP_FAST 0
+#define RP_PACED 1
+#define RP_LOOP 2
+
+/**
+ * Start of each record in a recording
+ *
+ * size bytes follow, the bytes written for RP_WRITE and the bytes read
+ * for RP_READ. delta is the time since the previous record in
+ * microseconds. Fields are in the byte order of the recording machine.
+ */
+typedef struct {
+    unsigned char type;
+    unsigned char reserved;
+    unsigned short size;
+    int result;
+    unsigned int delta;
+} RP_HEADER;
+
+/**
+ * A recording being written
+ */
+struct RP_RECORDER {
+    FILE* file;
+    long long last_time;
+};
+
+/**
+ * A recording being played back, held in memory
+ *
+ * start is when playback of the recording began and elapsed is the
+ * recorded time of the record at position, so paced playback waits for
+ * start + elapsed.
+ */
+typedef struct {
+    char* data;
+    long size;
+    long position;
+    int flags;
+    long long start;
+    long long elapsed;
+} RP_REPLAY;
+
+int RP_startRecording(UC_DEVICE* dev, const char* filename);
+void RP_stopRecording(UC_DEVICE* dev);
+void RP_record(struct RP_RECORDER* recorder, int type, char* buf, int size, int result);
+int RP_startReplay(UC_DEVICE* dev, const char* filename, int flags);
+int RP_stopReplay(UC_DEVICE* dev);
+
+#endif
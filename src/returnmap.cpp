@@ -0,0 +1,275 @@
+/**
+ * \file returnmap.cpp
+ * \brief Routines for building return maps from a stream of samples
+ */
+
+#include "returnmap.h"
+#include "data_processing.h"
+
+void RM_resetDetector(RM_DETECTOR* detector, int delta) {
+    /** 
+     * Reset a peak detector to its initial state
+     *
+     * \param delta How far the signal must fall from a maximum before it 
+     * is counted as a peak
+     */
+    detector->delta = delta;
+    detector->min = 2000;
+    detector->max = -1;
+    detector->look_for_max = false;
+}
+
+int RM_detect(RM_DETECTOR* detector, int x1) {
+    /** 
+     * Feed one x1 value to the detector
+     *
+     * Returns the value of the peak that this sample completes, or -1 if
+     * no peak was completed.
+     */
+    int peak = -1;
+    
+    if(x1 > detector->max) {
+        detector->max = x1;
+    }
+    if(x1 < detector->min) {
+        detector->min = x1;
+    }
+    
+    if(detector->look_for_max) {
+        if(x1 < detector->max - detector->delta) {
+            peak = detector->max;
+            detector->min = x1;
+            detector->look_for_max = false;
+        }
+    } else {
+        if(x1 > detector->min + detector->delta) {
+            detector->max = x1;
+            detector->look_for_max = true;
+        }
+    }
+    return peak;
+}
+
+int RM_init(RM_BUILDER* builder, int capacity, int delta) {
+    /** 
+     * Initialize a return map builder
+     *
+     * \param capacity Number of peaks kept. Once full the oldest peaks
+     * are overwritten.
+     * \param delta Peak detection threshold
+     */
+    if(capacity < 2) {
+        return -1;
+    }
+    
+    int* peaks = (int*)malloc(capacity*sizeof(int));
+    long long* segments = (long long*)malloc(capacity*sizeof(long long));
+    if(!peaks || !segments) {
+        free(peaks);
+        free(segments);
+        return -1;
+    }
+    
+    free(builder->peaks);
+    free(builder->segments);
+    builder->peaks = peaks;
+    builder->segments = segments;
+    builder->capacity = capacity;
+    RM_resetDetector(&builder->detector, delta);
+    RM_reset(builder);
+    return 0;
+}
+
+void RM_free(RM_BUILDER* builder) {
+    /** 
+     * Free the memory used by a return map builder
+     */
+    free(builder->peaks);
+    free(builder->segments);
+    memset(builder, 0, sizeof(RM_BUILDER));
+}
+
+int RM_copy(RM_BUILDER* dst, RM_BUILDER* src) {
+    /** 
+     * Copy the peaks held by a builder
+     *
+     * dst must be zeroed or initialized. Its memory is reused when the
+     * capacity matches.
+     */
+    if(dst->capacity != src->capacity) {
+        int* peaks = (int*)malloc(src->capacity*sizeof(int));
+        long long* segments = (long long*)malloc(src->capacity*sizeof(long long));
+        if(!peaks || !segments) {
+            free(peaks);
+            free(segments);
+            return -1;
+        }
+        free(dst->peaks);
+        free(dst->segments);
+        dst->peaks = peaks;
+        dst->segments = segments;
+    }
+    int* peaks = dst->peaks;
+    long long* segments = dst->segments;
+    *dst = *src;
+    dst->peaks = peaks;
+    dst->segments = segments;
+    memcpy(dst->peaks, src->peaks, src->capacity*sizeof(int));
+    memcpy(dst->segments, src->segments, src->capacity*sizeof(long long));
+    return 0;
+}
+
+void RM_reset(RM_BUILDER* builder) {
+    /** 
+     * Throw away all collected peaks and restart detection
+     */
+    builder->head = 0;
+    builder->num_peaks = 0;
+    builder->total = 0;
+    builder->segment_head = 0;
+    builder->num_segments = 0;
+    builder->broken = 1;
+    RM_resetDetector(&builder->detector, builder->detector.delta);
+}
+
+void RM_breakStream(RM_BUILDER* builder) {
+    /** 
+     * Mark a gap in the stream
+     *
+     * The detector starts over and no point pairs a peak before the gap 
+     * with one after it. Use this between separate captures, the peaks 
+     * already collected are kept.
+     */
+    RM_resetDetector(&builder->detector, builder->detector.delta);
+    builder->broken = 1;
+}
+
+static void RM_store(RM_BUILDER* builder, int peak) {
+    /** 
+     * Add a peak to the ring, starting a segment after a break
+     *
+     * Segments left without peaks in the ring are dropped first, so the
+     * segment ring never holds more than one per peak.
+     */
+    builder->peaks[builder->head] = peak;
+    builder->head++;
+    if(builder->head == builder->capacity) {
+        builder->head = 0;
+    }
+    if(builder->num_peaks < builder->capacity) {
+        builder->num_peaks++;
+    }
+    builder->total++;
+    
+    long long oldest = builder->total - builder->num_peaks;
+    while(builder->num_segments > 1 && 
+          builder->segments[(builder->segment_head + 1) % builder->capacity] <= oldest) {
+        builder->segment_head = (builder->segment_head + 1) % builder->capacity;
+        builder->num_segments--;
+    }
+    if(builder->broken) {
+        int slot = (builder->segment_head + builder->num_segments) % builder->capacity;
+        builder->segments[slot] = builder->total - 1;
+        builder->num_segments++;
+        builder->broken = 0;
+    }
+}
+
+static int RM_findPoint(RM_BUILDER* builder, int order, int index, long long* position) {
+    /** 
+     * Count the points of an order, or find one of them
+     *
+     * \param index Point to find, -1 to only count
+     * \param position Set to the count of the point's first peak
+     * \return The number of points, or the ones before the point found
+     */
+    long long oldest = builder->total - builder->num_peaks;
+    int count = 0;
+    for(int s = 0; s < builder->num_segments; s++) {
+        long long start = builder->segments[(builder->segment_head + s) % builder->capacity];
+        long long end = builder->total;
+        if(s + 1 < builder->num_segments) {
+            end = builder->segments[(builder->segment_head + s + 1) % builder->capacity];
+        }
+        if(start < oldest) {
+            start = oldest;
+        }
+        long long points = end - start - order;
+        if(points <= 0) {
+            continue;
+        }
+        if(index >= count && index < count + points) {
+            *position = start + (index - count);
+            return count;
+        }
+        count += (int)points;
+    }
+    return count;
+}
+
+int RM_process(RM_BUILDER* builder, int* samples, int num_samples) {
+    /** 
+     * Run the detector over a block of samples
+     *
+     * Detector state is carried over from the previous block, call 
+     * RM_breakStream first if the block does not follow on from it. 
+     * Returns the number of peaks found in this block.
+     */
+    int found = 0;
+    
+    if(!builder->capacity) {
+        return 0;
+    }
+    
+    for(int i = 0; i < num_samples; i++) {
+        int peak = RM_detect(&builder->detector, DP_getX1(samples[i]));
+        if(peak < 0) {
+            continue;
+        }
+        RM_store(builder, peak);
+        found++;
+    }
+    return found;
+}
+
+int RM_getNumPeaks(RM_BUILDER* builder) {
+    /** 
+     * Returns the number of peaks held in the ring
+     */
+    return builder->num_peaks;
+}
+
+int RM_getNumPoints(RM_BUILDER* builder, int order) {
+    /** 
+     * Returns the number of points available in a return map of an order
+     *
+     * Each segment of the stream gives its number of peaks less order.
+     */
+    if(order < 1 || builder->num_peaks <= order) {
+        return 0;
+    }
+    long long position;
+    return RM_findPoint(builder, order, -1, &position);
+}
+
+int RM_getPoint(RM_BUILDER* builder, int order, int index, int* xn, int* xnk) {
+    /** 
+     * Get a return map point
+     *
+     * \param order k in (x_n, x_n+k)
+     * \param index Point number, 0 is the oldest
+     */
+    long long position = -1;
+    if(index < 0 || order < 1) {
+        return -1;
+    }
+    RM_findPoint(builder, order, index, &position);
+    if(position < 0) {
+        return -1;
+    }
+    
+    // head follows total, so the count of a peak gives its place
+    *xn = builder->peaks[position % builder->capacity];
+    *xnk = builder->peaks[(position + order) % builder->capacity];
+    return 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * \file returnmap.h
+ * \brief Header file for returnmap.cpp
+ */
+
+#ifndef RETURNMAP_H
+#define RETURNMAP_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RM_DEFAULT_CAPACITY 1024
+#define RM_DEFAULT_DELTA 5
+
+/**
+ * Streaming x1 maxima detector
+ *
+ * This is the same detector used by peaks_findPeaks, but its state is
+ * kept between calls so peaks are not lost between blocks of one 
+ * stream.
+ */
+typedef struct {
+    int delta;
+    int min;
+    int max;
+    int look_for_max;
+} RM_DETECTOR;
+
+/**
+ * Return map builder
+ *
+ * Detected peaks go into a ring of fixed capacity. A point of order k is
+ * the pair (x_n, x_n+k) so every order is read from the same ring.
+ *
+ * A break in the stream starts a new segment and no pair spans two 
+ * segments. total counts every peak ever stored, segments is a ring of 
+ * the count at which each segment still in the peak ring started. 
+ * broken is set until the first peak after a break.
+ */
+typedef struct {
+    RM_DETECTOR detector;
+    int* peaks;
+    int capacity;
+    int head;
+    int num_peaks;
+    long long total;
+    long long* segments;
+    int segment_head;
+    int num_segments;
+    int broken;
+} RM_BUILDER;
+
+void RM_resetDetector(RM_DETECTOR* detector, int delta = RM_DEFAULT_DELTA);
+int RM_detect(RM_DETECTOR* detector, int x1);
+int RM_init(RM_BUILDER* builder, int capacity = RM_DEFAULT_CAPACITY, int delta = RM_DEFAULT_DELTA);
+void RM_free(RM_BUILDER* builder);
+int RM_copy(RM_BUILDER* dst, RM_BUILDER* src);
+void RM_reset(RM_BUILDER* builder);
+void RM_breakStream(RM_BUILDER* builder);
+int RM_process(RM_BUILDER* builder, int* samples, int num_samples);
+int RM_getNumPeaks(RM_BUILDER* builder);
+int RM_getNumPoints(RM_BUILDER* builder, int order);
+int RM_getPoint(RM_BUILDER* builder, int order, int index, int* xn, int* xnk);
+
+#endif
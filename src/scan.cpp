@@ -0,0 +1,134 @@
+/**
+ * \file scan.cpp
+ * \brief Order in which a progressive scan visits the MDAC values
+ *
+ * Taking MDAC values 0 to 4095 in turn draws the bifurcation diagram
+ * from left to right. Taking them in bit-reversed order instead, 0, 
+ * 2048, 1024, 3072, 512, ..., each 2^k taps are an even grid with a 
+ * step of 4096/2^k, which is every column of the diagram's level 12-k.
+ * The whole diagram is then there at low resolution after a few dozen 
+ * taps and every later tap halves the gaps of some part of it. The same
+ * order restricted to a focus range fills that range coarse to fine 
+ * first.
+ */
+
+#include "scan.h"
+
+int SC_reverse(int index) {
+    /**
+     * Reverse the SC_BITS low bits of index
+     */
+    int reversed = 0;
+    for(int i = 0; i < SC_BITS; i++) {
+        reversed = (reversed << 1) | ((index >> i) & 1);
+    }
+    return reversed;
+}
+
+void SC_init(SC_SCAN* scan) {
+    /**
+     * Start a scan from the beginning without a focus range
+     */
+    memset(scan, 0, sizeof(SC_SCAN));
+    scan->focus_first = -1;
+    scan->focus_last = -1;
+}
+
+void SC_clearVisited(SC_SCAN* scan) {
+    /**
+     * Take every tap again, for when the peaks cache has been emptied
+     */
+    memset(scan->visited, 0, sizeof(scan->visited));
+    scan->num_visited = 0;
+}
+
+int SC_setFocus(SC_SCAN* scan, int first, int last) {
+    /**
+     * Take most of the following taps from a range
+     *
+     * \param first First MDAC value of the range, -1 for no range
+     * \param last Last MDAC value of the range
+     */
+    if(first < 0) {
+        scan->focus_first = -1;
+        scan->focus_last = -1;
+        return 0;
+    }
+    if(first > last || last >= SC_NUM_TAPS) {
+        return -1;
+    }
+    scan->focus_first = first;
+    scan->focus_last = last;
+    scan->focus_next = 0;
+    return 0;
+}
+
+static int SC_isVisited(SC_SCAN* scan, int mdac_value) {
+    /**
+     * Return true if a tap has been visited
+     */
+    return (scan->visited[mdac_value >> 5] >> (mdac_value & 31)) & 1;
+}
+
+void SC_markVisited(SC_SCAN* scan, int mdac_value) {
+    /**
+     * Record that a tap has been taken
+     */
+    if(mdac_value < 0 || mdac_value >= SC_NUM_TAPS || SC_isVisited(scan, mdac_value)) {
+        return;
+    }
+    scan->visited[mdac_value >> 5] |= 1u << (mdac_value & 31);
+    scan->num_visited++;
+}
+
+static int SC_find(SC_SCAN* scan, int* next, PEAKS_STATE* peaks, int first, int last) {
+    /**
+     * Find the next tap from *next on in bit-reversed order that is 
+     * within first to last and not visited
+     *
+     * Taps found in the peaks cache are marked visited on the way.
+     *
+     * \return The MDAC value, or -1 if every one in the range is visited
+     */
+    for(int i = 0; i < SC_NUM_TAPS; i++) {
+        int index = (*next + i) & (SC_NUM_TAPS - 1);
+        int mdac = SC_reverse(index);
+        if(mdac < first || mdac > last || SC_isVisited(scan, mdac)) {
+            continue;
+        }
+        if(peaks_isCacheHit(peaks, mdac)) {
+            SC_markVisited(scan, mdac);
+            continue;
+        }
+        *next = index + 1;
+        return mdac;
+    }
+    return -1;
+}
+
+int SC_next(SC_SCAN* scan, PEAKS_STATE* peaks) {
+    /**
+     * Pick the next MDAC value to take peaks at
+     *
+     * SC_FOCUS_TURNS of every SC_TURNS taps come from the focus range 
+     * while it has taps missing, the rest keep the whole diagram 
+     * sharpening.
+     *
+     * \return The MDAC value, or -1 once every value is visited
+     */
+    scan->turn = (scan->turn + 1) % SC_TURNS;
+    if(scan->focus_first >= 0 && scan->turn < SC_FOCUS_TURNS) {
+        int mdac = SC_find(scan, &scan->focus_next, peaks, scan->focus_first, scan->focus_last);
+        if(mdac >= 0) {
+            return mdac;
+        }
+    }
+    return SC_find(scan, &scan->next, peaks, 0, SC_NUM_TAPS - 1);
+}
+
+int SC_remaining(SC_SCAN* scan) {
+    /**
+     * Returns the number of MDAC values not visited yet
+     */
+    return SC_NUM_TAPS - scan->num_visited;
+}
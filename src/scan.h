@@ -0,0 +1,45 @@
+/**
+ * \file scan.h
+ * \brief Header file for scan.cpp
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <string.h>
+#include "peaks.h"
+
+#define SC_BITS 12
+#define SC_NUM_TAPS (1 << SC_BITS)
+// taps out of every SC_TURNS taken from the focus range while there is one
+#define SC_TURNS 4
+#define SC_FOCUS_TURNS 3
+
+/**
+ * Where a progressive scan of every MDAC value has got to
+ *
+ * next and focus_next count through the taps in bit-reversed order and
+ * wrap around, so taps whose read failed are taken again. visited has a
+ * bit for every tap that was taken or found in the peaks cache, whether
+ * or not it had any peaks, and num_visited counts them. focus_first is 
+ * -1 without a focus range.
+ */
+typedef struct {
+    int next;
+    int focus_first;
+    int focus_last;
+    int focus_next;
+    int turn;
+    unsigned int visited[SC_NUM_TAPS/32];
+    int num_visited;
+} SC_SCAN;
+
+int SC_reverse(int index);
+void SC_init(SC_SCAN* scan);
+int SC_setFocus(SC_SCAN* scan, int first, int last);
+void SC_clearVisited(SC_SCAN* scan);
+int SC_next(SC_SCAN* scan, PEAKS_STATE* peaks);
+void SC_markVisited(SC_SCAN* scan, int mdac_value);
+int SC_remaining(SC_SCAN* scan);
+
+#endif
@@ -0,0 +1,705 @@
+/**
+ * \file server.cpp
+ * \brief Socket server that streams samples to local clients
+ *
+ * Clients connect over a Unix domain socket or a TCP port on the
+ * loopback interface and get a stream of messages, each a header
+ * followed by its payload. A message is built once and queued by
+ * reference for every client that wants it. One thread accepts clients
+ * and writes each client's queue with as few calls as it can, watching
+ * the sockets with epoll where there is one and poll elsewhere. Every
+ * client has its own queue and policy for when the queue is full, so a
+ * slow client only loses its own messages, or with SV_BLOCK holds up
+ * the sender for at most SV_BLOCK_TIMEOUT before it is dropped.
+ *
+ * All values are little endian. The header is
+ *
+ *     uint32 payload bytes, uint16 type, uint16 0, int32 MDAC value,
+ *     uint32 message number, int64 stream position
+ *
+ * SV_HELLO is sent first and carries int32 protocol version, library
+ * version, sample frequency and queue length. SV_SAMPLES and SV_TAP
+ * carry packed int32 samples of a plot or sweep tap, and SV_PEAKS the
+ * uint16 x1 peaks of a tap. A client may send 8 bytes at any time, a
+ * uint32 mask with bit (1 << type) for each type it wants and a uint32
+ * policy.
+ */
+
+#include "server.h"
+#include "libchaos.h"
+#include "log.h"
+
+#ifdef _WIN32
+
+int SV_start(SV_SERVER* server, const char* address, int queue_length, int policy) {
+    /**
+     * Not available on Windows
+     */
+    memset(server, 0, sizeof(SV_SERVER));
+    LOG(LOG_ERROR, "the server is not available on this platform\n");
+    return -1;
+}
+
+void SV_stop(SV_SERVER* server) {
+    /**
+     * Nothing to stop on Windows
+     */
+}
+
+void SV_send(SV_SERVER* server, int type, int mdac, long long position, const void* payload,
+             int size) {
+    /**
+     * Nothing to send to on Windows
+     */
+}
+
+void SV_stats(SV_SERVER* server, int* clients, long long* messages, long long* dropped,
+              long long* disconnected) {
+    /**
+     * No clients on Windows
+     */
+    *clients = 0;
+    *messages = 0;
+    *dropped = 0;
+    *disconnected = 0;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define SV_NOSIGNAL MSG_NOSIGNAL
+#else
+#define SV_NOSIGNAL 0
+#endif
+
+// poller ids of the listening socket and the wake pipe, clients use
+// their index
+#define SV_LISTEN_ID SV_MAX_CLIENTS
+#define SV_WAKE_ID (SV_MAX_CLIENTS + 1)
+#define SV_MAX_EVENTS (SV_MAX_CLIENTS + 2)
+
+typedef struct {
+    int id;
+    int in;
+    int hangup;
+} SV_EVENT;
+
+static int SV_nonblocking(int fd) {
+    /**
+     * Make a descriptor return at once instead of waiting
+     */
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void SV_wake(SV_SERVER* server) {
+    /**
+     * Get the server thread to look at its clients again
+     */
+    char byte = 0;
+    // a full pipe already wakes the thread
+    if(write(server->wake[1], &byte, 1) < 0) {
+        return;
+    }
+}
+
+static void SV_watch(SV_SERVER* server, int id, int fd, int add, int writing) {
+    /**
+     * Watch a descriptor for input, and for room to write if writing
+     *
+     * poll is given every descriptor each time, only epoll needs this.
+     */
+#ifdef __linux__
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    if(writing) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.u32 = id;
+    epoll_ctl(server->poll_fd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event);
+#endif
+}
+
+static int SV_wait(SV_SERVER* server, SV_EVENT* events) {
+    /**
+     * Wait for something to happen on the sockets or the wake pipe
+     *
+     * \return The number of events
+     */
+#ifdef __linux__
+    struct epoll_event ready[SV_MAX_EVENTS];
+    int n = epoll_wait(server->poll_fd, ready, SV_MAX_EVENTS, -1);
+    for(int i = 0; i < n; i++) {
+        events[i].id = ready[i].data.u32;
+        events[i].in = (ready[i].events & EPOLLIN) != 0;
+        events[i].hangup = (ready[i].events & (EPOLLHUP | EPOLLERR)) != 0;
+    }
+    return n < 0 ? 0 : n;
+#else
+    struct pollfd fds[SV_MAX_EVENTS];
+    int ids[SV_MAX_EVENTS];
+    int count = 0;
+    TH_lock(&server->lock);
+    for(int i = 0; i < SV_MAX_CLIENTS; i++) {
+        if(server->clients[i].fd >= 0) {
+            fds[count].fd = server->clients[i].fd;
+            fds[count].events = POLLIN | (server->clients[i].writing > 0 ? POLLOUT : 0);
+            ids[count++] = i;
+        }
+    }
+    TH_unlock(&server->lock);
+    fds[count].fd = server->listen_fd;
+    fds[count].events = POLLIN;
+    ids[count++] = SV_LISTEN_ID;
+    fds[count].fd = server->wake[0];
+    fds[count].events = POLLIN;
+    ids[count++] = SV_WAKE_ID;
+    if(poll(fds, count, -1) <= 0) {
+        return 0;
+    }
+    int n = 0;
+    for(int i = 0; i < count; i++) {
+        if(fds[i].revents) {
+            events[n].id = ids[i];
+            events[n].in = (fds[i].revents & POLLIN) != 0;
+            events[n].hangup = (fds[i].revents & (POLLHUP | POLLERR)) != 0;
+            n++;
+        }
+    }
+    return n;
+#endif
+}
+
+static SV_MESSAGE* SV_newMessage(SV_SERVER* server, int type, int mdac, long long position,
+                                 const void* payload, int size) {
+    /**
+     * Build a message with one reference
+     */
+    SV_MESSAGE* message = (SV_MESSAGE*)malloc(offsetof(SV_MESSAGE, data) +
+                                              SV_HEADER_SIZE + size);
+    if(!message) {
+        return 0;
+    }
+    unsigned int length = size;
+    unsigned short kind = type;
+    unsigned short zero = 0;
+    unsigned int sequence = server->sequence++;
+    memcpy(message->data, &length, 4);
+    memcpy(message->data + 4, &kind, 2);
+    memcpy(message->data + 6, &zero, 2);
+    memcpy(message->data + 8, &mdac, 4);
+    memcpy(message->data + 12, &sequence, 4);
+    memcpy(message->data + 16, &position, 8);
+    memcpy(message->data + SV_HEADER_SIZE, payload, size);
+    message->refs = 1;
+    message->size = SV_HEADER_SIZE + size;
+    return message;
+}
+
+static void SV_release(SV_MESSAGE* message) {
+    /**
+     * Drop a reference to a message
+     */
+    if(--message->refs == 0) {
+        free(message);
+    }
+}
+
+static void SV_pop(SV_SERVER* server, SV_CLIENT* client) {
+    /**
+     * Remove the first message of a client's queue
+     */
+    SV_release(client->queue[client->head]);
+    client->head = (client->head + 1) % server->queue_length;
+    client->count--;
+    client->offset = 0;
+}
+
+static void SV_enqueue(SV_SERVER* server, SV_CLIENT* client, SV_MESSAGE* message) {
+    /**
+     * Queue a message for a client, following its policy if the queue is
+     * full
+     *
+     * Called with the lock held, which SV_BLOCK gives up while it waits.
+     */
+    int length = server->queue_length;
+    if(client->count == length) {
+        if(client->policy == SV_BLOCK) {
+            int fd = client->fd;
+            long long give_up = TH_nanoseconds() + SV_BLOCK_TIMEOUT*1000000LL;
+            SV_wake(server);
+            while(client->fd == fd && client->writing >= 0 && client->count == length) {
+                int left = (int)((give_up - TH_nanoseconds())/1000000);
+                if(left <= 0) {
+                    LOG(LOG_WARNING, "client %d did not keep up, dropping it\n", fd);
+                    // the server thread closes it
+                    client->writing = -1;
+                    SV_wake(server);
+                    break;
+                }
+                TH_timedWait(&server->space, &server->lock, left);
+            }
+            if(client->fd != fd || client->writing < 0) {
+                return;
+            }
+        } else if(client->policy == SV_DROP_OLDEST && (length > 1 || !client->offset)) {
+            // the first message may be partly sent already
+            if(client->offset) {
+                int second = (client->head + 1) % length;
+                SV_release(client->queue[second]);
+                client->queue[second] = client->queue[client->head];
+                client->head = second;
+                client->count--;
+            } else {
+                SV_pop(server, client);
+            }
+            server->dropped++;
+        } else {
+            server->dropped++;
+            return;
+        }
+    }
+    client->queue[(client->head + client->count) % length] = message;
+    client->count++;
+    message->refs++;
+}
+
+static void SV_close(SV_SERVER* server, int index) {
+    /**
+     * Disconnect a client and drop its queue
+     *
+     * Only the server thread closes clients.
+     */
+    SV_CLIENT* client = &server->clients[index];
+    close(client->fd);
+    while(client->count) {
+        SV_pop(server, client);
+    }
+    free(client->queue);
+    memset(client, 0, sizeof(SV_CLIENT));
+    client->fd = -1;
+    server->disconnected++;
+    TH_broadcast(&server->space);
+}
+
+static void SV_flush(SV_SERVER* server, int index) {
+    /**
+     * Write as much of a client's queue as the socket takes
+     *
+     * Up to SV_MAX_BATCH messages go in each call. The socket is watched
+     * for room when it is full.
+     */
+    SV_CLIENT* client = &server->clients[index];
+    int length = server->queue_length;
+    while(client->count) {
+        struct iovec parts[SV_MAX_BATCH];
+        int n = 0;
+        for(; n < client->count && n < SV_MAX_BATCH; n++) {
+            SV_MESSAGE* message = client->queue[(client->head + n) % length];
+            int skip = n ? 0 : client->offset;
+            parts[n].iov_base = message->data + skip;
+            parts[n].iov_len = message->size - skip;
+        }
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = parts;
+        header.msg_iovlen = n;
+        ssize_t sent = sendmsg(client->fd, &header, SV_NOSIGNAL);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                if(!client->writing) {
+                    client->writing = 1;
+                    SV_watch(server, index, client->fd, 0, 1);
+                }
+                return;
+            }
+            SV_close(server, index);
+            return;
+        }
+        while(sent > 0) {
+            SV_MESSAGE* message = client->queue[client->head];
+            int left = message->size - client->offset;
+            if(sent < left) {
+                client->offset += (int)sent;
+                break;
+            }
+            sent -= left;
+            SV_pop(server, client);
+        }
+        TH_broadcast(&server->space);
+    }
+    if(client->writing) {
+        client->writing = 0;
+        SV_watch(server, index, client->fd, 0, 0);
+    }
+}
+
+static void SV_read(SV_SERVER* server, int index) {
+    /**
+     * Take what a client sent, closing it when it has gone
+     */
+    SV_CLIENT* client = &server->clients[index];
+    unsigned char buffer[64];
+    for(;;) {
+        ssize_t n = recv(client->fd, buffer, sizeof(buffer), 0);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if(n <= 0) {
+            SV_close(server, index);
+            return;
+        }
+        for(int i = 0; i < n; i++) {
+            client->control[client->control_size++] = buffer[i];
+            if(client->control_size == SV_CONTROL_SIZE) {
+                unsigned int mask, policy;
+                memcpy(&mask, client->control, 4);
+                memcpy(&policy, client->control + 4, 4);
+                client->mask = (int)mask;
+                if(policy <= SV_BLOCK) {
+                    client->policy = (int)policy;
+                }
+                client->control_size = 0;
+            }
+        }
+    }
+}
+
+static void SV_accept(SV_SERVER* server) {
+    /**
+     * Take every client waiting to connect and greet it
+     */
+    for(;;) {
+        int fd = accept(server->listen_fd, 0, 0);
+        if(fd < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        SV_nonblocking(fd);
+#ifdef SO_NOSIGPIPE
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+        TH_lock(&server->lock);
+        int index = 0;
+        while(index < SV_MAX_CLIENTS && server->clients[index].fd >= 0) {
+            index++;
+        }
+        SV_MESSAGE** queue = index < SV_MAX_CLIENTS ?
+            (SV_MESSAGE**)calloc(server->queue_length, sizeof(SV_MESSAGE*)) : 0;
+        if(!queue) {
+            TH_unlock(&server->lock);
+            LOG(LOG_WARNING, "no room for another client\n");
+            close(fd);
+            continue;
+        }
+        SV_CLIENT* client = &server->clients[index];
+        client->fd = fd;
+        client->mask = -1;
+        client->policy = server->policy;
+        client->queue = queue;
+        int hello[4] = {SV_PROTOCOL, LIBCHAOS_VERSION, LIBCHAOS_SAMPLE_FREQUENCY,
+                        server->queue_length};
+        SV_MESSAGE* message = SV_newMessage(server, SV_HELLO, -1, 0, hello, sizeof(hello));
+        if(message) {
+            SV_enqueue(server, client, message);
+            SV_release(message);
+        }
+        SV_watch(server, index, fd, 1, 0);
+        TH_unlock(&server->lock);
+    }
+}
+
+static void SV_run(void* arg) {
+    /**
+     * Server thread, accepts clients and writes their queues
+     */
+    SV_SERVER* server = (SV_SERVER*)arg;
+    SV_EVENT events[SV_MAX_EVENTS];
+    for(;;) {
+        TH_lock(&server->lock);
+        if(server->stop) {
+            TH_unlock(&server->lock);
+            return;
+        }
+        for(int i = 0; i < SV_MAX_CLIENTS; i++) {
+            SV_CLIENT* client = &server->clients[i];
+            if(client->fd >= 0 && client->writing < 0) {
+                SV_close(server, i);
+            } else if(client->fd >= 0 && client->count) {
+                SV_flush(server, i);
+            }
+        }
+        TH_unlock(&server->lock);
+
+        int n = SV_wait(server, events);
+        for(int i = 0; i < n; i++) {
+            if(events[i].id == SV_LISTEN_ID) {
+                SV_accept(server);
+            } else if(events[i].id == SV_WAKE_ID) {
+                char buffer[64];
+                while(read(server->wake[0], buffer, sizeof(buffer)) > 0) {
+                }
+            } else if(events[i].in || events[i].hangup) {
+                TH_lock(&server->lock);
+                if(server->clients[events[i].id].fd >= 0) {
+                    SV_read(server, events[i].id);
+                }
+                TH_unlock(&server->lock);
+            }
+        }
+    }
+}
+
+static void SV_closeAll(SV_SERVER* server) {
+    /**
+     * Close the server's descriptors and clients
+     */
+    for(int i = 0; i < SV_MAX_CLIENTS; i++) {
+        if(server->clients[i].fd >= 0) {
+            SV_close(server, i);
+        }
+    }
+    if(server->listen_fd >= 0) close(server->listen_fd);
+    if(server->wake[0] >= 0) close(server->wake[0]);
+    if(server->wake[1] >= 0) close(server->wake[1]);
+    if(server->poll_fd >= 0) close(server->poll_fd);
+    if(server->path[0]) {
+        unlink(server->path);
+    }
+}
+
+static int SV_parsePort(const char* text) {
+    /**
+     * Read a TCP port, only digits and at most 65535
+     *
+     * \return The port, -1 if it is not one
+     */
+    int port = 0;
+    if(!*text) {
+        return -1;
+    }
+    for(; *text; text++) {
+        if(*text < '0' || *text > '9') {
+            return -1;
+        }
+        port = port*10 + (*text - '0');
+        if(port > 65535) {
+            return -1;
+        }
+    }
+    return port;
+}
+
+static int SV_listen(SV_SERVER* server, const char* address) {
+    /**
+     * Open the listening socket for an address
+     *
+     * \return The TCP port, 0 for a Unix domain socket, -1 on error
+     */
+    int port = 0;
+    if(!strncmp(address, "unix:", 5)) {
+        struct sockaddr_un local;
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        if(!address[5] || strlen(address + 5) >= sizeof(local.sun_path) ||
+           strlen(address + 5) >= sizeof(server->path)) {
+            return -1;
+        }
+        strcpy(local.sun_path, address + 5);
+        // a socket left by a process that died is replaced, anything else
+        // at the path is left alone
+        struct stat info;
+        if(!lstat(local.sun_path, &info)) {
+            if(!S_ISSOCK(info.st_mode)) {
+                LOG(LOG_ERROR, "server path is not a socket\n");
+                return -1;
+            }
+            unlink(local.sun_path);
+        }
+        server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(server->listen_fd < 0 ||
+           bind(server->listen_fd, (struct sockaddr*)&local, sizeof(local))) {
+            return -1;
+        }
+        strcpy(server->path, local.sun_path);
+    } else if(!strncmp(address, "tcp:", 4)) {
+        struct sockaddr_in local;
+        int requested = SV_parsePort(address + 4);
+        if(requested < 0) {
+            return -1;
+        }
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons((unsigned short)requested);
+        // only local clients
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        if(server->listen_fd < 0 ||
+           setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+           bind(server->listen_fd, (struct sockaddr*)&local, sizeof(local))) {
+            return -1;
+        }
+        socklen_t size = sizeof(local);
+        getsockname(server->listen_fd, (struct sockaddr*)&local, &size);
+        port = ntohs(local.sin_port);
+    } else {
+        return -1;
+    }
+    if(listen(server->listen_fd, 16) || SV_nonblocking(server->listen_fd)) {
+        return -1;
+    }
+    return port;
+}
+
+int SV_start(SV_SERVER* server, const char* address, int queue_length, int policy) {
+    /**
+     * Start serving on "unix:path" or "tcp:port" on the loopback interface
+     *
+     * \param queue_length Messages held for each client
+     * \param policy Policy of new clients when their queue is full
+     * \return The TCP port, which "tcp:0" picks, 0 for a Unix domain
+     * socket, -1 on error
+     */
+    memset(server, 0, sizeof(SV_SERVER));
+    server->listen_fd = -1;
+    server->wake[0] = server->wake[1] = -1;
+    server->poll_fd = -1;
+    for(int i = 0; i < SV_MAX_CLIENTS; i++) {
+        server->clients[i].fd = -1;
+    }
+    if(!address || queue_length < 1 || queue_length > SV_MAX_QUEUE ||
+       policy < SV_DROP_NEWEST || policy > SV_BLOCK) {
+        return -1;
+    }
+    server->queue_length = queue_length;
+    server->policy = policy;
+    int port = SV_listen(server, address);
+    if(port < 0 || pipe(server->wake) || SV_nonblocking(server->wake[0]) ||
+       SV_nonblocking(server->wake[1])) {
+        LOG(LOG_ERROR, "could not start the server\n");
+        SV_closeAll(server);
+        return -1;
+    }
+#ifdef __linux__
+    server->poll_fd = epoll_create1(0);
+    if(server->poll_fd < 0) {
+        SV_closeAll(server);
+        return -1;
+    }
+    SV_watch(server, SV_LISTEN_ID, server->listen_fd, 1, 0);
+    SV_watch(server, SV_WAKE_ID, server->wake[0], 1, 0);
+#endif
+    TH_mutexInit(&server->lock);
+    TH_condInit(&server->space);
+    if(TH_create(&server->thread, SV_run, server)) {
+        SV_closeAll(server);
+        TH_condDestroy(&server->space);
+        TH_mutexDestroy(&server->lock);
+        return -1;
+    }
+    server->running = 1;
+    return port;
+}
+
+void SV_stop(SV_SERVER* server) {
+    /**
+     * Disconnect every client and stop serving
+     *
+     * No other thread may be sending.
+     */
+    if(!server->running) {
+        return;
+    }
+    TH_lock(&server->lock);
+    server->stop = 1;
+    TH_unlock(&server->lock);
+    SV_wake(server);
+    TH_join(server->thread);
+    SV_closeAll(server);
+    TH_condDestroy(&server->space);
+    TH_mutexDestroy(&server->lock);
+    server->running = 0;
+}
+
+void SV_send(SV_SERVER* server, int type, int mdac, long long position, const void* payload,
+             int size) {
+    /**
+     * Queue a message for every client that wants its type
+     *
+     * The server thread is woken to write it.
+     */
+    if(!server->running) {
+        return;
+    }
+    TH_lock(&server->lock);
+    SV_MESSAGE* message = SV_newMessage(server, type, mdac, position, payload, size);
+    if(!message) {
+        TH_unlock(&server->lock);
+        return;
+    }
+    server->messages++;
+    for(int i = 0; i < SV_MAX_CLIENTS; i++) {
+        SV_CLIENT* client = &server->clients[i];
+        if(client->fd >= 0 && client->writing >= 0 && (client->mask & (1 << type))) {
+            SV_enqueue(server, client, message);
+        }
+    }
+    SV_release(message);
+    TH_unlock(&server->lock);
+    SV_wake(server);
+}
+
+void SV_stats(SV_SERVER* server, int* clients, long long* messages, long long* dropped,
+              long long* disconnected) {
+    /**
+     * Get counts since the server started
+     *
+     * \param dropped Set to the messages clients lost to full queues
+     * \param disconnected Set to the clients that have gone or were dropped
+     */
+    *clients = 0;
+    *messages = 0;
+    *dropped = 0;
+    *disconnected = 0;
+    if(!server->running) {
+        return;
+    }
+    TH_lock(&server->lock);
+    for(int i = 0; i < SV_MAX_CLIENTS; i++) {
+        if(server->clients[i].fd >= 0) {
+            (*clients)++;
+        }
+    }
+    *messages = server->messages;
+    *dropped = server->dropped;
+    *disconnected = server->disconnected;
+    TH_unlock(&server->lock);
+}
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * \file server.h
+ * \brief Header file for server.cpp
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "threads.h"
+
+#define SV_PROTOCOL 1
+#define SV_MAX_CLIENTS 64
+#define SV_MAX_QUEUE 4096
+// messages sent to a client in one call
+#define SV_MAX_BATCH 64
+// longest a blocking client may hold up the others before it is dropped
+#define SV_BLOCK_TIMEOUT 1000
+#define SV_MAX_PEAKS 256
+#define SV_HEADER_SIZE 24
+#define SV_CONTROL_SIZE 8
+
+/* message types, a client's mask has bit (1 << type) */
+#define SV_HELLO 0
+#define SV_SAMPLES 1
+#define SV_TAP 2
+#define SV_PEAKS 3
+
+/* what happens when a client's queue is full, the same values as the
+   public ones */
+#define SV_DROP_NEWEST 0
+#define SV_DROP_OLDEST 1
+#define SV_BLOCK 2
+
+/**
+ * One message, shared by every client it is queued for
+ *
+ * data is the SV_HEADER_SIZE byte header followed by the payload.
+ * refs is only changed under the server's lock.
+ */
+typedef struct {
+    int refs;
+    int size;
+    unsigned char data[1];
+} SV_MESSAGE;
+
+/**
+ * A connected client, fd is -1 for a free slot
+ *
+ * queue holds messages not fully sent, offset bytes of the first are.
+ * writing is 1 while the poller watches fd for room to write, and -1
+ * once the client is to be closed by the server thread.
+ */
+typedef struct {
+    int fd;
+    int mask;
+    int policy;
+    SV_MESSAGE** queue;
+    int head;
+    int count;
+    int offset;
+    int writing;
+    unsigned char control[SV_CONTROL_SIZE];
+    int control_size;
+} SV_CLIENT;
+
+/**
+ * Server that fans messages out to the clients of one socket
+ *
+ * One thread accepts clients and writes their queues, any thread may
+ * send. Everything below lock is changed under it.
+ */
+typedef struct {
+    int running;
+    int listen_fd;
+    int wake[2];
+    int poll_fd;
+    char path[108];
+    TH_THREAD thread;
+    TH_MUTEX lock;
+    TH_COND space;
+    SV_CLIENT clients[SV_MAX_CLIENTS];
+    int queue_length;
+    int policy;
+    unsigned int sequence;
+    int stop;
+    long long messages;
+    long long dropped;
+    long long disconnected;
+} SV_SERVER;
+
+int SV_start(SV_SERVER* server, const char* address, int queue_length, int policy);
+void SV_stop(SV_SERVER* server);
+void SV_send(SV_SERVER* server, int type, int mdac, long long position, const void* payload,
+             int size);
+void SV_stats(SV_SERVER* server, int* clients, long long* messages, long long* dropped,
+              long long* disconnected);
+
+#endif
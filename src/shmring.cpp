@@ -0,0 +1,366 @@
+/**
+ * \file shmring.cpp
+ * \brief Ring of sample blocks in shared memory for other processes
+ *
+ * Only one process can claim the unit, so the one that does can publish
+ * what it samples into a named shared memory ring. Any number of local
+ * processes map the ring read only and read blocks where they lie. The
+ * publisher never waits for a reader: each slot carries the number of
+ * the block in it, which is -1 while the slot is rewritten, so a reader
+ * checks after reading a block that it was not overwritten meanwhile,
+ * like a sequence lock. A reader that falls more than a ring behind
+ * skips to the oldest block still held.
+ */
+
+#include "shmring.h"
+#include "log.h"
+
+#include <stdio.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static void SR_objectName(const char* name, char* object) {
+    /**
+     * Name of the shared memory object for a ring name
+     */
+    while(*name == '/') {
+        name++;
+    }
+#ifdef _WIN32
+    snprintf(object, SR_MAX_NAME + 8, "Local\\%s", name);
+#else
+    snprintf(object, SR_MAX_NAME + 8, "/%s", name);
+#endif
+}
+
+#ifndef _WIN32
+static int SR_isAbandoned(const char* object) {
+    /**
+     * Returns true if a shared memory object is a ring whose publisher
+     * stopped or died
+     *
+     * Anything that is not a whole ring, such as one still being created,
+     * is left alone.
+     */
+    int fd = shm_open(object, O_RDONLY, 0);
+    if(fd < 0) {
+        return 0;
+    }
+    struct stat info;
+    void* memory = MAP_FAILED;
+    if(!fstat(fd, &info) && info.st_size >= (off_t)sizeof(SR_HEADER)) {
+        memory = mmap(0, sizeof(SR_HEADER), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(memory == MAP_FAILED) {
+        return 0;
+    }
+    SR_HEADER* header = (SR_HEADER*)memory;
+    int abandoned = 0;
+    if(TH_atomicLoad(&header->magic) == SR_MAGIC) {
+        int pid = header->pid;
+        abandoned = !TH_atomicLoad(&header->publishing) || pid <= 0 ||
+                    (kill(pid, 0) && errno == ESRCH);
+    }
+    munmap(memory, sizeof(SR_HEADER));
+    return abandoned;
+}
+#endif
+
+static void* SR_map(SR_RING* ring, const char* name, size_t size, int create) {
+    /**
+     * Map a shared memory object, creating it at size or opening it
+     *
+     * An object opened is mapped at its own size. Creating fails if a
+     * live publisher has the name.
+     */
+    char object[SR_MAX_NAME + 8];
+    SR_objectName(name, object);
+#ifdef _WIN32
+    if(create) {
+        ring->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE,
+                                           (DWORD)((unsigned long long)size >> 32),
+                                           (DWORD)size, object);
+    } else {
+        ring->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, object);
+    }
+    if(!ring->mapping) {
+        return 0;
+    }
+    if(create && GetLastError() == ERROR_ALREADY_EXISTS) {
+        // a mapping lasts only while it is open, so someone still holds it
+        CloseHandle(ring->mapping);
+        ring->mapping = 0;
+        return 0;
+    }
+    void* memory = MapViewOfFile(ring->mapping, create ? FILE_MAP_WRITE : FILE_MAP_READ,
+                                 0, 0, size);
+    if(!memory) {
+        CloseHandle(ring->mapping);
+        ring->mapping = 0;
+    }
+    return memory;
+#else
+    int fd;
+    if(create) {
+        fd = shm_open(object, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if(fd < 0 && errno == EEXIST && SR_isAbandoned(object)) {
+            // a ring left by a publisher that died is replaced
+            shm_unlink(object);
+            fd = shm_open(object, O_RDWR | O_CREAT | O_EXCL, 0644);
+        }
+        if(fd >= 0 && ftruncate(fd, (off_t)size)) {
+            close(fd);
+            shm_unlink(object);
+            return 0;
+        }
+    } else {
+        fd = shm_open(object, O_RDONLY, 0);
+        struct stat info;
+        if(fd >= 0 && (fstat(fd, &info) || info.st_size < (off_t)sizeof(SR_HEADER))) {
+            close(fd);
+            return 0;
+        }
+        if(fd >= 0) {
+            size = (size_t)info.st_size;
+        }
+    }
+    if(fd < 0) {
+        return 0;
+    }
+    void* memory = mmap(0, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                        fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED) {
+        if(create) {
+            shm_unlink(object);
+        }
+        return 0;
+    }
+    ring->size = size;
+    return memory;
+#endif
+}
+
+int SR_create(SR_RING* ring, const char* name, int num_slots, int slot_samples) {
+    /**
+     * Create a ring for this process to publish to
+     *
+     * \param name Name readers open the ring by, the same for every
+     * platform
+     * \param num_slots Blocks held, readers more than this far behind
+     * lose blocks
+     * \param slot_samples Longest block held in one slot
+     *
+     * Returns -1 if another process is publishing under the name.
+     */
+    memset(ring, 0, sizeof(SR_RING));
+    if(!name || !*name || strlen(name) >= SR_MAX_NAME || num_slots < 2 ||
+       num_slots > SR_MAX_SLOTS || slot_samples < 1 || slot_samples > SR_MAX_SLOT_SAMPLES) {
+        return -1;
+    }
+    int slot_size = (SR_SLOT_HEADER_SIZE + slot_samples*10 + 63) & ~63;
+    size_t size = SR_HEADER_SIZE + (size_t)num_slots*slot_size;
+    SR_HEADER* header = (SR_HEADER*)SR_map(ring, name, size, 1);
+    if(!header) {
+        LOG(LOG_ERROR, "could not create shared memory ring\n");
+        return -1;
+    }
+    ring->size = size;
+    ring->header = header;
+    ring->owner = 1;
+    strcpy(ring->name, name);
+    for(int i = 0; i < num_slots; i++) {
+        SR_SLOT* slot = (SR_SLOT*)((char*)header + SR_HEADER_SIZE + (size_t)i*slot_size);
+        slot->sequence = -1;
+    }
+    header->version = SR_VERSION;
+    header->num_slots = num_slots;
+    header->slot_samples = slot_samples;
+    header->slot_size = slot_size;
+    header->written = 0;
+#ifdef _WIN32
+    header->pid = (int)GetCurrentProcessId();
+#else
+    header->pid = (int)getpid();
+#endif
+    header->publishing = 1;
+    // readers check magic last
+    TH_fence();
+    TH_atomicStore(&header->magic, SR_MAGIC);
+    return 0;
+}
+
+int SR_open(SR_RING* ring, const char* name) {
+    /**
+     * Map a ring another process publishes to
+     *
+     * The reader starts at the next block published.
+     */
+    memset(ring, 0, sizeof(SR_RING));
+    if(!name || !*name || strlen(name) >= SR_MAX_NAME) {
+        return -1;
+    }
+#ifdef _WIN32
+    // the view of a mapping opened by name is sized from its header
+    SR_HEADER* header = (SR_HEADER*)SR_map(ring, name, sizeof(SR_HEADER), 0);
+    if(header && TH_atomicLoad(&header->magic) == SR_MAGIC) {
+        size_t size = SR_HEADER_SIZE + (size_t)header->num_slots*header->slot_size;
+        UnmapViewOfFile(header);
+        header = (SR_HEADER*)MapViewOfFile(ring->mapping, FILE_MAP_READ, 0, 0, size);
+        ring->size = size;
+    }
+#else
+    SR_HEADER* header = (SR_HEADER*)SR_map(ring, name, 0, 0);
+#endif
+    ring->header = header;
+    strcpy(ring->name, name);
+    if(!header || TH_atomicLoad(&header->magic) != SR_MAGIC ||
+       header->version != SR_VERSION ||
+       ring->size < SR_HEADER_SIZE + (size_t)header->num_slots*header->slot_size) {
+        SR_close(ring);
+        return -1;
+    }
+    ring->next = TH_atomicLoad64(&header->written);
+    ring->current = -1;
+    return 0;
+}
+
+void SR_close(SR_RING* ring) {
+    /**
+     * Unmap a ring, the publisher also removes its name
+     *
+     * Readers that still have the ring mapped keep it until they close it.
+     */
+    if(ring->header) {
+        if(ring->owner) {
+            TH_atomicStore(&ring->header->publishing, 0);
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(ring->header);
+#else
+        munmap(ring->header, ring->size);
+#endif
+    }
+#ifdef _WIN32
+    if(ring->mapping) {
+        CloseHandle(ring->mapping);
+    }
+#else
+    if(ring->owner) {
+        char object[SR_MAX_NAME + 8];
+        SR_objectName(ring->name, object);
+        shm_unlink(object);
+    }
+#endif
+    memset(ring, 0, sizeof(SR_RING));
+}
+
+static SR_SLOT* SR_slot(SR_RING* ring, long long sequence) {
+    /**
+     * Slot that holds a block
+     */
+    SR_HEADER* header = ring->header;
+    return (SR_SLOT*)((char*)header + SR_HEADER_SIZE +
+                      (size_t)(sequence % header->num_slots)*header->slot_size);
+}
+
+int* SR_samples(SR_SLOT* slot) {
+    /**
+     * Packed samples of a block
+     */
+    return (int*)((char*)slot + SR_SLOT_HEADER_SIZE);
+}
+
+short* SR_channel(SR_RING* ring, SR_SLOT* slot, int channel) {
+    /**
+     * x1, x2 or x3 of a block
+     *
+     * \param channel 1, 2 or 3
+     */
+    int slot_samples = ring->header->slot_samples;
+    short* channels = (short*)(SR_samples(slot) + slot_samples);
+    return channels + (channel - 1)*slot_samples;
+}
+
+void SR_write(SR_RING* ring, int stream, int mdac, long long position, const int* samples,
+              const short* x1, const short* x2, const short* x3, int num_samples) {
+    /**
+     * Publish a block, in as many slots as it takes
+     *
+     * May be called from several threads of the publisher.
+     */
+    SR_HEADER* header = ring->header;
+    int slot_samples = header->slot_samples;
+    long long time = TH_nanoseconds();
+    TH_spinLock(&ring->lock);
+    for(int first = 0; first < num_samples; first += slot_samples) {
+        int n = num_samples - first < slot_samples ? num_samples - first : slot_samples;
+        long long sequence = header->written;
+        SR_SLOT* slot = SR_slot(ring, sequence);
+        TH_atomicStore64(&slot->sequence, -1);
+        TH_fence();
+        slot->position = position + first;
+        slot->time = time;
+        slot->stream = stream;
+        slot->mdac = mdac;
+        slot->num_samples = n;
+        memcpy(SR_samples(slot), samples + first, n*sizeof(int));
+        memcpy(SR_channel(ring, slot, 1), x1 + first, n*sizeof(short));
+        memcpy(SR_channel(ring, slot, 2), x2 + first, n*sizeof(short));
+        memcpy(SR_channel(ring, slot, 3), x3 + first, n*sizeof(short));
+        TH_atomicStore64(&slot->sequence, sequence);
+        TH_atomicStore64(&header->written, sequence + 1);
+    }
+    TH_spinUnlock(&ring->lock);
+}
+
+SR_SLOT* SR_next(SR_RING* ring) {
+    /**
+     * Take the next block a reader has not seen
+     *
+     * \return The block, read in place, or 0 if there is no new one. Check
+     * SR_valid once done with it.
+     */
+    SR_HEADER* header = ring->header;
+    for(;;) {
+        long long written = TH_atomicLoad64(&header->written);
+        if(ring->next >= written) {
+            return 0;
+        }
+        // the oldest slot may already be being rewritten
+        long long oldest = written - header->num_slots + 1;
+        if(ring->next < oldest) {
+            ring->missed += oldest - ring->next;
+            ring->next = oldest;
+        }
+        SR_SLOT* slot = SR_slot(ring, ring->next);
+        if(TH_atomicLoad64(&slot->sequence) == ring->next) {
+            ring->current = ring->next++;
+            return slot;
+        }
+        ring->missed++;
+        ring->next++;
+    }
+}
+
+bool SR_valid(SR_RING* ring) {
+    /**
+     * Check that the block from SR_next was not overwritten while it was
+     * read
+     *
+     * Whatever was read from the block before the call can be trusted if
+     * this returns true.
+     */
+    if(ring->current < 0) {
+        return false;
+    }
+    TH_fence();
+    return TH_atomicLoad64(&SR_slot(ring, ring->current)->sequence) == ring->current;
+}
@@ -0,0 +1,88 @@
+/**
+ * \file shmring.h
+ * \brief Header file for shmring.cpp
+ */
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "threads.h"
+
+#define SR_MAGIC 0x5253434C
+#define SR_VERSION 1
+#define SR_MAX_NAME 64
+#define SR_MAX_SLOTS (1 << 16)
+#define SR_MAX_SLOT_SAMPLES (1 << 20)
+// bytes before the first slot and before the samples of each slot
+#define SR_HEADER_SIZE 128
+#define SR_SLOT_HEADER_SIZE 64
+
+/**
+ * Start of the shared memory, written once by the publisher
+ *
+ * written counts the blocks published, block n is in slot
+ * n % num_slots. publishing is cleared when the publisher stops, and pid
+ * tells whether a ring still marked publishing was left by one that died.
+ */
+typedef struct {
+    int magic;
+    int version;
+    int num_slots;
+    int slot_samples;
+    int slot_size;
+    volatile int publishing;
+    volatile long long written;
+    int pid;
+} SR_HEADER;
+
+/**
+ * One block in the ring, followed by its packed samples and the x1, x2
+ * and x3 shorts
+ *
+ * sequence is the block number, or -1 while the publisher writes the
+ * slot. A block longer than a slot is split, position is the stream
+ * position of its first sample.
+ */
+struct libchaos_shared_block {
+    volatile long long sequence;
+    long long position;
+    long long time;
+    int stream;
+    int mdac;
+    int num_samples;
+};
+typedef struct libchaos_shared_block SR_SLOT;
+
+/**
+ * A process's mapping of a ring, as the publisher or a reader
+ *
+ * next is the next block a reader takes and current the one it took
+ * last. missed counts blocks overwritten before the reader got to them.
+ */
+typedef struct {
+    char name[SR_MAX_NAME];
+    SR_HEADER* header;
+    size_t size;
+    int owner;
+    volatile int lock;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+    long long next;
+    long long current;
+    long long missed;
+} SR_RING;
+
+int SR_create(SR_RING* ring, const char* name, int num_slots, int slot_samples);
+int SR_open(SR_RING* ring, const char* name);
+void SR_close(SR_RING* ring);
+void SR_write(SR_RING* ring, int stream, int mdac, long long position, const int* samples,
+              const short* x1, const short* x2, const short* x3, int num_samples);
+SR_SLOT* SR_next(SR_RING* ring);
+bool SR_valid(SR_RING* ring);
+int* SR_samples(SR_SLOT* slot);
+short* SR_channel(SR_RING* ring, SR_SLOT* slot, int channel);
+
+#endif
@@ -0,0 +1,168 @@
+/**
+ * \file simulator.cpp
+ * \brief A chaos unit simulated in software
+ *
+ * The simulator stands in for the unit behind a device's transport. It
+ * answers the same commands, numbers its data packets the same way and
+ * can run at the unit's own rate, faster, or as fast as it is asked, so
+ * long captures can be tested without the hardware and faster than real
+ * time. Packets can be dropped on purpose to exercise gap detection.
+ */
+
+#include "simulator.h"
+#include "threads.h"
+
+static double SM_random(SM_DEVICE* sim) {
+    /**
+     * Returns a repeatable random number between 0 and 1
+     */
+    sim->seed = sim->seed*1103515245 + 12345;
+    return ((sim->seed >> 8) & 0xFFFF)/65536.0;
+}
+
+static void SM_pace(SM_DEVICE* sim) {
+    /**
+     * Hold back a packet until the unit would have sampled it
+     */
+    if(sim->speed <= 0) {
+        return;
+    }
+    double samples = (double)sim->packets*SM_PACKET_SAMPLES;
+    long long target = sim->start +
+                       (long long)(samples*1e9/((LIBCHAOS_SAMPLE_FREQUENCY)*sim->speed));
+    for(;;) {
+        long long remaining = target - TH_nanoseconds();
+        if(remaining <= 0) {
+            return;
+        }
+        if(remaining > 2000000) {
+            TH_sleep(1);
+        }
+    }
+}
+
+static void SM_packet(SM_DEVICE* sim) {
+    /**
+     * Make the next data packet, the packet id followed by samples
+     */
+    int* packet = (int*)sim->reply;
+    // a lost packet still takes its time and its packet id
+    while(sim->drop_rate > 0 && SM_random(sim) < sim->drop_rate) {
+        SY_generate(&sim->attractor, packet + 1, SM_PACKET_SAMPLES);
+        sim->packet_id++;
+        sim->packets++;
+    }
+    SY_generate(&sim->attractor, packet + 1, SM_PACKET_SAMPLES);
+    packet[0] = sim->packet_id++;
+    sim->packets++;
+    SM_pace(sim);
+    sim->reply_size = 1024;
+}
+
+static int SM_write(void* state, char* buf, int size) {
+    /**
+     * Take a command and get its answer ready
+     */
+    SM_DEVICE* sim = (SM_DEVICE*)state;
+    if(size < 1) {
+        return -1;
+    }
+    sim->reply[0] = 0;
+    sim->reply_size = 1;
+    switch((unsigned char)buf[0]) {
+    case CMD_status:
+        memcpy(sim->reply, &sim->mdac, 4);
+        sim->reply_size = 4;
+        break;
+    case CMD_get_version: {
+        int version = SM_FIRMWARE_VERSION;
+        memcpy(sim->reply, &version, 4);
+        sim->reply_size = 4;
+        break;
+    }
+    case CMD_set_mdac:
+    case CMD_start_sample:
+        if(size >= 6) {
+            short tap;
+            memcpy(&tap, buf + 4, sizeof(tap));
+            // like the unit, an invalid value leaves the MDAC as it is
+            if(tap >= 0 && tap <= 4095) {
+                sim->mdac = tap;
+                SY_setMDAC(&sim->attractor, tap);
+            }
+        }
+        if((unsigned char)buf[0] == CMD_start_sample) {
+            sim->packet_id = 0;
+            sim->packets = 0;
+            sim->start = TH_nanoseconds();
+        }
+        break;
+    case CMD_get_data:
+        SM_packet(sim);
+        break;
+    }
+    return size;
+}
+
+static int SM_read(void* state, char* buf, int size) {
+    /**
+     * Hand over the answer to the last command
+     */
+    SM_DEVICE* sim = (SM_DEVICE*)state;
+    int length = sim->reply_size < size ? sim->reply_size : size;
+    memcpy(buf, sim->reply, length);
+    sim->reply_size = 0;
+    return length;
+}
+
+static void SM_free(void* state) {
+    /**
+     * Free a simulator when its device stops using it
+     */
+    free(state);
+}
+
+int SM_start(UC_DEVICE* dev, double speed, double drop_rate, unsigned int seed) {
+    /**
+     * Simulate the unit of a device
+     *
+     * \param speed Multiple of the unit's sample rate, 0 for as fast as
+     * samples are asked for
+     * \param drop_rate Fraction of data packets to lose, 0 for none
+     * \param seed Picks the attractor's starting point and noise
+     */
+    if(speed < 0 || drop_rate < 0 || drop_rate >= 1) {
+        return -1;
+    }
+    SM_DEVICE* sim = (SM_DEVICE*)calloc(1, sizeof(SM_DEVICE));
+    if(!sim) {
+        return -1;
+    }
+    sim->speed = speed;
+    sim->drop_rate = drop_rate;
+    sim->seed = seed;
+    sim->mdac = 2000;
+    SY_init(&sim->attractor, sim->mdac, seed);
+    sim->start = TH_nanoseconds();
+
+    UC_TRANSPORT transport;
+    transport.write = SM_write;
+    transport.read = SM_read;
+    transport.free = SM_free;
+    transport.state = sim;
+    UC_setTransport(dev, &transport);
+    return 0;
+}
+
+int SM_stop(UC_DEVICE* dev) {
+    /**
+     * Go back to the unit on the bus
+     *
+     * Returns -1 if the device was not simulated.
+     */
+    if(dev->transport.write != SM_write) {
+        return -1;
+    }
+    UC_setTransport(dev, 0);
+    return 0;
+}
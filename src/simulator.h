@@ -0,0 +1,42 @@
+/**
+ * \file simulator.h
+ * \brief Header file for simulator.cpp
+ */
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "usb_comm.h"
+#include "synth.h"
+
+// samples in each data packet, after the packet id
+#define SM_PACKET_SAMPLES 255
+#define SM_FIRMWARE_VERSION 1
+
+/**
+ * A chaos unit answering commands with samples from a model
+ *
+ * speed is a multiple of the unit's sample rate, 0 to answer as fast as
+ * asked. drop_rate is the fraction of data packets lost on the way, which
+ * shows up as missing packet ids. reply holds the answer to the last
+ * command until it is read.
+ */
+typedef struct {
+    SY_ATTRACTOR attractor;
+    double speed;
+    double drop_rate;
+    unsigned int seed;
+    int mdac;
+    int packet_id;
+    long long start;
+    long long packets;
+    char reply[1024];
+    int reply_size;
+} SM_DEVICE;
+
+int SM_start(UC_DEVICE* dev, double speed, double drop_rate, unsigned int seed);
+int SM_stop(UC_DEVICE* dev);
+
+#endif
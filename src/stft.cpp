@@ -0,0 +1,357 @@
+/**
+ * \file stft.cpp
+ * \brief Streaming short time Fourier transform
+ *
+ * Turns a stream of samples into a spectrogram: every hop samples the
+ * last size of them are windowed and transformed, and the log power of
+ * each frequency bin becomes one row of a ring. The plan of a size and
+ * window is made once and shared, so a row costs one complex transform
+ * of size/2 points, well within one core at the unit's sample rate.
+ */
+
+#include "stft.h"
+#include "bufpool.h"
+
+static ST_PLAN* ST_PLANS[ST_MAX_PLANS];
+static int ST_NUM_PLANS = 0;
+static volatile int ST_PLANS_LOCK = 0;
+
+static double ST_window(int window_type, int i, int size) {
+    /**
+     * Returns the weight of sample i in a window of size samples
+     */
+    double x = 2*M_PI*i/size;
+    switch(window_type) {
+    case ST_HANN:
+        return 0.5 - 0.5*cos(x);
+    case ST_HAMMING:
+        return 0.54 - 0.46*cos(x);
+    case ST_BLACKMAN:
+        return 0.42 - 0.5*cos(x) + 0.08*cos(2*x);
+    }
+    return 1;
+}
+
+static ST_PLAN* ST_makePlan(int size, int window_type) {
+    /**
+     * Work out the tables for one size and window
+     */
+    int half = size/2;
+    ST_PLAN* plan = (ST_PLAN*)calloc(1, sizeof(ST_PLAN));
+    if(!plan) {
+        return 0;
+    }
+    plan->size = size;
+    plan->window_type = window_type;
+    plan->reversed = (int*)malloc(half*sizeof(int));
+    plan->twiddles = (float*)malloc(half*sizeof(float));
+    plan->split = (float*)malloc(size*sizeof(float));
+    plan->window = (float*)malloc(size*sizeof(float));
+    if(!plan->reversed || !plan->twiddles || !plan->split || !plan->window) {
+        free(plan->reversed);
+        free(plan->twiddles);
+        free(plan->split);
+        free(plan->window);
+        free(plan);
+        return 0;
+    }
+    int bits = 0;
+    while((1 << bits) < half) {
+        bits++;
+    }
+    for(int i = 0; i < half; i++) {
+        int r = 0;
+        for(int b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        plan->reversed[i] = r;
+    }
+    for(int i = 0; i < half/2; i++) {
+        plan->twiddles[2*i] = (float)cos(2*M_PI*i/half);
+        plan->twiddles[2*i+1] = (float)-sin(2*M_PI*i/half);
+    }
+    for(int i = 0; i < half; i++) {
+        plan->split[2*i] = (float)cos(2*M_PI*i/size);
+        plan->split[2*i+1] = (float)-sin(2*M_PI*i/size);
+    }
+    for(int i = 0; i < size; i++) {
+        plan->window[i] = (float)ST_window(window_type, i, size);
+    }
+    return plan;
+}
+
+const ST_PLAN* ST_getPlan(int size, int window_type) {
+    /**
+     * Returns the plan for a size and window, made the first time it is asked for
+     *
+     * Plans are kept until the process ends. Returns 0 if size is not a
+     * power of 2 between ST_MIN_SIZE and ST_MAX_SIZE, the window is
+     * unknown or ST_MAX_PLANS are already made.
+     */
+    if(size < ST_MIN_SIZE || size > ST_MAX_SIZE || (size & (size - 1)) ||
+       window_type < ST_RECTANGULAR || window_type > ST_BLACKMAN) {
+        return 0;
+    }
+    ST_PLAN* plan = 0;
+    TH_spinLock(&ST_PLANS_LOCK);
+    for(int i = 0; i < ST_NUM_PLANS; i++) {
+        if(ST_PLANS[i]->size == size && ST_PLANS[i]->window_type == window_type) {
+            plan = ST_PLANS[i];
+            break;
+        }
+    }
+    if(!plan && ST_NUM_PLANS < ST_MAX_PLANS) {
+        plan = ST_makePlan(size, window_type);
+        if(plan) {
+            ST_PLANS[ST_NUM_PLANS++] = plan;
+        }
+    }
+    TH_spinUnlock(&ST_PLANS_LOCK);
+    return plan;
+}
+
+void ST_power(const ST_PLAN* plan, const float* input, float* work, float* power) {
+    /**
+     * Power of the first size/2 frequencies of size samples
+     *
+     * The mean is taken out first, as the samples sit around mid scale.
+     * The even samples become the real and the odd ones the imaginary
+     * parts of a complex transform of size/2 points, which is then split
+     * into the spectrum of the real samples.
+     *
+     * \param work Room for size floats
+     * \param power Gets size/2 values
+     */
+    int size = plan->size;
+    int half = size/2;
+    float mean = 0;
+    for(int i = 0; i < size; i++) {
+        mean += input[i];
+    }
+    mean /= size;
+    for(int i = 0; i < half; i++) {
+        int r = plan->reversed[i];
+        work[2*r] = (input[2*i] - mean)*plan->window[2*i];
+        work[2*r+1] = (input[2*i+1] - mean)*plan->window[2*i+1];
+    }
+
+    for(int length = 2, step = half/2; length <= half; length <<= 1, step >>= 1) {
+        int middle = length/2;
+        for(int start = 0; start < half; start += length) {
+            float* a = work + 2*start;
+            float* b = a + 2*middle;
+            for(int j = 0; j < middle; j++) {
+                float wr = plan->twiddles[2*j*step];
+                float wi = plan->twiddles[2*j*step+1];
+                float br = b[2*j]*wr - b[2*j+1]*wi;
+                float bi = b[2*j]*wi + b[2*j+1]*wr;
+                b[2*j] = a[2*j] - br;
+                b[2*j+1] = a[2*j+1] - bi;
+                a[2*j] += br;
+                a[2*j+1] += bi;
+            }
+        }
+    }
+
+    for(int k = 0; k < half; k++) {
+        int m = k ? half - k : 0;
+        float zr = work[2*k], zi = work[2*k+1];
+        float cr = work[2*m], ci = -work[2*m+1];
+        // even part (z + conj)/2, odd part (z - conj)/2i
+        float er = 0.5f*(zr + cr), ei = 0.5f*(zi + ci);
+        float or_ = 0.5f*(zi - ci), oi = -0.5f*(zr - cr);
+        float wr = plan->split[2*k], wi = plan->split[2*k+1];
+        float xr = er + or_*wr - oi*wi;
+        float xi = ei + or_*wi + oi*wr;
+        power[k] = xr*xr + xi*xi;
+    }
+}
+
+int ST_init(ST_SPECTROGRAM* spectrogram, int size, int hop, int window_type, int num_rows) {
+    /**
+     * Get a spectrogram ready for samples
+     *
+     * \param size Samples in each transform, a power of 2
+     * \param hop Samples between rows, may be more than size to skip some
+     * \param num_rows Rows kept before the oldest are overwritten
+     */
+    memset(spectrogram, 0, sizeof(ST_SPECTROGRAM));
+    const ST_PLAN* plan = ST_getPlan(size, window_type);
+    if(!plan || hop < 1 || num_rows < 1) {
+        return -1;
+    }
+    int bins = size/2;
+    spectrogram->plan = plan;
+    spectrogram->size = size;
+    spectrogram->hop = hop;
+    spectrogram->bins = bins;
+    spectrogram->num_rows = num_rows;
+    spectrogram->min_db = 0;
+    spectrogram->max_db = 120;
+    spectrogram->input = (float*)BP_alloc(size*sizeof(float));
+    spectrogram->work = (float*)BP_alloc(size*sizeof(float));
+    spectrogram->power = (float*)BP_alloc((size_t)num_rows*bins*sizeof(float));
+    spectrogram->image = (unsigned char*)BP_alloc((size_t)num_rows*bins);
+    spectrogram->row_mdac = (int*)BP_alloc(num_rows*sizeof(int));
+    spectrogram->row_position = (long long*)BP_alloc(num_rows*sizeof(long long));
+    TH_mutexInit(&spectrogram->lock);
+    if(!spectrogram->input || !spectrogram->work || !spectrogram->power ||
+       !spectrogram->image || !spectrogram->row_mdac || !spectrogram->row_position) {
+        ST_free(spectrogram);
+        return -1;
+    }
+    return 0;
+}
+
+void ST_free(ST_SPECTROGRAM* spectrogram) {
+    /**
+     * Free the buffers of a spectrogram, the plan stays for the next one
+     */
+    if(!spectrogram->plan) {
+        return;
+    }
+    BP_free(spectrogram->input);
+    BP_free(spectrogram->work);
+    BP_free(spectrogram->power);
+    BP_free(spectrogram->image);
+    BP_free(spectrogram->row_mdac);
+    BP_free(spectrogram->row_position);
+    TH_mutexDestroy(&spectrogram->lock);
+    memset(spectrogram, 0, sizeof(ST_SPECTROGRAM));
+}
+
+void ST_clear(ST_SPECTROGRAM* spectrogram) {
+    /**
+     * Forget all rows and samples
+     */
+    TH_lock(&spectrogram->lock);
+    spectrogram->fill = 0;
+    spectrogram->rows = 0;
+    spectrogram->position = 0;
+    TH_unlock(&spectrogram->lock);
+}
+
+void ST_setRange(ST_SPECTROGRAM* spectrogram, float min_db, float max_db) {
+    /**
+     * Set the dB values that become 0 and 255 in the image of rows made from now on
+     */
+    TH_lock(&spectrogram->lock);
+    spectrogram->min_db = min_db;
+    spectrogram->max_db = max_db;
+    TH_unlock(&spectrogram->lock);
+}
+
+static void ST_row(ST_SPECTROGRAM* spectrogram, int mdac) {
+    /**
+     * Make a row from the full input
+     */
+    int bins = spectrogram->bins;
+    int slot = (int)(spectrogram->rows % spectrogram->num_rows);
+    float* power = spectrogram->power + (size_t)slot*bins;
+    unsigned char* image = spectrogram->image + (size_t)slot*bins;
+    ST_power(spectrogram->plan, spectrogram->input, spectrogram->work, power);
+
+    float range = spectrogram->max_db - spectrogram->min_db;
+    float scale = range > 0 ? 255/range : 0;
+    for(int k = 0; k < bins; k++) {
+        float db = 10*log10f(power[k] + 1e-10f);
+        power[k] = db;
+        float level = (db - spectrogram->min_db)*scale;
+        image[k] = level <= 0 ? 0 : level >= 255 ? 255 : (unsigned char)(level + 0.5f);
+    }
+    spectrogram->row_mdac[slot] = mdac;
+    spectrogram->row_position[slot] = spectrogram->position - spectrogram->size;
+    spectrogram->rows++;
+}
+
+int ST_add(ST_SPECTROGRAM* spectrogram, const short* x1, int num_samples, int mdac,
+           int contiguous) {
+    /**
+     * Add samples of x1, making a row each time hop more have come
+     *
+     * A negative fill counts samples still to skip when hop is more
+     * than size.
+     *
+     * \param contiguous 0 if the samples do not follow the last ones, the
+     * samples left over are then dropped instead of sharing a row with them
+     * \return Rows made
+     */
+    TH_lock(&spectrogram->lock);
+    long long rows = spectrogram->rows;
+    int size = spectrogram->size;
+    int hop = spectrogram->hop;
+    if(!contiguous) {
+        spectrogram->fill = 0;
+    }
+    while(num_samples > 0) {
+        if(spectrogram->fill < 0) {
+            int skip = -spectrogram->fill < num_samples ? -spectrogram->fill : num_samples;
+            spectrogram->fill += skip;
+            spectrogram->position += skip;
+            x1 += skip;
+            num_samples -= skip;
+            continue;
+        }
+        int take = size - spectrogram->fill;
+        if(take > num_samples) {
+            take = num_samples;
+        }
+        float* input = spectrogram->input + spectrogram->fill;
+        for(int i = 0; i < take; i++) {
+            input[i] = x1[i];
+        }
+        spectrogram->fill += take;
+        spectrogram->position += take;
+        x1 += take;
+        num_samples -= take;
+        if(spectrogram->fill == size) {
+            ST_row(spectrogram, mdac);
+            if(hop < size) {
+                memmove(spectrogram->input, spectrogram->input + hop,
+                        (size - hop)*sizeof(float));
+            }
+            spectrogram->fill = size - hop;
+        }
+    }
+    rows = spectrogram->rows - rows;
+    TH_unlock(&spectrogram->lock);
+    return (int)rows;
+}
+
+int ST_getRows(ST_SPECTROGRAM* spectrogram, long long first, int num_rows, float* power,
+               unsigned char* image, int* mdac_values) {
+    /**
+     * Copy rows from first on, oldest first
+     *
+     * \param power Gets bins dB values for each row, or 0
+     * \param image Gets bins bytes for each row, or 0
+     * \param mdac_values Gets the mdac value of each row, or 0
+     * \return Rows copied, fewer than num_rows if not made yet, -1 if
+     * first is no longer kept
+     */
+    TH_lock(&spectrogram->lock);
+    long long oldest = spectrogram->rows - spectrogram->num_rows;
+    if(first < 0 || first < oldest) {
+        TH_unlock(&spectrogram->lock);
+        return -1;
+    }
+    if(num_rows > spectrogram->rows - first) {
+        num_rows = (int)(spectrogram->rows > first ? spectrogram->rows - first : 0);
+    }
+    int bins = spectrogram->bins;
+    for(int i = 0; i < num_rows; i++) {
+        int slot = (int)((first + i) % spectrogram->num_rows);
+        if(power) {
+            memcpy(power + (size_t)i*bins, spectrogram->power + (size_t)slot*bins,
+                   bins*sizeof(float));
+        }
+        if(image) {
+            memcpy(image + (size_t)i*bins, spectrogram->image + (size_t)slot*bins, bins);
+        }
+        if(mdac_values) {
+            mdac_values[i] = spectrogram->row_mdac[slot];
+        }
+    }
+    TH_unlock(&spectrogram->lock);
+    return num_rows;
+}
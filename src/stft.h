@@ -0,0 +1,80 @@
+/**
+ * \file stft.h
+ * \brief Header file for stft.cpp
+ */
+
+#ifndef STFT_H
+#define STFT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "threads.h"
+
+#define ST_MIN_SIZE 64
+#define ST_MAX_SIZE 65536
+#define ST_MAX_PLANS 32
+
+/* windows, the same values as the public ones */
+#define ST_RECTANGULAR 0
+#define ST_HANN 1
+#define ST_HAMMING 2
+#define ST_BLACKMAN 3
+
+/**
+ * Everything about a transform size that does not depend on the data
+ *
+ * A real transform of size points is done as a complex one of size/2.
+ * twiddles are its roots of unity, split the ones that separate the
+ * result into the spectrum of the real input.
+ */
+typedef struct {
+    int size;
+    int window_type;
+    int* reversed;
+    float* twiddles;
+    float* split;
+    float* window;
+} ST_PLAN;
+
+/**
+ * Log power spectra of a stream, one row every hop samples
+ *
+ * Rows are kept in a ring of num_rows, row r in slot r % num_rows, as
+ * dB floats and as bytes scaled from min_db to max_db. input holds the
+ * fill samples of x1 not yet used up. Changed under lock, so a stage
+ * may add rows while they are read.
+ */
+typedef struct {
+    const ST_PLAN* plan;
+    int size;
+    int hop;
+    int bins;
+    int num_rows;
+    int stream;
+    float min_db;
+    float max_db;
+    float* input;
+    int fill;
+    float* work;
+    float* power;
+    unsigned char* image;
+    int* row_mdac;
+    long long* row_position;
+    long long rows;
+    long long position;
+    TH_MUTEX lock;
+} ST_SPECTROGRAM;
+
+const ST_PLAN* ST_getPlan(int size, int window_type);
+void ST_power(const ST_PLAN* plan, const float* input, float* work, float* power);
+int ST_init(ST_SPECTROGRAM* spectrogram, int size, int hop, int window_type, int num_rows);
+void ST_free(ST_SPECTROGRAM* spectrogram);
+void ST_clear(ST_SPECTROGRAM* spectrogram);
+void ST_setRange(ST_SPECTROGRAM* spectrogram, float min_db, float max_db);
+int ST_add(ST_SPECTROGRAM* spectrogram, const short* x1, int num_samples, int mdac,
+           int contiguous);
+int ST_getRows(ST_SPECTROGRAM* spectrogram, long long first, int num_rows, float* power,
+               unsigned char* image, int* mdac_values);
+
+#endif
@@ -0,0 +1,89 @@
+/**
+ * \file synth.cpp
+ * \brief Routines for making samples without a chaos unit
+ *
+ * The samples come from integrating a model of the unit's circuit, so
+ * they have the same shape, peaks and return maps as real data and can
+ * be used to exercise and time the processing routines.
+ */
+
+#include "synth.h"
+#include "data_processing.h"
+
+static double SY_random(SY_ATTRACTOR* attractor) {
+    /**
+     * Returns a repeatable random number between -1 and 1
+     */
+    attractor->seed = attractor->seed*1103515245 + 12345;
+    return ((attractor->seed >> 8) & 0xFFFF)/32768.0 - 1.0;
+}
+
+static int SY_adc(double value) {
+    /**
+     * Convert a state variable to a 10 bit ADC reading
+     */
+    int reading = (int)(512 + value*SY_SCALE);
+    if(reading < 0) {
+        return 0;
+    }
+    if(reading > 1023) {
+        return 1023;
+    }
+    return reading;
+}
+
+void SY_init(SY_ATTRACTOR* attractor, int mdac_value, unsigned int seed) {
+    /**
+     * Start an attractor
+     *
+     * \param seed Picks the starting point and the noise added to the
+     * samples
+     */
+    attractor->seed = seed;
+    attractor->x = 0.1 + 0.01*SY_random(attractor);
+    attractor->v = 0;
+    attractor->a = 0;
+    attractor->damping = 0.6;
+    attractor->noise = 1.0;
+    SY_setMDAC(attractor, mdac_value);
+}
+
+void SY_setMDAC(SY_ATTRACTOR* attractor, int mdac_value) {
+    /**
+     * Change the gain the way the MDAC changes it on the unit
+     */
+    attractor->gain = 1.0 + mdac_value/4095.0*1.5;
+}
+
+void SY_generate(SY_ATTRACTOR* attractor, int* dst, int num_samples) {
+    /**
+     * Make packed samples, carrying on from the last call
+     *
+     * A trajectory that escapes is restarted near the origin, as the
+     * unit's rails would bring it back.
+     */
+    double x = attractor->x;
+    double v = attractor->v;
+    double a = attractor->a;
+
+    for(int i = 0; i < num_samples; i++) {
+        for(int k = 0; k < SY_STEPS_PER_SAMPLE; k++) {
+            double jerk = -attractor->damping*a - v - attractor->gain*(fabs(x) - 1);
+            x += v*SY_STEP;
+            v += a*SY_STEP;
+            a += jerk*SY_STEP;
+        }
+        if(fabs(x) > 5) {
+            x = 0.1;
+            v = 0;
+            a = 0;
+        }
+        double noise = attractor->noise/SY_SCALE;
+        dst[i] = DP_pack(SY_adc(x + noise*SY_random(attractor)),
+                         SY_adc(v + noise*SY_random(attractor)),
+                         SY_adc(a + noise*SY_random(attractor)));
+    }
+    attractor->x = x;
+    attractor->v = v;
+    attractor->a = a;
+}
@@ -0,0 +1,39 @@
+/**
+ * \file synth.h
+ * \brief Header file for synth.cpp
+ */
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdlib.h>
+#include <math.h>
+
+// integration steps between samples
+#define SY_STEPS_PER_SAMPLE 8
+#define SY_STEP 0.02
+// ADC counts per unit of the circuit's state
+#define SY_SCALE 150.0
+
+/**
+ * A model of the chaos unit's jerk circuit
+ *
+ * x''' = -damping x'' - x' - gain (|x| - 1), with the gain set by the
+ * MDAC value as on the real unit. The same seed and MDAC value always
+ * give the same samples.
+ */
+typedef struct {
+    double x;
+    double v;
+    double a;
+    double damping;
+    double gain;
+    double noise;
+    unsigned int seed;
+} SY_ATTRACTOR;
+
+void SY_init(SY_ATTRACTOR* attractor, int mdac_value, unsigned int seed);
+void SY_setMDAC(SY_ATTRACTOR* attractor, int mdac_value);
+void SY_generate(SY_ATTRACTOR* attractor, int* dst, int num_samples);
+
+#endif
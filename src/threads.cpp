@@ -0,0 +1,671 @@
+/**
+ * \file threads.cpp
+ * \brief Portable threading routines
+ */
+
+#include "threads.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+typedef struct {
+    TH_FUNCTION function;
+    void* arg;
+} TH_START;
+
+#ifdef _WIN32
+static DWORD WINAPI TH_run(LPVOID param) {
+#else
+static void* TH_run(void* param) {
+#endif
+    /** 
+     * Thread entry point, calls the function passed to TH_create
+     */
+    TH_START start = *(TH_START*)param;
+    free(param);
+    start.function(start.arg);
+    return 0;
+}
+
+int TH_create(TH_THREAD* thread, TH_FUNCTION function, void* arg) {
+    /** 
+     * Start a new thread running function(arg)
+     *
+     * Returns 0 on success
+     */
+    TH_START* start = (TH_START*)malloc(sizeof(TH_START));
+    if(!start) {
+        return -1;
+    }
+    start->function = function;
+    start->arg = arg;
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, TH_run, start, 0, NULL);
+    if(*thread == NULL) {
+        free(start);
+        return -1;
+    }
+#else
+    if(pthread_create(thread, NULL, TH_run, start)) {
+        free(start);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+int TH_join(TH_THREAD thread) {
+    /** 
+     * Wait for a thread to finish
+     */
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    return 0;
+#else
+    return pthread_join(thread, NULL);
+#endif
+}
+
+void TH_mutexInit(TH_MUTEX* mutex) {
+    /** 
+     * Initialize a mutex
+     *
+     * Mutexes are recursive on both platforms.
+     */
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+#endif
+}
+
+void TH_mutexDestroy(TH_MUTEX* mutex) {
+    /** 
+     * Destroy a mutex
+     */
+#ifdef _WIN32
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+void TH_lock(TH_MUTEX* mutex) {
+    /** 
+     * Lock a mutex
+     */
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+void TH_unlock(TH_MUTEX* mutex) {
+    /** 
+     * Unlock a mutex
+     */
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+void TH_condInit(TH_COND* cond) {
+    /** 
+     * Initialize a condition variable
+     */
+#ifdef _WIN32
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_init(cond, NULL);
+#endif
+}
+
+void TH_condDestroy(TH_COND* cond) {
+    /** 
+     * Destroy a condition variable
+     */
+#ifndef _WIN32
+    pthread_cond_destroy(cond);
+#endif
+}
+
+void TH_wait(TH_COND* cond, TH_MUTEX* mutex) {
+    /** 
+     * Wait on a condition variable
+     *
+     * mutex must be locked once by the caller
+     */
+#ifdef _WIN32
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+int TH_timedWait(TH_COND* cond, TH_MUTEX* mutex, int milliseconds) {
+    /** 
+     * Wait on a condition variable for at most a time
+     *
+     * \return 0 if woken, -1 if the time ran out
+     */
+#ifdef _WIN32
+    return SleepConditionVariableCS(cond, mutex, milliseconds) ? 0 : -1;
+#else
+    struct timeval now;
+    gettimeofday(&now, 0);
+    long long nanoseconds = (long long)now.tv_usec*1000 + (long long)milliseconds*1000000;
+    struct timespec until;
+    until.tv_sec = now.tv_sec + (time_t)(nanoseconds/1000000000);
+    until.tv_nsec = (long)(nanoseconds%1000000000);
+    return pthread_cond_timedwait(cond, mutex, &until) ? -1 : 0;
+#endif
+}
+
+void TH_signal(TH_COND* cond) {
+    /** 
+     * Wake one thread waiting on a condition variable
+     */
+#ifdef _WIN32
+    WakeConditionVariable(cond);
+#else
+    pthread_cond_signal(cond);
+#endif
+}
+
+void TH_broadcast(TH_COND* cond) {
+    /** 
+     * Wake every thread waiting on a condition variable
+     */
+#ifdef _WIN32
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+}
+
+void TH_spinLock(volatile int* lock) {
+    /** 
+     * Take a spin lock
+     *
+     * Spin locks need no initialization beyond being set to 0, so they
+     * can guard state that is set up before any mutex exists. Only use 
+     * them around short sections.
+     */
+    while(__sync_lock_test_and_set(lock, 1)) {
+        while(*lock) {
+#ifdef _WIN32
+            Sleep(0);
+#else
+            sched_yield();
+#endif
+        }
+    }
+}
+
+void TH_spinUnlock(volatile int* lock) {
+    /** 
+     * Release a spin lock
+     */
+    __sync_lock_release(lock);
+}
+
+int TH_atomicAdd(volatile int* value, int amount) {
+    /** 
+     * Atomically add to a value
+     *
+     * \return The new value
+     */
+    return __sync_add_and_fetch(value, amount);
+}
+
+int TH_atomicLoad(volatile int* value) {
+    /** 
+     * Read a value stored by another thread with TH_atomicStore
+     */
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+void TH_atomicStore(volatile int* value, int replacement) {
+    /** 
+     * Store a value for other threads
+     *
+     * Everything written before the call is visible to a thread that 
+     * reads the new value with TH_atomicLoad.
+     */
+    __atomic_store_n(value, replacement, __ATOMIC_RELEASE);
+}
+
+long long TH_atomicAdd64(volatile long long* value, long long amount) {
+    /** 
+     * Atomically add to a 64 bit value
+     *
+     * \return The new value
+     */
+    return __sync_add_and_fetch(value, amount);
+}
+
+long long TH_atomicLoad64(volatile long long* value) {
+    /** 
+     * Read a 64 bit value changed by other threads
+     */
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+void TH_atomicStore64(volatile long long* value, long long replacement) {
+    /** 
+     * Store a 64 bit value for other threads, see TH_atomicStore
+     */
+    __atomic_store_n(value, replacement, __ATOMIC_RELEASE);
+}
+
+void TH_fence() {
+    /** 
+     * Keep memory accesses from moving across the call either way
+     *
+     * Also orders plain accesses to memory shared with other processes.
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+bool TH_compareAndSwap64(volatile long long* value, long long expected, long long replacement) {
+    /** 
+     * Atomically replace a 64 bit value if it still holds expected
+     *
+     * \return true if the value was replaced
+     */
+    return __sync_bool_compare_and_swap(value, expected, replacement);
+}
+
+bool TH_compareAndSwap(volatile int* value, int expected, int replacement) {
+    /** 
+     * Atomically replace a value if it still holds expected
+     *
+     * \return true if the value was replaced
+     */
+    return __sync_bool_compare_and_swap(value, expected, replacement);
+}
+
+void* TH_loadPointer(void* volatile* pointer) {
+    /** 
+     * Read a pointer written by another thread
+     *
+     * Everything written before the pointer was stored is visible once
+     * this returns.
+     */
+    return __atomic_load_n(pointer, __ATOMIC_ACQUIRE);
+}
+
+void* TH_exchangePointer(void* volatile* pointer, void* value) {
+    /** 
+     * Store a pointer for other threads and return the old one
+     *
+     * Everything written before the call is visible to a thread that 
+     * reads the new pointer with TH_loadPointer.
+     */
+    return __atomic_exchange_n(pointer, value, __ATOMIC_ACQ_REL);
+}
+
+bool TH_compareAndSwapPointer(void* volatile* pointer, void* expected, void* replacement) {
+    /** 
+     * Store a pointer for other threads if it still holds expected
+     *
+     * \return true if the pointer was replaced, it is then published as 
+     * by TH_exchangePointer
+     */
+    return __atomic_compare_exchange_n(pointer, &expected, replacement, false, 
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+int TH_numCores() {
+    /** 
+     * Returns the number of processors available
+     */
+    int cores;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    cores = (int)info.dwNumberOfProcessors;
+#else
+    cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if(cores < 1) {
+        cores = 1;
+    }
+    if(cores > TH_MAX_THREADS) {
+        cores = TH_MAX_THREADS;
+    }
+    return cores;
+}
+
+typedef struct {
+    TH_RANGE_FUNCTION function;
+    void* arg;
+    int chunk;
+    int begin;
+    int end;
+} TH_RANGE;
+
+static void TH_runRange(void* param) {
+    /** 
+     * Thread entry point for TH_parallelFor
+     */
+    TH_RANGE* range = (TH_RANGE*)param;
+    range->function(range->arg, range->chunk, range->begin, range->end);
+}
+
+int TH_parallelFor(int count, TH_RANGE_FUNCTION function, void* arg, int num_chunks) {
+    /** 
+     * Split [0, count) into num_chunks ranges and run them in parallel
+     *
+     * \param function Called as function(arg, chunk, begin, end) once per
+     * chunk. Chunk numbers run from 0 to num_chunks-1 so the caller can 
+     * give each one its own accumulator.
+     * \param num_chunks Number of threads to use, 0 for one per core
+     *
+     * The calling thread runs the first chunk. Returns the number of 
+     * chunks used.
+     */
+    TH_THREAD threads[TH_MAX_THREADS];
+    TH_RANGE ranges[TH_MAX_THREADS];
+    int started[TH_MAX_THREADS];
+    
+    if(num_chunks <= 0) {
+        num_chunks = TH_numCores();
+    }
+    if(num_chunks > TH_MAX_THREADS) {
+        num_chunks = TH_MAX_THREADS;
+    }
+    if(num_chunks > count) {
+        num_chunks = count;
+    }
+    if(num_chunks < 1) {
+        return 0;
+    }
+    
+    for(int i = 0; i < num_chunks; i++) {
+        ranges[i].function = function;
+        ranges[i].arg = arg;
+        ranges[i].chunk = i;
+        ranges[i].begin = (int)(((long long)count*i)/num_chunks);
+        ranges[i].end = (int)(((long long)count*(i + 1))/num_chunks);
+        started[i] = 0;
+    }
+    
+    for(int i = 1; i < num_chunks; i++) {
+        started[i] = (TH_create(&threads[i], TH_runRange, &ranges[i]) == 0);
+        if(!started[i]) {
+            // out of threads, do it here instead
+            TH_runRange(&ranges[i]);
+        }
+    }
+    TH_runRange(&ranges[0]);
+    for(int i = 1; i < num_chunks; i++) {
+        if(started[i]) {
+            TH_join(threads[i]);
+        }
+    }
+    return num_chunks;
+}
+
+double TH_seconds() {
+    /** 
+     * Returns a time in seconds for measuring intervals
+     */
+#ifdef _WIN32
+    LARGE_INTEGER frequency, count;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart/(double)frequency.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec*1e-9;
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec*1e-6;
+#endif
+}
+
+long long TH_nanoseconds() {
+    /** 
+     * Returns a time in nanoseconds for timing short intervals
+     */
+#ifdef _WIN32
+    static LARGE_INTEGER frequency = {0};
+    LARGE_INTEGER count;
+    if(!frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&count);
+    return (long long)((double)count.QuadPart*1e9/(double)frequency.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec*1000000000LL + now.tv_nsec;
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (long long)now.tv_sec*1000000000LL + now.tv_usec*1000LL;
+#endif
+}
+
+void TH_sleep(int milliseconds) {
+    /** 
+     * Sleep the calling thread
+     */
+#ifdef _WIN32
+    Sleep(milliseconds);
+#else
+    usleep(milliseconds*1000);
+#endif
+}
+
+/* Work stealing pool */
+
+// the pool and worker number of the current thread, if it is a worker
+static __thread TH_POOL* TH_CURRENT_POOL = 0;
+static __thread int TH_CURRENT_WORKER = 0;
+
+typedef struct {
+    TH_POOL* pool;
+    int worker;
+} TH_WORKER;
+
+static int TH_push(TH_DEQUE* deque, TH_FUNCTION function, void* arg) {
+    /** 
+     * Add a task at the newest end of a deque
+     */
+    TH_lock(&deque->lock);
+    if(deque->count == deque->capacity) {
+        int capacity = deque->capacity ? deque->capacity*2 : 64;
+        TH_TASK* tasks = (TH_TASK*)malloc(capacity*sizeof(TH_TASK));
+        if(!tasks) {
+            TH_unlock(&deque->lock);
+            return -1;
+        }
+        for(int i = 0; i < deque->count; i++) {
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->head = 0;
+    }
+    TH_TASK* task = &deque->tasks[(deque->head + deque->count) % deque->capacity];
+    task->function = function;
+    task->arg = arg;
+    deque->count++;
+    TH_unlock(&deque->lock);
+    return 0;
+}
+
+static int TH_pop(TH_DEQUE* deque, TH_TASK* task, bool newest) {
+    /** 
+     * Take the newest or oldest task from a deque
+     *
+     * Returns 0 if the deque was empty
+     */
+    int found = 0;
+    TH_lock(&deque->lock);
+    if(deque->count) {
+        if(newest) {
+            *task = deque->tasks[(deque->head + deque->count - 1) % deque->capacity];
+        } else {
+            *task = deque->tasks[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+        }
+        deque->count--;
+        found = 1;
+    }
+    TH_unlock(&deque->lock);
+    return found;
+}
+
+static int TH_findTask(TH_POOL* pool, int worker, TH_TASK* task) {
+    /** 
+     * Take a task from a worker's own deque, or steal one
+     */
+    if(TH_pop(&pool->queues[worker], task, true)) {
+        return 1;
+    }
+    for(int i = 1; i < pool->num_workers; i++) {
+        if(TH_pop(&pool->queues[(worker + i) % pool->num_workers], task, false)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void TH_workerLoop(void* arg) {
+    /** 
+     * Run tasks until the pool is destroyed
+     */
+    TH_WORKER* start = (TH_WORKER*)arg;
+    TH_POOL* pool = start->pool;
+    int worker = start->worker;
+    free(start);
+    TH_CURRENT_POOL = pool;
+    TH_CURRENT_WORKER = worker;
+    
+    TH_TASK task;
+    for(;;) {
+        if(TH_findTask(pool, worker, &task)) {
+            TH_atomicAdd(&pool->pending, -1);
+            task.function(task.arg);
+            continue;
+        }
+        TH_lock(&pool->lock);
+        while(!TH_atomicAdd(&pool->pending, 0) && !pool->stop) {
+            TH_wait(&pool->wake, &pool->lock);
+        }
+        int stop = pool->stop;
+        TH_unlock(&pool->lock);
+        if(stop) {
+            return;
+        }
+    }
+}
+
+int TH_poolCreate(TH_POOL* pool, int num_workers) {
+    /** 
+     * Start the workers of a pool
+     *
+     * \param num_workers 0 for one per core
+     *
+     * Returns 0 on success
+     */
+    memset(pool, 0, sizeof(TH_POOL));
+    if(num_workers <= 0) {
+        num_workers = TH_numCores();
+    }
+    if(num_workers > TH_MAX_THREADS) {
+        num_workers = TH_MAX_THREADS;
+    }
+    TH_mutexInit(&pool->lock);
+    TH_condInit(&pool->wake);
+    for(int i = 0; i < TH_MAX_THREADS; i++) {
+        TH_mutexInit(&pool->queues[i].lock);
+    }
+    pool->num_workers = num_workers;
+    
+    for(int i = 0; i < num_workers; i++) {
+        TH_WORKER* start = (TH_WORKER*)malloc(sizeof(TH_WORKER));
+        if(start) {
+            start->pool = pool;
+            start->worker = i;
+        }
+        if(!start || TH_create(&pool->threads[i], TH_workerLoop, start)) {
+            free(start);
+            // keep the workers that did start
+            pool->num_workers = i;
+            break;
+        }
+    }
+    if(!pool->num_workers) {
+        TH_poolDestroy(pool);
+        return -1;
+    }
+    return 0;
+}
+
+void TH_poolDestroy(TH_POOL* pool) {
+    /** 
+     * Stop the workers and free the pool
+     *
+     * Tasks still queued are not run.
+     */
+    TH_lock(&pool->lock);
+    pool->stop = 1;
+    TH_broadcast(&pool->wake);
+    TH_unlock(&pool->lock);
+    for(int i = 0; i < pool->num_workers; i++) {
+        TH_join(pool->threads[i]);
+    }
+    for(int i = 0; i < TH_MAX_THREADS; i++) {
+        free(pool->queues[i].tasks);
+        TH_mutexDestroy(&pool->queues[i].lock);
+    }
+    TH_condDestroy(&pool->wake);
+    TH_mutexDestroy(&pool->lock);
+    memset(pool, 0, sizeof(TH_POOL));
+}
+
+int TH_poolSubmit(TH_POOL* pool, TH_FUNCTION function, void* arg) {
+    /** 
+     * Queue function(arg) to run on a worker
+     *
+     * A task submitted from a worker goes on that worker's own deque so 
+     * related work stays on one core until another worker steals it.
+     *
+     * Returns 0 on success
+     */
+    int worker;
+    if(TH_CURRENT_POOL == pool) {
+        worker = TH_CURRENT_WORKER;
+    } else {
+        worker = (TH_atomicAdd(&pool->next, 1) & 0x7fffffff) % pool->num_workers;
+    }
+    if(TH_push(&pool->queues[worker], function, arg)) {
+        return -1;
+    }
+    TH_lock(&pool->lock);
+    TH_atomicAdd(&pool->pending, 1);
+    TH_signal(&pool->wake);
+    TH_unlock(&pool->lock);
+    return 0;
+}
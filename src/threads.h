@@ -0,0 +1,96 @@
+/**
+ * \file threads.h
+ * \brief Header file for threads.cpp
+ *
+ * Thin wrappers over Win32 threads and pthreads so the rest of the 
+ * library does not need to care which one it is built with.
+ */
+
+#ifndef THREADS_H
+#define THREADS_H
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE TH_THREAD;
+typedef CRITICAL_SECTION TH_MUTEX;
+typedef CONDITION_VARIABLE TH_COND;
+#else
+#include <pthread.h>
+typedef pthread_t TH_THREAD;
+typedef pthread_mutex_t TH_MUTEX;
+typedef pthread_cond_t TH_COND;
+#endif
+
+#define TH_MAX_THREADS 64
+
+typedef void (*TH_FUNCTION)(void* arg);
+typedef void (*TH_RANGE_FUNCTION)(void* arg, int chunk, int begin, int end);
+
+typedef struct {
+    TH_FUNCTION function;
+    void* arg;
+} TH_TASK;
+
+/**
+ * Tasks queued on one worker of a pool
+ *
+ * The owner takes the newest task, thieves take the oldest.
+ */
+typedef struct {
+    TH_MUTEX lock;
+    TH_TASK* tasks;
+    int capacity;
+    int head;
+    int count;
+} TH_DEQUE;
+
+/**
+ * Fixed set of worker threads that steal work from each other
+ */
+typedef struct TH_POOL {
+    TH_THREAD threads[TH_MAX_THREADS];
+    TH_DEQUE queues[TH_MAX_THREADS];
+    int num_workers;
+    TH_MUTEX lock;
+    TH_COND wake;
+    volatile int pending;
+    volatile int next;
+    int stop;
+} TH_POOL;
+
+int TH_create(TH_THREAD* thread, TH_FUNCTION function, void* arg);
+int TH_join(TH_THREAD thread);
+void TH_mutexInit(TH_MUTEX* mutex);
+void TH_mutexDestroy(TH_MUTEX* mutex);
+void TH_lock(TH_MUTEX* mutex);
+void TH_unlock(TH_MUTEX* mutex);
+void TH_condInit(TH_COND* cond);
+void TH_condDestroy(TH_COND* cond);
+void TH_wait(TH_COND* cond, TH_MUTEX* mutex);
+int TH_timedWait(TH_COND* cond, TH_MUTEX* mutex, int milliseconds);
+void TH_signal(TH_COND* cond);
+void TH_broadcast(TH_COND* cond);
+void TH_spinLock(volatile int* lock);
+void TH_spinUnlock(volatile int* lock);
+int TH_atomicAdd(volatile int* value, int amount);
+int TH_atomicLoad(volatile int* value);
+void TH_atomicStore(volatile int* value, int replacement);
+bool TH_compareAndSwap(volatile int* value, int expected, int replacement);
+long long TH_atomicAdd64(volatile long long* value, long long amount);
+long long TH_atomicLoad64(volatile long long* value);
+void TH_atomicStore64(volatile long long* value, long long replacement);
+void TH_fence();
+bool TH_compareAndSwap64(volatile long long* value, long long expected, long long replacement);
+void* TH_loadPointer(void* volatile* pointer);
+void* TH_exchangePointer(void* volatile* pointer, void* value);
+bool TH_compareAndSwapPointer(void* volatile* pointer, void* expected, void* replacement);
+int TH_numCores();
+double TH_seconds();
+long long TH_nanoseconds();
+void TH_sleep(int milliseconds);
+int TH_poolCreate(TH_POOL* pool, int num_workers);
+void TH_poolDestroy(TH_POOL* pool);
+int TH_poolSubmit(TH_POOL* pool, TH_FUNCTION function, void* arg);
+int TH_parallelFor(int count, TH_RANGE_FUNCTION function, void* arg, int num_chunks);
+
+#endif
@@ -0,0 +1,298 @@
+/**
+ * \file trace.cpp
+ * \brief Routines for timing the stages of a capture
+ *
+ * Timers are placed with TRACE_SCOPE. When tracing is on, each timer
+ * adds its time to a histogram for its stage, and can also be kept as
+ * an event and written out in the Chrome trace format, which Perfetto
+ * and chrome://tracing can open.
+ */
+
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+volatile int TRACE_FLAGS = TRACE_OFF;
+
+TRACE_HISTOGRAM TRACE_STAGES[TRACE_NUM_STAGES];
+
+// allocated the first time events are turned on and kept after that
+TRACE_EVENT* volatile TRACE_BUFFER = 0;
+volatile int TRACE_NUM_EVENTS = 0;
+volatile int TRACE_DROPPED = 0;
+volatile int TRACE_NEXT_THREAD = 0;
+long long TRACE_EPOCH = 0;
+
+// guards turning tracing on and off
+volatile int TRACE_LOCK = 0;
+
+static __thread int TRACE_THREAD = 0;
+
+static const char* TRACE_NAMES[TRACE_NUM_STAGES] = {
+    "plot",
+    "sweep part",
+    "usb write",
+    "usb read",
+    "transient",
+    "sample",
+    "decode",
+    "trigger",
+    "fft",
+    "return map",
+    "peaks",
+    "csv",
+    "publish",
+    "stft"
+};
+
+static int TRACE_bucket(long long duration) {
+    /**
+     * Histogram bucket for a time in nanoseconds
+     */
+    int bucket = 0;
+    while(duration > 1 && bucket < TRACE_NUM_BUCKETS - 1) {
+        duration >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void TRACE_clearHistogram(TRACE_HISTOGRAM* histogram) {
+    /**
+     * Empty a histogram
+     */
+    memset((void*)histogram, 0, sizeof(TRACE_HISTOGRAM));
+    histogram->min = -1;
+}
+
+void TRACE_record(int stage, long long start, long long end) {
+    /**
+     * Add a timed scope to its stage, called by TRACE_TIMER
+     *
+     * Any thread may call this. Nothing is locked, so the numbers of a
+     * stage may be out of step with each other while it is being timed.
+     */
+    int flags = TRACE_FLAGS;
+    long long duration = end - start;
+    if(duration < 0) {
+        duration = 0;
+    }
+
+    if(flags & TRACE_HISTOGRAMS) {
+        TRACE_HISTOGRAM* histogram = &TRACE_STAGES[stage];
+        TH_atomicAdd64(&histogram->count, 1);
+        TH_atomicAdd64(&histogram->total, duration);
+        TH_atomicAdd64(&histogram->buckets[TRACE_bucket(duration)], 1);
+        long long min;
+        while(((min = TH_atomicLoad64(&histogram->min)) < 0 || duration < min) &&
+              !TH_compareAndSwap64(&histogram->min, min, duration)) {
+        }
+        long long max;
+        while(duration > (max = TH_atomicLoad64(&histogram->max)) &&
+              !TH_compareAndSwap64(&histogram->max, max, duration)) {
+        }
+    }
+
+    TRACE_EVENT* buffer = (TRACE_EVENT*)TH_loadPointer((void* volatile*)&TRACE_BUFFER);
+    if((flags & TRACE_EVENTS) && buffer) {
+        int index = TH_atomicAdd(&TRACE_NUM_EVENTS, 1) - 1;
+        if(index >= TRACE_MAX_EVENTS) {
+            TH_atomicAdd(&TRACE_DROPPED, 1);
+            return;
+        }
+        if(!TRACE_THREAD) {
+            TRACE_THREAD = TH_atomicAdd(&TRACE_NEXT_THREAD, 1);
+        }
+        TRACE_EVENT* event = &buffer[index];
+        event->stage = stage;
+        event->thread = TRACE_THREAD;
+        event->start = start - TRACE_EPOCH;
+        event->duration = duration;
+        TH_atomicStore(&event->done, 1);
+    }
+}
+
+void TRACE_setFlags(int flags) {
+    /**
+     * Choose what is recorded
+     *
+     * \param flags TRACE_OFF, or TRACE_HISTOGRAMS and/or TRACE_EVENTS
+     *
+     * Events are kept until TRACE_MAX_EVENTS have been recorded, later
+     * ones are counted as dropped. Turning tracing on does not clear
+     * what was recorded before.
+     */
+    TH_spinLock(&TRACE_LOCK);
+    if(!TRACE_EPOCH) {
+        for(int i = 0; i < TRACE_NUM_STAGES; i++) {
+            TRACE_clearHistogram(&TRACE_STAGES[i]);
+        }
+        TRACE_EPOCH = TH_nanoseconds();
+    }
+    if((flags & TRACE_EVENTS) && !TRACE_BUFFER) {
+        TRACE_EVENT* buffer = (TRACE_EVENT*)calloc(TRACE_MAX_EVENTS, sizeof(TRACE_EVENT));
+        if(buffer) {
+            TH_exchangePointer((void* volatile*)&TRACE_BUFFER, buffer);
+        } else {
+            flags &= ~TRACE_EVENTS;
+        }
+    }
+    TH_atomicStore(&TRACE_FLAGS, flags);
+    TH_spinUnlock(&TRACE_LOCK);
+}
+
+int TRACE_getFlags() {
+    /**
+     * Returns what is being recorded
+     */
+    return TH_atomicLoad(&TRACE_FLAGS);
+}
+
+void TRACE_reset() {
+    /**
+     * Throw away everything recorded so far
+     *
+     * Scopes that are being timed while this runs may be partly kept.
+     */
+    TH_spinLock(&TRACE_LOCK);
+    for(int i = 0; i < TRACE_NUM_STAGES; i++) {
+        TRACE_clearHistogram(&TRACE_STAGES[i]);
+    }
+    if(TRACE_BUFFER) {
+        int count = TH_atomicLoad(&TRACE_NUM_EVENTS);
+        if(count > TRACE_MAX_EVENTS) {
+            count = TRACE_MAX_EVENTS;
+        }
+        for(int i = 0; i < count; i++) {
+            TH_atomicStore(&TRACE_BUFFER[i].done, 0);
+        }
+    }
+    TH_atomicStore(&TRACE_NUM_EVENTS, 0);
+    TH_atomicStore(&TRACE_DROPPED, 0);
+    TRACE_EPOCH = TH_nanoseconds();
+    TH_spinUnlock(&TRACE_LOCK);
+}
+
+const char* TRACE_getName(int stage) {
+    /**
+     * Returns the name of a stage, or 0 if there is no such stage
+     */
+    if(stage < 0 || stage >= TRACE_NUM_STAGES) {
+        return 0;
+    }
+    return TRACE_NAMES[stage];
+}
+
+int TRACE_getHistogram(int stage, TRACE_HISTOGRAM* histogram) {
+    /**
+     * Copy the times recorded for a stage
+     *
+     * min is -1 if the stage has not been timed. Returns -1 if there is
+     * no such stage.
+     */
+    if(stage < 0 || stage >= TRACE_NUM_STAGES) {
+        return -1;
+    }
+    TRACE_HISTOGRAM* source = &TRACE_STAGES[stage];
+    histogram->count = TH_atomicLoad64(&source->count);
+    histogram->total = TH_atomicLoad64(&source->total);
+    histogram->min = TRACE_EPOCH ? TH_atomicLoad64(&source->min) : -1;
+    histogram->max = TH_atomicLoad64(&source->max);
+    for(int i = 0; i < TRACE_NUM_BUCKETS; i++) {
+        histogram->buckets[i] = TH_atomicLoad64(&source->buckets[i]);
+    }
+    return 0;
+}
+
+long long TRACE_getPercentile(int stage, double fraction) {
+    /**
+     * Estimate the time below which a fraction of a stage's scopes took
+     *
+     * The answer is the top of the histogram bucket the percentile falls
+     * in, so it may be up to twice the true time. Returns -1 if the stage
+     * has not been timed.
+     */
+    TRACE_HISTOGRAM histogram;
+    if(TRACE_getHistogram(stage, &histogram) || !histogram.count) {
+        return -1;
+    }
+    long long wanted = (long long)(fraction*histogram.count + 0.5);
+    long long seen = 0;
+    long long result = histogram.max;
+    for(int i = 0; i < TRACE_NUM_BUCKETS; i++) {
+        seen += histogram.buckets[i];
+        if(seen >= wanted && histogram.buckets[i]) {
+            result = 2LL << i;
+            break;
+        }
+    }
+    if(result > histogram.max) {
+        result = histogram.max;
+    }
+    if(result < histogram.min) {
+        result = histogram.min;
+    }
+    return result;
+}
+
+int TRACE_getDroppedEvents() {
+    /**
+     * Returns the number of events lost because the buffer was full
+     */
+    return TH_atomicLoad(&TRACE_DROPPED);
+}
+
+int TRACE_writeSummary(FILE* file) {
+    /**
+     * Write a table of the times of every stage that has been timed
+     *
+     * Times are in microseconds except the total, which is in
+     * milliseconds.
+     */
+    fprintf(file, "%-12s %10s %12s %10s %10s %10s %10s %10s %10s\n", "stage", "count",
+            "total_ms", "mean_us", "min_us", "p50_us", "p90_us", "p99_us", "max_us");
+    for(int i = 0; i < TRACE_NUM_STAGES; i++) {
+        TRACE_HISTOGRAM histogram;
+        TRACE_getHistogram(i, &histogram);
+        if(!histogram.count) {
+            continue;
+        }
+        fprintf(file, "%-12s %10lld %12.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+                TRACE_NAMES[i], histogram.count, histogram.total*1e-6,
+                histogram.total*1e-3/histogram.count, histogram.min*1e-3,
+                TRACE_getPercentile(i, 0.5)*1e-3, TRACE_getPercentile(i, 0.9)*1e-3,
+                TRACE_getPercentile(i, 0.99)*1e-3, histogram.max*1e-3);
+    }
+    return 0;
+}
+
+int TRACE_writeEvents(FILE* file) {
+    /**
+     * Write the recorded events as a Chrome trace
+     *
+     * Events still being filled in are left out. Returns the number of
+     * events written.
+     */
+    int count = TH_atomicLoad(&TRACE_NUM_EVENTS);
+    if(count > TRACE_MAX_EVENTS) {
+        count = TRACE_MAX_EVENTS;
+    }
+    TRACE_EVENT* buffer = (TRACE_EVENT*)TH_loadPointer((void* volatile*)&TRACE_BUFFER);
+    int written = 0;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for(int i = 0; buffer && i < count; i++) {
+        TRACE_EVENT* event = &buffer[i];
+        if(!TH_atomicLoad(&event->done)) {
+            continue;
+        }
+        fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"libchaos\",\"ph\":\"X\","
+                "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                written ? ",\n" : "", TRACE_NAMES[event->stage],
+                event->start*1e-3, event->duration*1e-3, event->thread);
+        written++;
+    }
+    fprintf(file, "\n]}\n");
+    return written;
+}
@@ -0,0 +1,101 @@
+/**
+ * \file trace.h
+ * \brief Header file for trace.cpp
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include "libchaos.h"
+#include "threads.h"
+
+/* what is recorded, the same values as the public ones */
+#define TRACE_OFF 0
+#define TRACE_HISTOGRAMS 1
+#define TRACE_EVENTS 2
+
+/* stages that are timed */
+#define TRACE_PLOT 0
+#define TRACE_SWEEP_PART 1
+#define TRACE_USB_WRITE 2
+#define TRACE_USB_READ 3
+#define TRACE_TRANSIENT 4
+#define TRACE_SAMPLE 5
+#define TRACE_DECODE 6
+#define TRACE_TRIGGER 7
+#define TRACE_FFT 8
+#define TRACE_RETURN_MAP 9
+#define TRACE_PEAKS 10
+#define TRACE_CSV 11
+#define TRACE_PUBLISH 12
+#define TRACE_STFT 13
+#define TRACE_NUM_STAGES 14
+
+// bucket i holds times from 2^i up to 2^(i+1) nanoseconds
+#define TRACE_NUM_BUCKETS 40
+#define TRACE_MAX_EVENTS (1 << 18)
+
+extern volatile int TRACE_FLAGS;
+
+/**
+ * Times taken by one stage, in nanoseconds
+ */
+typedef struct {
+    volatile long long count;
+    volatile long long total;
+    volatile long long min;
+    volatile long long max;
+    volatile long long buckets[TRACE_NUM_BUCKETS];
+} TRACE_HISTOGRAM;
+
+/**
+ * One timed scope, written out as a trace event
+ *
+ * done is set once the rest of the event has been filled in.
+ */
+typedef struct {
+    volatile int done;
+    short stage;
+    short thread;
+    long long start;
+    long long duration;
+} TRACE_EVENT;
+
+void TRACE_record(int stage, long long start, long long end);
+
+/**
+ * Times the scope it is declared in
+ *
+ * When tracing is off this costs a load and a branch.
+ */
+class TRACE_TIMER {
+public:
+    TRACE_TIMER(int stage) : stage(stage), start(TRACE_FLAGS ? TH_nanoseconds() : -1) {}
+    ~TRACE_TIMER() { if(start >= 0) TRACE_record(stage, start, TH_nanoseconds()); }
+private:
+    int stage;
+    long long start;
+};
+
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+
+// define LIBCHAOS_NO_TRACE to leave the timers out of the build
+#ifdef LIBCHAOS_NO_TRACE
+#define TRACE_SCOPE(stage)
+#else
+#define TRACE_SCOPE(stage) TRACE_TIMER TRACE_JOIN(trace_timer_, __LINE__)(stage)
+#endif
+
+void TRACE_setFlags(int flags);
+int TRACE_getFlags();
+void TRACE_reset();
+const char* TRACE_getName(int stage);
+int TRACE_getHistogram(int stage, TRACE_HISTOGRAM* histogram);
+long long TRACE_getPercentile(int stage, double fraction);
+int TRACE_getDroppedEvents();
+int TRACE_writeSummary(FILE* file);
+int TRACE_writeEvents(FILE* file);
+
+#endif
@@ -0,0 +1,363 @@
+/**
+ * \file trigger.cpp
+ * \brief Routines for finding trigger points in sample data
+ *
+ * The searches work directly on the packed samples returned by the 
+ * device. Where SSE2 is available four samples are decoded and compared
+ * at a time.
+ */
+
+#include "trigger.h"
+#include "data_processing.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// bit position of each channel in a packed sample
+static const int TR_SHIFT[4] = {0, 2, 12, 22};
+
+static inline int TR_channel(int sample, int shift) {
+    return (int)(((unsigned int)sample >> shift) & 0x3FF);
+}
+
+static inline int TR_quality(int distance, int tolerance) {
+    if(tolerance < 1) {
+        tolerance = 1;
+    }
+    if(distance >= tolerance) {
+        return 0;
+    }
+    return 100 - (distance*100)/tolerance;
+}
+
+#ifdef __SSE2__
+static inline __m128i TR_decode4(const int* samples, int shift) {
+    __m128i v = _mm_loadu_si128((const __m128i*)samples);
+    return _mm_and_si128(_mm_srl_epi32(v, _mm_cvtsi32_si128(shift)), 
+                         _mm_set1_epi32(0x3FF));
+}
+
+static inline int TR_firstBit(int mask) {
+    return __builtin_ctz(mask);
+}
+#endif
+
+static int TR_findBelow(int* samples, int shift, int start, int end, int level) {
+    /** 
+     * Returns the first index in [start, end) whose value is below level
+     */
+    int i = start;
+#ifdef __SSE2__
+    __m128i l = _mm_set1_epi32(level);
+    for(; i + 4 <= end; i += 4) {
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmplt_epi32(TR_decode4(samples + i, shift), l)));
+        if(mask) {
+            return i + TR_firstBit(mask);
+        }
+    }
+#endif
+    for(; i < end; i++) {
+        if(TR_channel(samples[i], shift) < level) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int TR_findAbove(int* samples, int shift, int start, int end, int level) {
+    /** 
+     * Returns the first index in [start, end) whose value is above level
+     */
+    int i = start;
+#ifdef __SSE2__
+    __m128i l = _mm_set1_epi32(level);
+    for(; i + 4 <= end; i += 4) {
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpgt_epi32(TR_decode4(samples + i, shift), l)));
+        if(mask) {
+            return i + TR_firstBit(mask);
+        }
+    }
+#endif
+    for(; i < end; i++) {
+        if(TR_channel(samples[i], shift) > level) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int TR_findCrossing(int* samples, int shift, int start, int end, int level, int edge) {
+    /** 
+     * Returns the first index i in [start, end) where the signal crosses
+     * level between i-1 and i. start must be at least 1.
+     */
+    int i = start;
+#ifdef __SSE2__
+    __m128i l = _mm_set1_epi32(level);
+    for(; i + 4 <= end; i += 4) {
+        __m128i prev = TR_decode4(samples + i - 1, shift);
+        __m128i cur = TR_decode4(samples + i, shift);
+        __m128i mask = _mm_setzero_si128();
+        if(edge & TR_RISING) {
+            // prev < level <= cur
+            mask = _mm_or_si128(mask, _mm_andnot_si128(_mm_cmplt_epi32(cur, l),
+                                                       _mm_cmplt_epi32(prev, l)));
+        }
+        if(edge & TR_FALLING) {
+            // prev >= level > cur
+            mask = _mm_or_si128(mask, _mm_andnot_si128(_mm_cmplt_epi32(prev, l),
+                                                       _mm_cmplt_epi32(cur, l)));
+        }
+        int bits = _mm_movemask_ps(_mm_castsi128_ps(mask));
+        if(bits) {
+            return i + TR_firstBit(bits);
+        }
+    }
+#endif
+    for(; i < end; i++) {
+        int prev = TR_channel(samples[i-1], shift);
+        int cur = TR_channel(samples[i], shift);
+        if((edge & TR_RISING) && prev < level && cur >= level) {
+            return i;
+        }
+        if((edge & TR_FALLING) && prev >= level && cur < level) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline int TR_distance2(TR_TRIGGER* trigger, int sample) {
+    int dx = DP_getX1(sample) - trigger->target[0];
+    int dy = DP_getX2(sample) - trigger->target[1];
+    int d = dx*dx + dy*dy;
+    if(trigger->target[2] >= 0) {
+        int dz = DP_getX3(sample) - trigger->target[2];
+        d += dz*dz;
+    }
+    return d;
+}
+
+static int TR_findNear(TR_TRIGGER* trigger, int* samples, int start, int end, 
+                       int radius2, int* best_index, int* best_distance2) {
+    /** 
+     * Returns the first index in [start, end) within the trigger radius
+     *
+     * The closest sample seen during the scan is also returned so that a
+     * failed search can still report how near it came.
+     */
+    int i = start;
+    int best = 0x7FFFFFFF;
+    int best_i = -1;
+#ifdef __SSE2__
+    // x1 and x2 differences share a lane as two 16 bit halves so that 
+    // one multiply-add gives dx*dx + dy*dy
+    __m128i t1 = _mm_set1_epi32(trigger->target[0]);
+    __m128i t2 = _mm_set1_epi32(trigger->target[1]);
+    __m128i t3 = _mm_set1_epi32(trigger->target[2]);
+    __m128i low = _mm_set1_epi32(0xFFFF);
+    __m128i r2 = _mm_set1_epi32(radius2 + 1);
+    __m128i vbest = _mm_set1_epi32(0x7FFFFFFF);
+    __m128i vbest_i = _mm_set1_epi32(-1);
+    __m128i vi = _mm_setr_epi32(i, i+1, i+2, i+3);
+    __m128i four = _mm_set1_epi32(4);
+    int use_x3 = trigger->target[2] >= 0;
+    for(; i + 4 <= end; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(samples + i));
+        __m128i dx = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(v, 2), _mm_set1_epi32(0x3FF)), t1);
+        __m128i dy = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(v, 12), _mm_set1_epi32(0x3FF)), t2);
+        __m128i xy = _mm_or_si128(_mm_and_si128(dx, low), _mm_slli_epi32(dy, 16));
+        __m128i d = _mm_madd_epi16(xy, xy);
+        if(use_x3) {
+            __m128i dz = _mm_and_si128(_mm_sub_epi32(_mm_srli_epi32(v, 22), t3), low);
+            d = _mm_add_epi32(d, _mm_madd_epi16(dz, dz));
+        }
+        // keep the per lane minimum
+        __m128i better = _mm_cmplt_epi32(d, vbest);
+        vbest = _mm_or_si128(_mm_and_si128(better, d), _mm_andnot_si128(better, vbest));
+        vbest_i = _mm_or_si128(_mm_and_si128(better, vi), _mm_andnot_si128(better, vbest_i));
+        vi = _mm_add_epi32(vi, four);
+        
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(d, r2)));
+        if(mask) {
+            i += TR_firstBit(mask);
+            *best_index = i;
+            *best_distance2 = TR_distance2(trigger, samples[i]);
+            return i;
+        }
+    }
+    int lane_best[4], lane_i[4];
+    _mm_storeu_si128((__m128i*)lane_best, vbest);
+    _mm_storeu_si128((__m128i*)lane_i, vbest_i);
+    for(int k = 0; k < 4; k++) {
+        if(lane_i[k] >= 0 && lane_best[k] < best) {
+            best = lane_best[k];
+            best_i = lane_i[k];
+        }
+    }
+#endif
+    for(; i < end; i++) {
+        int d = TR_distance2(trigger, samples[i]);
+        if(d < best) {
+            best = d;
+            best_i = i;
+        }
+        if(d <= radius2) {
+            *best_index = i;
+            *best_distance2 = d;
+            return i;
+        }
+    }
+    *best_index = best_i;
+    *best_distance2 = best;
+    return -1;
+}
+
+void TR_setLevel(TR_TRIGGER* trigger, int channel, int level, int edge) {
+    /** 
+     * Trigger when a channel crosses a level
+     */
+    trigger->mode = TR_LEVEL;
+    trigger->channel = channel;
+    trigger->level = level;
+    trigger->edge = edge;
+    trigger->hysteresis = 0;
+}
+
+void TR_setHysteresis(TR_TRIGGER* trigger, int channel, int level, int edge, int hysteresis) {
+    /** 
+     * Trigger when a channel crosses a level after first moving at least
+     * hysteresis away from it on the other side
+     *
+     * This ignores noise around the level. TR_EITHER is treated as 
+     * TR_RISING.
+     */
+    trigger->mode = TR_HYSTERESIS;
+    trigger->channel = channel;
+    trigger->level = level;
+    trigger->edge = edge;
+    trigger->hysteresis = hysteresis;
+}
+
+void TR_setPhase(TR_TRIGGER* trigger, int x1, int x2, int x3, int radius, int auto_seed) {
+    /** 
+     * Trigger where the trajectory comes near a point in phase space
+     *
+     * \param x3 Pass -1 to only compare x1 and x2
+     * \param radius Largest distance accepted as a match
+     * \param auto_seed Pick a new point when no match is found
+     */
+    trigger->mode = TR_PHASE;
+    trigger->target[0] = x1;
+    trigger->target[1] = x2;
+    trigger->target[2] = x3;
+    trigger->radius = radius;
+    trigger->auto_seed = auto_seed;
+}
+
+int TR_find(TR_TRIGGER* trigger, int* samples, int start, int end, TR_RESULT* result) {
+    /** 
+     * Search for the trigger point in samples[start..end)
+     *
+     * Returns the index of the trigger point, or -1 if the trigger did 
+     * not fire. For phase triggers the result holds the closest sample
+     * even when the search fails.
+     */
+    int shift = TR_SHIFT[(trigger->channel >= 1 && trigger->channel <= 3) ? trigger->channel : 1];
+    int index = -1;
+    
+    result->index = -1;
+    result->distance = 0;
+    result->quality = 0;
+    
+    if(start < 1) {
+        start = 1;
+    }
+    if(end <= start) {
+        return -1;
+    }
+    
+    if(trigger->mode == TR_PHASE) {
+        int radius2 = trigger->radius*trigger->radius;
+        int best_index, best2;
+        index = TR_findNear(trigger, samples, start, end, radius2, &best_index, &best2);
+        if(index >= 0) {
+            // follow the trajectory in to its closest approach
+            while(index + 1 < end) {
+                int d = TR_distance2(trigger, samples[index + 1]);
+                if(d > best2) {
+                    break;
+                }
+                best2 = d;
+                index++;
+            }
+            best_index = index;
+        }
+        result->index = best_index;
+        result->distance = (int)(sqrtf((float)best2) + 0.5f);
+        result->quality = index >= 0 ? TR_quality(result->distance, trigger->radius + 1) : 0;
+        return index;
+    }
+    
+    if(trigger->mode == TR_HYSTERESIS) {
+        int arm;
+        if(trigger->edge == TR_FALLING) {
+            arm = TR_findAbove(samples, shift, start - 1, end, trigger->level + trigger->hysteresis);
+            if(arm >= 0) {
+                index = TR_findBelow(samples, shift, arm + 1, end, trigger->level);
+            }
+        } else {
+            arm = TR_findBelow(samples, shift, start - 1, end, trigger->level - trigger->hysteresis);
+            if(arm >= 0) {
+                index = TR_findAbove(samples, shift, arm + 1, end, trigger->level - 1);
+            }
+        }
+    } else {
+        index = TR_findCrossing(samples, shift, start, end, trigger->level, trigger->edge);
+    }
+    
+    if(index >= 0) {
+        int cur = TR_channel(samples[index], shift);
+        int prev = TR_channel(samples[index - 1], shift);
+        result->index = index;
+        result->distance = abs(cur - trigger->level);
+        result->quality = TR_quality(result->distance, abs(cur - prev) + 1);
+    }
+    return index;
+}
+
+int TR_seedPhase(TR_TRIGGER* trigger, int* samples, int start, int end) {
+    /** 
+     * Pick a new phase space target from the samples
+     *
+     * The target is the first rising crossing of the middle of the x1 
+     * range, which is passed once per cycle on most attractors and is
+     * therefore easy to find again in the next frame. Returns the index
+     * used, or -1 if the range is empty.
+     */
+    int min = 1024, max = -1;
+    
+    if(end - start < 2) {
+        return -1;
+    }
+    for(int i = start; i < end; i++) {
+        int x1 = DP_getX1(samples[i]);
+        if(x1 < min) min = x1;
+        if(x1 > max) max = x1;
+    }
+    
+    int index = TR_findCrossing(samples, TR_SHIFT[1], start > 0 ? start : 1, end, 
+                                (min + max)/2, TR_RISING);
+    if(index < 0) {
+        index = start;
+    }
+    trigger->target[0] = DP_getX1(samples[index]);
+    trigger->target[1] = DP_getX2(samples[index]);
+    if(trigger->target[2] >= 0) {
+        trigger->target[2] = DP_getX3(samples[index]);
+    }
+    return index;
+}
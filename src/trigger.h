@@ -0,0 +1,63 @@
+/**
+ * \file trigger.h
+ * \brief Header file for trigger.cpp
+ */
+
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stdlib.h>
+
+/* trigger modes */
+#define TR_LEVEL 0
+#define TR_HYSTERESIS 1
+#define TR_PHASE 2
+
+/* edges for level and hysteresis triggers */
+#define TR_RISING 1
+#define TR_FALLING 2
+#define TR_EITHER 3
+
+// largest phase trigger radius, the full sample range, so that the
+// squared distances stay within an int
+#define TR_MAX_RADIUS 4095
+
+/**
+ * Trigger settings
+ *
+ * channel is 1, 2 or 3 for x1, x2 or x3. For TR_PHASE the trigger fires
+ * where the trajectory passes within radius of target. target[2] < 0 
+ * leaves x3 out of the distance. With auto_seed set, a failed phase 
+ * search picks a new target from the current data.
+ */
+typedef struct {
+    int mode;
+    int channel;
+    int level;
+    int edge;
+    int hysteresis;
+    int target[3];
+    int radius;
+    int auto_seed;
+} TR_TRIGGER;
+
+/**
+ * Result of a trigger search
+ *
+ * distance is how far the trigger sample is from the ideal trigger 
+ * point (level or target) and quality maps that to 0..100 where 100 
+ * is an exact match.
+ */
+typedef struct {
+    int index;
+    int distance;
+    int quality;
+} TR_RESULT;
+
+void TR_setLevel(TR_TRIGGER* trigger, int channel, int level, int edge);
+void TR_setHysteresis(TR_TRIGGER* trigger, int channel, int level, int edge, int hysteresis);
+void TR_setPhase(TR_TRIGGER* trigger, int x1, int x2, int x3, int radius, int auto_seed = 0);
+int TR_find(TR_TRIGGER* trigger, int* samples, int start, int end, TR_RESULT* result);
+int TR_seedPhase(TR_TRIGGER* trigger, int* samples, int start, int end);
+
+#endif
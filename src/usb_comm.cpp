@@ -5,18 +5,31 @@
 
 #include "usb_comm.h"
 #include "string.h"
-usb_dev_handle * UC_device_handle = NULL;
-/* initialization routines */
+#include "threads.h"
+#include "log.h"
+#include "trace.h"
+#include "replay.h"
 
-int LAST_PACKET_ID;
-bool USB_DEV_CONNECTED = false;
+// libusb keeps one list of busses for the whole process
+volatile int UC_BUS_LOCK = 0;
 
-int UC_TRANSIENT_DATA = 4;
+/* initialization routines */
 
-char UC_OUT_BUF[8];
-char UC_IN_BUF[1024];
+void UC_initDevice(UC_DEVICE* dev) {
+    /** 
+     * Set up a device structure before first use
+     */
+    dev->handle = NULL;
+    dev->connected = false;
+    dev->index = 0;
+    dev->last_packet_id = 0;
+    dev->transient_data = 4;
+    dev->sessions = 0;
+    memset(&dev->transport, 0, sizeof(dev->transport));
+    dev->recorder = 0;
+}
 
-int UC_init() {
+int UC_init(UC_DEVICE* dev) {
     /** 
      * Initialize the USB communication
      *
@@ -28,280 +41,336 @@ int UC_init() {
      *
      * 4. Claim the interface
      */
+    TH_spinLock(&UC_BUS_LOCK);
     usb_init(); /* initialize the library */
     usb_find_busses(); /* find all busses */
     usb_find_devices(); /* find all connected devices */
     usb_set_debug(0);
+    TH_spinUnlock(&UC_BUS_LOCK);
 
-    return UC_connect();
+    return UC_connect(dev);
 }
 
-int UC_connect() {
-	fprintf(DEBUG_FILE,"Opening the device...");
-	USB_DEV_CONNECTED = false;
-    if(UC_open()) {
-        fprintf(DEBUG_FILE,"error: device not found!\n");
+int UC_connect(UC_DEVICE* dev) {
+    if(dev->transport.write) {
+        dev->connected = true;
+        return 0;
+    }
+	LOG(LOG_INFO, "Opening the device...");
+	dev->connected = false;
+    if(UC_open(dev)) {
+        LOG(LOG_ERROR, "error: device not found!\n");
         return -1;
     }
-    fprintf(DEBUG_FILE,"Success\n");
+    LOG(LOG_INFO, "Success\n");
 
-    fprintf(DEBUG_FILE,"Setting USB configuration...");
-    if(usb_set_configuration(UC_device_handle, 1)) {
-        fprintf(DEBUG_FILE,"error: setting config 1 failed\n");
-        UC_close();
+    LOG(LOG_INFO, "Setting USB configuration...");
+    if(usb_set_configuration(dev->handle, 1)) {
+        LOG(LOG_ERROR, "error: setting config 1 failed\n");
+        UC_close(dev);
         return -2;
     }
-    fprintf(DEBUG_FILE,"Success\n");
+    LOG(LOG_INFO, "Success\n");
 
-    fprintf(DEBUG_FILE,"Claiming the USB interface...");
-    if(usb_claim_interface(UC_device_handle, 0) < 0) {
-        fprintf(DEBUG_FILE,"error: claiming interface 0 failed\n");
-        UC_close();
+    LOG(LOG_INFO, "Claiming the USB interface...");
+    if(usb_claim_interface(dev->handle, 0) < 0) {
+        LOG(LOG_ERROR, "error: claiming interface 0 failed\n");
+        UC_close(dev);
         return -3;
     }
 	
-    fprintf(DEBUG_FILE,"Success\n");
-	USB_DEV_CONNECTED = true;
+    LOG(LOG_INFO, "Success\n");
+	dev->connected = true;
 	return 0;
 }
 
-int UC_open() {
+int UC_open(UC_DEVICE* dev) {
     /** 
      * Open the USB device
+     *
+     * With more than one chaos unit attached, dev->index selects which 
+     * one is opened.
      */
     struct usb_bus *bus;
-    struct usb_device *dev;
+    struct usb_device *usb_dev;
+    int found = 0;
 
+    TH_spinLock(&UC_BUS_LOCK);
     for(bus = usb_get_busses(); bus; bus = bus->next)  {
-        for(dev = bus->devices; dev; dev = dev->next)  {
-                if(dev->descriptor.idVendor == MY_VID
-                     && dev->descriptor.idProduct == MY_PID) {
-                        UC_device_handle = usb_open(dev);    
+        for(usb_dev = bus->devices; usb_dev; usb_dev = usb_dev->next)  {
+                if(usb_dev->descriptor.idVendor == MY_VID
+                     && usb_dev->descriptor.idProduct == MY_PID) {
+                        if(found++ != dev->index) {
+                            continue;
+                        }
+                        dev->handle = usb_open(usb_dev);    
+                        TH_spinUnlock(&UC_BUS_LOCK);
                         return 0;
                     }
             }
     }
+    TH_spinUnlock(&UC_BUS_LOCK);
     return -1;
 }
 
-int UC_close() {
+int UC_close(UC_DEVICE* dev) {
     /** 
      * Close the USB device
      */
-    if(USB_DEV_CONNECTED == true) {
-        usb_release_interface(UC_device_handle, 0);
-        usb_close(UC_device_handle);
+    if(dev->connected == true && !dev->transport.write) {
+        usb_release_interface(dev->handle, 0);
+        usb_close(dev->handle);
     }
-    USB_DEV_CONNECTED = false;
+    dev->connected = false;
     return 0;
 }
 
+void UC_setTransport(UC_DEVICE* dev, UC_TRANSPORT* transport) {
+    /** 
+     * Talk through something other than libusb
+     *
+     * \param transport 0 to go back to libusb, which reconnects on the 
+     * next write
+     *
+     * The old transport is freed, a unit open on the bus is closed.
+     */
+    UC_close(dev);
+    dev->sessions++;
+    if(dev->transport.free) {
+        dev->transport.free(dev->transport.state);
+    }
+    if(transport) {
+        dev->transport = *transport;
+        dev->connected = true;
+    } else {
+        memset(&dev->transport, 0, sizeof(dev->transport));
+    }
+}
+
 /* Low level read and write */
 
-int UC_write(char* buf, int size) {
+int UC_write(UC_DEVICE* dev, char* buf, int size) {
     /** 
      * Write data to USB
      */
+    TRACE_SCOPE(TRACE_USB_WRITE);
 	int result = -1;
-	if(USB_DEV_CONNECTED == false) {
-		if(UC_connect() == 0) {
-			result = usb_bulk_write(UC_device_handle, EP_OUT, buf, size, UC_TIMEOUT);
+	if(dev->transport.write) {
+		result = dev->transport.write(dev->transport.state, buf, size);
+	} else if(dev->connected == false) {
+		if(UC_connect(dev) == 0) {
+			result = usb_bulk_write(dev->handle, EP_OUT, buf, size, UC_TIMEOUT);
 		}
 	} else {
-		result = usb_bulk_write(UC_device_handle, EP_OUT, buf, size, UC_TIMEOUT);
+		result = usb_bulk_write(dev->handle, EP_OUT, buf, size, UC_TIMEOUT);
+	}
+	if(dev->recorder) {
+		RP_record(dev->recorder, RP_WRITE, buf, size, result);
 	}
     return result;
 }
 
-int UC_read(char* buf, int size) {
+int UC_read(UC_DEVICE* dev, char* buf, int size) {
     /** 
      * Read data from USB
      */
+    TRACE_SCOPE(TRACE_USB_READ);
 	int result = -1;
-	if(USB_DEV_CONNECTED == false) {
-		if(UC_connect() == 0) {
-			result = usb_bulk_read(UC_device_handle, EP_IN, buf, size, UC_TIMEOUT);
+	if(dev->transport.read) {
+		result = dev->transport.read(dev->transport.state, buf, size);
+	} else if(dev->connected == false) {
+		if(UC_connect(dev) == 0) {
+			result = usb_bulk_read(dev->handle, EP_IN, buf, size, UC_TIMEOUT);
 		}
 	} else {
-		result = usb_bulk_read(UC_device_handle, EP_IN, buf, size, UC_TIMEOUT);
+		result = usb_bulk_read(dev->handle, EP_IN, buf, size, UC_TIMEOUT);
+	}
+	if(dev->recorder) {
+		RP_record(dev->recorder, RP_READ, buf, size, result);
 	}
     return result;
 }
 
 /* Command implemenations */
 
-int UC_reset() {
+int UC_reset(UC_DEVICE* dev) {
     /** 
      * Send the reset command
      */
     int bytes_read;
     
     for(int i = 0; i < 8; i++) {
-        UC_OUT_BUF[i] = 0x00;
+        dev->out_buf[i] = 0x00;
     }
     
-    UC_OUT_BUF[0] = CMD_reset;
+    dev->out_buf[0] = CMD_reset;
     
-    if(UC_write(UC_OUT_BUF,8) != 8) {
-        fprintf(DEBUG_FILE,"Write failed, checking for pending read.\n");
-        if((bytes_read = UC_read(UC_IN_BUF,1024)) < 0) {
-            fprintf(DEBUG_FILE,"Read failed.\n");
+    if(UC_write(dev, dev->out_buf,8) != 8) {
+        LOG(LOG_WARNING, "Write failed, checking for pending read.\n");
+        if((bytes_read = UC_read(dev, dev->in_buf,1024)) < 0) {
+            LOG(LOG_ERROR, "Read failed.\n");
             return -1;
         } else {
-            fprintf(DEBUG_FILE,"Read %d bytes.\n",bytes_read);
+            LOG(LOG_WARNING, "Read %d bytes.\n",bytes_read);
         }
-        fprintf(DEBUG_FILE,"Read succeeded (%d bytes).\n",bytes_read);
-        UC_OUT_BUF[0] = CMD_reset;
-        if(UC_write(UC_OUT_BUF,8) != 8) {
-            fprintf(DEBUG_FILE,"Write still failed even after read.\n");
+        LOG(LOG_WARNING, "Read succeeded (%d bytes).\n",bytes_read);
+        dev->out_buf[0] = CMD_reset;
+        if(UC_write(dev, dev->out_buf,8) != 8) {
+            LOG(LOG_ERROR, "Write still failed even after read.\n");
             return -1;
         }
     }
     
-    if((bytes_read = UC_read(UC_IN_BUF,1)) != 1) {
-        fprintf(DEBUG_FILE,"Read failed after reset sent.\n");
+    if((bytes_read = UC_read(dev, dev->in_buf,1)) != 1) {
+        LOG(LOG_ERROR, "Read failed after reset sent.\n");
         return -1;
     }
     
     return 0;
 }
 
-int UC_setMDAC(short int tap) {
+int UC_setMDAC(UC_DEVICE* dev, short int tap) {
     /** 
      * Send the command to set the MDAC
      *
      */
-    char* buf = UC_OUT_BUF;
+    char* buf = dev->out_buf;
 
+    dev->sessions++;
     // start the sample
     buf[0] = CMD_set_mdac;
     *(short int*)&buf[4] = tap;
-    if(UC_write(buf, 8) != 8) {
-        fprintf(DEBUG_FILE,"error: set MDAC write failed\n");
+    if(UC_write(dev, buf, 8) != 8) {
+        LOG(LOG_ERROR, "error: set MDAC write failed\n");
         return -1;
     }
   
-    if(UC_read(buf,1) != 1) {
-      fprintf(DEBUG_FILE,"error: set MDAC read failed\n");
+    if(UC_read(dev, buf,1) != 1) {
+      LOG(LOG_ERROR, "error: set MDAC read failed\n");
       return -1;
     }
     return 0;
 }
 
-int UC_startSample(short int tap) {
+int UC_startSample(UC_DEVICE* dev, short int tap) {
     /** 
      * Send the command to start a sample
      */
-    char* buf = UC_OUT_BUF;
-    int* in = (int*)UC_IN_BUF;
+    char* buf = dev->out_buf;
+    int* in = (int*)dev->in_buf;
     
+    dev->sessions++;
     #ifdef EXTRA_TRANSIENT_REMOVAL
         const int num_above = 300;
     
         if(tap - num_above >= 0) {
             buf[0] = CMD_start_sample;
             *(short int*)&buf[4] = tap - num_above;
-            if(UC_write(buf, 8) != 8) {
-                fprintf(DEBUG_FILE,"error: start sampling write failed\n");
+            if(UC_write(dev, buf, 8) != 8) {
+                LOG(LOG_ERROR, "error: start sampling write failed\n");
                 return -1;
             }
           
-            if(UC_read(buf,1) != 1) {
-              fprintf(DEBUG_FILE,"error: start sampling read failed\n");
+            if(UC_read(dev, buf,1) != 1) {
+              LOG(LOG_ERROR, "error: start sampling read failed\n");
               return -1;
             }
             
             // take a few packets of data and drop them to clear transient behavior
-            for( int i = 0; i <= UC_TRANSIENT_DATA; i++ ) {
-                if((UC_getData(in)) < 0) {
-                    fprintf(DEBUG_FILE,"error getting data\n");
+            for( int i = 0; i <= dev->transient_data; i++ ) {
+                if((UC_getData(dev, in)) < 0) {
+                    LOG(LOG_ERROR, "error getting data\n");
                     return -1;
                 }
             }
     
-            UC_endSample();
+            UC_endSample(dev);
         }
     #endif
 
     /* start the real sample */
     buf[0] = CMD_start_sample;
     *(short int*)&buf[4] = tap;
-    if(UC_write(buf, 8) != 8) {
-        fprintf(DEBUG_FILE,"error: start sampling write failed\n");
+    if(UC_write(dev, buf, 8) != 8) {
+        LOG(LOG_ERROR, "error: start sampling write failed\n");
         return -1;
     }
   
-    if(UC_read(buf,1) != 1) {
-      fprintf(DEBUG_FILE,"error: start sampling read failed\n");
+    if(UC_read(dev, buf,1) != 1) {
+      LOG(LOG_ERROR, "error: start sampling read failed\n");
       return -1;
     }
 
     // take a few packets of data and drop them to clear transient behavior
-    for( int i = 0; i <= UC_TRANSIENT_DATA; i++ ) {
-        if((UC_getData(in)) < 0) {
-            fprintf(DEBUG_FILE,"error getting data\n");
+    TRACE_SCOPE(TRACE_TRANSIENT);
+    for( int i = 0; i <= dev->transient_data; i++ ) {
+        if((UC_getData(dev, in)) < 0) {
+            LOG(LOG_ERROR, "error getting data\n");
             return -1;
         }
     }
-    LAST_PACKET_ID = UC_TRANSIENT_DATA;
+    dev->last_packet_id = dev->transient_data;
     return 0;
 }
 
-int UC_getData(int* dst) {
+int UC_getData(UC_DEVICE* dev, int* dst) {
     /** 
      * Send a data request to the device
      */
-    char* out = UC_OUT_BUF;
+    char* out = dev->out_buf;
     
     out[0] = CMD_get_data;
     
-    if(UC_write(out, 8) != 8) {
-        fprintf(DEBUG_FILE,"error: bulk write failed\n");
+    if(UC_write(dev, out, 8) != 8) {
+        LOG(LOG_ERROR, "error: bulk write failed\n");
         return -1;
     }
 
-    if(UC_read((char*)dst, 1024) < 0) {
-      fprintf(DEBUG_FILE,"error: bulk read failed\n");
+    if(UC_read(dev, (char*)dst, 1024) < 0) {
+      LOG(LOG_ERROR, "error: bulk read failed\n");
       return -1;
     }
     
     return dst[0];
 }
 
-int UC_endSample() {
+int UC_endSample(UC_DEVICE* dev) {
     /** 
      * Send a request to end the sample
      */
-    char* buf = UC_OUT_BUF;
+    char* buf = dev->out_buf;
 
     buf[0] = CMD_end_sample;
-    if(UC_write(buf, 8) != 8) {
-        fprintf(DEBUG_FILE,"error: end sampling write failed\n");
+    if(UC_write(dev, buf, 8) != 8) {
+        LOG(LOG_ERROR, "error: end sampling write failed\n");
         return -1;
     }
   
-    if(UC_read(buf,1) != 1) {
-      fprintf(DEBUG_FILE,"error: end sampling read failed\n");
+    if(UC_read(dev, buf,1) != 1) {
+      LOG(LOG_ERROR, "error: end sampling read failed\n");
       return -1;
     }
     return 0;
 }
 
-int UC_sample(int* dst, int num_samples, int value) {
+int UC_sample(UC_DEVICE* dev, int* dst, int num_samples, int value) {
     /** 
      * Read a sample from the device into a destination buffer
      *
      * dst is a pointer to an area of memory large enough to hold the data
      * num_samples is the number of data points to get
      * value is the value to send to the MDAC
+     * returns -1 if the sample could not be started or read
      */
-    UC_startSample(value);
-    UC_sampleCurrent(dst, num_samples);
-    UC_endSample();
-    return 0;
+    if(UC_startSample(dev, value)) {
+        return -1;
+    }
+    int ret_val = UC_sampleCurrent(dev, dst, num_samples);
+    UC_endSample(dev);
+    return ret_val;
 }
 
-int UC_sampleCurrent(int* dst, int num_samples) {
+int UC_sampleCurrent(UC_DEVICE* dev, int* dst, int num_samples) {
     /** 
      * Read a sample to a buffer at the current MDAC value
      *
@@ -311,16 +380,17 @@ int UC_sampleCurrent(int* dst, int num_samples) {
      * start sample must be called before this
      * end sample must be called after this
      */
+    TRACE_SCOPE(TRACE_SAMPLE);
     int packet_id = 0;
     int current_sample = 0;
     
-    int* in = (int*)UC_IN_BUF;
+    int* in = (int*)dev->in_buf;
     
     int len = 0;
     
     for(current_sample = 0; current_sample < num_samples; current_sample+=255) {
-        if((packet_id = UC_getData(in)) < 0) {
-            fprintf(DEBUG_FILE,"error getting data\n");
+        if((packet_id = UC_getData(dev, in)) < 0) {
+            LOG(LOG_ERROR, "error getting data\n");
             return -1;
         } else {
             if ( num_samples - current_sample > 255 ) {
@@ -329,75 +399,86 @@ int UC_sampleCurrent(int* dst, int num_samples) {
                 len = (num_samples - current_sample)*4;
             }
             memcpy((char*)&dst[current_sample],in + 1,len);
-            if(packet_id != LAST_PACKET_ID + 1) {
-                fprintf(DEBUG_FILE,"MISSING %d PACKETS (%d)\n",(packet_id - LAST_PACKET_ID) - 1,packet_id);
+            if(packet_id != dev->last_packet_id + 1) {
+                LOG(LOG_WARNING, "MISSING %d PACKETS (%d)\n",(packet_id - dev->last_packet_id) - 1,packet_id);
             }
-        LAST_PACKET_ID = packet_id;
+        dev->last_packet_id = packet_id;
         }
     }
     return 0;
 }
 
-int UC_getStatus(int* mdac_value) {
+int UC_getStatus(UC_DEVICE* dev, int* mdac_value) {
     /** 
      * Get the status from the device
      */
 	
-    char* buf = UC_OUT_BUF;
+    char* buf = dev->out_buf;
     buf[0] = CMD_status;
-    if(UC_write(buf, 8) != 8) {
-        fprintf(DEBUG_FILE,"error: status write failed\n");
+    if(UC_write(dev, buf, 8) != 8) {
+        LOG(LOG_ERROR, "error: status write failed\n");
         return -1;
     }
   
-    if(UC_read((char*)mdac_value,4) != 4) {
-      fprintf(DEBUG_FILE,"error: status read failed\n");
+    if(UC_read(dev, (char*)mdac_value,4) != 4) {
+      LOG(LOG_ERROR, "error: status read failed\n");
       return -1;
     }
     return 0;
 }
 
-int UC_getVersion() {
+int UC_getVersion(UC_DEVICE* dev) {
     /** 
      * Get the firmware version
      */
 	
     int version;
      
-    char* buf = UC_OUT_BUF;
+    char* buf = dev->out_buf;
     buf[0] = CMD_get_version;
-    if(UC_write(buf, 8) != 8) {
-        fprintf(DEBUG_FILE,"error: status write failed\n");
+    if(UC_write(dev, buf, 8) != 8) {
+        LOG(LOG_ERROR, "error: status write failed\n");
         return -1;
     }
   
-    if(UC_read((char*)&version,4) != 4) {
-      fprintf(DEBUG_FILE,"error: status read failed\n");
+    if(UC_read(dev, (char*)&version,4) != 4) {
+      LOG(LOG_ERROR, "error: status read failed\n");
       return -1;
     }
     
     return version;
 }
 
-bool UC_isConnected() {
+bool UC_isConnected(UC_DEVICE* dev) {
 	/**
 	* Return true if the device is found on the system.
 	*/
+    struct usb_bus *bus;
+    struct usb_device *usb_dev;
+    int found = 0;
+
+    if(dev->transport.write) {
+        return true;
+    }
+
+    TH_spinLock(&UC_BUS_LOCK);
     usb_find_busses(); /* find all busses */
     usb_find_devices(); /* find all connected devices */
 	
-    struct usb_bus *bus;
-    struct usb_device *dev;
     for(bus = usb_get_busses(); bus; bus = bus->next)  {
-        for(dev = bus->devices; dev; dev = dev->next)  {
-                if(dev->descriptor.idVendor == MY_VID
-                     && dev->descriptor.idProduct == MY_PID) {
-                        return true;
+        for(usb_dev = bus->devices; usb_dev; usb_dev = usb_dev->next)  {
+                if(usb_dev->descriptor.idVendor == MY_VID
+                     && usb_dev->descriptor.idProduct == MY_PID) {
+                        if(found++ == dev->index) {
+                            TH_spinUnlock(&UC_BUS_LOCK);
+                            return true;
+                        }
                     } 
             }
     }
-	if(USB_DEV_CONNECTED == true) {
-		UC_close();
+    TH_spinUnlock(&UC_BUS_LOCK);
+	if(dev->connected == true) {
+		UC_close(dev);
 	}
 	return false;
 }
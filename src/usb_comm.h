@@ -24,24 +24,61 @@
 /* additional settings */
 #define UC_TIMEOUT 1000
 
-extern usb_dev_handle * UC_device_handle;
-extern int UC_TRANSIENT_DATA;
-
-int UC_init();
-int UC_open();
-int UC_close();
-int UC_reset();
-int UC_write(char* buf, int size);
-int UC_read(char* buf, int size);
-int UC_setMDAC(short int tap);
-int UC_startSample(short int tap);
-int UC_getData(int *dst);
-int UC_endSample();
-int UC_sample(int* dst, int num_samples, int value);
-int UC_sampleCurrent(int* dst, int num_samples);
-int UC_getStatus(int* mdac_value);
-int UC_getVersion();
-bool UC_isConnected();
-int UC_connect();
+/**
+ * Something other than libusb for a device to talk through
+ *
+ * write and read behave like usb_bulk_write and usb_bulk_read. free is
+ * called on state when the device stops using the transport.
+ */
+typedef struct {
+    int (*write)(void* state, char* buf, int size);
+    int (*read)(void* state, char* buf, int size);
+    void (*free)(void* state);
+    void* state;
+} UC_TRANSPORT;
+
+struct RP_RECORDER;
+
+/**
+ * Connection to one chaos unit
+ *
+ * index picks the unit when more than one is attached. transient_data 
+ * is the number of packets dropped at the start of each sample. The 
+ * unit is reached through transport when transport.write is set, and 
+ * libusb otherwise. Traffic is copied to recorder when there is one.
+ * sessions counts the times sampling was started, the MDAC set or the 
+ * transport changed, so a sample kept running can tell it was ended.
+ */
+typedef struct {
+    usb_dev_handle* handle;
+    bool connected;
+    int index;
+    int last_packet_id;
+    int transient_data;
+    int sessions;
+    char out_buf[8];
+    char in_buf[1024];
+    UC_TRANSPORT transport;
+    struct RP_RECORDER* recorder;
+} UC_DEVICE;
+
+void UC_initDevice(UC_DEVICE* dev);
+int UC_init(UC_DEVICE* dev);
+int UC_open(UC_DEVICE* dev);
+int UC_close(UC_DEVICE* dev);
+int UC_reset(UC_DEVICE* dev);
+int UC_write(UC_DEVICE* dev, char* buf, int size);
+int UC_read(UC_DEVICE* dev, char* buf, int size);
+int UC_setMDAC(UC_DEVICE* dev, short int tap);
+int UC_startSample(UC_DEVICE* dev, short int tap);
+int UC_getData(UC_DEVICE* dev, int *dst);
+int UC_endSample(UC_DEVICE* dev);
+int UC_sample(UC_DEVICE* dev, int* dst, int num_samples, int value);
+int UC_sampleCurrent(UC_DEVICE* dev, int* dst, int num_samples);
+int UC_getStatus(UC_DEVICE* dev, int* mdac_value);
+int UC_getVersion(UC_DEVICE* dev);
+bool UC_isConnected(UC_DEVICE* dev);
+int UC_connect(UC_DEVICE* dev);
+void UC_setTransport(UC_DEVICE* dev, UC_TRANSPORT* transport);
 
 #endif
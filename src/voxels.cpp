@@ -0,0 +1,294 @@
+/**
+ * \file voxels.cpp
+ * \brief Routines for accumulating a sparse 3-D density of the attractor
+ */
+
+#include "voxels.h"
+#include "data_processing.h"
+
+int VX_init(VX_GRID* grid, int resolution, float decay) {
+    /** 
+     * Initialize a voxel grid
+     *
+     * \param resolution Voxels along each axis, a power of two from 8 to 
+     * 1024
+     * \param decay Factor applied to every density at each new frame, 1 
+     * keeps all history
+     */
+    int shift = 0;
+    
+    if(resolution < VX_BRICK_SIZE || resolution > 1024 || (resolution & (resolution - 1)) ||
+       decay <= 0 || decay > 1) {
+        return -1;
+    }
+    while((1024 >> shift) > resolution) {
+        shift++;
+    }
+    
+    if(grid->bricks) {
+        VX_free(grid);
+    }
+    
+    grid->resolution = resolution;
+    grid->shift = shift;
+    grid->bricks_per_axis = resolution/VX_BRICK_SIZE;
+    grid->num_slots = grid->bricks_per_axis*grid->bricks_per_axis*grid->bricks_per_axis;
+    grid->bricks = (VX_BRICK**)calloc(grid->num_slots, sizeof(VX_BRICK*));
+    grid->changed = (unsigned int*)calloc(grid->num_slots, sizeof(unsigned int));
+    grid->dirty_prev = (int*)malloc(grid->num_slots*sizeof(int));
+    grid->dirty_next = (int*)malloc(grid->num_slots*sizeof(int));
+    if(!grid->bricks || !grid->changed || !grid->dirty_prev || !grid->dirty_next) {
+        VX_free(grid);
+        return -1;
+    }
+    grid->dirty_head = -1;
+    grid->dirty_tail = -1;
+    grid->free_bricks = 0;
+    grid->num_bricks = 0;
+    grid->max_bricks = 0;
+    grid->generation = 1;
+    grid->decay = decay;
+    grid->threshold = 0.01f;
+    grid->sweep_position = 0;
+    for(int i = 0; i < VX_DECAY_TABLE; i++) {
+        grid->decay_table[i] = powf(decay, (float)i);
+    }
+    return 0;
+}
+
+void VX_free(VX_GRID* grid) {
+    /** 
+     * Free the memory used by a voxel grid
+     */
+    VX_clear(grid);
+    while(grid->free_bricks) {
+        VX_BRICK* next = grid->free_bricks->next;
+        free(grid->free_bricks);
+        grid->free_bricks = next;
+    }
+    free(grid->bricks);
+    free(grid->changed);
+    free(grid->dirty_prev);
+    free(grid->dirty_next);
+    memset(grid, 0, sizeof(VX_GRID));
+}
+
+static void VX_markChanged(VX_GRID* grid, int slot) {
+    /** 
+     * Record that a brick changed in the current generation
+     *
+     * The brick moves to the end of the changed list, which keeps the 
+     * list in order of generation.
+     */
+    if(grid->changed[slot] == grid->generation) {
+        return;
+    }
+    if(grid->changed[slot]) {
+        int prev = grid->dirty_prev[slot];
+        int next = grid->dirty_next[slot];
+        if(prev >= 0) {
+            grid->dirty_next[prev] = next;
+        } else {
+            grid->dirty_head = next;
+        }
+        if(next >= 0) {
+            grid->dirty_prev[next] = prev;
+        } else {
+            grid->dirty_tail = prev;
+        }
+    }
+    grid->dirty_prev[slot] = grid->dirty_tail;
+    grid->dirty_next[slot] = -1;
+    if(grid->dirty_tail >= 0) {
+        grid->dirty_next[grid->dirty_tail] = slot;
+    } else {
+        grid->dirty_head = slot;
+    }
+    grid->dirty_tail = slot;
+    grid->changed[slot] = grid->generation;
+}
+
+static void VX_release(VX_GRID* grid, int slot) {
+    /** 
+     * Return a brick to the free list
+     */
+    VX_BRICK* brick = grid->bricks[slot];
+    grid->bricks[slot] = 0;
+    VX_markChanged(grid, slot);
+    brick->next = grid->free_bricks;
+    grid->free_bricks = brick;
+    grid->num_bricks--;
+}
+
+void VX_clear(VX_GRID* grid) {
+    /** 
+     * Remove all samples from the grid
+     *
+     * Released bricks are kept for reuse.
+     */
+    // a grid that failed to initialize may have no table
+    if(!grid->bricks || !grid->changed) {
+        return;
+    }
+    for(int i = 0; i < grid->num_slots; i++) {
+        if(grid->bricks[i]) {
+            VX_release(grid, i);
+        }
+    }
+}
+
+static inline void VX_update(VX_GRID* grid, VX_BRICK* brick) {
+    /** 
+     * Apply the decay a brick has missed since it was last touched
+     */
+    unsigned int age = grid->generation - brick->generation;
+    if(!age) {
+        return;
+    }
+    float factor = age < VX_DECAY_TABLE ? grid->decay_table[age] : powf(grid->decay, (float)age);
+    if(factor < 1e-6f) {
+        memset(brick->density, 0, sizeof(brick->density));
+    } else if(factor != 1.0f) {
+        for(int i = 0; i < VX_BRICK_VOXELS; i++) {
+            brick->density[i] *= factor;
+        }
+    }
+    brick->generation = grid->generation;
+}
+
+void VX_beginFrame(VX_GRID* grid) {
+    /** 
+     * Start a new frame
+     *
+     * All densities decay by one step. A slice of the brick table is also
+     * checked each frame and bricks that have faded below the threshold 
+     * are released, so memory follows the visible attractor without a 
+     * full pass.
+     */
+    const int sweep_slots = 256;
+    
+    grid->generation++;
+    if(grid->decay >= 1.0f) {
+        return;
+    }
+    
+    for(int n = 0; n < sweep_slots && n < grid->num_slots; n++) {
+        int slot = grid->sweep_position;
+        grid->sweep_position = (grid->sweep_position + 1) % grid->num_slots;
+        VX_BRICK* brick = grid->bricks[slot];
+        if(!brick) {
+            continue;
+        }
+        unsigned int age = grid->generation - brick->generation;
+        float factor = age < VX_DECAY_TABLE ? grid->decay_table[age] : 0.0f;
+        float max = 0;
+        for(int i = 0; i < VX_BRICK_VOXELS; i++) {
+            if(brick->density[i] > max) {
+                max = brick->density[i];
+            }
+        }
+        if(max*factor < grid->threshold) {
+            VX_release(grid, slot);
+        }
+    }
+}
+
+void VX_add(VX_GRID* grid, int* samples, int num_samples) {
+    /** 
+     * Add a block of samples to the current frame
+     */
+    int shift = grid->shift;
+    int bpa = grid->bricks_per_axis;
+    int last_slot = -1;
+    VX_BRICK* brick = 0;
+    
+    if(!grid->bricks) {
+        return;
+    }
+    
+    for(int i = 0; i < num_samples; i++) {
+        int x = DP_getX1(samples[i]) >> shift;
+        int y = DP_getX2(samples[i]) >> shift;
+        int z = DP_getX3(samples[i]) >> shift;
+        int slot = ((z/VX_BRICK_SIZE)*bpa + (y/VX_BRICK_SIZE))*bpa + (x/VX_BRICK_SIZE);
+        
+        // consecutive samples are usually in the same brick
+        if(slot != last_slot) {
+            brick = grid->bricks[slot];
+            if(!brick) {
+                if(grid->free_bricks) {
+                    brick = grid->free_bricks;
+                    grid->free_bricks = brick->next;
+                } else {
+                    brick = (VX_BRICK*)malloc(sizeof(VX_BRICK));
+                    if(!brick) {
+                        last_slot = -1;
+                        continue;
+                    }
+                }
+                memset(brick->density, 0, sizeof(brick->density));
+                brick->generation = grid->generation;
+                grid->bricks[slot] = brick;
+                grid->num_bricks++;
+                if(grid->num_bricks > grid->max_bricks) {
+                    grid->max_bricks = grid->num_bricks;
+                }
+            } else {
+                VX_update(grid, brick);
+            }
+            VX_markChanged(grid, slot);
+            last_slot = slot;
+        }
+        
+        int voxel = (((z % VX_BRICK_SIZE)*VX_BRICK_SIZE) + (y % VX_BRICK_SIZE))*VX_BRICK_SIZE 
+                    + (x % VX_BRICK_SIZE);
+        brick->density[voxel] += 1.0f;
+    }
+}
+
+int VX_getChangedBricks(VX_GRID* grid, unsigned int since, int* dst, int len) {
+    /** 
+     * List the bricks that changed after a generation
+     *
+     * \param since Generation the caller last drew, 0 for everything
+     * \param dst Receives up to len brick numbers, the most recently 
+     * changed first
+     * \return The number of bricks listed
+     *
+     * Bricks that were freed are listed too, VX_getBrick returns 0 for 
+     * them. Decay alone does not mark a brick as changed. Only the 
+     * changed bricks are visited.
+     */
+    int count = 0;
+    if(!grid->changed) {
+        return 0;
+    }
+    for(int slot = grid->dirty_tail; slot >= 0 && count < len && grid->changed[slot] > since;
+        slot = grid->dirty_prev[slot]) {
+        dst[count++] = slot;
+    }
+    return count;
+}
+
+float* VX_getBrick(VX_GRID* grid, int brick, int* bx, int* by, int* bz) {
+    /** 
+     * Get the densities of a brick as of the current generation
+     *
+     * \param bx, by, bz Set to the brick position in bricks
+     * \return VX_BRICK_VOXELS densities with x varying fastest, or 0 if 
+     * the brick is empty
+     */
+    if(brick < 0 || brick >= grid->num_slots) {
+        return 0;
+    }
+    int bpa = grid->bricks_per_axis;
+    *bx = brick % bpa;
+    *by = (brick/bpa) % bpa;
+    *bz = brick/(bpa*bpa);
+    
+    if(!grid->bricks[brick]) {
+        return 0;
+    }
+    VX_update(grid, grid->bricks[brick]);
+    return grid->bricks[brick]->density;
+}
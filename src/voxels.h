@@ -0,0 +1,70 @@
+/**
+ * \file voxels.h
+ * \brief Header file for voxels.cpp
+ */
+
+#ifndef VOXELS_H
+#define VOXELS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// voxels along each side of a brick
+#define VX_BRICK_SIZE 8
+#define VX_BRICK_VOXELS (VX_BRICK_SIZE*VX_BRICK_SIZE*VX_BRICK_SIZE)
+#define VX_DEFAULT_RESOLUTION 128
+#define VX_DECAY_TABLE 64
+
+/**
+ * A block of VX_BRICK_SIZE^3 voxels
+ *
+ * density is indexed [(z*8 + y)*8 + x]. The values are correct as of
+ * generation, later decay is applied when the brick is next touched.
+ */
+typedef struct VX_BRICK {
+    float density[VX_BRICK_VOXELS];
+    unsigned int generation;
+    struct VX_BRICK* next;
+} VX_BRICK;
+
+/**
+ * Sparse voxel density grid over the 1024^3 sample space
+ *
+ * Only bricks that contain samples are allocated. Each frame starts a 
+ * new generation and multiplies all densities by decay. changed[b] is 
+ * the last generation in which brick b gained samples or was freed, 0 
+ * if it never has. Bricks that have changed are kept in a list ordered
+ * by changed, linked through dirty_prev and dirty_next, so the bricks 
+ * changed since a generation are found without visiting the others.
+ */
+typedef struct {
+    int resolution;
+    int shift;
+    int bricks_per_axis;
+    int num_slots;
+    VX_BRICK** bricks;
+    unsigned int* changed;
+    int* dirty_prev;
+    int* dirty_next;
+    int dirty_head;
+    int dirty_tail;
+    VX_BRICK* free_bricks;
+    int num_bricks;
+    int max_bricks;
+    unsigned int generation;
+    float decay;
+    float threshold;
+    float decay_table[VX_DECAY_TABLE];
+    int sweep_position;
+} VX_GRID;
+
+int VX_init(VX_GRID* grid, int resolution = VX_DEFAULT_RESOLUTION, float decay = 0.95f);
+void VX_free(VX_GRID* grid);
+void VX_clear(VX_GRID* grid);
+void VX_beginFrame(VX_GRID* grid);
+void VX_add(VX_GRID* grid, int* samples, int num_samples);
+int VX_getChangedBricks(VX_GRID* grid, unsigned int since, int* dst, int len);
+float* VX_getBrick(VX_GRID* grid, int brick, int* bx, int* by, int* bz);
+
+#endif